@@ -0,0 +1,393 @@
+#!/usr/bin/env python3
+# Converts a fully int8 quantized TensorFlow Lite keyword spotting model (DS-CNN style) to the
+# KWS1 file of the firmware, described in lib/keywordspotter/KeywordSpotter.h. Upload the result
+# to SPIFFS as /kws.bin.
+#
+#   python3 kws_convert.py model.tflite kws.bin --wake-label 2 [--stride-frames 2]
+#
+# The input of the model must be int8 [1, frames, features, 1] (or flat, followed by a reshape),
+# trained on the MFCC features of the device (10 ms frames, c0.. in log2 units). Supported
+# operators: CONV_2D, DEPTHWISE_CONV_2D (depth multiplier 1), FULLY_CONNECTED, AVERAGE_POOL_2D
+# and MEAN over the whole frame, RESHAPE, SOFTMAX as the last one. Only the standard library
+# is needed, the .tflite flatbuffer is read directly.
+import argparse
+import math
+import struct
+import sys
+
+# BuiltinOperator
+AVERAGE_POOL_2D = 1
+CONV_2D = 3
+DEPTHWISE_CONV_2D = 4
+FULLY_CONNECTED = 9
+RESHAPE = 22
+SOFTMAX = 25
+MEAN = 40
+
+# TensorType
+INT32 = 2
+INT8 = 9
+
+# Padding, ActivationFunctionType
+SAME = 0
+RELU = 1
+RELU6 = 3
+
+# KeywordSpotter::LayerType
+KWS_CONV = 1
+KWS_DEPTHWISE = 2
+KWS_POINTWISE = 3
+KWS_FULLY_CONNECTED = 4
+KWS_AVERAGE_POOL = 5
+KWS_SOFTMAX = 6
+
+MAX_LAYERS = 16
+MAX_FRAMES = 64
+MAX_FEATURES = 13
+MAX_LABELS = 32
+
+
+class ConvertError(Exception):
+    pass
+
+
+class Table:
+    """A flatbuffer table, fields are read by their index in the schema."""
+
+    def __init__(self, buf, pos):
+        self.buf = buf
+        self.pos = pos
+        vtable = pos - struct.unpack_from("<i", buf, pos)[0]
+        size = struct.unpack_from("<H", buf, vtable)[0]
+        self.fields = [struct.unpack_from("<H", buf, vtable + 4 + 2 * i)[0] for i in range((size - 4) // 2)]
+
+    def _offset(self, index):
+        return self.fields[index] if index < len(self.fields) else 0
+
+    def scalar(self, index, fmt, default=0):
+        o = self._offset(index)
+        return struct.unpack_from("<" + fmt, self.buf, self.pos + o)[0] if o else default
+
+    def _target(self, index):
+        o = self._offset(index)
+        if not o:
+            return None
+        at = self.pos + o
+        return at + struct.unpack_from("<I", self.buf, at)[0]
+
+    def table(self, index):
+        at = self._target(index)
+        return Table(self.buf, at) if at is not None else None
+
+    def vector(self, index, fmt):
+        at = self._target(index)
+        if at is None:
+            return []
+        count = struct.unpack_from("<I", self.buf, at)[0]
+        return list(struct.unpack_from("<%d%s" % (count, fmt), self.buf, at + 4))
+
+    def tables(self, index):
+        at = self._target(index)
+        if at is None:
+            return []
+        count = struct.unpack_from("<I", self.buf, at)[0]
+        result = []
+        for i in range(count):
+            element = at + 4 + 4 * i
+            result.append(Table(self.buf, element + struct.unpack_from("<I", self.buf, element)[0]))
+        return result
+
+    def bytes(self, index):
+        at = self._target(index)
+        if at is None:
+            return b""
+        count = struct.unpack_from("<I", self.buf, at)[0]
+        return bytes(self.buf[at + 4:at + 4 + count])
+
+
+class Tensor:
+    def __init__(self, table, buffers):
+        self.shape = table.vector(0, "i")
+        self.type = table.scalar(1, "b")
+        self.name = table.bytes(3).decode(errors="replace")
+        buffer = buffers[table.scalar(2, "I")]
+        self.data = buffer.bytes(0)
+        if not self.data and buffer.scalar(1, "Q"):
+            raise ConvertError("models with external buffers are not supported")
+        q = table.table(4)
+        self.scales = q.vector(2, "f") if q else []
+        self.zero_points = q.vector(3, "q") if q else []
+
+    @property
+    def scale(self):
+        if not self.scales:
+            raise ConvertError("tensor %s is not quantized" % self.name)
+        return self.scales[0]
+
+    @property
+    def zero_point(self):
+        return self.zero_points[0] if self.zero_points else 0
+
+    def values(self, fmt):
+        return list(struct.unpack("<%d%s" % (len(self.data) // struct.calcsize(fmt), fmt), self.data))
+
+
+def quantize_multiplier(m):
+    """TFLite QuantizeMultiplier: m = q * 2^shift, q as Q31."""
+    if m == 0:
+        return 0, 0
+    q, shift = math.frexp(m)
+    q_fixed = int(math.floor(q * (1 << 31) + 0.5))   # std::round, not round half to even
+    if q_fixed == 1 << 31:
+        q_fixed //= 2
+        shift += 1
+    if shift < -31:
+        return 0, 0
+    if shift > 30:
+        raise ConvertError("requantization scale %g is out of range" % m)
+    return q_fixed, shift
+
+
+def activation_range(function, scale, zero_point):
+    low, high = -128, 127
+    if function == RELU:
+        low = max(low, zero_point)
+    elif function == RELU6:
+        low = max(low, zero_point)
+        high = min(high, zero_point + int(math.floor(6.0 / scale + 0.5)))
+    elif function != 0:
+        raise ConvertError("activation function %d is not supported" % function)
+    return low, high
+
+
+def same_padding(size, kernel, stride, out):
+    """Top padding and whether the kernel needs an extra leading zero row for an odd total."""
+    total = max((out - 1) * stride + kernel - size, 0)
+    return total // 2, total % 2 == 1
+
+
+class Layer:
+    def __init__(self, kind, out_channels, output):
+        self.kind = kind
+        self.kernel = [0, 0]
+        self.stride = [0, 0]
+        self.pad = [0, 0]
+        self.out_channels = out_channels
+        self.output = output
+        self.activation = (-128, 127)
+        self.weights = b""
+        self.bias = []
+        self.multipliers = []
+        self.shifts = []
+
+
+def requantization(layer, input_tensor, weights, bias, output, channels):
+    w_scales = weights.scales if len(weights.scales) == channels else [weights.scale] * channels
+    if any(w != 0 for w in weights.zero_points):
+        raise ConvertError("weights of %s are not symmetric" % weights.name)
+    for c in range(channels):
+        q, shift = quantize_multiplier(input_tensor.scale * w_scales[c] / output.scale)
+        layer.multipliers.append(q)
+        layer.shifts.append(shift)
+    if bias is None:
+        layer.bias = [0] * channels
+    else:
+        if bias.type != INT32:
+            raise ConvertError("bias %s is not int32" % bias.name)
+        layer.bias = bias.values("i")
+
+
+def pad_kernel(weights, shape, pad_rows, pad_cols):
+    """Prepends a zero row and/or column to kernels of shape [n, kH, kW, c]."""
+    n, kh, kw, c = shape
+    out = bytearray()
+    for i in range(n):
+        if pad_rows:
+            out += bytes((kw + pad_cols) * c)
+        for y in range(kh):
+            if pad_cols:
+                out += bytes(c)
+            start = ((i * kh + y) * kw) * c
+            out += weights[start:start + kw * c]
+    return bytes(out), [n, kh + pad_rows, kw + pad_cols, c]
+
+
+def convert(model_bytes, wake_label, stride_frames):
+    if model_bytes[4:8] != b"TFL3":
+        raise ConvertError("not a TensorFlow Lite model")
+    model = Table(model_bytes, struct.unpack_from("<I", model_bytes, 0)[0])
+    codes = []
+    for code in model.tables(1):
+        # newer converters write builtin_code, older ones only the deprecated byte
+        codes.append(max(code.scalar(3, "i"), code.scalar(0, "b")))
+    subgraphs = model.tables(2)
+    if len(subgraphs) != 1:
+        raise ConvertError("the model must have a single subgraph")
+    buffers = model.tables(4)
+    graph = subgraphs[0]
+    tensors = [Tensor(t, buffers) for t in graph.tables(0)]
+
+    layers = []
+    header = None
+    current = None   # tensor index of the activations so far
+    shape = None     # H, W, C of the activations
+    for op in graph.tables(3):
+        code = codes[op.scalar(0, "I")]
+        inputs = op.vector(1, "i")
+        outputs = op.vector(2, "i")
+        options = op.table(4)
+        if current is None:
+            current = inputs[0]
+        if inputs[0] != current:
+            raise ConvertError("the operators must form a single chain")
+        x = tensors[inputs[0]]
+        y = tensors[outputs[0]]
+        if x.type != INT8 or y.type != INT8:
+            raise ConvertError("%s is not int8, convert with full integer quantization" % y.name)
+
+        if code == RESHAPE:
+            current = outputs[0]
+            if shape is not None:
+                shape = [1, 1, y.shape[-1]] if len(y.shape) == 2 else y.shape[1:]
+            continue
+
+        if header is None:
+            if len(x.shape) != 4 or x.shape[3] != 1:
+                raise ConvertError("the input must be [1, frames, features, 1], it is %s" % x.shape)
+            header = (x.shape[1], x.shape[2], x.scale, x.zero_point)
+            shape = x.shape[1:]
+        if y.shape[0] != 1:
+            raise ConvertError("the batch size must be 1")
+        h, w, c = shape
+
+        if code in (CONV_2D, DEPTHWISE_CONV_2D):
+            weights = tensors[inputs[1]]
+            bias = tensors[inputs[2]] if len(inputs) > 2 and inputs[2] >= 0 else None
+            padding = options.scalar(0, "b")
+            stride = [options.scalar(2, "i"), options.scalar(1, "i")]
+            if code == CONV_2D:
+                activation = options.scalar(3, "b")
+                dilation = [options.scalar(5, "i", 1), options.scalar(4, "i", 1)]
+            else:
+                if options.scalar(3, "i", 1) != 1:
+                    raise ConvertError("depthwise convolution needs a depth multiplier of 1")
+                activation = options.scalar(4, "b")
+                dilation = [options.scalar(6, "i", 1), options.scalar(5, "i", 1)]
+            if dilation != [1, 1]:
+                raise ConvertError("dilated convolution is not supported")
+            out_h, out_w, out_c = y.shape[1:]
+            kshape = list(weights.shape)
+            data = weights.data
+            kernel = kshape[1:3]
+            pad = [0, 0]
+            if padding == SAME:
+                # TFLite puts an odd padding row at the bottom, KWS1 pads both sides alike: a leading
+                # zero row of the kernel plus one more padding row on top gives the same taps
+                pad[0], extra_rows = same_padding(h, kernel[0], stride[0], out_h)
+                pad[1], extra_cols = same_padding(w, kernel[1], stride[1], out_w)
+                if extra_rows or extra_cols:
+                    data, kshape = pad_kernel(data, kshape, int(extra_rows), int(extra_cols))
+                    pad[0] += int(extra_rows)
+                    pad[1] += int(extra_cols)
+                    kernel = kshape[1:3]
+            pointwise = code == CONV_2D and kernel == [1, 1] and stride == [1, 1] and pad == [0, 0]
+            kind = KWS_POINTWISE if pointwise else (KWS_CONV if code == CONV_2D else KWS_DEPTHWISE)
+            layer = Layer(kind, out_c, y)
+            layer.kernel = kernel
+            layer.stride = stride
+            layer.pad = pad
+            layer.weights = data
+            for i in range(2):
+                size = [h, w][i]
+                if (size + 2 * pad[i] - kernel[i]) // stride[i] + 1 != [out_h, out_w][i]:
+                    raise ConvertError("the output shape of %s does not match its padding" % y.name)
+            requantization(layer, x, weights, bias, y, out_c)
+            layer.activation = activation_range(activation, y.scale, y.zero_point)
+            shape = [out_h, out_w, out_c]
+        elif code == FULLY_CONNECTED:
+            weights = tensors[inputs[1]]
+            bias = tensors[inputs[2]] if len(inputs) > 2 and inputs[2] >= 0 else None
+            if options is not None and options.scalar(1, "b") != 0:
+                raise ConvertError("shuffled fully connected weights are not supported")
+            out_c = weights.shape[0]
+            if weights.shape[1] != h * w * c:
+                raise ConvertError("%s does not take all %d inputs" % (weights.name, h * w * c))
+            layer = Layer(KWS_FULLY_CONNECTED, out_c, y)
+            layer.weights = weights.data
+            requantization(layer, x, weights, bias, y, out_c)
+            layer.activation = activation_range(options.scalar(0, "b") if options else 0, y.scale, y.zero_point)
+            shape = [1, 1, out_c]
+        elif code in (AVERAGE_POOL_2D, MEAN):
+            if code == AVERAGE_POOL_2D:
+                whole = options.scalar(4, "i") == h and options.scalar(3, "i") == w
+            else:
+                axes = tensors[inputs[1]].values("i")
+                whole = sorted(axes) == [1, 2]
+            if not whole:
+                raise ConvertError("only average pooling over the whole frame is supported")
+            if abs(x.scale - y.scale) > 1e-6 * x.scale or x.zero_point != y.zero_point:
+                raise ConvertError("average pooling must keep the quantization of its input")
+            layer = Layer(KWS_AVERAGE_POOL, c, y)
+            shape = [1, 1, c]
+        elif code == SOFTMAX:
+            layer = Layer(KWS_SOFTMAX, h * w * c, y)
+        else:
+            raise ConvertError("operator %d is not supported" % code)
+        layers.append(layer)
+        current = outputs[0]
+
+    if header is None or not layers:
+        raise ConvertError("the model has no layers")
+    frames, features, scale, zero_point = header
+    labels = layers[-1].out_channels
+    if layers[-1].kind != KWS_SOFTMAX:
+        raise ConvertError("the last operator must be a softmax")
+    if len(layers) > MAX_LAYERS:
+        raise ConvertError("%d layers, at most %d are supported" % (len(layers), MAX_LAYERS))
+    if frames > MAX_FRAMES or features > MAX_FEATURES:
+        raise ConvertError("input %d x %d, at most %d x %d is supported" % (frames, features, MAX_FRAMES, MAX_FEATURES))
+    if labels > MAX_LABELS or not 0 <= wake_label < labels:
+        raise ConvertError("wake label %d, the model has %d labels" % (wake_label, labels))
+
+    def padded(data):
+        return data + bytes(-len(data) % 4)
+
+    out = bytearray(struct.pack("<4sHBBfbBBB", b"KWS1", len(layers), frames, features, scale, zero_point,
+                                labels, wake_label, stride_frames))
+    for layer in layers:
+        out += struct.pack("<BBBBBBBbbbHf", layer.kind, layer.kernel[0], layer.kernel[1], layer.stride[0],
+                           layer.stride[1], layer.pad[0], layer.pad[1], layer.output.zero_point,
+                           layer.activation[0], layer.activation[1], layer.out_channels, layer.output.scale)
+        if layer.weights:
+            n = layer.out_channels
+            out += padded(layer.weights)
+            out += struct.pack("<%di" % n, *layer.bias)
+            out += struct.pack("<%di" % n, *layer.multipliers)
+            out += padded(struct.pack("<%db" % n, *layer.shifts))
+    return bytes(out), layers
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert an int8 .tflite keyword model to the KWS1 format")
+    parser.add_argument("model", help="fully int8 quantized .tflite file")
+    parser.add_argument("output", help="KWS1 file, upload as /kws.bin")
+    parser.add_argument("--wake-label", type=int, required=True, help="index of the wake word in the softmax output")
+    parser.add_argument("--stride-frames", type=int, default=2, help="run the network every this many 10 ms frames")
+    args = parser.parse_args()
+    with open(args.model, "rb") as f:
+        model = f.read()
+    try:
+        data, layers = convert(model, args.wake_label, args.stride_frames)
+    except ConvertError as e:
+        sys.exit("%s: %s" % (args.model, e))
+    with open(args.output, "wb") as f:
+        f.write(data)
+    names = {KWS_CONV: "conv", KWS_DEPTHWISE: "depthwise", KWS_POINTWISE: "pointwise",
+             KWS_FULLY_CONNECTED: "fully connected", KWS_AVERAGE_POOL: "average pool", KWS_SOFTMAX: "softmax"}
+    for layer in layers:
+        print("%-16s %3d channels, %6d weight bytes" % (names[layer.kind], layer.out_channels, len(layer.weights)))
+    print("%s: %d bytes, %d layers" % (args.output, len(data), len(layers)))
+
+
+if __name__ == "__main__":
+    main()
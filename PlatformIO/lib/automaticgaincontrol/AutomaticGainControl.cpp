@@ -0,0 +1,77 @@
+#include "AutomaticGainControl.h"
+#include <math.h>
+
+static int32_t dbfsToLevel(int dbfs)
+{
+    float level = 32767.0f * powf(10.0f, dbfs / 20.0f);
+    return level > 32767.0f ? 32767 : (int32_t)level;
+}
+
+// one pole smoothing coefficient for a time constant, given the frame duration
+static int32_t timeConstantToCoef(float frameMs, int timeMs)
+{
+    if (timeMs <= 0) {
+        return 1 << 15;
+    }
+    return (int32_t)((1.0f - expf(-frameMs / timeMs)) * (1 << 15));
+}
+
+void AutomaticGainControl::configure(int sampleRate, int frameSize, int targetDbfs, int maxGainDb, int attackMs,
+                                     int releaseMs, int gateDbfs, int limitDbfs)
+{
+    const float frameMs = 1000.0f * frameSize / sampleRate;
+
+    target = dbfsToLevel(targetDbfs);
+    gate = dbfsToLevel(gateDbfs);
+    limit = dbfsToLevel(limitDbfs);
+    maxGain = (int32_t)(UNITY * powf(10.0f, maxGainDb / 20.0f));
+    attackCoef = timeConstantToCoef(frameMs, attackMs);
+    releaseCoef = timeConstantToCoef(frameMs, releaseMs);
+    gain = UNITY;
+}
+
+void AutomaticGainControl::process(int16_t *samples, size_t count)
+{
+    if (!enabled || count == 0) {
+        return;
+    }
+
+    int32_t peak = 0;
+    for (size_t i = 0; i < count; i++) {
+        int32_t s = samples[i];
+        s = s < 0 ? -s : s;
+        peak = s > peak ? s : peak;
+    }
+
+    int32_t newGain = gain;
+    if (peak >= gate) {
+        // gain which brings the frame peak to the target level
+        int32_t desired = (int32_t)(((int64_t)target * UNITY) / peak);
+        desired = desired > maxGain ? maxGain : desired;
+        const int32_t coef = desired < gain ? attackCoef : releaseCoef;
+        newGain = gain + (int32_t)(((int64_t)(desired - gain) * coef) >> 15);
+    }
+
+    // limiter, the frame peak is known so the gain is lowered before anything overshoots
+    int32_t startGain = gain;
+    if (peak > 0 && ((int64_t)peak * newGain) >> 12 > limit) {
+        newGain = (int32_t)(((int64_t)limit * UNITY) / peak);
+        startGain = newGain < startGain ? newGain : startGain;
+    }
+
+    // ramp the gain linearly over the frame, step in Q12 << 8 for resolution
+    const int32_t step = (int32_t)((((int64_t)(newGain - startGain)) << 8) / (int32_t)count);
+    int32_t g = startGain << 8;
+    for (size_t i = 0; i < count; i++) {
+        g += step;
+        int32_t y = (int32_t)(((int64_t)samples[i] * (g >> 8)) >> 12);
+        y = y > limit ? limit : (y < -limit ? -limit : y);
+        samples[i] = (int16_t)y;
+    }
+    gain = newGain;
+}
+
+float AutomaticGainControl::getGainDb()
+{
+    return 20.0f * log10f((float)gain / UNITY);
+}
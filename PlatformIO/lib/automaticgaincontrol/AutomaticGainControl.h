@@ -0,0 +1,68 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Fixed point automatic gain control for 16 bit mono capture frames
+ *
+ * The frame peak is measured first, the gain follows the target level with separate
+ * attack (gain going down) and release (gain going up) time constants and is ramped
+ * linearly over the frame to avoid zipper noise. As the whole frame is known before
+ * the gain is applied, the limiter can lower the gain for the frame before any sample
+ * overshoots the limit. Frames below the noise gate keep the current gain, so silence
+ * is not amplified.
+ *
+ * Processing is done in place and only uses integer arithmetic, configure() is the
+ * only place where floating point is used.
+ */
+class AutomaticGainControl
+{
+public:
+    // gains are Q12 fixed point, 4096 = 1.0
+    static const int32_t UNITY = 1 << 12;
+
+    /**
+     * @brief (re)configure the gain control, resets the current gain to unity
+     *
+     * @param sampleRate sample rate of the capture frames in Hz
+     * @param frameSize number of samples per frame
+     * @param targetDbfs level the frame peaks are driven to, in dBFS (e.g. -9)
+     * @param maxGainDb maximum gain in dB
+     * @param attackMs time constant to reduce the gain
+     * @param releaseMs time constant to increase the gain
+     * @param gateDbfs frames with a peak below this level do not increase the gain
+     * @param limitDbfs no sample will exceed this level
+     */
+    void configure(int sampleRate, int frameSize, int targetDbfs, int maxGainDb, int attackMs = 10,
+                   int releaseMs = 400, int gateDbfs = -55, int limitDbfs = -1);
+
+    /**
+     * @brief apply the gain control to a frame, in place
+     *
+     * @param samples frame of 16 bit samples
+     * @param count number of samples, should match the configured frame size for the time
+     * constants to be correct
+     */
+    void process(int16_t *samples, size_t count);
+
+    void reset() { gain = UNITY; }
+    void setEnabled(bool enabled) { this->enabled = enabled; }
+    bool isEnabled() { return enabled; }
+
+    /* current gain in Q12 */
+    int32_t getGain() { return gain; }
+
+    /* current gain in dB, for reporting only */
+    float getGainDb();
+
+private:
+    bool enabled = false;
+    int32_t gain = UNITY;
+    int32_t maxGain = UNITY;
+    int32_t target = 0;
+    int32_t gate = 0;
+    int32_t limit = INT16_MAX;
+    // smoothing coefficients in Q15
+    int32_t attackCoef = 1 << 15;
+    int32_t releaseCoef = 1 << 15;
+};
@@ -0,0 +1,156 @@
+#include "Beamformer.h"
+#include <string.h>
+#include <math.h>
+
+#define SPEED_OF_SOUND_MM_PER_S 343000.0f
+// the direction estimate only moves on chunks 6 dB above the noise floor
+#define BF_SPEECH_FACTOR 4
+// smoothing of the steered response powers
+#define BF_POWER_SMOOTHING 0.1f
+
+static inline int32_t interpolate(const int16_t *x, const int16_t *coef)
+{
+    return (x[1] * coef[0] + x[0] * coef[1] + x[-1] * coef[2] + x[-2] * coef[3]) >> 14;
+}
+
+void Beamformer::configure(int channels, const float positions[][2], int sampleRate)
+{
+    this->channels = channels > MAX_CHANNELS ? MAX_CHANNELS : channels;
+    this->sampleRate = sampleRate;
+    channelScale = 32767 / this->channels;
+    for (int c = 0; c < this->channels; c++) {
+        this->positions[c][0] = positions[c][0];
+        this->positions[c][1] = positions[c][1];
+    }
+    for (int d = 0; d < DIRECTIONS; d++) {
+        computeSteering(d, directions[d]);
+    }
+    reset();
+}
+
+void Beamformer::computeSteering(int direction, Steering *steering)
+{
+    const float theta = 2.0f * (float)M_PI * direction / DIRECTIONS;
+    const float ux = cosf(theta);
+    const float uy = sinf(theta);
+    float lead[MAX_CHANNELS];
+    float minLead = 0.0f;
+    for (int c = 0; c < channels; c++) {
+        // microphones closer to the source hear it earlier and are delayed more
+        lead[c] = (positions[c][0] * ux + positions[c][1] * uy) / SPEED_OF_SOUND_MM_PER_S * sampleRate;
+        minLead = (c == 0 || lead[c] < minLead) ? lead[c] : minLead;
+    }
+    for (int c = 0; c < channels; c++) {
+        // at least one sample, the interpolation also uses the sample after the delayed one
+        float delay = lead[c] - minLead + 1.0f;
+        delay = delay > TAIL - 3 ? TAIL - 3 : delay;
+        const int whole = (int)delay;
+        const float u = -(delay - whole);
+        steering[c].delay = (uint8_t)whole;
+        steering[c].coef[0] = (int16_t)lroundf(16384.0f * u * (u + 1) * (u + 2) / 6);
+        steering[c].coef[1] = (int16_t)lroundf(16384.0f * -(u - 1) * (u + 1) * (u + 2) / 2);
+        steering[c].coef[2] = (int16_t)lroundf(16384.0f * (u - 1) * u * (u + 2) / 2);
+        steering[c].coef[3] = (int16_t)lroundf(16384.0f * -(u - 1) * u * (u + 1) / 6);
+    }
+}
+
+void Beamformer::setFixedAzimuth(int azimuth)
+{
+    fixedAzimuth = azimuth;
+    if (azimuth >= 0) {
+        steered = ((azimuth % 360) * DIRECTIONS + 180) / 360 % DIRECTIONS;
+    }
+}
+
+void Beamformer::reset()
+{
+    memset(tail, 0, sizeof(tail));
+    for (int d = 0; d < DIRECTIONS; d++) {
+        power[d] = 0.0f;
+    }
+    noiseFloor = -1;
+    estimate = -1;
+    estimateConfidence = 0.0f;
+}
+
+void Beamformer::updateDirection(const int16_t *input, size_t frames)
+{
+    const int n = frames > DOA_FRAMES ? DOA_FRAMES : (int)frames;
+    if (channels == 0) {
+        return;
+    }
+    int64_t energy = 0;
+    for (int s = 0; s < n; s++) {
+        energy += (int32_t)input[s * channels] * input[s * channels];
+    }
+    if (noiseFloor < 0 || energy < noiseFloor) {
+        noiseFloor = energy;
+    } else {
+        noiseFloor += (noiseFloor >> 6) + 1;
+    }
+    if (energy < noiseFloor * BF_SPEECH_FACTOR || n < 2) {
+        return;
+    }
+
+    int16_t lines[MAX_CHANNELS][TAIL + DOA_FRAMES];
+    for (int c = 0; c < channels; c++) {
+        memcpy(lines[c], tail[c], sizeof(tail[c]));
+        for (int s = 0; s < n; s++) {
+            lines[c][TAIL + s] = input[s * channels + c];
+        }
+    }
+
+    int best = 0;
+    float total = 0.0f;
+    for (int d = 0; d < DIRECTIONS; d++) {
+        int64_t p = 0;
+        int32_t last = 0;
+        for (int s = 0; s < n; s++) {
+            int32_t beam = 0;
+            for (int c = 0; c < channels; c++) {
+                const Steering &st = directions[d][c];
+                beam += interpolate(&lines[c][TAIL + s - st.delay], st.coef);
+            }
+            if (s > 0) {
+                const int32_t diff = beam - last;
+                p += (int64_t)diff * diff;
+            }
+            last = beam;
+        }
+        power[d] += ((float)p - power[d]) * BF_POWER_SMOOTHING;
+        total += power[d];
+        best = power[d] > power[best] ? d : best;
+    }
+
+    estimate = best * 360 / DIRECTIONS;
+    estimateConfidence = power[best] > 0.0f ? (power[best] - total / DIRECTIONS) / power[best] : 0.0f;
+    if (!held && fixedAzimuth < 0) {
+        steered = best;
+    }
+}
+
+void Beamformer::process(const int16_t *input, size_t frames, int16_t *output)
+{
+    for (size_t base = 0; base < frames; base += CHUNK) {
+        const int n = frames - base > CHUNK ? CHUNK : (int)(frames - base);
+        int32_t acc[CHUNK];
+        memset(acc, 0, sizeof(acc));
+        int16_t line[TAIL + CHUNK];
+        for (int c = 0; c < channels; c++) {
+            memcpy(line, tail[c], sizeof(tail[c]));
+            const int16_t *in = &input[base * channels + c];
+            for (int s = 0; s < n; s++) {
+                line[TAIL + s] = in[s * channels];
+            }
+            const Steering &st = directions[steered][c];
+            for (int s = 0; s < n; s++) {
+                acc[s] += interpolate(&line[TAIL + s - st.delay], st.coef);
+            }
+            memcpy(tail[c], &line[n], sizeof(tail[c]));
+        }
+        for (int s = 0; s < n; s++) {
+            const int32_t y = (acc[s] * channelScale) >> 15;
+            output[base + s] = (int16_t)(y > 32767 ? 32767 : (y < -32768 ? -32768 : y));
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Fixed point delay-and-sum beamformer with direction of arrival estimation
+ *
+ * Works on interleaved 16 bit samples of a planar microphone array. Every channel is delayed by
+ * a fractional number of samples (4 tap Lagrange interpolation, Q14) so a far field source in
+ * the steered direction adds up in phase, the output is the average of the delayed channels.
+ *
+ * The direction of arrival is a steered response power search over DIRECTIONS azimuths on up to
+ * DOA_FRAMES frames, only when the level is above the noise floor. The powers are taken of the
+ * first difference of the beams, which favours the higher frequencies where the array actually
+ * has some directivity. Unless the direction is fixed or held, the beam follows the estimate.
+ */
+class Beamformer
+{
+public:
+    static const int MAX_CHANNELS = 8;
+    static const int DIRECTIONS = 24;
+    static const int CHUNK = 64;
+    static const int DOA_FRAMES = 64;
+    static const int TAIL = 16;
+
+    /**
+     * @brief set the array geometry
+     *
+     * @param channels number of microphones, at most MAX_CHANNELS
+     * @param positions x and y of every microphone in mm
+     * @param sampleRate sample rate in Hz
+     */
+    void configure(int channels, const float positions[][2], int sampleRate);
+
+    /**
+     * @brief beamform interleaved samples
+     *
+     * @param input frames * channels interleaved samples
+     * @param frames number of frames, any number
+     * @param output frames mono samples
+     */
+    void process(const int16_t *input, size_t frames, int16_t *output);
+
+    /**
+     * @brief update the direction of arrival, call it before process() with the same frames
+     *
+     * The search costs about DIRECTIONS times the beamforming itself, so call it for one chunk
+     * per capture block rather than for every chunk.
+     *
+     * @param input frames * channels interleaved samples, only DOA_FRAMES frames are used
+     */
+    void updateDirection(const int16_t *input, size_t frames);
+
+    /* steer to a fixed azimuth in degrees, or follow the direction of arrival with -1 */
+    void setFixedAzimuth(int azimuth);
+
+    /* keep the current direction, e.g. during a session */
+    void hold(bool hold) { held = hold; }
+
+    /* estimated azimuth in degrees (0 is the x axis, counter clockwise), -1 if no speech seen yet */
+    int azimuth() { return estimate; }
+
+    /* 0..1, how much the best direction stands out from the average */
+    float confidence() { return estimateConfidence; }
+
+    /* azimuth the beam currently points to */
+    int steering() { return steered * 360 / DIRECTIONS; }
+
+    void reset();
+
+private:
+    struct Steering {
+        uint8_t delay;      // integer part of the delay, at least 1
+        int16_t coef[4];    // Lagrange coefficients for x[n - delay + 1] .. x[n - delay - 2], Q14
+    };
+
+    void computeSteering(int direction, Steering *steering);
+
+    int channels = 0;
+    int32_t channelScale = 0;   // 1 / channels, Q15
+    Steering directions[DIRECTIONS][MAX_CHANNELS];
+    float positions[MAX_CHANNELS][2];
+    int sampleRate = 16000;
+
+    int16_t tail[MAX_CHANNELS][TAIL];
+    int steered = 0;
+    int fixedAzimuth = -1;
+    bool held = false;
+
+    float power[DIRECTIONS];
+    int64_t noiseFloor = -1;
+    int estimate = -1;
+    float estimateConfidence = 0.0f;
+};
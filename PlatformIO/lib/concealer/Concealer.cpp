@@ -0,0 +1,114 @@
+#include "Concealer.h"
+
+void Concealer::configure(int channels, int sampleRate)
+{
+    this->channels = channels < 1 ? 1 : (channels > MAX_CHANNELS ? MAX_CHANNELS : channels);
+    this->sampleRate = sampleRate > 0 ? sampleRate : 16000;
+    fadeSamples = this->sampleRate * FADE_MS / 1000 * this->channels;
+    fadeSamples = fadeSamples < 1 ? 1 : fadeSamples;
+    reset();
+}
+
+void Concealer::reset()
+{
+    position = 0;
+    filled = 0;
+    active = false;
+}
+
+void Concealer::push(const int16_t *samples, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        history[position] = samples[i];
+        position = (position + 1) & (HISTORY - 1);
+    }
+    filled = filled + (int)count > HISTORY ? HISTORY : filled + (int)count;
+}
+
+// normalized autocorrelation of the first channel over the pitch range
+int Concealer::findPeriod()
+{
+    const int frames = filled / channels;
+    int minLag = sampleRate / MAX_PITCH_HZ;
+    int maxLag = sampleRate / MIN_PITCH_HZ;
+    maxLag = maxLag > frames / 2 ? frames / 2 : maxLag;
+    if (maxLag < 1) {
+        return 0;
+    }
+    minLag = minLag > maxLag ? maxLag : (minLag < 1 ? 1 : minLag);
+    const int window = maxLag;
+    int best = maxLag;
+    float bestScore = 0.0f;
+    for (int lag = minLag; lag <= maxLag; lag++) {
+        float correlation = 0.0f;
+        float energy = 0.0f;
+        for (int j = 1; j <= window; j++) {
+            const float x = history[(position - j * channels) & (HISTORY - 1)];
+            const float y = history[(position - (j + lag) * channels) & (HISTORY - 1)];
+            correlation += x * y;
+            energy += y * y;
+        }
+        if (correlation > 0.0f && energy > 0.0f && correlation * correlation / energy > bestScore) {
+            bestScore = correlation * correlation / energy;
+            best = lag;
+        }
+    }
+    return best * channels;
+}
+
+int16_t Concealer::next()
+{
+    if (period == 0 || generated >= fadeSamples) {
+        generated++;
+        return 0;
+    }
+    int32_t sample = segment[phase];
+    if (generated < MERGE_FRAMES * channels) {
+        // the step between the last played sample and the repeated period fades away
+        const int frame = generated / channels;
+        sample += step[generated % channels] * (MERGE_FRAMES - frame) / MERGE_FRAMES;
+        sample = sample > 32767 ? 32767 : (sample < -32768 ? -32768 : sample);
+    }
+    const int32_t gain = (int32_t)(((int64_t)(fadeSamples - generated) << 15) / fadeSamples);
+    phase = phase + 1 >= period ? 0 : phase + 1;
+    generated++;
+    return (int16_t)((sample * gain) >> 15);
+}
+
+void Concealer::conceal(int16_t *output, size_t count)
+{
+    if (!active) {
+        active = true;
+        period = findPeriod();
+        for (int i = 0; i < period; i++) {
+            segment[i] = history[(position - period + i) & (HISTORY - 1)];
+        }
+        for (int ch = 0; ch < channels && period > 0; ch++) {
+            step[ch] = history[(position - channels + ch) & (HISTORY - 1)] -
+                       history[(position - period - channels + ch) & (HISTORY - 1)];
+        }
+        phase = 0;
+        generated = 0;
+        underflows++;
+    }
+    for (size_t i = 0; i < count; i++) {
+        output[i] = next();
+    }
+    // the remainder is carried, blocks of any size add up to the exact time
+    const uint64_t concealed = (uint64_t)count * 1000000 + concealedRemainder;
+    concealedMicros += (uint32_t)(concealed / ((uint32_t)sampleRate * channels));
+    concealedRemainder = (uint32_t)(concealed % ((uint32_t)sampleRate * channels));
+}
+
+void Concealer::resume(int16_t *samples, size_t count)
+{
+    if (!active) {
+        return;
+    }
+    const int merge = MERGE_FRAMES * channels < (int)count ? MERGE_FRAMES * channels : (int)count;
+    for (int i = 0; i < merge; i++) {
+        const int32_t weight = ((i + 1) << 15) / (merge + 1);
+        samples[i] = (int16_t)((samples[i] * weight + next() * (32768 - weight)) >> 15);
+    }
+    active = false;
+}
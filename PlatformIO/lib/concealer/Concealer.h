@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Packet loss concealment for playback underflows
+ *
+ * Keeps the last played samples. When the audio runs out the last pitch period is repeated and
+ * faded out over FADE_MS, after that silence follows, so the DAC keeps getting samples without
+ * a click. When the audio comes back the first MERGE_FRAMES are crossfaded from the concealment
+ * into the real samples.
+ *
+ * Works on interleaved 16 bit samples, the period is estimated on the first channel. Push and
+ * conceal whole frames.
+ */
+class Concealer
+{
+public:
+    static const int HISTORY = 1024;    // samples, power of 2
+    static const int FADE_MS = 30;
+    static const int MERGE_FRAMES = 32;
+    static const int MAX_CHANNELS = 8;
+    static const int MIN_PITCH_HZ = 70;
+    static const int MAX_PITCH_HZ = 400;
+
+    void configure(int channels, int sampleRate);
+    void reset();
+
+    /* remember samples that were played, concealed ones included */
+    void push(const int16_t *samples, size_t count);
+
+    /* fill count samples of a gap, the first call starts a new concealment */
+    void conceal(int16_t *output, size_t count);
+
+    /* crossfade real samples that follow a gap, in place, does nothing when there was no gap */
+    void resume(int16_t *samples, size_t count);
+
+    bool concealing() { return active; }
+
+    uint32_t underflows = 0;
+    uint32_t concealedMicros = 0;
+
+private:
+    int16_t next();
+    int findPeriod();
+
+    int16_t history[HISTORY] = {};
+    int16_t segment[HISTORY / 2];   // the period that is repeated
+    int32_t step[MAX_CHANNELS];
+    int position = 0;
+    int filled = 0;
+    int channels = 1;
+    int sampleRate = 16000;
+    bool active = false;
+    int period = 0;         // samples, a whole number of frames
+    int phase = 0;
+    int generated = 0;      // samples
+    int fadeSamples = 1;
+    uint32_t concealedRemainder = 0;    // microseconds * sampleRate * channels
+};
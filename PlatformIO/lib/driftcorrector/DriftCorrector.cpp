@@ -0,0 +1,106 @@
+#include "DriftCorrector.h"
+#include <math.h>
+
+// ppm per ms of fill error and ppm per ms and second, critically damped for the plant
+// d(error)/dt = -ppm / 1000 ms/s
+#define DRIFT_KP 50.0f
+#define DRIFT_KI 0.6f
+
+void DriftCorrector::configure(int channels, int sampleRate)
+{
+    this->channels = channels < 1 ? 1 : (channels > MAX_CHANNELS ? MAX_CHANNELS : channels);
+    this->sampleRate = sampleRate > 0 ? sampleRate : 16000;
+    reset();
+}
+
+void DriftCorrector::reset()
+{
+    for (int c = 0; c < MAX_CHANNELS; c++) {
+        for (int t = 0; t < 4; t++) {
+            taps[c][t] = 0;
+        }
+    }
+    // three frames are read before the first output, which is the first input frame
+    position = 3ULL << 32;
+    step = 1ULL << 32;
+    correctionPpm = 0;
+    fill = 0.0f;
+    target = -1.0f;
+    integral = 0.0f;
+    settleSum = 0.0f;
+    settleTime = 0.0f;
+    started = false;
+}
+
+void DriftCorrector::update(uint32_t fillFrames, unsigned long nowMicros)
+{
+    if (!started) {
+        // the settle time starts with the first audio, not while waiting for it
+        if (fillFrames == 0) {
+            return;
+        }
+        started = true;
+        startMicros = nowMicros;
+        lastMicros = nowMicros;
+        return;
+    }
+    const float dt = (nowMicros - lastMicros) / 1000000.0f;
+    lastMicros = nowMicros;
+    if (dt <= 0.0f) {
+        return;
+    }
+    if (target < 0.0f) {
+        // the target is the mean fill over the settle time, the smoothing starts from there
+        settleSum += fillFrames * dt;
+        settleTime += dt;
+        if (nowMicros - startMicros >= SETTLE_MS * 1000UL) {
+            target = settleSum / settleTime;
+            fill = target;
+        }
+        return;
+    }
+    float alpha = dt * 1000.0f / FILL_TIME_MS;
+    alpha = alpha > 1.0f ? 1.0f : alpha;
+    fill += ((float)fillFrames - fill) * alpha;
+
+    const float errorMs = (fill - target) * 1000.0f / sampleRate;
+    integral += DRIFT_KI * errorMs * dt;
+    integral = integral > MAX_PPM ? MAX_PPM : (integral < -MAX_PPM ? -MAX_PPM : integral);
+    float ppm = DRIFT_KP * errorMs + integral;
+    ppm = ppm > MAX_PPM ? MAX_PPM : (ppm < -MAX_PPM ? -MAX_PPM : ppm);
+    correctionPpm = (int32_t)ppm;
+    step = (1ULL << 32) + (int64_t)(ppm * 4294.967296f);
+}
+
+void DriftCorrector::input(const int16_t *frame)
+{
+    for (int c = 0; c < channels; c++) {
+        taps[c][0] = taps[c][1];
+        taps[c][1] = taps[c][2];
+        taps[c][2] = taps[c][3];
+        taps[c][3] = frame[c];
+    }
+    position -= 1ULL << 32;
+}
+
+void DriftCorrector::output(int16_t *frame)
+{
+    const uint32_t fraction = (uint32_t)position;
+    position += step;
+    if (fraction == 0) {
+        for (int c = 0; c < channels; c++) {
+            frame[c] = taps[c][1];
+        }
+        return;
+    }
+    const float t = fraction / 4294967296.0f;
+    for (int c = 0; c < channels; c++) {
+        const float x0 = taps[c][0];
+        const float x1 = taps[c][1];
+        const float x2 = taps[c][2];
+        const float x3 = taps[c][3];
+        const float y = x1 + 0.5f * t * (x2 - x0 + t * (2.0f * x0 - 5.0f * x1 + 4.0f * x2 - x3 +
+                                                         t * (3.0f * (x1 - x2) + x3 - x0)));
+        frame[c] = (int16_t)(y > 32767.0f ? 32767 : (y < -32768.0f ? -32768 : (int32_t)lrintf(y)));
+    }
+}
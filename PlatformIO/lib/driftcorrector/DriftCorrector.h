@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Asynchronous sample rate correction between a sender clock and the DAC clock
+ *
+ * A stream that is sent in real time by another device fills the playback buffer a little
+ * faster or slower than the DAC empties it. The mean fill level over the first SETTLE_MS of
+ * audio becomes the target, after that the level is smoothed over FILL_TIME_MS and a PI
+ * controller adjusts the playback rate by at most MAX_PPM to stay there. Frames are resampled with a 4 tap cubic (Catmull-Rom)
+ * interpolator, at a ratio of exactly 1 the input is passed through unchanged.
+ *
+ * Feed input frames while needsInput() is true and take one output frame after that.
+ */
+class DriftCorrector
+{
+public:
+    static const int MAX_CHANNELS = 8;
+    static const int MAX_PPM = 1000;
+    static const int SETTLE_MS = 3000;
+    static const int FILL_TIME_MS = 4000;
+
+    void configure(int channels, int sampleRate);
+    void reset();
+
+    /* the frames in the playback buffer, once per block while the sender is streaming */
+    void update(uint32_t fillFrames, unsigned long nowMicros);
+
+    bool needsInput() { return (position >> 32) >= 1; }
+    void input(const int16_t *frame);
+    void output(int16_t *frame);
+
+    /* current correction, positive when the input is played faster than its nominal rate */
+    int32_t ppm() { return correctionPpm; }
+    /* smoothed fill minus the target, in frames */
+    int32_t fillError() { return (int32_t)(fill - target); }
+    bool settled() { return target >= 0.0f; }
+
+private:
+    int16_t taps[MAX_CHANNELS][4] = {};
+    int channels = 1;
+    int sampleRate = 16000;
+    uint64_t position = 0;      // Q32, the output lies between taps 1 and 2
+    uint64_t step = 1ULL << 32;
+    int32_t correctionPpm = 0;
+    float fill = 0.0f;
+    float target = -1.0f;
+    float integral = 0.0f;
+    float settleSum = 0.0f;     // fill frames * seconds
+    float settleTime = 0.0f;
+    unsigned long startMicros = 0;
+    unsigned long lastMicros = 0;
+    bool started = false;
+};
@@ -0,0 +1,135 @@
+#include "EchoCanceller.h"
+#include <string.h>
+#include <math.h>
+
+// adaptation step, Q15
+#define AEC_STEP 8192
+// regularization of the step normalization per tap, -54 dBFS
+#define AEC_DELTA_PER_TAP 64
+// no adaptation below -60 dBFS of reference per tap
+#define AEC_MIN_ENERGY_PER_TAP 1024
+// double talk when the microphone peak exceeds twice the reference peak, i.e. the echo path
+// may amplify by up to 6 dB
+#define AEC_GEIGEL_FACTOR 2
+// blocks without adaptation after double talk, ~50 ms at 16 kHz
+#define AEC_DOUBLE_TALK_HOLD 12
+
+void EchoCanceller::configure(int taps, int delay)
+{
+    this->taps = taps < BLOCK ? BLOCK : (taps > MAX_TAPS ? MAX_TAPS : taps);
+    this->delay = delay < 0 ? 0 : (delay > REFERENCE_SIZE - 1024 ? REFERENCE_SIZE - 1024 : delay);
+    resetFilter();
+}
+
+void EchoCanceller::resetFilter()
+{
+    memset(weights, 0, sizeof(weights));
+    memset(coefs, 0, sizeof(coefs));
+    reset();
+}
+
+void EchoCanceller::reset()
+{
+    memset(history, 0, sizeof(history));
+    energy = 0;
+    doubleTalk = 0;
+    // the bulk delay is a run of silence in front of the reference
+    memset(reference, 0, sizeof(reference));
+    referenceHead = 0;
+    referenceCount = delay;
+}
+
+void EchoCanceller::pushReference(const int16_t *samples, size_t frames, int channels)
+{
+    for (size_t i = 0; i < frames; i++) {
+        if (referenceCount == REFERENCE_SIZE) {
+            referenceOverruns += frames - i;
+            return;
+        }
+        int32_t sample = samples[i * channels];
+        if (channels == 2) {
+            sample = (sample + samples[i * 2 + 1]) >> 1;
+        }
+        reference[(referenceHead + referenceCount) % REFERENCE_SIZE] = (int16_t)sample;
+        referenceCount++;
+    }
+}
+
+void EchoCanceller::process(int16_t *samples, size_t count)
+{
+    for (size_t done = 0; done < count; done += BLOCK) {
+        processBlock(&samples[done], count - done < BLOCK ? (int)(count - done) : BLOCK);
+    }
+}
+
+void EchoCanceller::processBlock(int16_t *samples, int count)
+{
+    // append the reference of this block, silence if the playback ran dry
+    int16_t *block = &history[taps];
+    int32_t refPeak = 0;
+    for (int i = 0; i < count; i++) {
+        if (referenceCount > 0) {
+            block[i] = reference[referenceHead];
+            referenceHead = (referenceHead + 1) % REFERENCE_SIZE;
+            referenceCount--;
+        } else {
+            block[i] = 0;
+        }
+    }
+    for (int i = 0; i < taps + count; i++) {
+        const int32_t magnitude = history[i] < 0 ? -history[i] : history[i];
+        refPeak = magnitude > refPeak ? magnitude : refPeak;
+    }
+    int32_t micPeak = 0;
+    for (int i = 0; i < count; i++) {
+        const int32_t magnitude = samples[i] < 0 ? -samples[i] : samples[i];
+        micPeak = magnitude > micPeak ? magnitude : micPeak;
+    }
+    if (micPeak > AEC_GEIGEL_FACTOR * refPeak) {
+        doubleTalk = AEC_DOUBLE_TALK_HOLD;
+    } else if (doubleTalk > 0) {
+        doubleTalk--;
+    }
+
+    const int64_t minEnergy = (int64_t)taps * AEC_MIN_ENERGY_PER_TAP;
+    const int64_t delta = (int64_t)taps * AEC_DELTA_PER_TAP;
+    for (int i = 0; i < count; i++) {
+        // x[0] is the newest reference sample, x[-k] is k samples older
+        const int16_t *x = &block[i];
+        energy += (int32_t)x[0] * x[0] - (int32_t)x[-taps] * x[-taps];
+
+        int64_t acc = 0;
+        for (int k = 0; k < taps; k++) {
+            acc += (int32_t)coefs[k] * x[-k];
+        }
+        int32_t e = samples[i] - (int32_t)(acc >> 14);
+        e = e > 32767 ? 32767 : (e < -32768 ? -32768 : e);
+
+        if (energy > minEnergy && doubleTalk == 0) {
+            micEnergy += (int32_t)samples[i] * samples[i];
+            residualEnergy += e * e;
+            // step * e / energy, scaled to the Q28 weights
+            int64_t step = (((int64_t)AEC_STEP * e) << 13) / (energy + delta);
+            step = step > 65535 ? 65535 : (step < -65535 ? -65535 : step);
+            const int32_t s = (int32_t)step;
+            for (int k = 0; k < taps; k++) {
+                int32_t w = weights[k] + s * x[-k];
+                // the filter taps are limited to +-2, a louder echo path is not modelled
+                w = w > (32767 << 14) ? (32767 << 14) : (w < -(32768 << 14) ? -(32768 << 14) : w);
+                weights[k] = w;
+                coefs[k] = (int16_t)(w >> 14);
+            }
+        }
+        samples[i] = (int16_t)e;
+    }
+
+    memmove(history, &history[count], taps * sizeof(int16_t));
+}
+
+float EchoCanceller::takeErle()
+{
+    const float erle = residualEnergy > 0 && micEnergy > 0 ? 10.0f * log10f((float)micEnergy / residualEnergy) : 0.0f;
+    micEnergy = 0;
+    residualEnergy = 0;
+    return erle;
+}
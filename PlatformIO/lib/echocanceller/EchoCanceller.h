@@ -0,0 +1,79 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Fixed point NLMS acoustic echo canceller for 16 bit mono audio
+ *
+ * The played audio is pushed as reference and delayed by a fixed bulk delay (the DMA buffers
+ * between writing and hearing it), an adaptive FIR filter of up to MAX_TAPS taps then models the
+ * echo path and its estimate is subtracted from the microphone. The filter weights are Q28, the
+ * step is normalized by the reference energy in the filter window. Adaptation stops while the
+ * microphone is much louder than the reference (Geigel double talk detection), so the talker
+ * does not detune the filter, and when there is no reference.
+ *
+ * Both the reference and the microphone must have the same sample rate and be processed from
+ * the same task, the microphone is processed in place without delay.
+ */
+class EchoCanceller
+{
+public:
+    static const int MAX_TAPS = 512;
+    static const int BLOCK = 64;
+    static const int REFERENCE_SIZE = 4096;
+
+    /**
+     * @brief set the filter length and bulk delay, resets the filter
+     *
+     * @param taps filter length in samples, at most MAX_TAPS
+     * @param delay samples between writing the reference and it reaching the microphone,
+     * at most REFERENCE_SIZE - 1024
+     */
+    void configure(int taps, int delay);
+
+    /**
+     * @brief add played samples to the reference, stereo is mixed down to mono
+     */
+    void pushReference(const int16_t *samples, size_t frames, int channels);
+
+    /**
+     * @brief remove the echo from microphone samples, in place, takes count reference samples
+     */
+    void process(int16_t *samples, size_t count);
+
+    /* start a new playback, the reference is emptied but the filter is kept */
+    void reset();
+
+    /* forget the echo path as well */
+    void resetFilter();
+
+    /* echo return loss enhancement in dB since the last call, 0 if there was no echo */
+    float takeErle();
+
+    /* reference samples dropped because the reference buffer was full */
+    uint32_t overruns() { return referenceOverruns; }
+
+    void setEnabled(bool enabled) { this->enabled = enabled; }
+    bool isEnabled() { return enabled; }
+
+private:
+    void processBlock(int16_t *samples, int count);
+
+    bool enabled = false;
+    int taps = 256;
+    int delay = 0;
+
+    int32_t weights[MAX_TAPS];          // echo path, Q28
+    int16_t coefs[MAX_TAPS];            // weights >> 14, Q14, used for filtering
+    int16_t history[MAX_TAPS + BLOCK];  // reference, oldest first, the current block at the end
+    int64_t energy = 0;                 // reference energy in the filter window
+    int doubleTalk = 0;                 // blocks left without adaptation
+
+    int16_t reference[REFERENCE_SIZE];
+    size_t referenceHead = 0;
+    size_t referenceCount = 0;
+    uint32_t referenceOverruns = 0;
+
+    uint64_t micEnergy = 0;
+    uint64_t residualEnergy = 0;
+};
@@ -0,0 +1,90 @@
+#include "Endpointer.h"
+
+// a frame is speech 12 dB above the noise floor (log2 of the power in Q8, 3 dB per unit)
+#define EP_SPEECH_MARGIN (4 * 256)
+// and above -60 dBFS
+#define EP_MIN_ENERGY (10 * 256)
+// consecutive speech frames needed to start an utterance
+#define EP_SPEECH_START 3
+// noise floor rise per frame, ~2.4 dB/s
+#define EP_FLOOR_RISE 2
+
+// log2 in Q8, mantissa approximated by f + 0.346 * f * (1 - f)
+static int32_t log2Q8(uint64_t x)
+{
+    if (x == 0) {
+        return 0;
+    }
+    const int msb = 63 - __builtin_clzll(x);
+    const uint32_t frac = (uint32_t)((msb >= 8 ? x >> (msb - 8) : x << (8 - msb)) & 0xff);
+    return msb * 256 + (int32_t)(frac + ((frac * (256 - frac) * 89) >> 16));
+}
+
+void Endpointer::configure(int sampleRate, int trailingSilenceMs, int maxUtteranceMs, int noSpeechMs)
+{
+    frameSize = sampleRate / 100;
+    trailingFrames = trailingSilenceMs > 10 ? trailingSilenceMs / 10 : 1;
+    maxFrames = maxUtteranceMs > 10 ? maxUtteranceMs / 10 : 1;
+    noSpeechFrames = noSpeechMs > 10 ? noSpeechMs / 10 : 1;
+    reset();
+}
+
+void Endpointer::reset()
+{
+    energy = 0;
+    position = 0;
+    frames = 0;
+    noiseFloor = -1;
+    speechRun = 0;
+    silenceRun = 0;
+    lastSpeechFrame = 0;
+    speechStarted = false;
+    result = NONE;
+}
+
+Endpointer::Result Endpointer::process(const int16_t *samples, size_t count)
+{
+    for (size_t i = 0; i < count && result == NONE; i++) {
+        energy += (int32_t)samples[i] * samples[i];
+        if (++position >= frameSize) {
+            processFrame();
+            energy = 0;
+            position = 0;
+        }
+    }
+    return result;
+}
+
+void Endpointer::processFrame()
+{
+    const int32_t level = log2Q8(energy / frameSize);
+    frames++;
+
+    // the floor is the level of the first frame, then follows the minimum
+    if (noiseFloor < 0 || level < noiseFloor) {
+        noiseFloor = noiseFloor < 0 ? level : noiseFloor + ((level - noiseFloor) >> 2);
+    } else {
+        noiseFloor += EP_FLOOR_RISE;
+    }
+
+    const bool speech = level > EP_MIN_ENERGY && level > noiseFloor + EP_SPEECH_MARGIN;
+    if (speech) {
+        speechRun++;
+        silenceRun = 0;
+        if (speechRun >= EP_SPEECH_START) {
+            speechStarted = true;
+        }
+        lastSpeechFrame = frames;
+    } else {
+        speechRun = 0;
+        silenceRun++;
+    }
+
+    if (speechStarted && silenceRun >= trailingFrames) {
+        result = END_OF_SPEECH;
+    } else if (frames >= maxFrames) {
+        result = MAX_LENGTH;
+    } else if (!speechStarted && frames >= noSpeechFrames) {
+        result = NO_SPEECH;
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Fixed point end of utterance detection for 16 bit mono audio
+ *
+ * The audio is cut in 10 ms frames, a frame is speech when its energy is a margin above an
+ * adaptive noise floor (fast down, slow up). Speech starts after a few consecutive speech
+ * frames and ends after the configured trailing silence. The utterance is also ended when it
+ * gets too long, or when no speech starts at all within the no speech timeout.
+ */
+class Endpointer
+{
+public:
+    enum Result {
+        NONE = 0,
+        END_OF_SPEECH,
+        MAX_LENGTH,
+        NO_SPEECH
+    };
+
+    /**
+     * @brief set the limits, resets the detection
+     *
+     * @param sampleRate sample rate in Hz
+     * @param trailingSilenceMs silence after speech that ends the utterance
+     * @param maxUtteranceMs maximum length of the utterance, counted from reset()
+     * @param noSpeechMs time to wait for speech to start
+     */
+    void configure(int sampleRate, int trailingSilenceMs, int maxUtteranceMs, int noSpeechMs = 5000);
+
+    /**
+     * @brief run the detection on a block of samples
+     *
+     * @return the end reason once the utterance has ended, NONE before that
+     */
+    Result process(const int16_t *samples, size_t count);
+
+    /* start a new utterance */
+    void reset();
+
+    /* time from reset() to the end of the last speech frame */
+    uint32_t speechEndMs() { return lastSpeechFrame * 10; }
+
+    /* time from reset() to the detected end */
+    uint32_t elapsedMs() { return frames * 10; }
+
+private:
+    void processFrame();
+
+    int frameSize = 160;
+    uint32_t trailingFrames = 80;
+    uint32_t maxFrames = 1000;
+    uint32_t noSpeechFrames = 500;
+
+    uint64_t energy = 0;
+    int position = 0;
+    uint32_t frames = 0;
+    int32_t noiseFloor = -1;
+    uint32_t speechRun = 0;
+    uint32_t silenceRun = 0;
+    uint32_t lastSpeechFrame = 0;
+    bool speechStarted = false;
+    Result result = NONE;
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+/**
+ * @brief In place radix-2 complex FFT on 32 bit integer data with Q15 twiddles
+ *
+ * The forward transform halves the data after every stage, so the result is scaled by 1/N
+ * and cannot overflow as long as the input stays below 2^30 / N. The inverse transform is
+ * not scaled, hence inverse(forward(x)) == x (within rounding). Keep 16 bit audio shifted
+ * left by a few bits before the forward transform to retain precision.
+ *
+ * All buffers are owned by the caller, the twiddle table is part of the object, no heap
+ * is used.
+ */
+template <size_t N>
+class FixedFFT
+{
+    static_assert(N >= 4 && (N & (N - 1)) == 0, "N must be a power of 2");
+
+    int16_t cosTable[N / 2];
+    int16_t sinTable[N / 2];
+
+    static int32_t mulQ15(int32_t a, int16_t b)
+    {
+        return (int32_t)(((int64_t)a * b) >> 15);
+    }
+
+    void bitReverse(int32_t *re, int32_t *im)
+    {
+        for (size_t i = 1, j = 0; i < N; i++)
+        {
+            size_t bit = N >> 1;
+            for (; j & bit; bit >>= 1)
+            {
+                j ^= bit;
+            }
+            j ^= bit;
+            if (i < j)
+            {
+                int32_t t = re[i];
+                re[i] = re[j];
+                re[j] = t;
+                t = im[i];
+                im[i] = im[j];
+                im[j] = t;
+            }
+        }
+    }
+
+    void transform(int32_t *re, int32_t *im, bool inverse)
+    {
+        bitReverse(re, im);
+        for (size_t len = 2; len <= N; len <<= 1)
+        {
+            const size_t half = len >> 1;
+            const size_t step = N / len;
+            for (size_t i = 0; i < N; i += len)
+            {
+                for (size_t k = 0; k < half; k++)
+                {
+                    const int16_t c = cosTable[k * step];
+                    const int16_t s = inverse ? sinTable[k * step] : (int16_t)-sinTable[k * step];
+                    const size_t a = i + k;
+                    const size_t b = a + half;
+                    const int32_t tr = mulQ15(re[b], c) - mulQ15(im[b], s);
+                    const int32_t ti = mulQ15(re[b], s) + mulQ15(im[b], c);
+                    if (inverse)
+                    {
+                        re[b] = re[a] - tr;
+                        im[b] = im[a] - ti;
+                        re[a] = re[a] + tr;
+                        im[a] = im[a] + ti;
+                    }
+                    else
+                    {
+                        re[b] = (re[a] - tr) >> 1;
+                        im[b] = (im[a] - ti) >> 1;
+                        re[a] = (re[a] + tr) >> 1;
+                        im[a] = (im[a] + ti) >> 1;
+                    }
+                }
+            }
+        }
+    }
+
+public:
+    FixedFFT()
+    {
+        for (size_t k = 0; k < N / 2; k++)
+        {
+            cosTable[k] = (int16_t)lroundf(32767.0f * cosf(2.0f * (float)M_PI * k / N));
+            sinTable[k] = (int16_t)lroundf(32767.0f * sinf(2.0f * (float)M_PI * k / N));
+        }
+    }
+
+    /* Forward transform, result is scaled by 1/N */
+    void forward(int32_t *re, int32_t *im) { transform(re, im, false); }
+
+    /* Inverse transform, not scaled */
+    void inverse(int32_t *re, int32_t *im) { transform(re, im, true); }
+
+    static constexpr size_t size() { return N; }
+};
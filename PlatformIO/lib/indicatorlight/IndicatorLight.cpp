@@ -53,7 +53,7 @@ void indicatorLedTask(void *param)
     }
 }
 
-IndicatorLight::IndicatorLight(int gpio, bool _inversePWM, int _BITS) : BITS(_BITS), inversePWM(_inversePWM)
+IndicatorLight::IndicatorLight(int gpio, bool _inversePWM, int _BITS, BaseType_t core, UBaseType_t priority) : BITS(_BITS), inversePWM(_inversePWM)
 {
     // use the build in LED as an indicator - we'll set it up as a pwm output so we can make it glow nicely
     ledcSetup(0, 10000, BITS);
@@ -65,7 +65,7 @@ IndicatorLight::IndicatorLight(int gpio, bool _inversePWM, int _BITS) : BITS(_BI
     m_state = OFF;
     updateAnimation();
     // set up the task for controlling the light
-    xTaskCreate(indicatorLedTask, "Indicator LED Task", 4096, this, 1, &m_taskHandle);
+    xTaskCreatePinnedToCore(indicatorLedTask, "Indicator LED Task", 4096, this, priority, &m_taskHandle, core);
 }
 
 
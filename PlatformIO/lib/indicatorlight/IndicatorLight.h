@@ -48,8 +48,10 @@ public:
      * @param gpio which GPIO the led is connected to
      * @param inversePWM set to true if LED is active at LOW output level
      * @param _BITS number of bits for pwm controller, up to 16 is permitted, 12 is default
+     * @param core core the animation task runs on, any core by default
+     * @param priority priority of the animation task
      */
-    IndicatorLight(int gpio, bool inversePWM = false, int _BITS = 12);
+    IndicatorLight(int gpio, bool inversePWM = false, int _BITS = 12, BaseType_t core = tskNO_AFFINITY, UBaseType_t priority = 1);
 
     void setState(IndicatorState state) 
     {
@@ -0,0 +1,191 @@
+#include "Int8Kernels.h"
+#include <math.h>
+
+static int32_t saturatingRoundingDoublingHighMul(int32_t a, int32_t b)
+{
+    if (a == b && a == INT32_MIN) {
+        return INT32_MAX;
+    }
+    const int64_t ab = (int64_t)a * b;
+    const int32_t nudge = ab >= 0 ? (1 << 30) : (1 - (1 << 30));
+    return (int32_t)((ab + nudge) / (1ll << 31));
+}
+
+static int32_t roundingDivideByPowerOfTwo(int32_t x, int exponent)
+{
+    const int32_t mask = (int32_t)((1ll << exponent) - 1);
+    const int32_t remainder = x & mask;
+    const int32_t threshold = (mask >> 1) + (x < 0 ? 1 : 0);
+    return (x >> exponent) + (remainder > threshold ? 1 : 0);
+}
+
+int32_t int8Requantize(int32_t acc, int32_t multiplier, int shift)
+{
+    const int left = shift > 0 ? shift : 0;
+    const int right = shift > 0 ? 0 : -shift;
+    return roundingDivideByPowerOfTwo(saturatingRoundingDoublingHighMul(acc * (1 << left), multiplier), right);
+}
+
+static inline int8_t clampOutput(int32_t acc, int channel, const Int8Quantization &quant)
+{
+    int32_t y = int8Requantize(acc, quant.multiplier[channel], quant.shift[channel]) + quant.outputZeroPoint;
+    y = y < quant.activationMin ? quant.activationMin : y;
+    y = y > quant.activationMax ? quant.activationMax : y;
+    return (int8_t)y;
+}
+
+int32_t int8Dot(const int8_t *a, const int8_t *b, int n)
+{
+    int32_t acc0 = 0;
+    int32_t acc1 = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 += a[i] * b[i] + a[i + 2] * b[i + 2];
+        acc1 += a[i + 1] * b[i + 1] + a[i + 3] * b[i + 3];
+    }
+    for (; i < n; i++) {
+        acc0 += a[i] * b[i];
+    }
+    return acc0 + acc1;
+}
+
+void int8FoldInputOffset(int32_t *bias, const int8_t *weights, int outChannels, int inChannels, int32_t inputOffset)
+{
+    for (int c = 0; c < outChannels; c++) {
+        int32_t sum = 0;
+        for (int i = 0; i < inChannels; i++) {
+            sum += weights[c * inChannels + i];
+        }
+        bias[c] += inputOffset * sum;
+    }
+}
+
+void int8Conv2d(const int8_t *input, int inH, int inW, int inC, int32_t inputOffset,
+                const int8_t *weights, const int32_t *foldedBias, int outC, int kernelH, int kernelW,
+                int strideH, int strideW, int padH, int padW, int outH, int outW,
+                const Int8Quantization &quant, int8_t *output)
+{
+    const int filterSize = kernelH * kernelW * inC;
+    for (int oy = 0; oy < outH; oy++) {
+        const int iy0 = oy * strideH - padH;
+        const int ky0 = iy0 < 0 ? -iy0 : 0;
+        const int ky1 = iy0 + kernelH > inH ? inH - iy0 : kernelH;
+        for (int ox = 0; ox < outW; ox++) {
+            const int ix0 = ox * strideW - padW;
+            const int kx0 = ix0 < 0 ? -ix0 : 0;
+            const int kx1 = ix0 + kernelW > inW ? inW - ix0 : kernelW;
+            const bool border = ky0 > 0 || kx0 > 0 || ky1 < kernelH || kx1 < kernelW;
+            for (int c = 0; c < outC; c++) {
+                const int8_t *filter = &weights[c * filterSize];
+                int32_t acc = foldedBias[c];
+                for (int ky = ky0; ky < ky1; ky++) {
+                    const int8_t *x = &input[((iy0 + ky) * inW + ix0 + kx0) * inC];
+                    const int8_t *w = &filter[(ky * kernelW + kx0) * inC];
+                    // the taps of a row are contiguous in the input and in the filter
+                    acc += int8Dot(x, w, (kx1 - kx0) * inC);
+                }
+                if (border) {
+                    // the bias holds the input offset of all taps, padding is at the input zero point
+                    // and contributes nothing, so take back the offset of the taps outside the input
+                    int32_t skipped = 0;
+                    for (int ky = 0; ky < kernelH; ky++) {
+                        for (int kx = 0; kx < kernelW; kx++) {
+                            if (ky < ky0 || ky >= ky1 || kx < kx0 || kx >= kx1) {
+                                const int8_t *w = &filter[(ky * kernelW + kx) * inC];
+                                for (int i = 0; i < inC; i++) {
+                                    skipped += w[i];
+                                }
+                            }
+                        }
+                    }
+                    acc -= inputOffset * skipped;
+                }
+                *output++ = clampOutput(acc, c, quant);
+            }
+        }
+    }
+}
+
+void int8DepthwiseConv2d(const int8_t *input, int inH, int inW, int channels, int32_t inputOffset,
+                         const int8_t *weights, const int32_t *bias, int kernelH, int kernelW,
+                         int strideH, int strideW, int padH, int padW, int outH, int outW,
+                         const Int8Quantization &quant, int8_t *output)
+{
+    for (int oy = 0; oy < outH; oy++) {
+        for (int ox = 0; ox < outW; ox++) {
+            const int iy0 = oy * strideH - padH;
+            const int ix0 = ox * strideW - padW;
+            for (int c = 0; c < channels; c++) {
+                int32_t acc = bias ? bias[c] : 0;
+                for (int ky = 0; ky < kernelH; ky++) {
+                    const int iy = iy0 + ky;
+                    if (iy < 0 || iy >= inH) {
+                        continue;
+                    }
+                    const int8_t *x = &input[(iy * inW) * channels + c];
+                    const int8_t *w = &weights[(ky * kernelW) * channels + c];
+                    for (int kx = 0; kx < kernelW; kx++) {
+                        const int ix = ix0 + kx;
+                        if (ix < 0 || ix >= inW) {
+                            continue;
+                        }
+                        acc += (x[ix * channels] + inputOffset) * w[kx * channels];
+                    }
+                }
+                *output++ = clampOutput(acc, c, quant);
+            }
+        }
+    }
+}
+
+void int8Pointwise(const int8_t *input, int pixels, int inC, const int8_t *weights, const int32_t *foldedBias,
+                   int outC, const Int8Quantization &quant, int8_t *output)
+{
+    for (int p = 0; p < pixels; p++) {
+        const int8_t *x = &input[p * inC];
+        for (int c = 0; c < outC; c++) {
+            const int32_t acc = foldedBias[c] + int8Dot(x, &weights[c * inC], inC);
+            *output++ = clampOutput(acc, c, quant);
+        }
+    }
+}
+
+void int8FullyConnected(const int8_t *input, int inSize, const int8_t *weights, const int32_t *foldedBias,
+                        int outSize, const Int8Quantization &quant, int8_t *output)
+{
+    int8Pointwise(input, 1, inSize, weights, foldedBias, outSize, quant, output);
+}
+
+void int8AveragePool(const int8_t *input, int inH, int inW, int channels, int8_t *output)
+{
+    const int32_t count = inH * inW;
+    for (int c = 0; c < channels; c++) {
+        int32_t sum = 0;
+        for (int i = 0; i < count; i++) {
+            sum += input[i * channels + c];
+        }
+        // round half away from zero, like the TFLite reference
+        const int32_t avg = sum > 0 ? (sum + count / 2) / count : (sum - count / 2) / count;
+        output[c] = (int8_t)(avg < -128 ? -128 : (avg > 127 ? 127 : avg));
+    }
+}
+
+void int8Softmax(const int8_t *input, int size, float scale, uint8_t *probabilities)
+{
+    size = size > INT8_SOFTMAX_MAX_SIZE ? INT8_SOFTMAX_MAX_SIZE : size;
+    int8_t largest = -128;
+    for (int i = 0; i < size; i++) {
+        largest = input[i] > largest ? input[i] : largest;
+    }
+    // the zero point cancels out against the largest logit
+    float exps[INT8_SOFTMAX_MAX_SIZE];
+    float sum = 0.0f;
+    for (int i = 0; i < size; i++) {
+        exps[i] = expf((input[i] - largest) * scale);
+        sum += exps[i];
+    }
+    for (int i = 0; i < size; i++) {
+        const int32_t p = (int32_t)lroundf(255.0f * exps[i] / sum);
+        probabilities[i] = (uint8_t)(p > 255 ? 255 : p);
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Quantized int8 kernels for small keyword spotting networks
+ *
+ * Activations are int8 in HWC order, weights are symmetric int8 and biases are int32. The
+ * requantization follows the TensorFlow Lite reference (per channel multiplier and shift,
+ * rounding doubling high multiply, rounding right shift), so results are bit exact with a
+ * model quantized by the TFLite converter.
+ *
+ * The inner loops are plain C written for the Xtensa LX6: 4 way unrolled int8 multiply
+ * accumulates into int32, with the input offset folded into the bias when the model is loaded.
+ * Only the padded border of a convolution needs a correction.
+ */
+
+/* Output quantization of a layer, multiplier and shift are per output channel */
+struct Int8Quantization {
+    const int32_t *multiplier;
+    const int8_t *shift;
+    int32_t outputZeroPoint;
+    int32_t activationMin;
+    int32_t activationMax;
+};
+
+/* TFLite MultiplyByQuantizedMultiplier, shift > 0 is a left shift */
+int32_t int8Requantize(int32_t acc, int32_t multiplier, int shift);
+
+/* sum(a[i] * b[i]) for i < n */
+int32_t int8Dot(const int8_t *a, const int8_t *b, int n);
+
+/**
+ * @brief fold the input offset into the bias: bias[c] += inputOffset * sum(weights[c])
+ *
+ * For convolution, pointwise convolution and fully connected layers, inChannels is the size of one filter.
+ */
+void int8FoldInputOffset(int32_t *bias, const int8_t *weights, int outChannels, int inChannels, int32_t inputOffset);
+
+/**
+ * @brief 2D convolution, weights are [outC][kernelH][kernelW][inC], padded with the input zero point
+ *
+ * inputOffset is minus the input zero point, the bias must have it folded in. Output pixels whose
+ * filter reaches into the padding subtract the offset of the taps outside the input again.
+ */
+void int8Conv2d(const int8_t *input, int inH, int inW, int inC, int32_t inputOffset,
+                const int8_t *weights, const int32_t *foldedBias, int outC, int kernelH, int kernelW,
+                int strideH, int strideW, int padH, int padW, int outH, int outW,
+                const Int8Quantization &quant, int8_t *output);
+
+/**
+ * @brief depthwise 2D convolution with a depth multiplier of 1, weights are [kernelH][kernelW][C]
+ */
+void int8DepthwiseConv2d(const int8_t *input, int inH, int inW, int channels, int32_t inputOffset,
+                         const int8_t *weights, const int32_t *bias, int kernelH, int kernelW,
+                         int strideH, int strideW, int padH, int padW, int outH, int outW,
+                         const Int8Quantization &quant, int8_t *output);
+
+/**
+ * @brief 1x1 convolution, weights are [outC][inC], bias must have the input offset folded in
+ */
+void int8Pointwise(const int8_t *input, int pixels, int inC, const int8_t *weights, const int32_t *foldedBias,
+                   int outC, const Int8Quantization &quant, int8_t *output);
+
+/**
+ * @brief fully connected layer, weights are [outSize][inSize], bias must have the input offset folded in
+ */
+void int8FullyConnected(const int8_t *input, int inSize, const int8_t *weights, const int32_t *foldedBias,
+                        int outSize, const Int8Quantization &quant, int8_t *output);
+
+/* global average pooling over H and W, input and output share the quantization */
+void int8AveragePool(const int8_t *input, int inH, int inW, int channels, int8_t *output);
+
+#define INT8_SOFTMAX_MAX_SIZE 32
+
+/* softmax of dequantized logits, probabilities as 0..255, at most INT8_SOFTMAX_MAX_SIZE classes */
+void int8Softmax(const int8_t *input, int size, float scale, uint8_t *probabilities);
@@ -0,0 +1,289 @@
+#include "KeywordSpotter.h"
+#include <string.h>
+#include <math.h>
+
+// frames to ignore after a detection, so one utterance is reported once (~1 s)
+#define KWS_HOLD_OFF 100
+
+static size_t padded(size_t size)
+{
+    return (size + 3) & ~(size_t)3;
+}
+
+bool KeywordSpotter::fail(const char *reason)
+{
+    lastError = reason;
+    loaded = false;
+    return false;
+}
+
+uint8_t *KeywordSpotter::allocate(size_t size)
+{
+    size = padded(size);
+    if (used + size > arenaSize) {
+        return NULL;
+    }
+    uint8_t *block = &arena[used];
+    used += size;
+    return block;
+}
+
+bool KeywordSpotter::readExactly(size_t size, uint8_t *buffer)
+{
+    size_t done = 0;
+    while (done < size) {
+        const size_t bytes = reader(readerContext, &buffer[done], size - done);
+        if (bytes == 0) {
+            return false;
+        }
+        done += bytes;
+    }
+    return true;
+}
+
+bool KeywordSpotter::load(ReadFunction read, void *context, uint8_t *arena, size_t arenaSize)
+{
+    loaded = false;
+    reader = read;
+    readerContext = context;
+    this->arena = arena;
+    this->arenaSize = arenaSize;
+    used = 0;
+
+    if (!readExactly(sizeof(model), (uint8_t *)&model)) {
+        return fail("model file too short");
+    }
+    if (memcmp(model.magic, "KWS1", 4) != 0) {
+        return fail("not a KWS1 model");
+    }
+    if (model.layerCount == 0 || model.layerCount > MAX_LAYERS) {
+        return fail("too many layers");
+    }
+    if (model.inputFrames == 0 || model.inputFrames > MAX_FRAMES || model.inputFeatures == 0 ||
+        model.inputFeatures > MAX_FEATURES) {
+        return fail("input does not fit the MFCC window");
+    }
+    if (model.labelCount == 0 || model.labelCount > INT8_SOFTMAX_MAX_SIZE || model.wakeLabel >= model.labelCount) {
+        return fail("invalid labels");
+    }
+    if (!(model.inputScale > 1.0f / 256)) {
+        return fail("invalid input scale");
+    }
+    model.strideFrames = model.strideFrames == 0 ? 1 : model.strideFrames;
+    inputMultiplier = (int32_t)lroundf(65536.0f / (256.0f * model.inputScale));
+
+    int h = model.inputFrames;
+    int w = model.inputFeatures;
+    int c = 1;
+    int32_t zeroPoint = model.inputZeroPoint;
+    size_t largest = h * w * c;
+    for (int i = 0; i < model.layerCount; i++) {
+        Layer &layer = layers[i];
+        LayerHeader &lh = layer.header;
+        if (!readExactly(sizeof(LayerHeader), (uint8_t *)&lh)) {
+            return fail("model file too short");
+        }
+        layer.inH = h;
+        layer.inW = w;
+        layer.inC = c;
+        layer.inputOffset = -zeroPoint;
+        layer.weights = NULL;
+        layer.bias = NULL;
+
+        int outC = lh.outChannels;
+        size_t weightCount = 0;
+        switch (lh.type) {
+            case CONV:
+            case DEPTHWISE:
+                if (lh.kernelH == 0 || lh.kernelW == 0 || lh.strideH == 0 || lh.strideW == 0) {
+                    return fail("invalid kernel or stride");
+                }
+                if (lh.type == DEPTHWISE && outC != c) {
+                    return fail("depthwise layers need a depth multiplier of 1");
+                }
+                weightCount = lh.type == CONV ? (size_t)outC * lh.kernelH * lh.kernelW * c : (size_t)lh.kernelH * lh.kernelW * c;
+                layer.outH = (h + 2 * lh.padH - lh.kernelH) / lh.strideH + 1;
+                layer.outW = (w + 2 * lh.padW - lh.kernelW) / lh.strideW + 1;
+                break;
+            case POINTWISE:
+                weightCount = (size_t)outC * c;
+                layer.outH = h;
+                layer.outW = w;
+                break;
+            case FULLY_CONNECTED:
+                weightCount = (size_t)outC * h * w * c;
+                layer.outH = 1;
+                layer.outW = 1;
+                break;
+            case AVERAGE_POOL:
+                outC = c;
+                layer.outH = 1;
+                layer.outW = 1;
+                break;
+            case SOFTMAX:
+                if (i != model.layerCount - 1 || h * w * c != model.labelCount) {
+                    return fail("softmax must be the last layer with one output per label");
+                }
+                outC = c;
+                layer.outH = h;
+                layer.outW = w;
+                break;
+            default:
+                return fail("unknown layer type");
+        }
+        if (outC == 0 || layer.outH <= 0 || layer.outW <= 0) {
+            return fail("invalid layer shape");
+        }
+        if (i == model.layerCount - 1 && lh.type != SOFTMAX) {
+            return fail("the last layer must be a softmax");
+        }
+
+        if (weightCount > 0) {
+            int8_t *weights = (int8_t *)allocate(weightCount);
+            int32_t *bias = (int32_t *)allocate(outC * sizeof(int32_t));
+            int32_t *multiplier = (int32_t *)allocate(outC * sizeof(int32_t));
+            int8_t *shift = (int8_t *)allocate(outC);
+            if (!weights || !bias || !multiplier || !shift) {
+                return fail("model does not fit the arena");
+            }
+            if (!readExactly(padded(weightCount), (uint8_t *)weights) ||
+                !readExactly(outC * sizeof(int32_t), (uint8_t *)bias) ||
+                !readExactly(outC * sizeof(int32_t), (uint8_t *)multiplier) ||
+                !readExactly(padded(outC), (uint8_t *)shift)) {
+                return fail("model file too short");
+            }
+            // depthwise filters are interleaved by channel, the input offset stays in its inner loop
+            if (lh.type != DEPTHWISE) {
+                int8FoldInputOffset(bias, weights, outC, (int)(weightCount / outC), layer.inputOffset);
+            }
+            layer.weights = weights;
+            layer.bias = bias;
+            layer.quant.multiplier = multiplier;
+            layer.quant.shift = shift;
+            layer.quant.outputZeroPoint = lh.outputZeroPoint;
+            layer.quant.activationMin = lh.activationMin;
+            layer.quant.activationMax = lh.activationMax;
+            zeroPoint = lh.outputZeroPoint;
+        }
+
+        h = layer.outH;
+        w = layer.outW;
+        c = outC;
+        largest = (size_t)(h * w * c) > largest ? (size_t)(h * w * c) : largest;
+    }
+
+    activations[0] = (int8_t *)allocate(largest);
+    activations[1] = (int8_t *)allocate(largest);
+    if (!activations[0] || !activations[1]) {
+        return fail("model does not fit the arena");
+    }
+    lastError = "";
+    loaded = true;
+    inferences = 0;
+    reset();
+    return true;
+}
+
+const uint8_t *KeywordSpotter::invoke(const int8_t *input)
+{
+    if (!loaded) {
+        return NULL;
+    }
+    const int8_t *in = input;
+    for (int i = 0; i < model.layerCount; i++) {
+        const Layer &layer = layers[i];
+        const LayerHeader &lh = layer.header;
+        int8_t *out = in == activations[0] ? activations[1] : activations[0];
+        switch (lh.type) {
+            case CONV:
+                int8Conv2d(in, layer.inH, layer.inW, layer.inC, layer.inputOffset, layer.weights, layer.bias,
+                           lh.outChannels, lh.kernelH, lh.kernelW, lh.strideH, lh.strideW, lh.padH, lh.padW,
+                           layer.outH, layer.outW, layer.quant, out);
+                break;
+            case DEPTHWISE:
+                int8DepthwiseConv2d(in, layer.inH, layer.inW, layer.inC, layer.inputOffset, layer.weights, layer.bias,
+                                    lh.kernelH, lh.kernelW, lh.strideH, lh.strideW, lh.padH, lh.padW,
+                                    layer.outH, layer.outW, layer.quant, out);
+                break;
+            case POINTWISE:
+                int8Pointwise(in, layer.inH * layer.inW, layer.inC, layer.weights, layer.bias, lh.outChannels,
+                              layer.quant, out);
+                break;
+            case FULLY_CONNECTED:
+                int8FullyConnected(in, layer.inH * layer.inW * layer.inC, layer.weights, layer.bias, lh.outChannels,
+                                   layer.quant, out);
+                break;
+            case AVERAGE_POOL:
+                int8AveragePool(in, layer.inH, layer.inW, layer.inC, out);
+                break;
+            case SOFTMAX:
+                int8Softmax(in, model.labelCount, i > 0 ? layers[i - 1].header.outputScale : model.inputScale,
+                            probabilities);
+                break;
+        }
+        in = out;
+    }
+    inferences++;
+    return probabilities;
+}
+
+void KeywordSpotter::reset()
+{
+    windowStart = 0;
+    framesSeen = 0;
+    sinceInference = 0;
+    holdOff = 0;
+    memset(history, 0, sizeof(history));
+}
+
+bool KeywordSpotter::processFrame(const int16_t *coeffs)
+{
+    if (!loaded) {
+        return false;
+    }
+
+    int8_t *row = window[windowStart];
+    for (int f = 0; f < model.inputFeatures; f++) {
+        int32_t q = (int32_t)(((int64_t)coeffs[f] * inputMultiplier + (1 << 15)) >> 16) + model.inputZeroPoint;
+        row[f] = (int8_t)(q < -128 ? -128 : (q > 127 ? 127 : q));
+    }
+    windowStart = (windowStart + 1) % model.inputFrames;
+    framesSeen = framesSeen < model.inputFrames ? framesSeen + 1 : framesSeen;
+    if (holdOff > 0) {
+        holdOff--;
+    }
+    if (framesSeen < model.inputFrames || ++sinceInference < model.strideFrames) {
+        return false;
+    }
+    sinceInference = 0;
+
+    // oldest frame first
+    int8_t *input = activations[0];
+    for (int i = 0; i < model.inputFrames; i++) {
+        memcpy(&input[i * model.inputFeatures], window[(windowStart + i) % model.inputFrames], model.inputFeatures);
+    }
+    const uint8_t *p = invoke(input);
+
+    int32_t sum = p[model.wakeLabel];
+    for (int i = SMOOTHING - 1; i > 0; i--) {
+        history[i] = history[i - 1];
+        sum += history[i];
+    }
+    history[0] = p[model.wakeLabel];
+    const uint8_t smoothed = (uint8_t)(sum / SMOOTHING);
+    bestProbability = smoothed > bestProbability ? smoothed : bestProbability;
+
+    if (holdOff == 0 && smoothed >= threshold) {
+        holdOff = KWS_HOLD_OFF;
+        memset(history, 0, sizeof(history));
+        return true;
+    }
+    return false;
+}
+
+uint8_t KeywordSpotter::takeBestProbability()
+{
+    const uint8_t best = bestProbability;
+    bestProbability = 0;
+    return best;
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <MfccFrontEnd.h>
+#include "Int8Kernels.h"
+
+/**
+ * @brief Int8 keyword spotting network (DS-CNN style) on top of the MFCC front end
+ *
+ * The network is read from a model file into an arena supplied by the caller, nothing is allocated here.
+ * MFCC frames are collected in a sliding window of inputFrames frames and the network runs
+ * every strideFrames frames. The wake word probability is averaged over the last inferences,
+ * an average at or above the threshold is a detection.
+ *
+ * Model file, little endian, each record padded to a multiple of 4 bytes:
+ *   ModelHeader
+ *   per layer: LayerHeader, int8 weights, int32 bias[outChannels], int32 multiplier[outChannels],
+ *              int8 shift[outChannels]. Average pool and softmax only have the LayerHeader.
+ * Weight layouts: conv [outC][kH][kW][inC], depthwise [kH][kW][C], pointwise [outC][inC],
+ * fully connected [outC][H * W * C]. The input is inputFrames x inputFeatures x 1, the features
+ * are c0.. of the MFCC front end in log2 units. The last layer must be a softmax.
+ * padH and padW pad both sides alike, the output is (in + 2 * pad - kernel) / stride + 1.
+ * kws_convert.py writes this file from a .tflite model.
+ */
+class KeywordSpotter
+{
+public:
+    enum LayerType {
+        CONV = 1,
+        DEPTHWISE = 2,
+        POINTWISE = 3,
+        FULLY_CONNECTED = 4,
+        AVERAGE_POOL = 5,
+        SOFTMAX = 6
+    };
+
+    struct ModelHeader {
+        char magic[4];          // "KWS1"
+        uint16_t layerCount;
+        uint8_t inputFrames;
+        uint8_t inputFeatures;
+        float inputScale;       // real value = (q - inputZeroPoint) * inputScale
+        int8_t inputZeroPoint;
+        uint8_t labelCount;
+        uint8_t wakeLabel;      // index of the wake word in the softmax output
+        uint8_t strideFrames;   // run the network every this many 10 ms frames
+    };
+
+    struct LayerHeader {
+        uint8_t type;
+        uint8_t kernelH;
+        uint8_t kernelW;
+        uint8_t strideH;
+        uint8_t strideW;
+        uint8_t padH;
+        uint8_t padW;
+        int8_t outputZeroPoint;
+        int8_t activationMin;
+        int8_t activationMax;
+        uint16_t outChannels;
+        float outputScale;
+    };
+
+    static const int MAX_LAYERS = 16;
+    static const int MAX_FRAMES = 64;
+    static const int MAX_FEATURES = MfccFrontEnd::NUM_COEFFS;
+    static const int SMOOTHING = 3;
+
+    /* reads up to size bytes into buffer, returns the number of bytes read */
+    typedef size_t (*ReadFunction)(void *context, uint8_t *buffer, size_t size);
+
+    /**
+     * @brief load a model into the arena
+     *
+     * @return false if the model is malformed or does not fit, see error()
+     */
+    bool load(ReadFunction read, void *context, uint8_t *arena, size_t arenaSize);
+
+    void unload() { loaded = false; }
+    bool isLoaded() { return loaded; }
+    const char *error() { return lastError; }
+    size_t arenaUsed() { return used; }
+
+    /**
+     * @brief add one MFCC frame, runs the network when a stride is complete
+     *
+     * @return true on a detection
+     */
+    bool processFrame(const int16_t *coeffs);
+
+    /* run the network on a quantized input of inputFrames x inputFeatures, returns the probabilities or NULL without a model */
+    const uint8_t *invoke(const int8_t *input);
+
+    void reset();
+    void setThreshold(int threshold) { this->threshold = threshold; }
+
+    /* number of inferences since the model was loaded */
+    uint32_t inferenceCount() { return inferences; }
+
+    /* highest smoothed wake word probability (0..255) since the last call */
+    uint8_t takeBestProbability();
+
+private:
+    struct Layer {
+        LayerHeader header;
+        int inH, inW, inC;
+        int outH, outW;
+        int32_t inputOffset;
+        const int8_t *weights;
+        int32_t *bias;
+        Int8Quantization quant;
+    };
+
+    uint8_t *allocate(size_t size);
+    bool readExactly(size_t size, uint8_t *buffer);
+    bool fail(const char *reason);
+
+    ReadFunction reader = 0;
+    void *readerContext = 0;
+    uint8_t *arena = 0;
+    size_t arenaSize = 0;
+    size_t used = 0;
+    const char *lastError = "no model";
+    bool loaded = false;
+    uint32_t inferences = 0;
+
+    ModelHeader model;
+    Layer layers[MAX_LAYERS];
+    int8_t *activations[2];
+    int32_t inputMultiplier = 0; // Q8 MFCC to quantized input, Q16
+
+    int8_t window[MAX_FRAMES][MAX_FEATURES];
+    int windowStart = 0;
+    int framesSeen = 0;
+    int sinceInference = 0;
+    int holdOff = 0;
+    uint8_t history[SMOOTHING];
+    uint8_t probabilities[INT8_SOFTMAX_MAX_SIZE];
+    int threshold = 200;
+    uint8_t bestProbability = 0;
+};
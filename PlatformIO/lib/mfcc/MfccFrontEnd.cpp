@@ -0,0 +1,130 @@
+#include "MfccFrontEnd.h"
+#include <string.h>
+#include <math.h>
+
+// headroom shift applied before the FFT, keeps precision for quiet signals
+#define MFCC_SHIFT 6
+// pre-emphasis coefficient 0.97, Q15
+#define MFCC_PREEMPHASIS 31785
+#define MFCC_LOW_HZ 20.0f
+#define MFCC_HIGH_HZ 7600.0f
+
+static float hzToMel(float hz)
+{
+    return 2595.0f * log10f(1.0f + hz / 700.0f);
+}
+
+// log2 in Q8, mantissa approximated by f + 0.346 * f * (1 - f)
+static int32_t log2Q8(uint64_t x)
+{
+    if (x == 0) {
+        return 0;
+    }
+    const int msb = 63 - __builtin_clzll(x);
+    const uint32_t frac = (uint32_t)((msb >= 8 ? x >> (msb - 8) : x << (8 - msb)) & 0xff);
+    return msb * 256 + (int32_t)(frac + ((frac * (256 - frac) * 89) >> 16));
+}
+
+MfccFrontEnd::MfccFrontEnd()
+{
+    for (int n = 0; n < FRAME_SIZE; n++) {
+        window[n] = (int16_t)lroundf(32767.0f * (0.54f - 0.46f * cosf(2.0f * (float)M_PI * n / (FRAME_SIZE - 1))));
+    }
+
+    for (int i = 0; i < NUM_COEFFS; i++) {
+        const float scale = sqrtf((i == 0 ? 1.0f : 2.0f) / NUM_FILTERS);
+        for (int j = 0; j < NUM_FILTERS; j++) {
+            dct[i][j] = (int16_t)lroundf(32767.0f * scale * cosf((float)M_PI * i * (j + 0.5f) / NUM_FILTERS));
+        }
+    }
+
+    // filter centers equally spaced on the mel scale, every bin between two centers
+    // belongs to the lower filter with weight 1 - w and to the upper one with weight w
+    float centers[NUM_FILTERS + 2];
+    const float lowMel = hzToMel(MFCC_LOW_HZ);
+    const float highMel = hzToMel(MFCC_HIGH_HZ);
+    for (int m = 0; m < NUM_FILTERS + 2; m++) {
+        const float mel = lowMel + (highMel - lowMel) * m / (NUM_FILTERS + 1);
+        centers[m] = 700.0f * (powf(10.0f, mel / 2595.0f) - 1.0f) * FFT_SIZE / SAMPLE_RATE;
+    }
+    for (int k = 0; k < BINS; k++) {
+        filterIndex[k] = 0xff;
+        filterWeight[k] = 0;
+        for (int m = 0; m < NUM_FILTERS + 1; m++) {
+            if (k >= centers[m] && k < centers[m + 1]) {
+                filterIndex[k] = (uint8_t)m;
+                filterWeight[k] = (int16_t)lroundf(32767.0f * (k - centers[m]) / (centers[m + 1] - centers[m]));
+                break;
+            }
+        }
+    }
+    reset();
+}
+
+void MfccFrontEnd::reset()
+{
+    memset(history, 0, sizeof(history));
+    memset(coeffs, 0, sizeof(coeffs));
+    lastSample = 0;
+    position = 0;
+    ready = false;
+}
+
+size_t MfccFrontEnd::feed(const int16_t *samples, size_t count)
+{
+    ready = false;
+    size_t i = 0;
+    while (i < count) {
+        const int32_t s = samples[i++];
+        const int32_t y = s - ((lastSample * MFCC_PREEMPHASIS) >> 15);
+        lastSample = (int16_t)s;
+        history[FRAME_SIZE - HOP_SIZE + position] = (int16_t)(y > 32767 ? 32767 : (y < -32768 ? -32768 : y));
+        if (++position == HOP_SIZE) {
+            computeFrame();
+            memmove(history, &history[HOP_SIZE], (FRAME_SIZE - HOP_SIZE) * sizeof(int16_t));
+            position = 0;
+            ready = true;
+            break;
+        }
+    }
+    return i;
+}
+
+void MfccFrontEnd::computeFrame()
+{
+    for (int n = 0; n < FRAME_SIZE; n++) {
+        re[n] = ((int32_t)history[n] * window[n]) >> (15 - MFCC_SHIFT);
+        im[n] = 0;
+    }
+    for (int n = FRAME_SIZE; n < FFT_SIZE; n++) {
+        re[n] = 0;
+        im[n] = 0;
+    }
+    fft.forward(re, im);
+
+    uint64_t energies[NUM_FILTERS + 2];
+    memset(energies, 0, sizeof(energies));
+    for (int k = 0; k < BINS; k++) {
+        const uint8_t m = filterIndex[k];
+        if (m == 0xff) {
+            continue;
+        }
+        const uint64_t p = (uint64_t)((int64_t)re[k] * re[k] + (int64_t)im[k] * im[k]);
+        const uint64_t upper = (p * (uint32_t)filterWeight[k]) >> 15;
+        energies[m] += p - upper;
+        energies[m + 1] += upper;
+    }
+
+    // energies[m] collects the filter centered at centers[m], the outer two are only half filters
+    int32_t logEnergies[NUM_FILTERS];
+    for (int j = 0; j < NUM_FILTERS; j++) {
+        logEnergies[j] = log2Q8(energies[j + 1] + 1);
+    }
+    for (int i = 0; i < NUM_COEFFS; i++) {
+        int32_t acc = 0;
+        for (int j = 0; j < NUM_FILTERS; j++) {
+            acc += (logEnergies[j] * dct[i][j]) >> 15;
+        }
+        coeffs[i] = (int16_t)(acc > 32767 ? 32767 : (acc < -32768 ? -32768 : acc));
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <FixedFFT.h>
+
+/**
+ * @brief Fixed point MFCC front end for 16 kHz, 16 bit mono audio
+ *
+ * 25 ms frames (400 samples) every 10 ms (160 samples), pre-emphasis, Hamming window,
+ * 512 point FFT, 26 triangular mel filters between 20 Hz and 7600 Hz, log2 of the filter
+ * energies and a DCT-II to 13 cepstral coefficients.
+ *
+ * Coefficients are in Q8 log2 units. c0 holds the frame energy and is the only coefficient
+ * affected by the input gain, c1..c12 are gain independent.
+ *
+ * Samples are fed with feed(), which stops as soon as a frame is complete, so the caller
+ * can pick up the coefficients before feeding the remaining samples.
+ */
+class MfccFrontEnd
+{
+public:
+    static const int SAMPLE_RATE = 16000;
+    static const int FRAME_SIZE = 400;
+    static const int HOP_SIZE = 160;
+    static const int FFT_SIZE = 512;
+    static const int BINS = FFT_SIZE / 2 + 1;
+    static const int NUM_FILTERS = 26;
+    static const int NUM_COEFFS = 13;
+
+    MfccFrontEnd();
+
+    /**
+     * @brief feed samples into the front end
+     *
+     * @return number of samples consumed, less than count if a frame was completed
+     */
+    size_t feed(const int16_t *samples, size_t count);
+
+    /* true if a frame was completed by the last call to feed() */
+    bool frameReady() { return ready; }
+
+    /* cepstral coefficients of the last completed frame, Q8 */
+    const int16_t *coefficients() { return coeffs; }
+
+    void reset();
+
+private:
+    void computeFrame();
+
+    FixedFFT<FFT_SIZE> fft;
+    int16_t window[FRAME_SIZE];           // Hamming, Q15
+    int16_t dct[NUM_COEFFS][NUM_FILTERS]; // orthonormal DCT-II, Q15
+    uint8_t filterIndex[BINS];            // lower mel filter of a bin, 0xff if none
+    int16_t filterWeight[BINS];           // weight of the upper filter for a bin, Q15
+    int16_t history[FRAME_SIZE];
+    int16_t lastSample = 0;
+    size_t position = 0;
+    bool ready = false;
+    int32_t re[FFT_SIZE];
+    int32_t im[FFT_SIZE];
+    int16_t coeffs[NUM_COEFFS];
+};
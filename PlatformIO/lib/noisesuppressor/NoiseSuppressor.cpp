@@ -0,0 +1,104 @@
+#include "NoiseSuppressor.h"
+#include <string.h>
+#include <math.h>
+
+// headroom shift applied before the FFT, keeps precision for quiet signals
+#define NS_SHIFT 6
+// number of hops used to get an initial noise estimate (~128 ms at 16 kHz)
+#define NS_INIT_HOPS 16
+
+NoiseSuppressor::NoiseSuppressor()
+{
+    // sqrt of a periodic Hann window, analysis * synthesis sums to 1 at 50% overlap
+    for (int n = 0; n < FFT_SIZE; n++) {
+        window[n] = (int16_t)lroundf(32767.0f * sinf((float)M_PI * n / FFT_SIZE));
+    }
+    reset();
+}
+
+void NoiseSuppressor::configure(int maxAttenuationDb)
+{
+    minGain = (int16_t)(32767.0f * powf(10.0f, -maxAttenuationDb / 20.0f));
+    reset();
+}
+
+void NoiseSuppressor::reset()
+{
+    memset(history, 0, sizeof(history));
+    memset(output, 0, sizeof(output));
+    memset(overlap, 0, sizeof(overlap));
+    memset(power, 0, sizeof(power));
+    memset(noise, 0, sizeof(noise));
+    for (int k = 0; k < BINS; k++) {
+        gain[k] = 32767;
+    }
+    position = 0;
+    hops = 0;
+}
+
+void NoiseSuppressor::process(int16_t *samples, size_t count)
+{
+    if (!enabled) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        history[HOP_SIZE + position] = samples[i];
+        samples[i] = output[position];
+        if (++position == HOP_SIZE) {
+            processHop();
+            memmove(history, &history[HOP_SIZE], HOP_SIZE * sizeof(int16_t));
+            position = 0;
+        }
+    }
+}
+
+void NoiseSuppressor::processHop()
+{
+    for (int n = 0; n < FFT_SIZE; n++) {
+        re[n] = ((int32_t)history[n] * window[n]) >> (15 - NS_SHIFT);
+        im[n] = 0;
+    }
+    fft.forward(re, im);
+
+    for (int k = 0; k < BINS; k++) {
+        const int64_t p = (int64_t)re[k] * re[k] + (int64_t)im[k] * im[k];
+        power[k] += (p - power[k]) >> 1;
+
+        // noise floor: running mean to start with, then fast down and slow up (~2 dB/s)
+        if (hops < NS_INIT_HOPS) {
+            noise[k] += (power[k] - noise[k]) / (int64_t)(hops + 1);
+        } else if (power[k] < noise[k]) {
+            noise[k] -= (noise[k] - power[k]) >> 3;
+        } else {
+            noise[k] += (noise[k] >> 8) + 1;
+            noise[k] = noise[k] > power[k] ? power[k] : noise[k];
+        }
+
+        // Wiener style gain with an over-subtraction factor of 2
+        int32_t g = minGain;
+        const int64_t signal = power[k] - 2 * noise[k];
+        if (signal > 0) {
+            g = (int32_t)((signal << 15) / power[k]);
+            g = g > 32767 ? 32767 : (g < minGain ? minGain : g);
+        }
+        // follow rising gain (speech onset) faster than falling gain
+        gain[k] = (int16_t)(g > gain[k] ? (gain[k] + g) >> 1 : (3 * gain[k] + g) >> 2);
+
+        re[k] = (int32_t)(((int64_t)re[k] * gain[k]) >> 15);
+        im[k] = (int32_t)(((int64_t)im[k] * gain[k]) >> 15);
+        if (k > 0 && k < FFT_SIZE / 2) {
+            re[FFT_SIZE - k] = (int32_t)(((int64_t)re[FFT_SIZE - k] * gain[k]) >> 15);
+            im[FFT_SIZE - k] = (int32_t)(((int64_t)im[FFT_SIZE - k] * gain[k]) >> 15);
+        }
+    }
+    hops++;
+
+    fft.inverse(re, im);
+
+    for (int n = 0; n < HOP_SIZE; n++) {
+        const int32_t head = (int32_t)(((int64_t)re[n] * window[n]) >> 15);
+        int32_t y = (head + overlap[n]) >> NS_SHIFT;
+        output[n] = (int16_t)(y > 32767 ? 32767 : (y < -32768 ? -32768 : y));
+        overlap[n] = (int32_t)(((int64_t)re[n + HOP_SIZE] * window[n + HOP_SIZE]) >> 15);
+    }
+}
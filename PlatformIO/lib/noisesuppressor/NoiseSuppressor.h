@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <FixedFFT.h>
+
+/**
+ * @brief Fixed point spectral noise suppression for 16 bit mono audio
+ *
+ * Weighted overlap-add with a 256 point FFT, a sqrt-Hann window and 50% overlap (128 sample
+ * hop, 8 ms at 16 kHz). Per bin, the noise floor follows the smoothed power down quickly and
+ * creeps up slowly, so it tracks stationary noise but not speech. The suppression gain is a
+ * Wiener style gain with over-subtraction, limited by the configured maximum attenuation and
+ * smoothed over time to avoid musical noise.
+ *
+ * Samples are processed in place with a delay of FFT_SIZE samples, any block size can be passed.
+ */
+class NoiseSuppressor
+{
+public:
+    static const int FFT_SIZE = 256;
+    static const int HOP_SIZE = FFT_SIZE / 2;
+    static const int BINS = FFT_SIZE / 2 + 1;
+
+    NoiseSuppressor();
+
+    /**
+     * @brief set the maximum attenuation applied to noise, resets the noise estimate
+     *
+     * @param maxAttenuationDb attenuation in dB, e.g. 15
+     */
+    void configure(int maxAttenuationDb);
+
+    /**
+     * @brief suppress noise in a block of samples, in place, output is delayed by FFT_SIZE samples
+     */
+    void process(int16_t *samples, size_t count);
+
+    void reset();
+    void setEnabled(bool enabled) { this->enabled = enabled; }
+    bool isEnabled() { return enabled; }
+
+private:
+    void processHop();
+
+    FixedFFT<FFT_SIZE> fft;
+    bool enabled = false;
+    int16_t minGain = 32767;
+
+    int16_t window[FFT_SIZE];    // sqrt-Hann, Q15
+    int16_t history[FFT_SIZE];   // last FFT_SIZE input samples
+    int16_t output[HOP_SIZE];    // processed hop, waiting to be handed out
+    int32_t overlap[HOP_SIZE];   // second half of the previous synthesis frame
+    int32_t re[FFT_SIZE];
+    int32_t im[FFT_SIZE];
+    int64_t power[BINS];         // smoothed power spectrum
+    int64_t noise[BINS];         // noise floor estimate
+    int16_t gain[BINS];          // smoothed suppression gain, Q15
+    size_t position = 0;
+    uint32_t hops = 0;
+};
@@ -0,0 +1,97 @@
+#include "RegisterShadow.h"
+
+void RegisterShadow::begin(WriteFunction write, ReadFunction read, void *context, bool burst)
+{
+    this->write = write;
+    this->read = read;
+    this->context = context;
+    this->burst = burst;
+    invalidate();
+}
+
+void RegisterShadow::invalidate()
+{
+    known = 0;
+    dirty = 0;
+}
+
+void RegisterShadow::set(uint8_t reg, uint8_t value)
+{
+    if (reg >= MAX_REGISTERS) {
+        return;
+    }
+    pending[reg] = value;
+    dirty |= 1ULL << reg;
+}
+
+bool RegisterShadow::get(uint8_t reg, uint8_t &value)
+{
+    if (reg >= MAX_REGISTERS) {
+        return false;
+    }
+    if (isSet(dirty, reg)) {
+        value = pending[reg];
+        return true;
+    }
+    if (!isSet(known, reg)) {
+        transactions++;
+        if (read == NULL || !read(context, reg, values[reg])) {
+            return false;
+        }
+        known |= 1ULL << reg;
+    }
+    value = values[reg];
+    return true;
+}
+
+bool RegisterShadow::update(uint8_t reg, uint8_t mask, uint8_t value)
+{
+    uint8_t current;
+    if (!get(reg, current)) {
+        return false;
+    }
+    set(reg, (current & ~mask) | (value & mask));
+    return true;
+}
+
+bool RegisterShadow::commit()
+{
+    bool res = true;
+    int reg = 0;
+    while (reg < MAX_REGISTERS) {
+        if (!isSet(dirty, reg)) {
+            reg++;
+            continue;
+        }
+        if (isSet(known, reg) && values[reg] == pending[reg]) {
+            skipped++;
+            dirty &= ~(1ULL << reg);
+            reg++;
+            continue;
+        }
+        // a run of changed registers, one transaction when the chip increments the address
+        int end = reg + 1;
+        while (burst && end < MAX_REGISTERS && isSet(dirty, end) &&
+               !(isSet(known, end) && values[end] == pending[end])) {
+            end++;
+        }
+        transactions++;
+        if (write != NULL && write(context, reg, &pending[reg], end - reg)) {
+            for (int r = reg; r < end; r++) {
+                values[r] = pending[r];
+                known |= 1ULL << r;
+            }
+        } else {
+            // the chip may hold anything now
+            for (int r = reg; r < end; r++) {
+                known &= ~(1ULL << r);
+            }
+            res = false;
+        }
+        for (int r = reg; r < end; r++) {
+            dirty &= ~(1ULL << r);
+        }
+        reg = end;
+    }
+    return res;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Shadow of the 8 bit registers of a codec that is configured over I2C
+ *
+ * Writes are staged with set() and sent with commit(). A register that already holds the value
+ * is not written again, registers that follow each other are sent in one transaction when the
+ * chip increments the register address after every byte. Reads are answered from the shadow,
+ * so read-modify-write needs no bus transaction once a register has been read or written.
+ *
+ * Registers that must be written in a certain order go in separate commits, one commit writes in
+ * register order.
+ */
+class RegisterShadow
+{
+public:
+    static const int MAX_REGISTERS = 64;
+
+    /* write count values starting at register reg, true on success */
+    typedef bool (*WriteFunction)(void *context, uint8_t reg, const uint8_t *values, size_t count);
+    /* read one register, true on success */
+    typedef bool (*ReadFunction)(void *context, uint8_t reg, uint8_t &value);
+
+    void begin(WriteFunction write, ReadFunction read, void *context, bool burst);
+
+    /* stage a write, it is sent by the next commit */
+    void set(uint8_t reg, uint8_t value);
+
+    /* stage a change of the masked bits */
+    bool update(uint8_t reg, uint8_t mask, uint8_t value);
+
+    /* the value a register has, or will have after the next commit */
+    bool get(uint8_t reg, uint8_t &value);
+
+    /* send the staged registers that changed, true when all writes succeeded */
+    bool commit();
+
+    /* forget the shadow, e.g. after a reset of the chip */
+    void invalidate();
+
+    uint32_t transactions = 0;  // bus transactions, reads included
+    uint32_t skipped = 0;       // staged writes that were not sent because nothing changed
+
+private:
+    bool isSet(const uint64_t &bits, uint8_t reg) { return (bits >> reg) & 1; }
+
+    WriteFunction write = NULL;
+    ReadFunction read = NULL;
+    void *context = NULL;
+    bool burst = false;
+    uint8_t values[MAX_REGISTERS] = {};
+    uint8_t pending[MAX_REGISTERS] = {};
+    uint64_t known = 0;         // values[] holds what the chip has
+    uint64_t dirty = 0;         // pending[] holds a value to write
+};
@@ -0,0 +1,110 @@
+#include "SoftVolume.h"
+#include <math.h>
+
+// the volume scale in dB below unity and the most boost above it
+#define SOFT_VOLUME_RANGE_DB 40
+#define SOFT_VOLUME_MAX_BOOST_DB 12
+// the limiter gain comes back up by 1/32 per chunk, about 0.27 dB
+#define SOFT_VOLUME_RELEASE_SHIFT 5
+
+void SoftVolume::configure(int channels, int sampleRate)
+{
+    this->channels = channels < 1 ? 1 : channels;
+    const int rampChunks = (sampleRate > 0 ? sampleRate : 16000) * RAMP_MS / 1000 / CHUNK;
+    rampStep = UNITY / (rampChunks < 1 ? 1 : rampChunks);
+    holdChunks = (sampleRate > 0 ? sampleRate : 16000) * HOLD_MS / 1000 / CHUNK;
+}
+
+void SoftVolume::setVolume(int volume, int boostDb)
+{
+    if (volume <= 0) {
+        target = 0;
+        return;
+    }
+    volume = volume > 100 ? 100 : volume;
+    boostDb = boostDb < 0 ? 0 : (boostDb > SOFT_VOLUME_MAX_BOOST_DB ? SOFT_VOLUME_MAX_BOOST_DB : boostDb);
+    if (volume == 100 && boostDb == 0) {
+        target = UNITY;
+        return;
+    }
+    const float db = (volume - 100) * SOFT_VOLUME_RANGE_DB / 100.0f + boostDb;
+    target = (int32_t)lroundf(UNITY * powf(10.0f, db / 20.0f));
+}
+
+void SoftVolume::process(int16_t *samples, size_t frames)
+{
+    const size_t segment = MAX_CHUNKS * CHUNK;
+    while (frames > 0 && !isUnity()) {
+        const int n = frames > segment ? (int)segment : (int)frames;
+        const int chunks = (n + CHUNK - 1) / CHUNK;
+        processChunks(samples, chunks, n - (chunks - 1) * CHUNK);
+        samples += n * channels;
+        frames -= n;
+    }
+}
+
+// limiter gain that keeps a peak below LIMIT at the given volume gain. Up to unity the samples
+// cannot overflow and are left alone, a loud stream is not limited by a ramp back to unity.
+static int32_t allowedGain(int32_t peak, int32_t volumeGain)
+{
+    if (volumeGain <= SoftVolume::UNITY) {
+        return SoftVolume::UNITY;
+    }
+    const int64_t level = (int64_t)peak * volumeGain;
+    const int64_t limit = (int64_t)SoftVolume::LIMIT * SoftVolume::UNITY;
+    if (level <= limit) {
+        return SoftVolume::UNITY;
+    }
+    return (int32_t)(limit * SoftVolume::UNITY / level);
+}
+
+void SoftVolume::processChunks(int16_t *samples, int chunks, int lastFrames)
+{
+    for (int k = 0; k < chunks; k++) {
+        const int count = (k == chunks - 1 ? lastFrames : CHUNK) * channels;
+        int32_t peak = 0;
+        for (int i = 0; i < count; i++) {
+            const int32_t x = samples[k * CHUNK * channels + i];
+            peak = (x < 0 ? -x : x) > peak ? (x < 0 ? -x : x) : peak;
+        }
+        peaks[k] = peak;
+    }
+
+    for (int k = 0; k < chunks; k++) {
+        const int frames = k == chunks - 1 ? lastFrames : CHUNK;
+        const int32_t g0 = gain;
+        int32_t g1 = target;
+        g1 = g1 > g0 + rampStep ? g0 + rampStep : (g1 < g0 - rampStep ? g0 - rampStep : g1);
+
+        // down before the peak of the next chunk, slowly back up after it
+        const int32_t l0 = limiterGain;
+        int32_t l1 = allowedGain(peaks[k], g0 > g1 ? g0 : g1);
+        if (k + 1 < chunks) {
+            const int32_t next = allowedGain(peaks[k + 1], g1);
+            l1 = next < l1 ? next : l1;
+        }
+        // a quiet chunk between two peaks does not release the gain, neither does the end of
+        // the block, the next block is not known yet
+        held = l1 < l0 ? 0 : held + 1;
+        const int32_t release = held > holdChunks && k + 1 < chunks ? l0 + (l0 >> SOFT_VOLUME_RELEASE_SHIFT) + 1 : l0;
+        l1 = l1 > release ? release : l1;
+        if (l1 < UNITY) {
+            limitedChunks++;
+        }
+
+        const int32_t start = (g0 * l0) >> 14;
+        const int32_t end = (g1 * l1) >> 14;
+        const int32_t step = (end - start) / frames;
+        int32_t g = start;
+        int16_t *x = &samples[k * CHUNK * channels];
+        for (int f = 0; f < frames; f++) {
+            for (int c = 0; c < channels; c++) {
+                const int32_t y = (*x * g) >> 14;
+                *x++ = (int16_t)(y > 32767 ? 32767 : (y < -32768 ? -32768 : y));
+            }
+            g += step;
+        }
+        gain = g1;
+        limiterGain = l1;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Fixed point playback volume with ramps and a look-ahead soft limiter
+ *
+ * For devices without a hardware volume. The volume in percent maps to a gain on a 40 dB scale,
+ * an optional boost raises it above unity. Gain changes ramp over RAMP_MS. Whenever a gain above
+ * unity would push a sample above LIMIT the limiter lowers it: the block is split in chunks of CHUNK
+ * frames, each chunk ramps to the gain the next chunk needs, so the gain is down before a peak
+ * arrives. After HOLD_MS without a louder peak it comes back up by about 0.27 dB per chunk.
+ * The look-ahead ends at the end of the block, a peak at the start of the next block is clipped.
+ *
+ * At unity gain the samples are not touched. Gains are Q14, processing is in place.
+ */
+class SoftVolume
+{
+public:
+    static const int CHUNK = 32;            // frames
+    static const int MAX_CHUNKS = 32;
+    static const int RAMP_MS = 20;
+    static const int HOLD_MS = 20;
+    static const int32_t UNITY = 1 << 14;
+    static const int32_t LIMIT = 29204;     // -1 dBFS
+
+    void configure(int channels, int sampleRate);
+
+    /**
+     * @brief set the target gain, ramps to it during the next blocks
+     *
+     * @param volume 0 to 100, 0 mutes, 100 is unity
+     * @param boostDb gain added on top of the volume, 0 to 12 dB
+     */
+    void setVolume(int volume, int boostDb);
+
+    /* apply the gain to interleaved samples, in place */
+    void process(int16_t *samples, size_t frames);
+
+    bool isUnity() { return target == UNITY && gain == UNITY && limiterGain == UNITY; }
+
+    /* chunks in which the limiter reduced the gain */
+    uint32_t limitedChunks = 0;
+
+private:
+    void processChunks(int16_t *samples, int chunks, int lastFrames);
+
+    int channels = 1;
+    int32_t rampStep = UNITY;         // most the volume gain changes in a chunk
+    volatile int32_t target = UNITY;
+    int32_t gain = UNITY;             // volume gain at the end of the last chunk
+    int32_t limiterGain = UNITY;
+    int holdChunks = 10;
+    int held = 0;                     // chunks the limiter could have released
+    int32_t peaks[MAX_CHUNKS];
+};
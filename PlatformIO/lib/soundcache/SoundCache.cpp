@@ -0,0 +1,102 @@
+#include "SoundCache.h"
+
+#define FNV_PRIME 16777619u
+
+uint32_t SoundCache::hash(const uint8_t *data, size_t size, uint32_t seed)
+{
+    uint32_t h = seed;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ data[i]) * FNV_PRIME;
+    }
+    return h;
+}
+
+int SoundCache::lookup(uint32_t prefix, uint32_t size)
+{
+    lookups++;
+    for (int slot = 0; slot < MAX_ENTRIES; slot++) {
+        if (entries[slot].used && entries[slot].prefix == prefix && entries[slot].size == size) {
+            entries[slot].hits++;
+            hits++;
+            return slot;
+        }
+    }
+    return -1;
+}
+
+int SoundCache::find(uint32_t hash)
+{
+    for (int slot = 0; slot < MAX_ENTRIES; slot++) {
+        if (entries[slot].used && entries[slot].hash == hash) {
+            entries[slot].hits++;
+            return slot;
+        }
+    }
+    return -1;
+}
+
+bool SoundCache::admit(uint32_t prefix, uint32_t size)
+{
+    // the size is part of the key, the same beep at another rate is another sound
+    // 0 marks an empty place in seen
+    const uint32_t key = (prefix ^ (size * FNV_PRIME)) | 1;
+    for (int i = 0; i < SEEN_SIZE; i++) {
+        if (seen[i] == key) {
+            seen[i] = 0;
+            return true;
+        }
+    }
+    seen[seenPosition] = key;
+    seenPosition = (seenPosition + 1) % SEEN_SIZE;
+    return false;
+}
+
+int SoundCache::insert(uint32_t prefix, uint32_t hash, uint32_t size, uint32_t *evicted)
+{
+    int slot = 0;
+    for (int i = 0; i < MAX_ENTRIES; i++) {
+        if (!entries[i].used) {
+            slot = i;
+            break;
+        }
+        slot = entries[i].hits < entries[slot].hits ? i : slot;
+    }
+    *evicted = entries[slot].used ? entries[slot].hash : 0;
+    if (*evicted != 0) {
+        // age the counts, a sound that was popular long ago gives way eventually
+        for (int i = 0; i < MAX_ENTRIES; i++) {
+            entries[i].hits /= 2;
+        }
+    }
+    entries[slot].prefix = prefix;
+    entries[slot].hash = hash;
+    entries[slot].size = size;
+    entries[slot].hits = 0;
+    entries[slot].used = 1;
+    return slot;
+}
+
+void SoundCache::remove(int slot)
+{
+    entries[slot].used = 0;
+}
+
+int SoundCache::victim()
+{
+    int slot = -1;
+    for (int i = 0; i < MAX_ENTRIES; i++) {
+        if (entries[i].used && (slot < 0 || entries[i].hits < entries[slot].hits)) {
+            slot = i;
+        }
+    }
+    return slot;
+}
+
+int SoundCache::count()
+{
+    int n = 0;
+    for (int slot = 0; slot < MAX_ENTRIES; slot++) {
+        n += entries[slot].used;
+    }
+    return n;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Index of a content addressed cache for short sounds that are played again and again
+ *
+ * A payload is identified by the FNV-1a hash of its first PREFIX_BYTES and its size, so a
+ * cached sound can start to play as soon as the first chunk of a message has arrived. The hash
+ * of the whole payload names the stored copy and is checked once the message is complete.
+ * Sounds are only admitted when they are seen for the second time, so one-off TTS answers do not
+ * wear out the flash. When the cache is full the entry with the fewest hits is replaced and the
+ * hit counts of the others are halved.
+ *
+ * Only the index lives here, storing the payloads is up to the caller.
+ */
+class SoundCache
+{
+public:
+    static const int MAX_ENTRIES = 8;
+    static const int SEEN_SIZE = 8;
+    static const size_t PREFIX_BYTES = 512;
+    static const uint32_t HASH_SEED = 2166136261u;
+
+    struct Entry {
+        uint32_t prefix;    // hash of the first PREFIX_BYTES
+        uint32_t hash;      // hash of the whole payload
+        uint32_t size;      // payload size in bytes
+        uint32_t hits;
+        uint8_t used;
+    };
+
+    /* FNV-1a, pass the previous result as seed to continue over the next chunk */
+    static uint32_t hash(const uint8_t *data, size_t size, uint32_t seed = HASH_SEED);
+
+    /**
+     * @brief find a payload by its prefix, counts as a lookup
+     *
+     * @return the slot of the entry, -1 when it is not cached
+     */
+    int lookup(uint32_t prefix, uint32_t size);
+
+    /* find a payload by the hash of its content, e.g. for a hint, -1 when it is not cached */
+    int find(uint32_t hash);
+
+    /* whether a payload that missed should be stored, true when it was seen before */
+    bool admit(uint32_t prefix, uint32_t size);
+
+    /**
+     * @brief add a stored payload, replaces the entry with the fewest hits when full
+     *
+     * @param evicted set to the hash of the replaced entry, 0 if none was replaced
+     * @return the slot of the new entry
+     */
+    int insert(uint32_t prefix, uint32_t hash, uint32_t size, uint32_t *evicted);
+
+    void remove(int slot);
+
+    /* the slot that would be replaced first, -1 when the cache is empty */
+    int victim();
+
+    const Entry &entry(int slot) { return entries[slot]; }
+    int count();
+
+    /* the raw index, to persist it */
+    Entry *table() { return entries; }
+    size_t tableSize() { return sizeof(entries); }
+
+    uint32_t lookups = 0;
+    uint32_t hits = 0;
+
+private:
+    Entry entries[MAX_ENTRIES] = {};
+    uint32_t seen[SEEN_SIZE] = {};
+    int seenPosition = 0;
+};
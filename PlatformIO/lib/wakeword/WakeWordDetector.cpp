@@ -0,0 +1,175 @@
+#include "WakeWordDetector.h"
+#include <string.h>
+#include <math.h>
+
+// frames quieter than the loudest frame by more than this are trimmed from a recording
+#define WW_TRIM_DB 25
+// frames to ignore after a detection, so one utterance is reported once (~1 s)
+#define WW_HOLD_OFF 100
+#define WW_INFINITY 0x3fffffffu
+
+void WakeWordDetector::clearTemplates()
+{
+    numTemplates = 0;
+    pendingFrames = 0;
+    enrolling = false;
+    reset();
+}
+
+void WakeWordDetector::addTemplateSamples(const int16_t *samples, size_t count)
+{
+    if (!enrolling) {
+        mfcc.reset();
+        pendingFrames = 0;
+        enrolling = true;
+    }
+    while (count > 0) {
+        const size_t used = mfcc.feed(samples, count);
+        samples += used;
+        count -= used;
+        if (mfcc.frameReady() && pendingFrames < PENDING_FRAMES) {
+            memcpy(pending[pendingFrames++], mfcc.coefficients(), sizeof(pending[0]));
+        }
+    }
+}
+
+bool WakeWordDetector::finishTemplate()
+{
+    enrolling = false;
+    mfcc.reset();
+    if (numTemplates >= MAX_TEMPLATES || pendingFrames == 0) {
+        return false;
+    }
+
+    // c0 is sqrt(NUM_FILTERS) times the mean log2 filter energy, in Q8
+    int32_t loudest = INT16_MIN;
+    for (int i = 0; i < pendingFrames; i++) {
+        loudest = pending[i][0] > loudest ? pending[i][0] : loudest;
+    }
+    const int32_t floor = loudest - (int32_t)(256.0f * WW_TRIM_DB / 6.02f * sqrtf(MfccFrontEnd::NUM_FILTERS));
+    int first = 0;
+    int last = pendingFrames - 1;
+    while (first < last && pending[first][0] < floor) {
+        first++;
+    }
+    while (last > first && pending[last][0] < floor) {
+        last--;
+    }
+    const int frames = last - first + 1;
+    if (frames < MIN_FRAMES) {
+        return false;
+    }
+
+    Template &t = templates[numTemplates++];
+    t.length = (uint16_t)(frames > MAX_FRAMES ? MAX_FRAMES : frames);
+    for (int i = 0; i < t.length; i++) {
+        memcpy(t.frames[i], &pending[first + i][1], sizeof(t.frames[0]));
+    }
+    reset();
+    return true;
+}
+
+void WakeWordDetector::reset()
+{
+    mfcc.reset();
+    if (spotter) {
+        spotter->reset();
+    }
+    for (int t = 0; t < MAX_TEMPLATES; t++) {
+        for (int j = 0; j < MAX_FRAMES; j++) {
+            cost[t][j] = WW_INFINITY;
+            length[t][j] = 1;
+        }
+    }
+    holdOff = 0;
+}
+
+int32_t WakeWordDetector::takeBestScore()
+{
+    const int32_t score = bestScore;
+    bestScore = INT32_MAX;
+    return score;
+}
+
+bool WakeWordDetector::process(const int16_t *samples, size_t count)
+{
+    bool detected = false;
+    while (count > 0) {
+        const size_t used = mfcc.feed(samples, count);
+        samples += used;
+        count -= used;
+        if (mfcc.frameReady() && processFrame(mfcc.coefficients())) {
+            detected = true;
+        }
+    }
+    return detected;
+}
+
+bool WakeWordDetector::processFrame(const int16_t *coeffs)
+{
+    if (spotter && spotter->isLoaded()) {
+        return spotter->processFrame(coeffs);
+    }
+
+    const int16_t *features = coeffs + 1;
+    bool detected = false;
+    for (int t = 0; t < numTemplates; t++) {
+        const Template &tmpl = templates[t];
+        uint32_t *c = cost[t];
+        uint16_t *len = length[t];
+        // c[j - 1] of the previous column, overwritten before it is needed as diagonal
+        uint32_t diagonalCost = WW_INFINITY;
+        uint16_t diagonalLength = 1;
+        for (int j = 0; j < tmpl.length; j++) {
+            uint32_t d = 0;
+            for (int k = 0; k < FEATURES; k++) {
+                const int32_t diff = (int32_t)features[k] - tmpl.frames[j][k];
+                d += (uint32_t)(diff < 0 ? -diff : diff);
+            }
+
+            uint32_t best;
+            uint16_t bestLength;
+            if (j == 0) {
+                // subsequence DTW, a match may start at any input frame
+                best = 0;
+                bestLength = 0;
+            } else {
+                best = c[j];
+                bestLength = len[j];
+                if (diagonalCost <= best) {
+                    best = diagonalCost;
+                    bestLength = diagonalLength;
+                }
+                if (c[j - 1] < best) {
+                    best = c[j - 1];
+                    bestLength = len[j - 1];
+                }
+            }
+            diagonalCost = c[j];
+            diagonalLength = len[j];
+            c[j] = best + d < WW_INFINITY ? best + d : WW_INFINITY;
+            len[j] = bestLength < 0xffff ? bestLength + 1 : bestLength;
+        }
+
+        const int last = tmpl.length - 1;
+        if (c[last] < WW_INFINITY) {
+            const int32_t score = (int32_t)(c[last] / len[last]);
+            bestScore = score < bestScore ? score : bestScore;
+            if (holdOff == 0 && score <= threshold) {
+                detected = true;
+            }
+        }
+    }
+
+    if (holdOff > 0) {
+        holdOff--;
+    } else if (detected) {
+        holdOff = WW_HOLD_OFF;
+        for (int t = 0; t < numTemplates; t++) {
+            for (int j = 0; j < MAX_FRAMES; j++) {
+                cost[t][j] = WW_INFINITY;
+            }
+        }
+    }
+    return detected;
+}
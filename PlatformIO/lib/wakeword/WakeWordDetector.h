@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <MfccFrontEnd.h>
+#include <KeywordSpotter.h>
+
+/**
+ * @brief Template based wake word detector on top of the MFCC front end
+ *
+ * A few recordings of the wake word are turned into MFCC templates with the same front end
+ * that is used on the live audio, so there is no training step and no model to ship. Every
+ * 10 ms frame advances a subsequence DTW per template (the match may start at any frame),
+ * the length normalised cost of reaching the last template frame is the score. A score at or
+ * below the threshold is a detection. c0 is not used, so the score does not depend on gain.
+ *
+ * All memory is static, templates are limited to MAX_TEMPLATES of up to MAX_FRAMES frames.
+ *
+ * When a keyword spotting network with a loaded model is attached, the MFCC frames go to the
+ * network instead and the templates are not used.
+ */
+class WakeWordDetector
+{
+public:
+    static const int MAX_TEMPLATES = 4;
+    static const int MAX_FRAMES = 120;
+    static const int MIN_FRAMES = 20;
+    static const int PENDING_FRAMES = 200;
+    static const int FEATURES = MfccFrontEnd::NUM_COEFFS - 1;
+
+    /* start adding templates, removes the existing ones */
+    void clearTemplates();
+
+    /**
+     * @brief add a template from a recording of the wake word, 16 kHz mono
+     *
+     * Call repeatedly with consecutive blocks of the same recording, then finishTemplate().
+     */
+    void addTemplateSamples(const int16_t *samples, size_t count);
+
+    /**
+     * @brief trim leading and trailing silence of the recording and store the template
+     *
+     * @return false if the recording was too short or the template store is full
+     */
+    bool finishTemplate();
+
+    int templateCount() { return numTemplates; }
+
+    /* use a keyword spotting network instead of the templates while it has a model loaded */
+    void setKeywordSpotter(KeywordSpotter *spotter) { this->spotter = spotter; }
+
+    /* true if there are templates or a network to detect with */
+    bool isReady() { return numTemplates > 0 || (spotter && spotter->isLoaded()); }
+
+    /**
+     * @brief run detection on a block of live samples, 16 kHz mono
+     *
+     * @return true if the wake word ended somewhere in this block
+     */
+    bool process(const int16_t *samples, size_t count);
+
+    /* reset the live state, e.g. when detection is (re)started */
+    void reset();
+
+    /* detection threshold, average L1 distance per frame in Q8 log2 units */
+    void setThreshold(int threshold) { this->threshold = threshold; }
+
+    /* lowest score seen since the last call, useful to tune the threshold */
+    int32_t takeBestScore();
+
+private:
+    struct Template {
+        int16_t frames[MAX_FRAMES][FEATURES];
+        uint16_t length;
+    };
+
+    bool processFrame(const int16_t *coeffs);
+
+    MfccFrontEnd mfcc;
+    KeywordSpotter *spotter = 0;
+    Template templates[MAX_TEMPLATES];
+    int numTemplates = 0;
+
+    // recording being turned into a template, kept with c0 for silence trimming
+    int16_t pending[PENDING_FRAMES][MfccFrontEnd::NUM_COEFFS];
+    int pendingFrames = 0;
+    bool enrolling = false;
+
+    // DTW column per template: accumulated cost and path length
+    uint32_t cost[MAX_TEMPLATES][MAX_FRAMES];
+    uint16_t length[MAX_TEMPLATES][MAX_FRAMES];
+    int threshold = 1500;
+    int32_t bestScore = INT32_MAX;
+    uint16_t holdOff = 0;
+};
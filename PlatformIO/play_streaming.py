@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+# Sends a WAV file to the satellite in playBytesStreaming chunks and measures the time to
+# playFinished. The time to first sound measured on the device is taken from the next telemetry.
+#
+#   python3 play_streaming.py reply.wav [--chunk-ms 500] [--speed 1.0]
+#
+# The MQTT server and siteId are read from settings.ini, needs paho-mqtt
+import argparse
+import configparser
+import io
+import json
+import threading
+import time
+import uuid
+import wave
+
+import paho.mqtt.client as mqtt
+
+parser = argparse.ArgumentParser()
+parser.add_argument("wav")
+parser.add_argument("--settings", default="settings.ini")
+parser.add_argument("--chunk-ms", type=int, default=500, help="audio per chunk")
+parser.add_argument("--speed", type=float, default=1.0, help="send rate relative to real time, 0 sends at once")
+args = parser.parse_args()
+
+config = configparser.RawConfigParser()
+config.read(args.settings)
+siteId = config["General"]["siteId"]
+host = config["MQTT"]["hostname"] if "hostname" in config["MQTT"] else config["MQTT"]["ip"]
+
+requestId = str(uuid.uuid4())
+finished = threading.Event()
+telemetry = threading.Event()
+result = {}
+
+def on_message(client, userdata, msg):
+    if msg.topic.endswith("/playFinished"):
+        if json.loads(msg.payload).get("id") == requestId:
+            result["finished"] = time.monotonic()
+            finished.set()
+    elif finished.is_set():
+        playback = json.loads(msg.payload).get("playback")
+        if playback and playback.get("streams"):
+            result["playback"] = playback
+            telemetry.set()
+
+client = mqtt.Client()
+if config["MQTT"].get("username"):
+    client.username_pw_set(config["MQTT"]["username"], config["MQTT"]["password"])
+client.on_message = on_message
+client.connect(host, int(config["MQTT"]["port"]))
+client.subscribe("hermes/audioServer/" + siteId + "/playFinished")
+client.subscribe(siteId + "/telemetry")
+client.loop_start()
+
+with wave.open(args.wav, "rb") as source:
+    params = source.getparams()
+    framesPerChunk = max(1, params.framerate * args.chunk_ms // 1000)
+    chunks = []
+    while True:
+        frames = source.readframes(framesPerChunk)
+        if not frames:
+            break
+        chunks.append(frames)
+
+start = time.monotonic()
+for index, frames in enumerate(chunks):
+    # every chunk is a WAV of its own, as Rhasspy sends them
+    buffer = io.BytesIO()
+    with wave.open(buffer, "wb") as chunk:
+        chunk.setparams(params)
+        chunk.writeframes(frames)
+    last = 1 if index == len(chunks) - 1 else 0
+    topic = "hermes/audioServer/%s/playBytesStreaming/%s/%d/%d" % (siteId, requestId, index, last)
+    client.publish(topic, buffer.getvalue())
+    if args.speed > 0:
+        due = start + (index + 1) * args.chunk_ms / 1000.0 / args.speed
+        time.sleep(max(0.0, due - time.monotonic()))
+sent = time.monotonic() - start
+
+duration = sum(len(c) for c in chunks) / float(params.framerate * params.nchannels * params.sampwidth)
+if not finished.wait(duration + 30):
+    print("No playFinished received")
+else:
+    print("Audio %.2f s, sent %.2f s, playFinished after %.2f s"
+          % (duration, sent, result["finished"] - start))
+    if telemetry.wait(70):
+        playback = result["playback"]
+        print("Time to first sound %.1f ms (max %.1f ms)"
+              % (playback["avg_first_sound_us"] / 1000.0, playback["max_first_sound_us"] / 1000.0))
+    else:
+        print("No telemetry received")
+client.loop_stop()
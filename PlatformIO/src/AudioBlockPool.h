@@ -0,0 +1,98 @@
+#pragma once
+#include <Arduino.h>
+
+/**
+ * @brief A fixed pool of equally sized audio blocks in static memory
+ *
+ * All audio stages (I2S read/write, MQTT payloads, device conversions) borrow their
+ * scratch buffers from this pool instead of placing variable length arrays on the
+ * task stack. The pool is sized at compile time from the device read and write sizes,
+ * lives in internal DRAM and is word aligned, so blocks can be handed to the I2S DMA.
+ *
+ * The implementation is multi-core and multi-thread safe.
+ */
+template <
+    size_t BS,
+    size_t BC>
+
+class AudioBlockPool
+{
+    static_assert(BC > 0 && BC <= 32, "block count must be between 1 and 32");
+    static_assert((BS % 4) == 0, "block size must be a multiple of 4");
+
+    WORD_ALIGNED_ATTR uint8_t blocks[BC][BS];
+    uint32_t used = 0;
+    uint32_t lowWater = BC;
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+public:
+    /* Borrow a block, returns NULL if all blocks are in use */
+    uint8_t *acquire()
+    {
+        uint8_t *block = NULL;
+        portENTER_CRITICAL(&mux);
+        for (size_t i = 0; i < BC; i++)
+        {
+            if ((used & (1U << i)) == 0)
+            {
+                used |= (1U << i);
+                block = blocks[i];
+                break;
+            }
+        }
+        lowWater = std::min(lowWater, (uint32_t)available());
+        portEXIT_CRITICAL(&mux);
+        return block;
+    }
+
+    /* Return a block to the pool, NULL is ignored */
+    void release(uint8_t *block)
+    {
+        if (block == NULL)
+        {
+            return;
+        }
+        size_t i = (block - blocks[0]) / BS;
+        assert(i < BC && block == blocks[i]);
+        portENTER_CRITICAL(&mux);
+        used &= ~(1U << i);
+        portEXIT_CRITICAL(&mux);
+    }
+
+    /* return the number of free blocks */
+    size_t available() { return BC - __builtin_popcount(used); }
+
+    /* return the lowest number of free blocks seen since boot */
+    size_t minAvailable() { return lowWater; }
+
+    /* return the size of a single block in bytes */
+    static constexpr size_t blockSize() { return BS; }
+
+    /* return the number of blocks in the pool */
+    static constexpr size_t blockCount() { return BC; }
+
+    /* return the total memory used by the pool in bytes */
+    static constexpr size_t totalSize() { return BS * BC; }
+};
+
+// The pool instance is created in General.hpp, once the device sizes are known
+uint8_t *acquireAudioBlock();
+void releaseAudioBlock(uint8_t *block);
+
+/**
+ * @brief Scoped loan of a block from the audio block pool, the block is returned when
+ * the AudioBlock goes out of scope
+ */
+class AudioBlock
+{
+    uint8_t *block;
+
+public:
+    AudioBlock() : block(acquireAudioBlock()) {}
+    ~AudioBlock() { releaseAudioBlock(block); }
+    AudioBlock(const AudioBlock &) = delete;
+    AudioBlock &operator=(const AudioBlock &) = delete;
+
+    uint8_t *get() { return block; }
+    template <typename T> T *as() { return reinterpret_cast<T *>(block); }
+};
@@ -16,7 +16,18 @@
 #include <ArduinoJson.h>
 #include "index_html.h"
 #include "Esp32RingBuffer.h"
+#include <AutomaticGainControl.h>
+#include <NoiseSuppressor.h>
+#include <WakeWordDetector.h>
+#include <KeywordSpotter.h>
+#include <Endpointer.h>
+#include <EchoCanceller.h>
+#include <SoundCache.h>
+#include <Concealer.h>
+#include <DriftCorrector.h>
+#include <SoftVolume.h>
 #include <map>
+#include <type_traits>
 
 const int PLAY = BIT0;
 const int STREAM = BIT1;
@@ -43,6 +54,26 @@ struct Config {
   uint16_t volume = 100;
   int gain = 5;
   int animation = SOLID;
+  bool agc = false;
+  int agc_target = -9;     // dBFS
+  int agc_max_gain = 30;   // dB
+  bool ns = false;
+  int ns_level = 12;       // maximum noise attenuation in dB
+  int ww_threshold = 2000; // wake word score, lower is stricter
+  int kws_threshold = 200; // keyword network probability 0..255, higher is stricter
+  bool endpointer = false;
+  int ep_silence = 800;    // trailing silence in ms that ends a command
+  int ep_max = 10000;      // maximum command length in ms
+  bool beamformer = false;
+  int beam_azimuth = -1;   // degrees, -1 follows the direction of arrival
+  int channels = 1;        // >1 streams the raw microphones, if the device has them
+  int capture_rate = 16000; // Hz, devices that support it capture at 8000, 22050 or 48000 as well
+  bool aec = false;
+  int aec_taps = 256;      // echo path length in samples
+  int aec_delay = 32;      // ms between writing audio and hearing it
+  bool sound_cache = true; // keep short sounds that are played again in SPIFFS
+  bool drift_correction = true; // follow the clock of a streaming sender
+  int volume_boost = 0;    // dB on top of the volume for quiet amplifiers, the limiter keeps it clean
 };
 const char *configfile = "/config.json"; 
 Config config;
@@ -63,7 +94,6 @@ struct wavfile_header {
     int data_length;        // 4
 };
 struct wavfile_header header;
-std::string finishedMsg = "";
 bool mqttInitialized = false;
 int retryCount = 0;
 int I2SMode = -1;
@@ -73,6 +103,7 @@ bool configChanged = false;
 
 std::string audioFrameTopic("hermes/audioServer/" + config.siteid + "/audioFrame");
 std::string playBytesTopic = "hermes/audioServer/" + config.siteid + "/playBytes/#";
+std::string playBytesStreamingTopic = "hermes/audioServer/" + config.siteid + "/playBytesStreaming/#";
 std::string playFinishedTopic = "hermes/audioServer/" + config.siteid + "/playFinished";
 std::string hotwordTopic = "hermes/hotword/#";
 std::string audioTopic = config.siteid + std::string("/audio");
@@ -83,20 +114,352 @@ std::string sayTopic = "hermes/tts/say";
 std::string sayFinishedTopic = "hermes/tts/sayFinished";
 std::string errorTopic = "hermes/nlu/intentNotRecognized";
 std::string setVolumeTopic = "rhasspy/audioServer/setVolume";
+std::string telemetryTopic = config.siteid + std::string("/telemetry");
+std::string tasksTopic = config.siteid + std::string("/tasks");
+std::string asrStartListeningTopic = "hermes/asr/startListening";
+std::string asrStopListeningTopic = "hermes/asr/stopListening";
+std::string doaTopic = config.siteid + std::string("/doa");
+std::string stopPlayingTopic = config.siteid + std::string("/stopPlaying");
+std::string playCachedTopic = config.siteid + std::string("/playCached");
 AsyncMqttClient asyncClient; 
 WiFiClient net;
 PubSubClient audioServer(net); 
 Esp32RingBuffer<uint8_t, uint16_t, (1U << 15)> audioData;
-long message_size = 0;
+
+// Audio block pool, sized from the device read and write sizes. A block holds a full
+// read or write block, twice over to allow for mono to stereo conversions in the devices.
+// At most 3 blocks are in use at the same time (I2Stask data + payload + device conversion)
+#ifndef DEVICE_READ_SIZE
+#define DEVICE_READ_SIZE 256
+#endif
+#ifndef DEVICE_WRITE_SIZE
+#define DEVICE_WRITE_SIZE 256
+#endif
+#define DEVICE_WIDTH 2
+#define AUDIO_BLOCK_SIZE (2 * ((DEVICE_READ_SIZE * DEVICE_WIDTH) > DEVICE_WRITE_SIZE ? (DEVICE_READ_SIZE * DEVICE_WIDTH) : DEVICE_WRITE_SIZE))
+#define AUDIO_BLOCK_COUNT 4
+AudioBlockPool<AUDIO_BLOCK_SIZE, AUDIO_BLOCK_COUNT> audioBlocks;
+
+// The device type is known at compile time. A final device class lets the compiler call and
+// inline its methods directly instead of going through the vtable, on every audio block.
+// The audio sizes are Device fields, set by the constructor of the device: a device that
+// declares them again hides its values from everything that sees it as a Device
+typedef std::remove_pointer<decltype(device)>::type DeviceType;
+static_assert(std::is_base_of<Device, DeviceType>::value, "device must derive from Device");
+static_assert(__is_final(DeviceType), "mark the device class final");
+static_assert(std::is_same<decltype(&DeviceType::readSize), int Device::*>::value &&
+              std::is_same<decltype(&DeviceType::writeSize), int Device::*>::value &&
+              std::is_same<decltype(&DeviceType::width), int Device::*>::value &&
+              std::is_same<decltype(&DeviceType::rate), int Device::*>::value,
+              "set readSize, writeSize, width and rate in the device constructor, do not declare them again");
+
+uint8_t *acquireAudioBlock() {
+  uint8_t *block = audioBlocks.acquire();
+  // the pool is sized for the worst case, running out means a block is leaking
+  assert(block != NULL);
+  return block;
+}
+
+void releaseAudioBlock(uint8_t *block) {
+  audioBlocks.release(block);
+}
+
+// I2Stask used to have a 30000 byte stack to hold the audio buffers. These are now in the
+// audio block pool. The deepest chain of frames of the firmware and the libraries is about
+// 2.2 KB (I2Stask 320, playRequest 352, Beamformer::updateDirection 1256 bytes and smaller
+// ones, gcc -fstack-usage on the host, "make -C PlatformIO/test stack" for the libraries).
+// The calls into the framework (printf family, SPIFFS, AsyncTCP, i2s_read) and the saved
+// interrupt and FPU context come on top, so more than half of the stack is left for them.
+// The high water mark is published to the debug topic when it drops and to SITEID/tasks,
+// below I2S_TASK_STACK_MIN_FREE a warning asks for a larger stack.
+#define I2S_TASK_STACK_SIZE 8192
+#define I2S_TASK_STACK_MIN_FREE 2048
+#define I2S_TASK_STACK_SIZE_LEGACY 30000
+UBaseType_t i2sStackHighWater = I2S_TASK_STACK_SIZE;
+
 int queueDelay = 10;
 int sampleRate = 16000;
 int numChannels = 2;
 int bitDepth = 16;
 StateColors current_colors = COLORS_IDLE;
+AutomaticGainControl agc;
+NoiseSuppressor noiseSuppressor;
+WakeWordDetector wakeWord;
+
+// The capture processing belongs to I2Stask. The MQTT and web handlers change the config and
+// set a reload flag, I2Stask applies the settings before its next block.
+volatile bool agcReload = true;
+volatile bool nsReload = true;
+
+// Cycle count statistics of an audio processing stage, per capture block of device->readSize samples
+struct CycleStats {
+  uint32_t frames = 0;
+  uint64_t cycles = 0;
+  uint32_t maxCycles = 0;
+  uint32_t budget = 0;
+  uint32_t overBudget = 0;
+
+  void add(uint32_t frameCycles) {
+    frames++;
+    cycles += frameCycles;
+    maxCycles = frameCycles > maxCycles ? frameCycles : maxCycles;
+    if (budget > 0 && frameCycles > budget) {
+      overBudget++;
+    }
+  }
+
+  void reset() {
+    frames = 0;
+    cycles = 0;
+    maxCycles = 0;
+    overBudget = 0;
+  }
+
+  // a stage may use percent of the cycles core 1 has while one capture block is recorded
+  void setBudget(int percent) {
+    budget = (uint64_t)getCpuFrequencyMhz() * 1000000 / device->rate * device->readSize * percent / 100;
+  }
+};
+
+// Noise suppression may use this share of core 1 per capture block
+#define NS_CPU_BUDGET_PERCENT 20
+CycleStats nsStats;
+
+// Local wake word detection (HW_LOCAL). Templates are 16 kHz, mono, 16 bit recordings of
+// the wake word, uploaded to SPIFFS as /wakeword0.wav .. /wakeword3.wav. They are loaded
+// by I2Stask, so the detector is only ever touched from that task.
+#define WAKEWORD_TEMPLATE_FILE "/wakeword%d.wav"
+#define WAKEWORD_ID "default"
+#define WW_CPU_BUDGET_PERCENT 20
+#define WAKEWORD_RATE 16000
+bool localDetection = false;
+volatile bool wakeWordDetected = false;
+volatile bool wakeWordReload = true;
+uint32_t wakeWordDetections = 0;
+CycleStats wwStats;
+
+// Int8 keyword spotting network, used instead of the templates when /kws.bin exists.
+// The model is read into an arena taken from the heap when HW_LOCAL is selected and the
+// model exists, set KWS_ARENA_SIZE as build flag for larger models.
+#define KWS_MODEL_FILE "/kws.bin"
+#ifndef KWS_ARENA_SIZE
+#define KWS_ARENA_SIZE (48 * 1024)
+#endif
+uint8_t *kwsArena = NULL;
+KeywordSpotter keywordSpotter;
+CycleStats kwsStats;
+uint32_t kwsInferences = 0;
+
+// End of utterance detection in Listening. Listening bumps endpointerSession to start a
+// new utterance, I2Stask sets endOfSpeech and stops streaming, Listening tells the ASR.
+// Like the capture processing, the endpointer is only configured by I2Stask.
+Endpointer endpointer;
+volatile bool endpointerReload = true;
+bool endpointing = false;
+volatile uint32_t endpointerSession = 0;
+volatile int endOfSpeech = Endpointer::NONE;
+std::string asrSessionId = "";
+bool asrStopOnSilence = true;
+struct EndpointerStats {
+  uint32_t results[4] = {0, 0, 0, 0};
+  uint32_t endDelayMs = 0;
+} epStats;
+
+// Beamforming of the microphone array on the device, for devices that support it.
+// The direction of arrival is published to SITEID/doa when Listening starts. The beamformer
+// runs inside device->readAudio, so I2Stask also applies its settings.
+#define BF_CPU_BUDGET_PERCENT 20
+volatile bool beamformerReload = true;
+CycleStats bfStats;
+
+// Audio is published in audioFrame messages of this many bytes after the WAV header.
+// With more than one capture channel the raw microphones are streamed interleaved, without
+// any processing on the device. captureChannels, captureRate and captureStats belong to I2Stask,
+// a changed setting only sets captureReload.
+#define AUDIO_FRAME_BYTES 512
+volatile bool captureReload = true;
+int captureChannels = 1;
+int captureRate = 16000;
+struct CaptureStats {
+  uint32_t messages = 0;
+  uint32_t bytes = 0;
+  CycleStats publish;
+  uint32_t busReads = 0;
+  CycleStats read;          // moving the samples of a block into the pipeline
+} captureStats;
+
+// Echo cancellation while playing, on devices that can capture and play at the same time.
+// The capture then keeps running during playback, with HW_LOCAL the wake word interrupts
+// the playback (barge-in) in the states that set bargeInEnabled.
+#define AEC_CPU_BUDGET_PERCENT 25
+EchoCanceller echoCanceller;
+volatile bool aecReload = true;
+CycleStats aecStats;
+volatile bool bargeInEnabled = false;
+volatile bool bargeIn = false;
+uint32_t bargeIns = 0;
+
+// Devices that share the I2S port between mic and speaker switch modes. A switch to the
+// speaker is started as soon as a playBytes message begins to arrive, I2Stask pauses the
+// capture meanwhile. The time of the switches is measured per device.
+#define PLAYBACK_PREPARE_TIMEOUT_MS 2000
+volatile bool playbackStarting = false;
+volatile unsigned long playbackStartMillis = 0;
+struct LatencyStats {
+  uint32_t count = 0;
+  uint64_t micros = 0;
+  uint32_t maxMicros = 0;
+  void add(uint32_t elapsed) {
+    count++;
+    micros += elapsed;
+    maxMicros = elapsed > maxMicros ? elapsed : maxMicros;
+  }
+  uint32_t average() { return count > 0 ? (uint32_t)(micros / count) : 0; }
+  void reset() { count = 0; micros = 0; maxMicros = 0; }
+} modeSwitchStats;
+
+// Playback can be stopped by a stop message, a new hotword or a barge-in. I2Stask leaves the
+// playback within one block, drops the queued output and publishes playFinished at once. The
+// rest of the playBytes message is dropped while it arrives. The latency is from the request
+// until the output is flushed.
+volatile bool stopPlayback = false;
+volatile bool playbackDropped = false;
+volatile unsigned long stopRequestMicros = 0;
+LatencyStats stopStats;
+
+// Capture jitter: how far the time between two blocks read by I2Stask is off the block length.
+// A gap of more than CAPTURE_GAP_BLOCKS blocks is a new start of the capture, not jitter.
+#define CAPTURE_GAP_BLOCKS 4
+unsigned long lastCaptureMicros = 0;
+LatencyStats jitterStats;
+
+// playFinished waits until the device has played what is still queued in its DMA buffers or
+// FIFO, otherwise Rhasspy opens the mic while the speaker still plays. The wait is measured.
+#define PLAYBACK_DRAIN_TIMEOUT_MS 1000
+#define PLAYBACK_DRAIN_POLL_MS 20
+LatencyStats drainStats;
+
+// Every playBytes message is a request of its own with its own format, a second message (a beep
+// followed by the TTS answer) is queued instead of overwriting the first. The PCM data of the
+// requests follows each other in audioData, so they play back to back and each gets its own
+// playFinished. Both latencies run from the first chunk until the request starts to play:
+// - start: the speaker was idle. I2Stask starts once the message is complete or audioData
+//   (32 KB, 1 s of 16 kHz mono) is full, and sees the request after the capture block it is
+//   reading (16 ms with 256 samples at 16 kHz). The mode switch is in the "i2s" object.
+// - queue: the request waited for the ones before it, the rest of their playback.
+// The gap is the silence between two requests, 0 unless the format changes and the output
+// has to drain first.
+#define PLAY_QUEUE_SIZE 4
+#define PLAY_ID_SIZE 64
+struct PlayRequest {
+  char id[PLAY_ID_SIZE];
+  int sampleRate;
+  int numChannels;
+  int bitDepth;
+  long bytes;
+  unsigned long queuedMicros;
+  uint32_t cached;        // hash of the cached payload to play from SPIFFS, 0 plays from audioData
+  long dataOffset;        // start of the PCM data in the cached payload
+  uint32_t stream;        // streaming session, 0 for a complete message
+};
+QueueHandle_t playQueue = NULL;
+LatencyStats startStats;
+LatencyStats queueStats;
+LatencyStats gapStats;
+
+// When the audio does not arrive in time the gap is concealed, so the DAC never runs dry. A
+// request that gets no audio for PLAYBACK_DATA_TIMEOUT_MS ends.
+#define PLAYBACK_DATA_TIMEOUT_MS 5000
+Concealer concealer;
+DriftCorrector driftCorrector;
+SoftVolume softVolume;
+
+// Streamed playback on hermes/audioServer/SITEID/playBytesStreaming/<id>/<chunk>/<last>. The
+// chunks of a session are appended to one request that starts to play when the first chunk is
+// in, its length is known once the last chunk has arrived. The time to first sound is measured
+// for every request, from its first byte until its first write to the device.
+#define STREAM_SESSIONS 2
+#define STREAM_POLL_MS 5
+struct StreamSession {
+  uint32_t number;
+  volatile long bytes;
+  volatile bool ended;
+};
+StreamSession streams[STREAM_SESSIONS];
+uint32_t streamNumber = 0;
+int streamNextChunk = 0;
+volatile bool streamOpen = false;
+uint32_t streamCount = 0;
+LatencyStats firstSoundStats;
+
+// Short sounds that come again and again (wake beep, error sound) are kept in SPIFFS, a repeated
+// one starts to play from flash as soon as the first chunk matches and the rest of the message
+// is dropped. SITEID/playCached plays a cached sound by its hash without sending it at all.
+// The saved time to first sample is from the first until the last chunk of a hit. The SPIFFS
+// partition is small, the least used sounds make room for a new one and some space stays free.
+#define SOUND_CACHE_MAX_BYTES 24576
+#define SOUND_CACHE_RESERVE_BYTES 8192
+#define SOUND_CACHE_INDEX "/sc/index"
+SoundCache soundCache;
+LatencyStats cacheSavedStats;
+uint32_t cacheHints = 0;
+uint32_t cacheMismatches = 0;
+
+// Statistics are published to SITEID/telemetry with this interval
+#define TELEMETRY_INTERVAL_MS 10000
+unsigned long lastTelemetry = 0;
 static EventGroupHandle_t audioGroup;
 SemaphoreHandle_t wbSemaphore;
+// I2Stask owns the audio processing. Handlers set a reload flag and wake it with wakeI2S, it
+// applies the change before its next block
 TaskHandle_t i2sHandle;
 
+// Codec settings are written by codecTask, not by the MQTT and web handlers or the audio task.
+// Requests are bits, a setting requested again before codecTask got to it is written once, with
+// the latest config value
+#define CODEC_VOLUME 0x01
+#define CODEC_AMP_OUTPUT 0x02
+#define CODEC_GAIN 0x04
+#define CODEC_TASK_STACK_SIZE 3072
+TaskHandle_t codecHandle = NULL;
+volatile uint32_t codecPending = 0;
+portMUX_TYPE codecMux = portMUX_INITIALIZER_UNLOCKED;
+uint32_t codecRequests = 0;
+uint32_t codecCoalesced = 0;
+
+// The button that starts a session is handled by an interrupt on both edges. The interrupt only
+// notes the edge and restarts a one-shot timer, which wakes the main loop once the pin has been
+// quiet for BUTTON_DEBOUNCE_MS. The loop then reads the level: low after high is a press, with
+// the time of the first edge. Edges that do not change the confirmed level are bounces, as are the
+// spurious interrupts GPIO36 and GPIO39 get when the ADC or the WiFi powers up. The latency is
+// from the first edge until startSession is published, so it includes the debounce time.
+// Devices that have no button pin are polled whenever the main loop wakes.
+#define BUTTON_DEBOUNCE_MS 30
+int buttonPin = -1;
+bool buttonDown = false;
+volatile bool buttonEdge = false;
+volatile unsigned long buttonFirstEdgeMicros = 0;
+volatile unsigned long buttonEdgeMicros = 0;
+volatile uint32_t buttonEdges = 0;
+uint32_t buttonSettledEdges = 0;
+uint32_t buttonPresses = 0;
+uint32_t buttonBounces = 0;
+TimerHandle_t buttonTimer = NULL;
+portMUX_TYPE buttonMux = portMUX_INITIALIZER_UNLOCKED;
+LatencyStats buttonStats;
+
+// The main loop sleeps until it is notified by wakeLoop: the state changed, a task set a flag that
+// run() of the current state handles, the button was pressed or a deadline passed. ArduinoOTA has
+// no callback for an invitation, while the network is up the loop wakes every OTA_POLL_MS to look
+// for one. The time spent in the loop body and the wakeups by the poll are counted since boot.
+#define OTA_POLL_MS 100
+#define MQTT_CONNECT_TIMEOUT_MS 5000
+TaskHandle_t loopHandle = NULL;
+TimerHandle_t mqttConnectTimer = NULL;
+uint32_t loopIterations = 0;
+uint32_t loopPolls = 0;
+uint32_t loopBusyMicros = 0;
+
 struct WifiConnected;
 struct WifiDisconnected;
 struct MQTTConnected;
@@ -125,6 +488,7 @@ struct StreamAudioEvent : tinyfsm::Event { };
 struct PlayBytesEvent : tinyfsm::Event {};
 struct ListeningEvent : tinyfsm::Event { };
 struct UpdateConfigurationEvent : tinyfsm::Event { };
+struct ButtonEvent : tinyfsm::Event { unsigned long pressMicros; };
 
 void onMqttConnect(bool sessionPresent);
 void onMqttDisconnect(AsyncMqttClientDisconnectReason reason);
@@ -132,11 +496,30 @@ void onMqttMessage(char *topic, char *payload, AsyncMqttClientMessageProperties
 void publishDebug(const char* message);
 void InitI2SSpeakerOrMic(int mode);
 void WiFiEvent(WiFiEvent_t event);
-void initHeader(int readSize, int width, int rate);
+void initHeader(int dataLength, int width, int rate, int channels);
 void MQTTtask(void *p);
 void I2Stask(void *p);
 void loadConfiguration(const char *filename, Config &config);
 void saveConfiguration(const char *filename, Config &config);
+void applyVolumeConfiguration();
+void requestCodecUpdate(uint32_t settings);
+void codecTask(void *p);
+void wakeLoop();
+void wakeI2S();
+void setupButton();
+bool takeButtonPress(unsigned long &pressMicros);
+void applyAgcConfiguration();
+void applyNsConfiguration();
+void reloadCaptureSettings();
+void applyEndpointerConfiguration();
+void applyBeamformerConfiguration();
+void applyCaptureConfiguration();
+void applyHotwordConfiguration();
+void applyAecConfiguration();
+void loadWakeWordModels();
+void loadSoundCache();
+void publishTelemetry();
+void publishTaskStats();
 
 /* ************************************************************************* *
       HELPER CLASS FOR WAVE HEADER, taken from https://www.xtronical.com/
@@ -181,11 +564,17 @@ void updateMqttTopicsStrings()
 {
     audioFrameTopic = std::string("hermes/audioServer/") + config.siteid + std::string("/audioFrame");
     playBytesTopic = std::string("hermes/audioServer/") + config.siteid + std::string("/playBytes/#");
+    playBytesStreamingTopic = std::string("hermes/audioServer/") + config.siteid + std::string("/playBytesStreaming/#");
     playFinishedTopic = std::string("hermes/audioServer/") + config.siteid + std::string("/playFinished");
     audioTopic = config.siteid + std::string("/audio");
     ledTopic = config.siteid + std::string("/led");
     debugTopic = config.siteid + std::string("/debug");
     restartTopic = config.siteid + std::string("/restart");
+    telemetryTopic = config.siteid + std::string("/telemetry");
+    tasksTopic = config.siteid + std::string("/tasks");
+    doaTopic = config.siteid + std::string("/doa");
+    stopPlayingTopic = config.siteid + std::string("/stopPlaying");
+    playCachedTopic = config.siteid + std::string("/playCached");
 
 }
 
@@ -217,12 +606,27 @@ template <typename T> bool processParam(AsyncWebParameter *p, T& p_val)
     return retval;
 }
 
+// the same for the MQTT handlers, true if the value was changed
+template <typename T> bool updateSetting(T& setting, T value)
+{
+    if (setting == value) {
+        return false;
+    }
+    setting = value;
+    return true;
+}
+
 // these two gloval variables are used to simplify
 // handling of "communication" out of the config parameter processing
 // there more elegant solutions possible
 static bool reconnectNeeded = false;
 static bool doReconnect = false;
 
+// an option of the capture rate select, hidden when the device cannot capture at the rate
+String captureRateOption(int rate) {
+    return !device->captureRateSupported(rate) ? "hidden" : (config.capture_rate == rate) ? "selected" : "";
+}
+
 struct Conv 
 {
     /**
@@ -284,13 +688,13 @@ const std::map<const std::string, Conv> config_values = {
     { "volume", { 
             []() { return toStringFunc(config.volume); },
             [](AsyncWebParameter *p) { return processParam(p, config.volume); },
-            []() { device->setVolume(config.volume); } 
+            []() { applyVolumeConfiguration(); } 
         }
     },
     { "gain", { 
             []() { return toStringFunc(config.gain); },
             [](AsyncWebParameter *p) { return processParam(p, config.gain); },
-            []() { device->setGain(config.gain); } 
+            []() { requestCodecUpdate(CODEC_GAIN); } 
         }
     },
     { "brightness", { 
@@ -320,13 +724,13 @@ const std::map<const std::string, Conv> config_values = {
     { "amp_output", { 
             []() { return toStringFunc(config.amp_output); },
             [](AsyncWebParameter *p) { return processParam(p, config.amp_output); },
-            []() { device->ampOutput(config.amp_output); } 
+            []() { requestCodecUpdate(CODEC_AMP_OUTPUT); } 
         }
     },
     { "hotword_detection", { 
             []() { return toStringFunc(config.hotword_detection); },
             [](AsyncWebParameter *p) { return processParam(p,config.hotword_detection); },
-            []() {} 
+            []() { applyHotwordConfiguration(); } 
         }
     },
     { "hw_local", { 
@@ -359,6 +763,36 @@ const std::map<const std::string, Conv> config_values = {
             []() {} 
         }
     },
+    { "capture_rate", { 
+            []() { return toStringFunc(config.capture_rate); },
+            [](AsyncWebParameter *p) { return processParam(p, config.capture_rate); },
+            []() { applyCaptureConfiguration(); } 
+        }
+    },
+    { "rate_8000", { 
+            []() { return captureRateOption(8000); },
+            [](AsyncWebParameter *p) { return false; },
+            []() {} 
+        }
+    },
+    { "rate_16000", { 
+            []() { return captureRateOption(16000); },
+            [](AsyncWebParameter *p) { return false; },
+            []() {} 
+        }
+    },
+    { "rate_22050", { 
+            []() { return captureRateOption(22050); },
+            [](AsyncWebParameter *p) { return false; },
+            []() {} 
+        }
+    },
+    { "rate_48000", { 
+            []() { return captureRateOption(48000); },
+            [](AsyncWebParameter *p) { return false; },
+            []() {} 
+        }
+    },
     {"animationsupported",  {   
             []() -> String { return device->animationSupported() ? "block" : "none"; },
             [](AsyncWebParameter *p) { return false; },
@@ -431,6 +865,7 @@ void handleFSf ( AsyncWebServerRequest* request, const String& route ) {
                 Serial.println("Settings changed, saving configuration");
                 saveConfiguration(configfile, config);
                 configChanged = true;
+                wakeLoop();
             } else {
                 Serial.println("No settings changed");
             }
@@ -452,6 +887,7 @@ void handleFSf ( AsyncWebServerRequest* request, const String& route ) {
         delay(1000);
         reconnectNeeded = false;
         doReconnect = true;
+        wakeLoop();
         // ESP.restart();    
     }
 
@@ -462,21 +898,22 @@ void handleRequest ( AsyncWebServerRequest* request )
     handleFSf ( request, String( "/index.html") ) ;
 }
 
-void initHeader(int readSize, int width, int rate) {
+void initHeader(int dataLength, int width, int rate, int channels) {
     strncpy(header.riff_tag, "RIFF", 4);
     strncpy(header.wave_tag, "WAVE", 4);
     strncpy(header.fmt_tag, "fmt ", 4);
     strncpy(header.data_tag, "data", 4);
 
-    header.riff_length = (uint32_t)sizeof(header) + (readSize * width);
+    // the RIFF length does not count the RIFF tag and the length itself
+    header.riff_length = (uint32_t)sizeof(header) - 8 + dataLength;
     header.fmt_length = 16;
     header.audio_format = 1;
-    header.num_channels = 1;
+    header.num_channels = channels;
     header.sample_rate = rate;
-    header.byte_rate = rate * width;
-    header.block_align = width;
+    header.byte_rate = rate * width * channels;
+    header.block_align = width * channels;
     header.bits_per_sample = width * 8;
-    header.data_length = readSize * width;
+    header.data_length = dataLength;
 }
 
 void publishDebug(const char* message) {
@@ -488,7 +925,7 @@ void publishDebug(const char* message) {
 
 void loadConfiguration(const char *filename, Config &config) {
   File file = SPIFFS.open(filename);
-  StaticJsonDocument<512> doc;
+  StaticJsonDocument<1024> doc;
   // Deserialize the JSON document
   DeserializationError error = deserializeJson(doc, file);
   if (error) {
@@ -510,12 +947,37 @@ void loadConfiguration(const char *filename, Config &config) {
     config.volume = doc["volume"].as<int>();
     config.gain = doc["gain"].as<int>();
     config.animation = doc["animation"].as<int>();
+    config.agc = doc["agc"] | config.agc;
+    config.agc_target = doc["agc_target"] | config.agc_target;
+    config.agc_max_gain = doc["agc_max_gain"] | config.agc_max_gain;
+    config.ns = doc["ns"] | config.ns;
+    config.ns_level = doc["ns_level"] | config.ns_level;
+    config.ww_threshold = doc["ww_threshold"] | config.ww_threshold;
+    config.kws_threshold = doc["kws_threshold"] | config.kws_threshold;
+    config.endpointer = doc["endpointer"] | config.endpointer;
+    config.ep_silence = doc["ep_silence"] | config.ep_silence;
+    config.ep_max = doc["ep_max"] | config.ep_max;
+    config.beamformer = doc["beamformer"] | config.beamformer;
+    config.beam_azimuth = doc["beam_azimuth"] | config.beam_azimuth;
+    config.channels = doc["channels"] | config.channels;
+    config.capture_rate = doc["capture_rate"] | config.capture_rate;
+    config.aec = doc["aec"] | config.aec;
+    config.aec_taps = doc["aec_taps"] | config.aec_taps;
+    config.aec_delay = doc["aec_delay"] | config.aec_delay;
+    config.sound_cache = doc["sound_cache"] | config.sound_cache;
+    config.drift_correction = doc["drift_correction"] | config.drift_correction;
+    config.volume_boost = doc["volume_boost"] | config.volume_boost;
 
     // apply configuration values
-    device->ampOutput(config.amp_output);
+    requestCodecUpdate(CODEC_AMP_OUTPUT | CODEC_GAIN);
     device->updateBrightness(config.brightness);
-    device->setVolume(config.volume);
-    device->setGain(config.gain);
+    applyVolumeConfiguration();
+    applyAgcConfiguration();
+    applyNsConfiguration();
+    applyEndpointerConfiguration();
+    applyBeamformerConfiguration();
+    applyCaptureConfiguration();
+    applyAecConfiguration();
     
     // reconfigure if siteid changes
     updateMqttTopicsStrings();
@@ -534,7 +996,7 @@ void saveConfiguration(const char *filename, Config &config) {
         Serial.println(F("Failed to create file"));
         return;
     }
-    StaticJsonDocument<512> doc;
+    StaticJsonDocument<1024> doc;
     doc["siteid"] = config.siteid;
     doc["mqtt_host"] = config.mqtt_host;
     doc["mqtt_port"] = config.mqtt_port;
@@ -549,8 +1011,600 @@ void saveConfiguration(const char *filename, Config &config) {
     doc["volume"] = config.volume;
     doc["gain"] = config.gain;
     doc["animation"] = config.animation;
+    doc["agc"] = config.agc;
+    doc["agc_target"] = config.agc_target;
+    doc["agc_max_gain"] = config.agc_max_gain;
+    doc["ns"] = config.ns;
+    doc["ns_level"] = config.ns_level;
+    doc["ww_threshold"] = config.ww_threshold;
+    doc["kws_threshold"] = config.kws_threshold;
+    doc["endpointer"] = config.endpointer;
+    doc["ep_silence"] = config.ep_silence;
+    doc["ep_max"] = config.ep_max;
+    doc["beamformer"] = config.beamformer;
+    doc["beam_azimuth"] = config.beam_azimuth;
+    doc["channels"] = config.channels;
+    doc["capture_rate"] = config.capture_rate;
+    doc["aec"] = config.aec;
+    doc["aec_taps"] = config.aec_taps;
+    doc["aec_delay"] = config.aec_delay;
+    doc["sound_cache"] = config.sound_cache;
+    doc["drift_correction"] = config.drift_correction;
+    doc["volume_boost"] = config.volume_boost;
     if (serializeJson(doc, file) == 0) {
         Serial.println(F("Failed to write to file"));
     }
     file.close();
 }
+
+void applyCodecSettings() {
+    portENTER_CRITICAL(&codecMux);
+    const uint32_t settings = codecPending;
+    codecPending = 0;
+    portEXIT_CRITICAL(&codecMux);
+    if (settings == 0) {
+        return;
+    }
+    xSemaphoreTake(wbSemaphore, portMAX_DELAY);
+    if (settings & CODEC_AMP_OUTPUT) {
+        device->ampOutput(config.amp_output);
+    }
+    if (settings & CODEC_VOLUME) {
+        device->setVolume(config.volume);
+    }
+    if (settings & CODEC_GAIN) {
+        device->setGain(config.gain);
+    }
+    xSemaphoreGive(wbSemaphore);
+}
+
+void requestCodecUpdate(uint32_t settings) {
+    portENTER_CRITICAL(&codecMux);
+    codecRequests++;
+    if (codecPending & settings) {
+        codecCoalesced++;
+    }
+    codecPending |= settings;
+    portEXIT_CRITICAL(&codecMux);
+    if (codecHandle != NULL) {
+        xTaskNotifyGive(codecHandle);
+    } else {
+        // before the task is started, during setup
+        applyCodecSettings();
+    }
+}
+
+void codecTask(void *p) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        applyCodecSettings();
+    }
+}
+
+void wakeLoop() {
+    if (loopHandle != NULL) {
+        xTaskNotifyGive(loopHandle);
+    }
+}
+
+void wakeI2S() {
+    if (i2sHandle != NULL) {
+        xTaskNotifyGive(i2sHandle);
+    }
+}
+
+void mqttConnectTimeout(TimerHandle_t timer) {
+    wakeLoop();
+}
+
+void onMqttConnect(bool sessionPresent) {
+    wakeLoop();
+}
+
+void IRAM_ATTR buttonISR() {
+    const unsigned long now = micros();
+    BaseType_t woken = pdFALSE;
+    portENTER_CRITICAL_ISR(&buttonMux);
+    if (!buttonEdge) {
+        buttonFirstEdgeMicros = now;
+    }
+    buttonEdge = true;
+    buttonEdgeMicros = now;
+    buttonEdges++;
+    portEXIT_CRITICAL_ISR(&buttonMux);
+    xTimerResetFromISR(buttonTimer, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+void buttonSettled(TimerHandle_t timer) {
+    wakeLoop();
+}
+
+void setupButton() {
+    buttonPin = device->hotwordButtonPin();
+    if (buttonPin >= 0) {
+        // one tick more, the loop must find the pin quiet for the whole debounce time
+        buttonTimer = xTimerCreate("button", pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS) + 1, pdFALSE, NULL, buttonSettled);
+        buttonDown = digitalRead(buttonPin) == LOW;
+        attachInterrupt(digitalPinToInterrupt(buttonPin), buttonISR, CHANGE);
+    }
+}
+
+bool takeButtonPress(unsigned long &pressMicros) {
+    if (buttonPin < 0) {
+        const bool down = device->isHotwordDetected();
+        const bool pressed = down && !buttonDown;
+        buttonDown = down;
+        if (pressed) {
+            pressMicros = micros();
+            buttonPresses++;
+        }
+        return pressed;
+    }
+    portENTER_CRITICAL(&buttonMux);
+    const bool settled = buttonEdge && micros() - buttonEdgeMicros >= BUTTON_DEBOUNCE_MS * 1000UL;
+    if (settled) {
+        buttonEdge = false;
+    }
+    const unsigned long firstEdgeMicros = buttonFirstEdgeMicros;
+    const uint32_t edges = buttonEdges;
+    portEXIT_CRITICAL(&buttonMux);
+    // still bouncing, the timer wakes the loop again when the pin is quiet
+    if (!settled) {
+        return false;
+    }
+    const bool down = digitalRead(buttonPin) == LOW;
+    const bool pressed = down && !buttonDown;
+    buttonBounces += edges - buttonSettledEdges - (down != buttonDown ? 1 : 0);
+    buttonSettledEdges = edges;
+    buttonDown = down;
+    if (pressed) {
+        pressMicros = firstEdgeMicros;
+        buttonPresses++;
+    }
+    return pressed;
+}
+
+void applyVolumeConfiguration() {
+    requestCodecUpdate(CODEC_VOLUME);
+    softVolume.setVolume(device->volumeSupported() ? 100 : config.volume, config.volume_boost);
+}
+
+void applyAgcConfiguration() {
+    agcReload = true;
+}
+
+void applyNsConfiguration() {
+    nsReload = true;
+}
+
+// I2Stask, before a block: apply the settings that were changed since the last one
+void reloadCaptureSettings() {
+    if (captureReload) {
+        captureReload = false;
+        const int channels = config.channels < 1 ? 1 : config.channels;
+        captureChannels = channels > device->rawChannels() ? device->rawChannels() : channels;
+        // the wake word templates and the keyword network are 16 kHz
+        captureRate = config.hotword_detection == HW_LOCAL ? WAKEWORD_RATE : config.capture_rate;
+        captureStats = CaptureStats();
+    }
+    if (agcReload) {
+        agcReload = false;
+        agc.configure(device->rate, device->readSize, config.agc_target, config.agc_max_gain);
+        agc.setEnabled(config.agc);
+    }
+    if (nsReload) {
+        nsReload = false;
+        noiseSuppressor.configure(config.ns_level);
+        noiseSuppressor.setEnabled(config.ns);
+        nsStats.setBudget(NS_CPU_BUDGET_PERCENT);
+        nsStats.reset();
+    }
+    if (endpointerReload) {
+        endpointerReload = false;
+        endpointer.configure(device->rate, config.ep_silence, config.ep_max);
+    }
+}
+
+void applyEndpointerConfiguration() {
+    endpointerReload = true;
+}
+
+void applyBeamformerConfiguration() {
+    beamformerReload = true;
+}
+
+void applyCaptureConfiguration() {
+    captureReload = true;
+    wakeI2S();
+}
+
+void applyHotwordConfiguration() {
+    // the templates and the keyword model are only held with local detection
+    wakeWordReload = true;
+    applyCaptureConfiguration();
+}
+
+void applyAecConfiguration() {
+    // the filter and its statistics are reconfigured by I2Stask, which owns them
+    aecReload = true;
+    wakeI2S();
+}
+
+void soundCachePath(uint32_t hash, char *path, size_t size) {
+    snprintf(path, size, "/sc/%08x.wav", hash);
+}
+
+void saveSoundCache() {
+    File file = SPIFFS.open(SOUND_CACHE_INDEX, "w");
+    if (file) {
+        file.write((const uint8_t *)soundCache.table(), soundCache.tableSize());
+        file.close();
+    }
+}
+
+void loadSoundCache() {
+    File file = SPIFFS.open(SOUND_CACHE_INDEX);
+    if (!file) {
+        return;
+    }
+    if (file.size() == soundCache.tableSize()) {
+        file.read((uint8_t *)soundCache.table(), soundCache.tableSize());
+    }
+    file.close();
+    // drop entries whose payload is gone
+    char path[20];
+    for (int slot = 0; slot < SoundCache::MAX_ENTRIES; slot++) {
+        soundCachePath(soundCache.entry(slot).hash, path, sizeof(path));
+        if (soundCache.entry(slot).used && !SPIFFS.exists(path)) {
+            soundCache.remove(slot);
+        }
+    }
+}
+
+size_t readFile(void *file, uint8_t *buffer, size_t size) {
+    return ((File *)file)->read(buffer, size);
+}
+
+void loadWakeWordModels() {
+    wakeWord.clearTemplates();
+    wakeWord.setThreshold(config.ww_threshold);
+    wakeWord.setKeywordSpotter(&keywordSpotter);
+    keywordSpotter.unload();
+    keywordSpotter.setThreshold(config.kws_threshold);
+    kwsStats.reset();
+    const bool local = config.hotword_detection == HW_LOCAL;
+    if (local && SPIFFS.exists(KWS_MODEL_FILE)) {
+        char message[100];
+        if (kwsArena == NULL) {
+            kwsArena = (uint8_t *)malloc(KWS_ARENA_SIZE);
+        }
+        File file = SPIFFS.open(KWS_MODEL_FILE);
+        if (kwsArena == NULL) {
+            snprintf(message, 100, "Keyword model not loaded: no %d bytes free for the arena", KWS_ARENA_SIZE);
+        } else if (keywordSpotter.load(readFile, &file, kwsArena, KWS_ARENA_SIZE)) {
+            snprintf(message, 100, "Keyword model loaded, %d of %d arena bytes used", (int)keywordSpotter.arenaUsed(), KWS_ARENA_SIZE);
+        } else {
+            snprintf(message, 100, "Keyword model not loaded: %s", keywordSpotter.error());
+        }
+        file.close();
+        publishDebug(message);
+    }
+    if (!keywordSpotter.isLoaded() && kwsArena != NULL) {
+        free(kwsArena);
+        kwsArena = NULL;
+    }
+    kwsInferences = keywordSpotter.inferenceCount();
+    wwStats.setBudget(WW_CPU_BUDGET_PERCENT);
+    wwStats.reset();
+    if (!local) {
+        return;
+    }
+    for (int i = 0; i < WakeWordDetector::MAX_TEMPLATES; i++) {
+        char filename[32];
+        snprintf(filename, sizeof(filename), WAKEWORD_TEMPLATE_FILE, i);
+        if (!SPIFFS.exists(filename)) {
+            continue;
+        }
+        char message[100];
+        File file = SPIFFS.open(filename);
+        AudioBlock block;
+        uint8_t *data = block.get();
+        size_t bytes = file.read(data, 64);
+        XT_Wav_Class wav(data);
+        if (bytes < 44 || wav.DataStart == 0 || wav.SampleRate != 16000 || wav.NumChannels != 1 || wav.BitsPerSample != 16) {
+            snprintf(message, 100, "Wake word template %s must be 16 kHz, mono, 16 bit", filename);
+            publishDebug(message);
+            file.close();
+            continue;
+        }
+        file.seek(wav.DataStart);
+        while ((bytes = file.read(data, AUDIO_BLOCK_SIZE)) >= 2) {
+            wakeWord.addTemplateSamples((const int16_t *)data, bytes / 2);
+        }
+        file.close();
+        snprintf(message, 100, "Wake word template %s %s", filename, wakeWord.finishTemplate() ? "loaded" : "rejected, too short or silent");
+        publishDebug(message);
+    }
+}
+
+void publishTelemetry() {
+    // static, only I2Stask publishes and its stack is tight
+    static StaticJsonDocument<2048> doc;
+    // the device counters run since boot, the telemetry shows what happened since the last one
+    static uint32_t statusReads = 0;
+    static uint32_t codecWrites = 0;
+    static uint32_t codecSkipped = 0;
+    static uint32_t presses = 0;
+    static uint32_t bounces = 0;
+    static uint32_t iterations = 0;
+    static uint32_t polls = 0;
+    static uint32_t busyMicros = 0;
+    static unsigned long publishMicros = 0;
+    doc.clear();
+    doc["siteId"] = config.siteid;
+    JsonObject heap = doc.createNestedObject("heap");
+    heap["free"] = ESP.getFreeHeap();
+    heap["min_free"] = ESP.getMinFreeHeap();
+    heap["largest_block"] = ESP.getMaxAllocHeap();
+    if (config.ns && nsStats.frames > 0) {
+        JsonObject ns = doc.createNestedObject("ns");
+        ns["frames"] = nsStats.frames;
+        ns["avg_cycles"] = (uint32_t)(nsStats.cycles / nsStats.frames);
+        ns["max_cycles"] = nsStats.maxCycles;
+        ns["budget_cycles"] = nsStats.budget;
+        ns["over_budget"] = nsStats.overBudget;
+        ns["cpu_percent"] = (float)(nsStats.cycles / nsStats.frames) * device->rate / device->readSize / (getCpuFrequencyMhz() * 10000.0f);
+    }
+    nsStats.reset();
+    if (config.hotword_detection == HW_LOCAL) {
+        JsonObject ww = doc.createNestedObject("ww");
+        ww["templates"] = wakeWord.templateCount();
+        ww["detections"] = wakeWordDetections;
+        ww["threshold"] = config.ww_threshold;
+        ww["best_score"] = wakeWord.takeBestScore();
+        if (wwStats.frames > 0) {
+            ww["frames"] = wwStats.frames;
+            ww["avg_cycles"] = (uint32_t)(wwStats.cycles / wwStats.frames);
+            ww["max_cycles"] = wwStats.maxCycles;
+            ww["over_budget"] = wwStats.overBudget;
+            ww["cpu_percent"] = (float)(wwStats.cycles / wwStats.frames) * device->rate / device->readSize / (getCpuFrequencyMhz() * 10000.0f);
+        }
+        if (keywordSpotter.isLoaded()) {
+            JsonObject kws = ww.createNestedObject("kws");
+            kws["inferences"] = keywordSpotter.inferenceCount() - kwsInferences;
+            kws["threshold"] = config.kws_threshold;
+            kws["best_probability"] = keywordSpotter.takeBestProbability();
+            kws["arena_used"] = keywordSpotter.arenaUsed();
+            if (kwsStats.frames > 0) {
+                const uint32_t avg = (uint32_t)(kwsStats.cycles / kwsStats.frames);
+                kws["avg_cycles"] = avg;
+                kws["max_cycles"] = kwsStats.maxCycles;
+                kws["inferences_per_second"] = (float)getCpuFrequencyMhz() * 1000000.0f / avg;
+            }
+            kwsInferences = keywordSpotter.inferenceCount();
+        }
+    }
+    wwStats.reset();
+    kwsStats.reset();
+    const uint32_t utterances = epStats.results[Endpointer::END_OF_SPEECH] + epStats.results[Endpointer::MAX_LENGTH] + epStats.results[Endpointer::NO_SPEECH];
+    if (config.endpointer && utterances > 0) {
+        JsonObject ep = doc.createNestedObject("ep");
+        ep["end_of_speech"] = epStats.results[Endpointer::END_OF_SPEECH];
+        ep["max_length"] = epStats.results[Endpointer::MAX_LENGTH];
+        ep["no_speech"] = epStats.results[Endpointer::NO_SPEECH];
+        // time between the end of speech and the end of streaming
+        if (epStats.results[Endpointer::END_OF_SPEECH] > 0) {
+            ep["avg_end_delay_ms"] = epStats.endDelayMs / epStats.results[Endpointer::END_OF_SPEECH];
+        }
+    }
+    epStats = EndpointerStats();
+    if (config.beamformer && device->beamformerSupported()) {
+        JsonObject beam = doc.createNestedObject("beam");
+        float confidence = 0;
+        beam["azimuth"] = device->directionOfArrival(&confidence);
+        beam["confidence"] = confidence;
+        if (bfStats.frames > 0) {
+            beam["avg_cycles"] = (uint32_t)(bfStats.cycles / bfStats.frames);
+            beam["max_cycles"] = bfStats.maxCycles;
+            beam["over_budget"] = bfStats.overBudget;
+            beam["cpu_percent"] = (float)(bfStats.cycles / bfStats.frames) * device->rate / device->readSize / (getCpuFrequencyMhz() * 10000.0f);
+        }
+    }
+    bfStats.reset();
+    if (captureStats.messages > 0) {
+        JsonObject capture = doc.createNestedObject("capture");
+        capture["channels"] = captureChannels;
+        capture["rate"] = device->rate;
+        capture["messages"] = captureStats.messages;
+        capture["bytes_per_second"] = (uint32_t)((uint64_t)captureStats.bytes * 1000 / TELEMETRY_INTERVAL_MS);
+        capture["avg_publish_cycles"] = (uint32_t)(captureStats.publish.cycles / captureStats.publish.frames);
+        capture["cpu_percent"] = (float)captureStats.publish.cycles / (TELEMETRY_INTERVAL_MS * getCpuFrequencyMhz() * 10.0f);
+        if (captureStats.read.frames > 0) {
+            capture["bus_reads_per_block"] = (float)captureStats.busReads / captureStats.read.frames;
+            capture["avg_read_cycles"] = (uint32_t)(captureStats.read.cycles / captureStats.read.frames);
+            capture["max_read_cycles"] = captureStats.read.maxCycles;
+        }
+        if (jitterStats.count > 0) {
+            capture["avg_jitter_us"] = jitterStats.average();
+            capture["max_jitter_us"] = jitterStats.maxMicros;
+        }
+    }
+    captureStats = CaptureStats();
+    jitterStats.reset();
+    if (echoCanceller.isEnabled() && aecStats.frames > 0) {
+        JsonObject aec = doc.createNestedObject("aec");
+        aec["frames"] = aecStats.frames;
+        aec["erle_db"] = echoCanceller.takeErle();
+        aec["barge_ins"] = bargeIns;
+        aec["overruns"] = echoCanceller.overruns();
+        aec["avg_cycles"] = (uint32_t)(aecStats.cycles / aecStats.frames);
+        aec["max_cycles"] = aecStats.maxCycles;
+        aec["over_budget"] = aecStats.overBudget;
+        aec["cpu_percent"] = (float)(aecStats.cycles / aecStats.frames) * device->rate / device->readSize / (getCpuFrequencyMhz() * 10000.0f);
+    }
+    aecStats.reset();
+    if (modeSwitchStats.count > 0) {
+        JsonObject i2s = doc.createNestedObject("i2s");
+        i2s["switches"] = modeSwitchStats.count;
+        i2s["avg_switch_us"] = modeSwitchStats.average();
+        i2s["max_switch_us"] = modeSwitchStats.maxMicros;
+    }
+    modeSwitchStats.reset();
+    if (stopStats.count > 0 || drainStats.count > 0 || startStats.count > 0 || concealer.underflows > 0 || streamOpen) {
+        JsonObject playback = doc.createNestedObject("playback");
+        playback["stops"] = stopStats.count;
+        playback["avg_stop_us"] = stopStats.average();
+        playback["max_stop_us"] = stopStats.maxMicros;
+        playback["drains"] = drainStats.count;
+        playback["avg_drain_us"] = drainStats.average();
+        playback["max_drain_us"] = drainStats.maxMicros;
+        playback["requests"] = startStats.count + queueStats.count;
+        playback["avg_start_us"] = startStats.average();
+        playback["max_start_us"] = startStats.maxMicros;
+        playback["queued"] = queueStats.count;
+        playback["avg_queue_us"] = queueStats.average();
+        playback["max_queue_us"] = queueStats.maxMicros;
+        playback["streams"] = streamCount;
+        playback["avg_first_sound_us"] = firstSoundStats.average();
+        playback["max_first_sound_us"] = firstSoundStats.maxMicros;
+        if (config.drift_correction && driftCorrector.settled()) {
+            playback["drift_ppm"] = driftCorrector.ppm();
+        }
+        playback["limited_chunks"] = softVolume.limitedChunks;
+        playback["status_reads"] = device->outputStatusReads() - statusReads;
+        playback["underflows"] = concealer.underflows;
+        playback["concealed_ms"] = concealer.concealedMicros / 1000;
+        playback["gaps"] = gapStats.count;
+        playback["avg_gap_us"] = gapStats.average();
+        playback["max_gap_us"] = gapStats.maxMicros;
+    }
+    if (config.sound_cache && soundCache.lookups + cacheHints > 0) {
+        JsonObject cache = doc.createNestedObject("cache");
+        cache["entries"] = soundCache.count();
+        cache["lookups"] = soundCache.lookups;
+        cache["hits"] = soundCache.hits;
+        cache["hit_ratio"] = soundCache.lookups > 0 ? (float)soundCache.hits / soundCache.lookups : 0.0f;
+        cache["hints"] = cacheHints;
+        cache["mismatches"] = cacheMismatches;
+        cache["avg_saved_us"] = cacheSavedStats.average();
+        cache["max_saved_us"] = cacheSavedStats.maxMicros;
+    }
+    if (codecRequests > 0) {
+        JsonObject codec = doc.createNestedObject("codec");
+        codec["requests"] = codecRequests;
+        codec["coalesced"] = codecCoalesced;
+        codec["writes"] = device->codecWrites() - codecWrites;
+        codec["skipped"] = device->codecWritesSkipped() - codecSkipped;
+    }
+    if (buttonPresses != presses || buttonBounces != bounces) {
+        JsonObject button = doc.createNestedObject("button");
+        button["presses"] = buttonPresses - presses;
+        button["bounces"] = buttonBounces - bounces;
+        button["sessions"] = buttonStats.count;
+        button["avg_latency_us"] = buttonStats.average();
+        button["max_latency_us"] = buttonStats.maxMicros;
+    }
+    const unsigned long now = micros();
+    JsonObject mainLoop = doc.createNestedObject("loop");
+    mainLoop["iterations"] = loopIterations - iterations;
+    mainLoop["polls"] = loopPolls - polls;
+    mainLoop["busy_percent"] = (float)(loopBusyMicros - busyMicros) * 100.0f / (now - publishMicros);
+    presses = buttonPresses;
+    bounces = buttonBounces;
+    iterations = loopIterations;
+    polls = loopPolls;
+    busyMicros = loopBusyMicros;
+    publishMicros = now;
+    buttonStats.reset();
+    statusReads = device->outputStatusReads();
+    codecWrites = device->codecWrites();
+    codecSkipped = device->codecWritesSkipped();
+    codecRequests = 0;
+    codecCoalesced = 0;
+    soundCache.lookups = 0;
+    soundCache.hits = 0;
+    cacheHints = 0;
+    cacheMismatches = 0;
+    cacheSavedStats.reset();
+    stopStats.reset();
+    drainStats.reset();
+    startStats.reset();
+    queueStats.reset();
+    gapStats.reset();
+    firstSoundStats.reset();
+    concealer.underflows = 0;
+    softVolume.limitedChunks = 0;
+    concealer.concealedMicros = 0;
+    streamCount = 0;
+    static char message[2048];
+    serializeJson(doc, message, sizeof(message));
+    asyncClient.publish(telemetryTopic.c_str(), 0, false, message);
+}
+
+// CPU use per task over the last telemetry interval, from the FreeRTOS run time stats. On the
+// ESP32 the run time counter is a clock, so cpu is the percent of one core and idle the percent
+// of each core its idle task had. A framework built without CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+// has no counters, nothing is published then.
+void publishTaskStats() {
+#if configGENERATE_RUN_TIME_STATS == 1 && configUSE_TRACE_FACILITY == 1
+    // static, only I2Stask publishes and its stack is tight
+    static TaskStatus_t tasks[TASK_STATS_MAX];
+    static TaskHandle_t lastHandles[TASK_STATS_MAX];
+    static uint32_t lastCounters[TASK_STATS_MAX];
+    static int lastCount = 0;
+    static uint32_t lastTotal = 0;
+    static char message[2048];
+    uint32_t total = 0;
+    // nothing when there are more than TASK_STATS_MAX tasks
+    const int count = uxTaskGetSystemState(tasks, TASK_STATS_MAX, &total);
+    const uint32_t elapsed = total - lastTotal;
+    if (count == 0 || elapsed == 0) {
+        return;
+    }
+    float idle[portNUM_PROCESSORS] = {};
+    int len = snprintf(message, sizeof(message), "{\"siteId\":\"%s\",\"tasks\":[", config.siteid.c_str());
+    for (int i = 0; i < count; i++) {
+        uint32_t last = 0;
+        for (int j = 0; j < lastCount; j++) {
+            if (lastHandles[j] == tasks[i].xHandle) {
+                last = lastCounters[j];
+                break;
+            }
+        }
+        const float cpu = (float)(tasks[i].ulRunTimeCounter - last) * 100.0f / elapsed;
+        int core = -1;  // not pinned, or not known
+#if configTASKLIST_INCLUDE_COREID
+        if (tasks[i].xCoreID >= 0 && tasks[i].xCoreID < portNUM_PROCESSORS) {
+            core = tasks[i].xCoreID;
+            if (strncmp(tasks[i].pcTaskName, "IDLE", 4) == 0) {
+                idle[core] += cpu;
+            }
+        }
+#endif
+        if (len < (int)sizeof(message)) {
+            len += snprintf(message + len, sizeof(message) - len, "%s{\"name\":\"%s\",\"core\":%d,\"priority\":%d,\"cpu\":%.1f,\"stack_free\":%d}",
+                i > 0 ? "," : "", tasks[i].pcTaskName, core, (int)tasks[i].uxCurrentPriority, cpu, (int)tasks[i].usStackHighWaterMark);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        lastHandles[i] = tasks[i].xHandle;
+        lastCounters[i] = tasks[i].ulRunTimeCounter;
+    }
+    lastCount = count;
+    lastTotal = total;
+    for (int core = 0; core < portNUM_PROCESSORS && len < (int)sizeof(message); core++) {
+        len += snprintf(message + len, sizeof(message) - len, "%s%.1f", core == 0 ? "],\"idle\":[" : ",", idle[core]);
+    }
+    if (len < (int)sizeof(message)) {
+        len += snprintf(message + len, sizeof(message) - len, "]}");
+    }
+    if (len >= (int)sizeof(message)) {
+        publishDebug("Task stats do not fit in the message");
+        return;
+    }
+    asyncClient.publish(tasksTopic.c_str(), 0, false, message);
+#endif
+}
@@ -117,6 +117,35 @@
     - Added new device - inmp441max98357afastled
    v7.9.1   
     - Fix issue #113 and #121
+   v8.0
+    - Audio buffers are borrowed from a static pool of audio blocks, I2Stask stack reduced to 8192 bytes
+    - Added fixed point automatic gain control on the capture path, publish {"agc":"true"} to SITEID/audio
+    - Added optional noise suppression on the capture path, publish {"ns":"true"} to SITEID/audio
+    - Processing statistics are published to SITEID/telemetry
+    - Added local wake word detection (MFCC + DTW templates from SPIFFS), publish {"hotword":"local"} to SITEID/audio
+    - Added an int8 keyword spotting network runtime for local wake word detection, model loaded from /kws.bin
+    - Added end of command detection on the device, publish {"endpointer":"true"} to SITEID/audio
+    - Added a delay-and-sum beamformer with direction of arrival for the Matrix Voice, publish {"beamformer":"true"} to SITEID/audio
+    - Added streaming of the raw microphone channels (Matrix Voice, AudioKit ES8388), publish {"channels":8} to SITEID/audio
+    - Fixed the RIFF length in the audioFrame WAV header
+    - Added echo cancellation and wake word barge-in during playback, publish {"aec":"true"} to SITEID/audio
+    - AudioKit installs the I2S driver once and switches between mic and speaker without reinstalling, the ES8388 runs full duplex
+    - The speaker is prepared as soon as a playBytes message starts to arrive, switch times are published in the telemetry
+    - Playback can be stopped by publishing to SITEID/stopPlaying or by a new hotword, the output buffers are flushed at once
+    - playFinished is published when the queued audio has been played, not when it was written
+    - playBytes requests are queued with their own format and played back to back instead of overwriting each other
+    - Added a cache for short sounds that are played again, SITEID/playCached plays one by its hash
+    - Added playBytesStreaming, streamed audio plays while the rest of it arrives
+    - Playback underflows are concealed instead of sleeping in the playback loop, underflows are published in the telemetry
+    - Streams are resampled to follow the clock of their sender, the buffer fill level drives the correction
+    - Added a software volume with a soft limiter for devices without a hardware volume, setVolume now applies at once
+    - Codec registers are cached, unchanged values are not written again and codec settings are written by a background task
+    - Matrix Voice: writes to the DAC FIFO are paced by the estimated fill instead of a fixed sleep, 44.1 kHz stereo plays at the right speed
+    - Matrix Voice: the microphones are read straight into the audio block, the capture rate can be set with capture_rate
+    - Device classes are final so their methods are called directly, the Matrix Voice and T-Audio no longer hide the audio sizes of Device
+    - The hotword button (AudioKit, T-Audio, M5 Atom Echo) is handled by a debounced interrupt, the press is posted to the state machine with its timestamp
+    - The main loop blocks until it is notified or a deadline passes instead of running the state machine continuously
+    - Task cores and priorities are in one table (tasks.h), network callbacks and LED animation moved to core 0, CPU use per task on SITEID/tasks
 
 * ************************************************************************ */
 
@@ -131,6 +160,7 @@
   #include <WiFi.h>
 #endif
 
+#include "tasks.h"
 #include "device.h"
 
 #define M5ATOMECHO 0
@@ -191,19 +221,33 @@ void setup() {
     if ((wbSemaphore) != NULL) xSemaphoreGive(wbSemaphore);  // Free for all
   }
 
+  // setup runs in the task that runs loop
+  loopHandle = xTaskGetCurrentTaskHandle();
+  mqttConnectTimer = xTimerCreate("mqttConnect", pdMS_TO_TICKS(MQTT_CONNECT_TIMEOUT_MS), pdFALSE, NULL, mqttConnectTimeout);
+
   device->init();
+  setupButton();
 
   if (!SPIFFS.begin(true)) {
       Serial.println("Failed to mount file system");
   } else {
       Serial.println("Loading configuration");
       loadConfiguration(configfile, config);
+      loadSoundCache();
   }
 
-  device->setGain(config.gain);
-  device->setVolume(config.volume);
+  requestCodecUpdate(CODEC_GAIN);
+  applyVolumeConfiguration();
+  applyAgcConfiguration();
+  applyNsConfiguration();
+  // from here on codec settings are written in the background, on the core the audio task does not use
+  xTaskCreatePinnedToCore(codecTask, "codecTask", CODEC_TASK_STACK_SIZE, NULL, CODEC_TASK_PRIORITY, &codecHandle, CODEC_TASK_CORE);
+
+  initHeader(AUDIO_FRAME_BYTES, device->width, device->rate, 1);
 
-  initHeader(device->readSize, device->width, device->rate);
+  Serial.printf("Audio blocks: %d x %d bytes, I2Stask stack: %d bytes, reclaimed %d bytes\r\n",
+    (int)audioBlocks.blockCount(), (int)audioBlocks.blockSize(), I2S_TASK_STACK_SIZE,
+    I2S_TASK_STACK_SIZE_LEGACY - I2S_TASK_STACK_SIZE - (int)audioBlocks.totalSize());
 
   // ---------------------------------------------------------------------------
   // ArduinoOTA
@@ -239,9 +283,17 @@ void setup() {
 
   server.on("/", handleRequest);
   server.begin();
+
+  // the keyword model arena (KWS_ARENA_SIZE) is taken from this later, by I2Stask
+  Serial.printf("Free heap after boot: %d bytes, largest block %d bytes\r\n", (int)ESP.getFreeHeap(), (int)ESP.getMaxAllocHeap());
 }
 
 void loop() {
+  // sleep until there is something to do, see wakeLoop
+  if (ulTaskNotifyTake(pdTRUE, WiFi.isConnected() ? pdMS_TO_TICKS(OTA_POLL_MS) : portMAX_DELAY) == 0) {
+    loopPolls++;
+  }
+  const unsigned long loopStart = micros();
   if (WiFi.isConnected()) {
     ArduinoOTA.handle();
   }
@@ -252,6 +304,13 @@ void loop() {
     send_event(MQTTDisconnectedEvent());
   }
   doReconnect = false;
+
+  ButtonEvent button;
+  if (takeButtonPress(button.pressMicros)) {
+    send_event(button);
+  }
   
   fsm::run();
+  loopIterations++;
+  loopBusyMicros += micros() - loopStart;
 }
@@ -38,6 +38,7 @@ public:
     xEventGroupSetBits(audioGroup, PLAY);
   };
   virtual void react(ListeningEvent const &) {};
+  virtual void react(ButtonEvent const &) {};
   virtual void react(UpdateConfigurationEvent const &) {
     current_colors = COLORS_IDLE;
     device->updateBrightness(config.brightness);
@@ -49,6 +50,10 @@ public:
   virtual void entry(void) {  
     xEventGroupClearBits(audioGroup, PLAY);
     xEventGroupClearBits(audioGroup, STREAM);
+    localDetection = false;
+    endpointing = false;
+    bargeInEnabled = false;
+    device->holdBeam(false);
     device->updateBrightness(hotwordDetected ? config.hotword_brightness : config.brightness);
     xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
     device->updateColors(current_colors);
@@ -56,6 +61,20 @@ public:
   }; 
   virtual void run(void) {}; 
   void         exit(void) {};
+
+  // every state change wakes the main loop, run() of the new state gets a pass
+  template<typename S>
+  void transit(void) {
+    tinyfsm::Fsm<StateMachine>::transit<S>();
+    wakeLoop();
+  }
+
+  //let the dialogue manager start a session, like a remote hotword service would
+  void startWakeWordSession() {
+    std::string message = "{\"modelId\":\"" WAKEWORD_ID "\",\"modelVersion\":\"\",\"modelType\":\"personal\",\"currentSensitivity\":1.0,\"siteId\":\"" + config.siteid + "\",\"sessionId\":null,\"sendAudioCaptured\":null}";
+    asyncClient.publish("hermes/hotword/" WAKEWORD_ID "/detected", 0, false, message.c_str());
+    transit<Listening>();
+  }
   bool hotwordDetected = false;
 };
 
@@ -65,6 +84,16 @@ class Tts : public StateMachine
     publishDebug("Enter Tts");
     current_colors = COLORS_TTS;
     StateMachine::entry();
+    bargeInEnabled = config.hotword_detection == HW_LOCAL;
+  }
+
+  void run(void) override {
+    if (bargeIn) {
+      bargeIn = false;
+      wakeWordDetected = false;
+      publishDebug("Local wake word detected during Tts");
+      startWakeWordSession();
+    }
   }
 
   void react(IdleEvent const &) override { 
@@ -106,14 +135,45 @@ class Updating : public StateMachine
 
 class Listening : public StateMachine
 {
+  bool stopped = false;
+
   void entry(void) override {
     publishDebug("Enter Listening");
     current_colors = COLORS_HOTWORD;
     hotwordDetected = true;
     StateMachine::entry();
+    // a new utterance starts on every entry, also after a sound was played in ListeningPlay
+    stopped = false;
+    endpointerSession++;
+    endOfSpeech = Endpointer::NONE;
+    endpointing = config.endpointer && asrStopOnSilence;
+    if (config.beamformer && device->beamformerSupported()) {
+      // keep the beam on the speaker that woke us up
+      device->holdBeam(true);
+      float confidence = 0;
+      const int azimuth = device->directionOfArrival(&confidence);
+      if (azimuth >= 0) {
+        char message[150];
+        snprintf(message, 150, "{\"siteId\":\"%s\",\"azimuth\":%d,\"confidence\":%.2f}", config.siteid.c_str(), azimuth, confidence);
+        asyncClient.publish(doaTopic.c_str(), 0, false, message);
+      }
+    }
     xEventGroupSetBits(audioGroup, STREAM);
   }
 
+  void run(void) override {
+    if (endOfSpeech != Endpointer::NONE && !stopped) {
+      stopped = true;
+      xEventGroupClearBits(audioGroup, STREAM);
+      //I2Stask already stopped sending audio, let the ASR finish without waiting for its own silence detection
+      std::string message = "{\"siteId\":\"" + config.siteid + "\",\"sessionId\":" + (asrSessionId.empty() ? std::string("null") : "\"" + asrSessionId + "\"") + "}";
+      asyncClient.publish(asrStopListeningTopic.c_str(), 0, false, message.c_str());
+      char debug[100];
+      snprintf(debug, 100, "End of utterance (%d) after %d ms", (int)endOfSpeech, (int)endpointer.elapsedMs());
+      publishDebug(debug);
+    }
+  }
+
   void react(IdleEvent const &) override { 
     publishDebug("IdleEvent in Listening");
     hotwordDetected = false;
@@ -159,18 +219,23 @@ class Idle : public StateMachine
     }
     else 
     {
-      // stop streaming audio to rhasspy if it
-      // was active before
-      xEventGroupClearBits(audioGroup, STREAM);
+      // keep capturing for the local wake word detector,
+      // no audio is sent to rhasspy until it triggers.
+      // A barge-in during playback already heard the wake word
+      wakeWordDetected = bargeIn;
+      bargeIn = false;
+      localDetection = true;
+      bargeInEnabled = true;
+      xEventGroupSetBits(audioGroup, STREAM);
     }
   }
 
   void run(void) override {
-    if (device->isHotwordDetected() && !hotwordDetected) {
-      hotwordDetected = true;
-      //start session by publishing a message to hermes/dialogueManager/startSession
-      std::string message = "{\"init\":{\"type\":\"action\",\"canBeEnqueued\": false},\"siteId\":\"" + std::string(config.siteid) + "\"}";
-      asyncClient.publish("hermes/dialogueManager/startSession", 0, false, message.c_str());
+    if (wakeWordDetected) {
+      wakeWordDetected = false;
+      publishDebug("Local wake word detected");
+      startWakeWordSession();
+      return;
     }
     if (configChanged) {
       configChanged = false;
@@ -178,6 +243,17 @@ class Idle : public StateMachine
     }
   }
 
+  void react(ButtonEvent const &e) override {
+    if (hotwordDetected) {
+      return;  // a session is already requested
+    }
+    hotwordDetected = true;
+    //start session by publishing a message to hermes/dialogueManager/startSession
+    std::string message = "{\"init\":{\"type\":\"action\",\"canBeEnqueued\": false},\"siteId\":\"" + std::string(config.siteid) + "\"}";
+    asyncClient.publish("hermes/dialogueManager/startSession", 0, false, message.c_str());
+    buttonStats.add(micros() - e.pressMicros);
+  }
+
   void react(ListeningEvent const &) override { 
     transit<Listening>();
   }
@@ -253,6 +329,7 @@ class MQTTConnected : public StateMachine {
     Serial.printf("Connected as %s\r\n",config.siteid.c_str());
     publishDebug("Connected to asynch MQTT!");
     asyncClient.subscribe(playBytesTopic.c_str(), 0);
+    asyncClient.subscribe(playBytesStreamingTopic.c_str(), 0);
     asyncClient.subscribe(hotwordTopic.c_str(), 0);
     asyncClient.subscribe(audioTopic.c_str(), 0);
     //asyncClient.subscribe(debugTopic.c_str(), 0);
@@ -262,6 +339,9 @@ class MQTTConnected : public StateMachine {
     asyncClient.subscribe(sayFinishedTopic.c_str(), 0);
     asyncClient.subscribe(errorTopic.c_str(), 0);
     asyncClient.subscribe(setVolumeTopic.c_str(), 0);
+    asyncClient.subscribe(asrStartListeningTopic.c_str(), 0);
+    asyncClient.subscribe(stopPlayingTopic.c_str(), 0);
+    asyncClient.subscribe(playCachedTopic.c_str(), 0);
     transit<Idle>();
   }
 };
@@ -279,6 +359,7 @@ class MQTTDisconnected : public StateMachine {
     device->updateColors(current_colors);
     startMillis = millis();
     currentMillis = millis();
+    xTimerReset(mqttConnectTimer, 0);
     if (audioServer.connected()) {
       audioServer.disconnect();
     }    
@@ -287,6 +368,7 @@ class MQTTDisconnected : public StateMachine {
     }
     if (!mqttInitialized) {
       asyncClient.onMessage(onMqttMessage);
+      asyncClient.onConnect(onMqttConnect);
       mqttInitialized = true;
     }
     Serial.printf("Connecting MQTT: %s, %d\r\n", config.mqtt_host.c_str(), config.mqtt_port);
@@ -302,10 +384,11 @@ class MQTTDisconnected : public StateMachine {
 
   void run(void) override {
     if (audioServer.connected() && asyncClient.connected()) {
+      xTimerStop(mqttConnectTimer, 0);
       transit<MQTTConnected>();
     } else {
       currentMillis = millis();
-      if (currentMillis - startMillis > 5000) {
+      if (currentMillis - startMillis >= MQTT_CONNECT_TIMEOUT_MS) {
         Serial.println("Connect failed, retry");
         Serial.printf("Audio connected: %d, Async connected: %d\r\n", audioServer.connected(), asyncClient.connected());
         transit<MQTTDisconnected>();
@@ -348,13 +431,16 @@ class WifiDisconnected : public StateMachine
     if (!audioGroup) {
       audioGroup = xEventGroupCreate();
     }
+    if (!playQueue) {
+      playQueue = xQueueCreate(PLAY_QUEUE_SIZE, sizeof(PlayRequest));
+    }
     //Mute initial output
     device->muteOutput(true);
     xEventGroupClearBits(audioGroup, STREAM);
     xEventGroupClearBits(audioGroup, PLAY);
     if (i2sHandle == NULL) {
       Serial.println("Creating I2Stask");
-      xTaskCreatePinnedToCore(I2Stask, "I2Stask", 30000, NULL, 3, &i2sHandle, 1);
+      xTaskCreatePinnedToCore(I2Stask, "I2Stask", I2S_TASK_STACK_SIZE, NULL, I2S_TASK_PRIORITY, &i2sHandle, I2S_TASK_CORE);
     } else {  
       Serial.println("We already have a I2Stask");
     }
@@ -488,10 +574,38 @@ std::vector<std::string> explode( const std::string &delimiter, const std::strin
     return arr;
 }
 
+void publishPlayFinished(const char *id)
+{
+  std::string message = "{\"id\":\"" + std::string(id) + "\",\"siteId\":\"" + config.siteid + "\",\"sessionId\":null}";
+  asyncClient.publish(playFinishedTopic.c_str(), 0, false, message.c_str());
+}
+
+// Stop the playback that is running or about to start, ignored when nothing plays
+void requestStopPlayback()
+{
+  const bool starting = playbackStarting && millis() - playbackStartMillis < PLAYBACK_PREPARE_TIMEOUT_MS;
+  if (xEventGroupGetBits(audioGroup) != PLAY && !starting) {
+    return;
+  }
+  if (!stopPlayback) {
+    stopRequestMicros = micros();
+    stopPlayback = true;
+  }
+  playbackDropped = true;
+  if (streamOpen) {
+    // the rest of the stream is dropped as it arrives
+    streamOpen = false;
+    streams[streamNumber % STREAM_SESSIONS].ended = true;
+  }
+}
+
 void push_i2s_data(const uint8_t *const payload, size_t len)
 {
   while (audioData.push((uint8_t *)payload, len) == false)
   {
+    if (playbackDropped) {
+      return;
+    }
     // getting in here indicates a completely filled buffer, as this is the only 
     // reason why push can fail unless len is larger than max buffer size
     // this case is not handled and must be avoided, hence we put an assert in
@@ -504,30 +618,228 @@ void push_i2s_data(const uint8_t *const payload, size_t len)
         send_event(PlayBytesEvent());
       }
       vTaskDelay(pdMS_TO_TICKS(50));
-    } while (audioData.isFull());
+    } while (audioData.isFull() && !playbackDropped);
+  }
+}
+
+// Sound cache state of the playBytes message that is arriving, only used by the MQTT callback
+#define SOUND_CACHE_TEMP "/sc/new.wav"
+struct CacheTransfer {
+  enum Mode { NONE, HIT, STORE };
+  Mode mode = NONE;
+  int slot = -1;
+  uint32_t prefix = 0;
+  uint32_t hash = 0;
+  uint32_t size = 0;
+  unsigned long firstMicros = 0;
+  File file;
+} cacheTransfer;
+
+void abortCacheTransfer()
+{
+  if (cacheTransfer.mode == CacheTransfer::STORE) {
+    cacheTransfer.file.close();
+    SPIFFS.remove(SOUND_CACHE_TEMP);
+  }
+  cacheTransfer.mode = CacheTransfer::NONE;
+}
+
+// Look a message up when its first chunk arrives, on a hit the request plays from the cache
+bool startCacheTransfer(const uint8_t *payload, size_t len, size_t total, PlayRequest &request)
+{
+  abortCacheTransfer();
+  if (!config.sound_cache || total > SOUND_CACHE_MAX_BYTES || len < SoundCache::PREFIX_BYTES) {
+    return false;
+  }
+  cacheTransfer.prefix = SoundCache::hash(payload, SoundCache::PREFIX_BYTES);
+  cacheTransfer.hash = SoundCache::HASH_SEED;
+  cacheTransfer.size = total;
+  cacheTransfer.firstMicros = micros();
+  cacheTransfer.slot = soundCache.lookup(cacheTransfer.prefix, total);
+  if (cacheTransfer.slot >= 0) {
+    cacheTransfer.mode = CacheTransfer::HIT;
+    request.cached = soundCache.entry(cacheTransfer.slot).hash;
+    return true;
+  }
+  if (soundCache.admit(cacheTransfer.prefix, total)) {
+    // seen before, keep it this time
+    char path[20];
+    int victim;
+    while (SPIFFS.totalBytes() - SPIFFS.usedBytes() < total + SOUND_CACHE_RESERVE_BYTES && (victim = soundCache.victim()) >= 0) {
+      soundCachePath(soundCache.entry(victim).hash, path, sizeof(path));
+      soundCache.remove(victim);
+      SPIFFS.remove(path);
+      saveSoundCache();
+    }
+    if (SPIFFS.totalBytes() - SPIFFS.usedBytes() < total + SOUND_CACHE_RESERVE_BYTES) {
+      return false;
+    }
+    cacheTransfer.file = SPIFFS.open(SOUND_CACHE_TEMP, "w");
+    if (cacheTransfer.file) {
+      cacheTransfer.mode = CacheTransfer::STORE;
+    }
+  }
+  return false;
+}
+
+// Every chunk passes here, with the last one a hit is verified or the stored payload is added
+void continueCacheTransfer(const uint8_t *payload, size_t len, bool last)
+{
+  if (cacheTransfer.mode == CacheTransfer::NONE) {
+    return;
+  }
+  cacheTransfer.hash = SoundCache::hash(payload, len, cacheTransfer.hash);
+  if (cacheTransfer.mode == CacheTransfer::STORE && cacheTransfer.file.write(payload, len) != len) {
+    publishDebug("Sound cache write failed");
+    abortCacheTransfer();
+    return;
+  }
+  if (!last) {
+    return;
+  }
+  char path[20];
+  if (cacheTransfer.mode == CacheTransfer::HIT) {
+    const SoundCache::Entry &entry = soundCache.entry(cacheTransfer.slot);
+    if (cacheTransfer.hash == entry.hash) {
+      cacheSavedStats.add(micros() - cacheTransfer.firstMicros);
+    } else {
+      // another payload with the same start and size, it has been played from the cache
+      cacheMismatches++;
+      soundCachePath(entry.hash, path, sizeof(path));
+      soundCache.remove(cacheTransfer.slot);
+      SPIFFS.remove(path);
+      saveSoundCache();
+    }
+  } else {
+    cacheTransfer.file.close();
+    if (soundCache.find(cacheTransfer.hash) >= 0) {
+      // same content under another prefix, keep the copy we have
+      SPIFFS.remove(SOUND_CACHE_TEMP);
+    } else {
+      uint32_t evicted = 0;
+      soundCache.insert(cacheTransfer.prefix, cacheTransfer.hash, cacheTransfer.size, &evicted);
+      if (evicted != 0) {
+        soundCachePath(evicted, path, sizeof(path));
+        SPIFFS.remove(path);
+      }
+      soundCachePath(cacheTransfer.hash, path, sizeof(path));
+      SPIFFS.rename(SOUND_CACHE_TEMP, path);
+      saveSoundCache();
+      char message[60];
+      snprintf(message, sizeof(message), "Sound %08x cached", cacheTransfer.hash);
+      publishDebug(message);
+    }
+  }
+  cacheTransfer.mode = CacheTransfer::NONE;
+}
+
+// Play a cached sound by its hash, SITEID/playCached
+void handle_playCached(uint32_t hash, const char *id)
+{
+  const int slot = soundCache.find(hash);
+  char path[20];
+  soundCachePath(hash, path, sizeof(path));
+  File file = slot >= 0 ? SPIFFS.open(path) : File();
+  uint8_t wavHeader[64];
+  if (!file || file.read(wavHeader, sizeof(wavHeader)) != sizeof(wavHeader)) {
+    publishDebug("Sound not cached");
+    publishPlayFinished(id);
+    return;
+  }
+  file.close();
+  XT_Wav_Class Message(wavHeader);
+  PlayRequest request;
+  snprintf(request.id, sizeof(request.id), "%s", id);
+  request.sampleRate = Message.SampleRate;
+  request.numChannels = Message.NumChannels;
+  request.bitDepth = Message.BitsPerSample;
+  request.bytes = soundCache.entry(slot).size - Message.DataStart;
+  request.queuedMicros = micros();
+  request.cached = hash;
+  request.dataOffset = Message.DataStart;
+  request.stream = 0;
+  if (xQueueSend(playQueue, &request, 0) != pdTRUE) {
+    publishDebug("Play queue full, request dropped");
+    publishPlayFinished(id);
+    return;
+  }
+  cacheHints++;
+  if (xEventGroupGetBits(audioGroup) != PLAY) {
+    send_event(PlayBytesEvent());
   }
 }
 
 void handle_playBytes(const std::string& topicstr, uint8_t *payload, size_t len, size_t index, size_t total)
 {
   size_t offset = 0;
+  // the chunks of an open stream and this message would end up mixed in audioData
+  static bool rejected = false;
 
-  // start of message
+  // start of message, it is queued as a request of its own
   if (index == 0)
   {
-    message_size = total;
-    audioData.clear();
     XT_Wav_Class Message((const uint8_t *)payload);
-    
-    sampleRate = Message.SampleRate;
-    numChannels = Message.NumChannels;
-    bitDepth = Message.BitsPerSample;
+    std::vector<std::string> topicparts = explode("/", topicstr);
+    rejected = streamOpen;
+    if (rejected) {
+      publishDebug("Stream in progress, playBytes dropped");
+      publishPlayFinished(topicparts.size() > 4 ? topicparts[4].c_str() : "");
+      return;
+    }
+    PlayRequest request;
+    snprintf(request.id, sizeof(request.id), "%s", topicparts.size() > 4 ? topicparts[4].c_str() : "");
+    request.sampleRate = Message.SampleRate;
+    request.numChannels = Message.NumChannels;
+    request.bitDepth = Message.BitsPerSample;
+    request.bytes = total - Message.DataStart;
+    request.queuedMicros = micros();
+    request.cached = 0;
+    request.dataOffset = Message.DataStart;
+    request.stream = 0;
     offset = Message.DataStart;
+    const bool cached = startCacheTransfer(payload, len, total, request);
+
+    const bool playing = xEventGroupGetBits(audioGroup) == PLAY;
+    if (!playing && uxQueueMessagesWaiting(playQueue) == 0) {
+      // nothing plays or waits, whatever is left in the buffer is stale
+      audioData.clear();
+      stopPlayback = false;
+    }
+    playbackDropped = xQueueSend(playQueue, &request, 0) != pdTRUE;
+    if (playbackDropped) {
+      publishDebug("Play queue full, request dropped");
+      publishPlayFinished(request.id);
+    } else if (cached && !playing) {
+      // the audio is here already, no need to wait for the rest
+      publishDebug("Send PlayBytesEvent");
+      send_event(PlayBytesEvent());
+    } else if (!playing) {
+      // let I2Stask switch the device to the speaker while the rest arrives
+      playbackStartMillis = millis();
+      playbackStarting = true;
+    }
 
     char message[100];
-    snprintf(message, 100, "Samplerate: %d, Channels: %d, Format: %d, Bits per Sample: %d, Start: %d", sampleRate, numChannels, (int)Message.Format, bitDepth, offset);
+    snprintf(message, 100, "Samplerate: %d, Channels: %d, Format: %d, Bits per Sample: %d, Start: %d", request.sampleRate, request.numChannels, (int)Message.Format, request.bitDepth, offset);
     publishDebug(message);
-    queueDelay = (sampleRate * numChannels * bitDepth) / 1000;
+    queueDelay = (request.sampleRate * request.numChannels * request.bitDepth) / 1000;
+  }
+
+  if (rejected) {
+    return;
+  }
+  continueCacheTransfer(payload, len, len + index == total);
+  if (playbackDropped) {
+    // stopped before playback started, let I2Stask finish it so playFinished is sent once
+    if (len + index == total && stopPlayback && xEventGroupGetBits(audioGroup) != PLAY) {
+      send_event(PlayBytesEvent());
+    }
+    return;
+  }
+
+  if (cacheTransfer.mode == CacheTransfer::HIT) {
+    // playing from the cache, the rest of the message is only hashed
+    return;
   }
 
   push_i2s_data((uint8_t *)&payload[offset], len - offset);
@@ -541,9 +853,105 @@ void handle_playBytes(const std::string& topicstr, uint8_t *payload, size_t len,
       publishDebug("Send PlayBytesEvent");
       send_event(PlayBytesEvent());
     }
+  }
+}
 
-    std::vector<std::string> topicparts = explode("/", topicstr);
-    finishedMsg = "{\"id\":\"" + topicparts[4] + "\",\"siteId\":\"" + config.siteid + "\",\"sessionId\":null}";
+// hermes/audioServer/SITEID/playBytesStreaming/<requestId>/<chunkIndex>/<isLastChunk>
+void handle_playBytesStreaming(const std::string& topicstr, uint8_t *payload, size_t len, size_t index, size_t total)
+{
+  std::vector<std::string> topicparts = explode("/", topicstr);
+  if (topicparts.size() < 7) {
+    return;
+  }
+  const int chunk = atoi(topicparts[5].c_str());
+  const bool lastChunk = topicparts[6] == "1";
+  size_t offset = 0;
+
+  // first chunk, it opens a session and queues a request of unknown length
+  if (index == 0 && chunk == 0)
+  {
+    if (streamOpen) {
+      streams[streamNumber % STREAM_SESSIONS].ended = true;
+    }
+    streamNumber++;
+    StreamSession &session = streams[streamNumber % STREAM_SESSIONS];
+    session.number = streamNumber;
+    session.bytes = 0;
+    session.ended = false;
+    streamNextChunk = 1;
+
+    XT_Wav_Class Message((const uint8_t *)payload);
+    PlayRequest request;
+    snprintf(request.id, sizeof(request.id), "%s", topicparts[4].c_str());
+    request.sampleRate = Message.SampleRate;
+    request.numChannels = Message.NumChannels;
+    request.bitDepth = Message.BitsPerSample;
+    request.bytes = -1;
+    request.queuedMicros = micros();
+    request.cached = 0;
+    request.dataOffset = Message.DataStart;
+    request.stream = streamNumber;
+    offset = Message.DataStart;
+
+    if (xEventGroupGetBits(audioGroup) != PLAY && uxQueueMessagesWaiting(playQueue) == 0) {
+      audioData.clear();
+      stopPlayback = false;
+    }
+    playbackDropped = xQueueSend(playQueue, &request, 0) != pdTRUE;
+    streamOpen = !playbackDropped;
+    if (playbackDropped) {
+      session.ended = true;
+      publishDebug("Play queue full, stream dropped");
+      publishPlayFinished(request.id);
+      return;
+    }
+    streamCount++;
+
+    char message[100];
+    snprintf(message, 100, "Stream %s, Samplerate: %d, Channels: %d, Bits per Sample: %d", request.id, request.sampleRate, request.numChannels, request.bitDepth);
+    publishDebug(message);
+  }
+  else if (index == 0)
+  {
+    if (!streamOpen) {
+      // stopped, or the first chunk was dropped
+      if (stopPlayback && xEventGroupGetBits(audioGroup) != PLAY) {
+        send_event(PlayBytesEvent());
+      }
+      return;
+    }
+    if (chunk != streamNextChunk) {
+      char message[60];
+      snprintf(message, 60, "Stream chunk %d, expected %d", chunk, streamNextChunk);
+      publishDebug(message);
+    }
+    // Rhasspy sends every chunk as a WAV file of its own
+    if (len >= 44 && memcmp(payload, "RIFF", 4) == 0) {
+      offset = XT_Wav_Class((const uint8_t *)payload).DataStart;
+    }
+    streamNextChunk = chunk + 1;
+  }
+  if (!streamOpen) {
+    return;
+  }
+
+  push_i2s_data((uint8_t *)&payload[offset], len - offset);
+  StreamSession &session = streams[streamNumber % STREAM_SESSIONS];
+  session.bytes += len - offset;
+
+  // end of the chunk
+  if (len + index == total)
+  {
+    if (lastChunk) {
+      session.ended = true;
+      streamOpen = false;
+    }
+    // start to play after the first chunk, the rest follows while it plays
+    if (xEventGroupGetBits(audioGroup) != PLAY)
+    {
+      publishDebug("Send PlayBytesEvent");
+      send_event(PlayBytesEvent());
+    }
   }
 }
 
@@ -593,6 +1001,47 @@ void onMqttMessage(char *topic, char *payload, AsyncMqttClientMessageProperties
           send_event(TtsEvent());
         }
       }
+    } else if (topicstr.find(asrStartListeningTopic.c_str()) != std::string::npos)
+    {
+      std::string payloadstr(payload);
+      StaticJsonDocument<500> doc;
+      DeserializationError err = deserializeJson(doc, payloadstr.c_str());
+      // Check if this is for us
+      if (!err) {
+        JsonObject root = doc.as<JsonObject>();
+        if (root["siteId"] == config.siteid.c_str()) {
+          const char *sessionId = root["sessionId"];
+          asrSessionId = sessionId ? sessionId : "";
+          asrStopOnSilence = root["stopOnSilence"] | true;
+        }
+      }
+    } else if (topicstr.find(stopPlayingTopic.c_str()) != std::string::npos)
+    {
+      publishDebug("Stop playing requested");
+      requestStopPlayback();
+    } else if (topicstr.find(playCachedTopic.c_str()) != std::string::npos)
+    {
+      std::string payloadstr(payload);
+      StaticJsonDocument<300> doc;
+      DeserializationError err = deserializeJson(doc, payloadstr.c_str());
+      if (!err) {
+        JsonObject root = doc.as<JsonObject>();
+        const char *hash = root["hash"];
+        const char *id = root["id"];
+        handle_playCached(hash ? strtoul(hash, NULL, 16) : 0, id ? id : "");
+      }
+    } else if (topicstr.find("hermes/hotword/") != std::string::npos && topicstr.find("/detected") != std::string::npos)
+    {
+      std::string payloadstr(payload);
+      StaticJsonDocument<500> doc;
+      DeserializationError err = deserializeJson(doc, payloadstr.c_str());
+      // a new hotword for this site interrupts the playback
+      if (!err) {
+        JsonObject root = doc.as<JsonObject>();
+        if (root["siteId"] == config.siteid.c_str()) {
+          requestStopPlayback();
+        }
+      }
     } else if (topicstr.find("toggleOff") != std::string::npos)
     {
       std::string payloadstr(payload);
@@ -639,6 +1088,10 @@ void onMqttMessage(char *topic, char *payload, AsyncMqttClientMessageProperties
         }
       }
     }
+    else if (topicstr.find("playBytesStreaming") != std::string::npos)
+    {
+      handle_playBytesStreaming(topicstr, (uint8_t*)payload, len, index, total);
+    }
     else if (topicstr.find("playBytes") != std::string::npos)
     {
       handle_playBytes(topicstr, (uint8_t*)payload, len, index, total);
@@ -725,15 +1178,109 @@ void onMqttMessage(char *topic, char *payload, AsyncMqttClientMessageProperties
         }
         if (root.containsKey("amp_output")) {
             config.amp_output =  (root["amp_output"] == "0") ? AMP_OUT_SPEAKERS : AMP_OUT_HEADPHONE;
+            requestCodecUpdate(CODEC_AMP_OUTPUT);
         }
         if (root.containsKey("gain")) {
           config.gain = (int)root["gain"];
+          requestCodecUpdate(CODEC_GAIN);
         }
         if (root.containsKey("volume")) {
           config.volume = (uint16_t)root["volume"];
+          applyVolumeConfiguration();
         }
-        if (root.containsKey("hotword")) {
-          config.hotword_detection = (root["hotword"] == "local") ? HW_LOCAL : HW_REMOTE;
+        if (root.containsKey("volume_boost")) {
+          config.volume_boost = (int)root["volume_boost"];
+          applyVolumeConfiguration();
+        }
+        // the capture processing is only reloaded when its settings change, a reload restarts it
+        bool agcChanged = false;
+        if (root.containsKey("agc")) {
+          agcChanged |= updateSetting(config.agc, root["agc"] == "true");
+        }
+        if (root.containsKey("agc_target")) {
+          agcChanged |= updateSetting(config.agc_target, (int)root["agc_target"]);
+        }
+        if (root.containsKey("agc_max_gain")) {
+          agcChanged |= updateSetting(config.agc_max_gain, (int)root["agc_max_gain"]);
+        }
+        if (agcChanged) {
+          applyAgcConfiguration();
+        }
+        bool nsChanged = false;
+        if (root.containsKey("ns")) {
+          nsChanged |= updateSetting(config.ns, root["ns"] == "true");
+        }
+        if (root.containsKey("ns_level")) {
+          nsChanged |= updateSetting(config.ns_level, (int)root["ns_level"]);
+        }
+        if (nsChanged) {
+          applyNsConfiguration();
+        }
+        if (root.containsKey("hotword") && updateSetting(config.hotword_detection, (uint16_t)((root["hotword"] == "local") ? HW_LOCAL : HW_REMOTE))) {
+          applyHotwordConfiguration();
+          configChanged = true;
+          wakeLoop();
+        }
+        if (root.containsKey("ww_threshold")) {
+          config.ww_threshold = (int)root["ww_threshold"];
+          wakeWord.setThreshold(config.ww_threshold);
+        }
+        if (root.containsKey("kws_threshold")) {
+          config.kws_threshold = (int)root["kws_threshold"];
+          keywordSpotter.setThreshold(config.kws_threshold);
+        }
+        if (root.containsKey("endpointer")) {
+          config.endpointer = (root["endpointer"] == "true") ? true : false;
+        }
+        bool epChanged = false;
+        if (root.containsKey("ep_silence")) {
+          epChanged |= updateSetting(config.ep_silence, (int)root["ep_silence"]);
+        }
+        if (root.containsKey("ep_max")) {
+          epChanged |= updateSetting(config.ep_max, (int)root["ep_max"]);
+        }
+        if (epChanged) {
+          applyEndpointerConfiguration();
+        }
+        bool bfChanged = false;
+        if (root.containsKey("beamformer")) {
+          bfChanged |= updateSetting(config.beamformer, root["beamformer"] == "true");
+        }
+        if (root.containsKey("beam_azimuth")) {
+          bfChanged |= updateSetting(config.beam_azimuth, (int)root["beam_azimuth"]);
+        }
+        if (bfChanged) {
+          applyBeamformerConfiguration();
+        }
+        bool captureChanged = false;
+        if (root.containsKey("channels")) {
+          captureChanged |= updateSetting(config.channels, (int)root["channels"]);
+        }
+        if (root.containsKey("capture_rate")) {
+          captureChanged |= updateSetting(config.capture_rate, (int)root["capture_rate"]);
+        }
+        if (captureChanged) {
+          applyCaptureConfiguration();
+        }
+        // a reload resets the echo path the filter has learned
+        bool aecChanged = false;
+        if (root.containsKey("aec")) {
+          aecChanged |= updateSetting(config.aec, root["aec"] == "true");
+        }
+        if (root.containsKey("aec_taps")) {
+          aecChanged |= updateSetting(config.aec_taps, (int)root["aec_taps"]);
+        }
+        if (root.containsKey("aec_delay")) {
+          aecChanged |= updateSetting(config.aec_delay, (int)root["aec_delay"]);
+        }
+        if (aecChanged) {
+          applyAecConfiguration();
+        }
+        if (root.containsKey("sound_cache")) {
+          config.sound_cache = (root["sound_cache"] == "true") ? true : false;
+        }
+        if (root.containsKey("drift_correction")) {
+          config.drift_correction = (root["drift_correction"] == "true") ? true : false;
         }
         saveConfiguration(configfile, config);
       } else {
@@ -773,13 +1320,18 @@ void onMqttMessage(char *topic, char *payload, AsyncMqttClientMessageProperties
         if (root["siteId"] == config.siteid.c_str()) {
           // volume is between 0 and 1
           config.volume = (uint16_t)((float)root["volume"] * 100);
+          applyVolumeConfiguration();
           saveConfiguration(configfile, config);
         }
       }
     }
   } else {
     // len + index < total ==> partial message
-    if (topicstr.find("playBytes") != std::string::npos)
+    if (topicstr.find("playBytesStreaming") != std::string::npos)
+    {
+      handle_playBytesStreaming(topicstr, (uint8_t*)payload, len, index, total);
+    }
+    else if (topicstr.find("playBytes") != std::string::npos)
     {
       handle_playBytes(topicstr, (uint8_t*)payload, len, index, total);
     }
@@ -792,96 +1344,493 @@ void onMqttMessage(char *topic, char *payload, AsyncMqttClientMessageProperties
   }
 }
 
+//Rhasspy needs an audiofeed of 512 bytes+header per message
+//Some devices, like the Matrix Voice do 512 16 bit read in one mic read
+//This is 1024 bytes, so two message are needed in that case
+void publishAudioFrames(const uint8_t *data, size_t bytes) {
+  const uint32_t start = ESP.getCycleCount();
+  AudioBlock payloadBlock;
+  uint8_t *payload = payloadBlock.get();
+  for (size_t offset = 0; offset < bytes; offset += AUDIO_FRAME_BYTES) {
+    const size_t messageBytes = bytes - offset < AUDIO_FRAME_BYTES ? bytes - offset : AUDIO_FRAME_BYTES;
+    memcpy(payload, &header, sizeof(header));
+    if (messageBytes != AUDIO_FRAME_BYTES) {
+      // a shorter last message needs its own lengths
+      wavfile_header *shortHeader = (wavfile_header *)payload;
+      shortHeader->riff_length = sizeof(header) - 8 + messageBytes;
+      shortHeader->data_length = messageBytes;
+    }
+    memcpy(&payload[sizeof(header)], &data[offset], messageBytes);
+    audioServer.publish(audioFrameTopic.c_str(), payload, sizeof(header) + messageBytes);
+    captureStats.messages++;
+    captureStats.bytes += sizeof(header) + messageBytes;
+  }
+  captureStats.publish.add(ESP.getCycleCount() - start);
+}
+
+// Switch between capture and playback, the time of actual mode changes goes to the telemetry
+void switchDeviceMode(DeviceMode target) {
+  const DeviceMode before = device->currentMode();
+  const unsigned long start = micros();
+  xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
+  if (target == MODE_SPK) {
+    device->setWriteMode(sampleRate, bitDepth, numChannels);
+  } else {
+    device->setReadMode();
+  }
+  xSemaphoreGive(wbSemaphore); 
+  if (device->currentMode() != before) {
+    modeSwitchStats.add(micros() - start);
+  }
+}
+
+// Capture during playback: remove the echo and, where barge-in is enabled, look for the
+// wake word. Returns true when the wake word was heard
+bool captureWhilePlaying(bool &detecting) {
+  AudioBlock block;
+  int16_t *samples = block.as<int16_t>();
+  xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
+  const bool read = device->readAudio((uint8_t *)samples, device->readSize * device->width);
+  xSemaphoreGive(wbSemaphore); 
+  if (!read) {
+    return false;
+  }
+  const uint32_t start = ESP.getCycleCount();
+  echoCanceller.process(samples, device->readSize);
+  aecStats.add(ESP.getCycleCount() - start);
+  if (!bargeInEnabled || config.hotword_detection != HW_LOCAL || !wakeWord.isReady()) {
+    return false;
+  }
+  if (!detecting) {
+    detecting = true;
+    wakeWord.reset();
+  }
+  if (wakeWord.process(samples, device->readSize)) {
+    wakeWordDetections++;
+    bargeIns++;
+    bargeIn = true;
+    wakeLoop();
+    return true;
+  }
+  return false;
+}
+
+// A request that has been written, playFinished is published once the DAC has played it
+struct PendingFinish {
+  bool pending = false;
+  char id[PLAY_ID_SIZE];
+  unsigned long deadline = 0;
+};
+
+void checkPendingFinish(PendingFinish &finish, bool now) {
+  if (finish.pending && (now || (long)(micros() - finish.deadline) >= 0)) {
+    finish.pending = false;
+    publishPlayFinished(finish.id);
+  }
+}
+
+uint32_t pendingOutputMicros() {
+  xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
+  const uint32_t pending = device->pendingOutputFrames();
+  xSemaphoreGive(wbSemaphore); 
+  return sampleRate > 0 ? (uint64_t)pending * 1000000 / sampleRate : 0;
+}
+
+// wait until the queued audio has left the DAC
+void waitForOutputDrain() {
+  const unsigned long drainStart = micros();
+  while (!stopPlayback && micros() - drainStart < PLAYBACK_DRAIN_TIMEOUT_MS * 1000UL) {
+    const uint32_t ms = pendingOutputMicros() / 1000;
+    if (ms == 0) {
+      break;
+    }
+    vTaskDelay(pdMS_TO_TICKS(ms < PLAYBACK_DRAIN_POLL_MS ? ms : PLAYBACK_DRAIN_POLL_MS));
+  }
+  drainStats.add(micros() - drainStart);
+}
+
+// Play the PCM data of one request from audioData, false when the playback was stopped
+bool playRequest(const PlayRequest &request, bool &detecting, PendingFinish &finish) {
+  size_t bytes_written;
+  long played = 0;
+  File file;
+  if (request.cached) {
+    char path[20];
+    soundCachePath(request.cached, path, sizeof(path));
+    file = SPIFFS.open(path);
+    if (!file || !file.seek(request.dataOffset)) {
+      publishDebug("Cached sound missing");
+      return true;
+    }
+  }
+  // a stream only has a length once its last chunk is in
+  StreamSession *session = request.stream ? &streams[request.stream % STREAM_SESSIONS] : NULL;
+  if (session && session->number != request.stream) {
+    publishDebug("Stream session overwritten");
+    return true;
+  }
+  // keep capturing while playing when the played audio can serve as echo reference
+  const bool duplex = echoCanceller.isEnabled() && !config.mute_input && sampleRate == device->rate &&
+                      bitDepth == 16 && (numChannels == 1 || numChannels == 2);
+
+  unsigned long lastDataMillis = millis();
+  const int frameSamples = numChannels < 1 ? 1 : (numChannels > Concealer::MAX_CHANNELS ? Concealer::MAX_CHANNELS : numChannels);
+  uint16_t carry[Concealer::MAX_CHANNELS];
+  int carried = 0;
+  bool sounded = false;
+  concealer.configure(frameSamples, sampleRate);
+  // a stream is paced by the clock of its sender, it is resampled to the clock of the DAC
+  const bool drifting = session && config.drift_correction;
+  driftCorrector.configure(frameSamples, sampleRate);
+  softVolume.configure(frameSamples, sampleRate);
+  while (!stopPlayback)
+  {
+    const bool streaming = session && !session->ended;
+    const long length = session ? session->bytes : request.bytes;
+    if (!streaming && played >= length) {
+      break;
+    }
+    if (!file && millis() - lastDataMillis > PLAYBACK_DATA_TIMEOUT_MS) {
+      publishDebug("Playback timed out waiting for audio");
+      if (streaming) {
+        session->ended = true;
+        streamOpen = false;
+      }
+      break;
+    }
+    checkPendingFinish(finish, false);
+    xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
+    device->animate(current_colors, config.animation);
+    xSemaphoreGive(wbSemaphore); 
+    // in duplex mode every write covers one capture block, the capture paces the loop
+    const int blockBytes = duplex ? device->readSize * numChannels * 2 : device->writeSize;
+    int bytes_to_write = blockBytes;
+    if (!streaming && length - played < blockBytes)
+    {
+      bytes_to_write = length - played;
+    }
+    AudioBlock block;
+    uint16_t *data = block.as<uint16_t>();
+    if (file) {
+      bytes_to_write = file.read((uint8_t *)data, bytes_to_write) & ~1;
+      if (bytes_to_write == 0) {
+        break;
+      }
+    }
+    int samples = bytes_to_write / 2;
+    long consumed = 0;
+    if (drifting) {
+      if (streaming) {
+        driftCorrector.update(audioData.size() / 2 / frameSamples, micros());
+      }
+      const int blockFrames = bytes_to_write / 2 / frameSamples;
+      int frames = 0;
+      while (frames < blockFrames) {
+        if (!driftCorrector.needsInput()) {
+          driftCorrector.output((int16_t *)&data[frames * frameSamples]);
+          frames++;
+          continue;
+        }
+        while (carried < frameSamples && audioData.pop(carry[carried])) {
+          carried++;
+        }
+        if (carried < frameSamples) {
+          break;
+        }
+        driftCorrector.input((const int16_t *)carry);
+        consumed += frameSamples * 2;
+        carried = 0;
+      }
+      samples = frames * frameSamples;
+    } else if (!file) {
+      // whole frames only, a frame that is only partly in is finished in the next block
+      samples = carried;
+      memcpy(data, carry, carried * sizeof(uint16_t));
+      while (samples < bytes_to_write / 2 && audioData.pop(data[samples])) {
+        samples++;
+      }
+      carried = samples < bytes_to_write / 2 ? samples % frameSamples : 0;
+      samples -= carried;
+      memcpy(carry, &data[samples], carried * sizeof(uint16_t));
+    }
+    if (samples == 0 && !sounded) {
+      // nothing to play yet
+      vTaskDelay(pdMS_TO_TICKS(STREAM_POLL_MS));
+      continue;
+    }
+    if (samples > 0) {
+      lastDataMillis = millis();
+      if (!sounded) {
+        firstSoundStats.add(micros() - request.queuedMicros);
+        sounded = true;
+      }
+      concealer.resume((int16_t *)data, samples);
+      concealer.push((const int16_t *)data, samples);
+    }
+    if (samples < bytes_to_write / 2) {
+      if (stopPlayback) {
+        bytes_to_write = samples * 2;
+      } else {
+        // keep the DAC fed until the audio is back, the gap is filled from what played last
+        if (!concealer.concealing() && !streaming) {
+          char message[100];
+          snprintf(message, 100, "Buffer underflow %ld %ld", played + samples * 2, length);
+          publishDebug(message);
+        }
+        concealer.conceal((int16_t *)&data[samples], bytes_to_write / 2 - samples);
+        concealer.push((const int16_t *)&data[samples], bytes_to_write / 2 - samples);
+      }
+    }
+    if (bytes_to_write == 0) {
+      continue;
+    }
+    played = played + (drifting ? consumed : samples * 2);
+    // devices without a hardware volume are turned down here, in place
+    softVolume.process((int16_t *)data, bytes_to_write / 2 / frameSamples);
+    if (duplex) {
+      echoCanceller.pushReference((const int16_t *)data, bytes_to_write / (2 * numChannels), numChannels);
+    }
+    if (!config.mute_output)
+    {
+      xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
+      device->muteOutput(false);
+      device->writeAudio((uint8_t*)data, bytes_to_write, &bytes_written);
+      xSemaphoreGive(wbSemaphore);
+    }
+    else
+    {
+      bytes_written = bytes_to_write;
+      if (samples * 2 < bytes_to_write) {
+        // nothing paces the loop while the gap lasts
+        vTaskDelay(pdMS_TO_TICKS(bytes_to_write / 2 / frameSamples * 1000 / sampleRate));
+      }
+    }
+    if (bytes_written != bytes_to_write) {
+      char message[100];
+      snprintf(message, 100, "Bytes to write %d, but bytes written %d", bytes_to_write, bytes_written);
+      publishDebug(message);
+    }
+    if (duplex && captureWhilePlaying(detecting)) {
+      // barge-in, the rest of the audio is dropped
+      publishDebug("Barge-in, playback stopped");
+      requestStopPlayback();
+    }
+  }
+  return !stopPlayback;
+}
+
 void I2Stask(void *p) {  
+  bool detecting = false;
+  uint32_t utterance = endpointerSession;
+  int channels = 1;
+  int rate = device->rate;
   while (1) {    
-    if (xEventGroupGetBits(audioGroup) == PLAY) {
-      size_t bytes_written;
-      boolean timeout = false;
-      int played = 44;
-
+    reloadCaptureSettings();
+    if (rate != captureRate) {
+      rate = captureRate;
       xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
-      device->setWriteMode(sampleRate, bitDepth, numChannels);
+      const bool supported = device->setCaptureRate(rate);
       xSemaphoreGive(wbSemaphore); 
-
-      while (played < message_size && timeout == false)
-      {
+      if (!supported) {
+        char message[60];
+        snprintf(message, sizeof(message), "Capture rate %d not supported, using %d", rate, device->rate);
+        publishDebug(message);
+      }
+      // everything that depends on the rate, reloaded below
+      applyAgcConfiguration();
+      applyNsConfiguration();
+      applyEndpointerConfiguration();
+      applyBeamformerConfiguration();
+      applyAecConfiguration();
+      reloadCaptureSettings();
+      initHeader(AUDIO_FRAME_BYTES, device->width, device->rate, channels);
+    }
+    if (wakeWordReload) {
+      wakeWordReload = false;
+      loadWakeWordModels();
+    }
+    if (aecReload) {
+      aecReload = false;
+      echoCanceller.configure(config.aec_taps, config.aec_delay * device->rate / 1000);
+      echoCanceller.setEnabled(config.aec && device->fullDuplexSupported());
+      aecStats.setBudget(AEC_CPU_BUDGET_PERCENT);
+      aecStats.reset();
+    }
+    if (beamformerReload) {
+      beamformerReload = false;
+      xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
+      device->setBeamformer(config.beamformer && device->beamformerSupported(), config.beam_azimuth);
+      xSemaphoreGive(wbSemaphore); 
+      bfStats.setBudget(BF_CPU_BUDGET_PERCENT);
+      bfStats.reset();
+    }
+    if (channels != captureChannels) {
+      channels = captureChannels;
+      initHeader(AUDIO_FRAME_BYTES, device->width, device->rate, channels);
+    }
+    if (xEventGroupGetBits(audioGroup) == PLAY) {
+      playbackStarting = false;
+      PlayRequest request;
+      PendingFinish finish;
+      bool first = true;
+      bool stopped = false;
+      while (!stopPlayback && xQueueReceive(playQueue, &request, 0) == pdTRUE) {
+        (first ? startStats : queueStats).add(micros() - request.queuedMicros);
+        const bool formatChanged = request.sampleRate != sampleRate || request.numChannels != numChannels ||
+                                   request.bitDepth != bitDepth;
+        if (!first && formatChanged) {
+          // the clock changes, let the previous request play out first
+          waitForOutputDrain();
+          checkPendingFinish(finish, true);
+        }
+        sampleRate = request.sampleRate;
+        numChannels = request.numChannels;
+        bitDepth = request.bitDepth;
+        if (first || formatChanged) {
+          switchDeviceMode(MODE_SPK);
+        }
+        if (first) {
+          echoCanceller.reset();
+          detecting = false;
+        } else {
+          gapStats.add((long)(micros() - finish.deadline) > 0 ? micros() - finish.deadline : 0);
+        }
+        first = false;
+        if (!playRequest(request, detecting, finish)) {
+          stopped = true;
+          break;
+        }
+        // playFinished follows when the DAC has played the request
+        checkPendingFinish(finish, true);
+        snprintf(finish.id, sizeof(finish.id), "%s", request.id);
+        finish.deadline = micros() + pendingOutputMicros();
+        finish.pending = true;
+      }
+      detecting = false;
+      if (!stopPlayback && !config.mute_output) {
+        waitForOutputDrain();
+      }
+      if (stopPlayback) {
+        // drop what is still queued in the DMA buffers or FIFO
         xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
-        device->animate(current_colors, config.animation);
+        device->flushOutput();
         xSemaphoreGive(wbSemaphore); 
-        int bytes_to_write = device->writeSize;
-        if (message_size - played < device->writeSize)
-        {
-          bytes_to_write = message_size - played;
+        stopStats.add(micros() - stopRequestMicros);
+        publishDebug("Playback stopped");
+      }
+      checkPendingFinish(finish, true);
+      if (stopPlayback) {
+        // the stopped request and everything queued behind it are finished as well
+        if (stopped) {
+          publishPlayFinished(request.id);
         }
-        uint16_t data[bytes_to_write/2];
-        if (!timeout)
-        {
-          for (int i = 0; i < bytes_to_write/2; i++)
-          {
-            if (!audioData.pop(data[i]))
-            {
-              char message[100];
-              snprintf(message, 100, "Buffer underflow %d %ld", played + i, message_size);
-              publishDebug(message);
-              vTaskDelay(60);
-              bytes_to_write = (i)*2;
-            }
-          }
-          played = played + bytes_to_write;
-          if (!config.mute_output)
-          {
-            xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
-            device->muteOutput(false);
-            device->writeAudio((uint8_t*)data, bytes_to_write, &bytes_written);
-            xSemaphoreGive(wbSemaphore);
-          }
-          else
-          {
-            bytes_written = bytes_to_write;
-          }
-            if (bytes_written != bytes_to_write) {
-              char message[100];
-              snprintf(message, 100, "Bytes to write %d, but bytes written %d", bytes_to_write, bytes_written);
-              publishDebug(message);
-          }
+        while (xQueueReceive(playQueue, &request, 0) == pdTRUE) {
+          publishPlayFinished(request.id);
         }
+        audioData.clear();
       }
-      asyncClient.publish(playFinishedTopic.c_str(), 0, false, finishedMsg.c_str());
       xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
       device->muteOutput(true);
       xSemaphoreGive(wbSemaphore); 
-      audioData.clear();
+      stopPlayback = false;
 
       publishDebug("Done");
       publishDebug("Send StreamAudioEvent");
       send_event(StreamAudioEvent());
+      if (uxQueueMessagesWaiting(playQueue) > 0) {
+        // a request came in while the last one played out
+        publishDebug("Send PlayBytesEvent");
+        send_event(PlayBytesEvent());
+      }
     }
-    if (xEventGroupGetBits(audioGroup) == STREAM && !config.mute_input) {     
-      xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
-      device->setReadMode();
-      xSemaphoreGive(wbSemaphore); 
-      uint8_t data[device->readSize * device->width];
-      if (audioServer.connected()) {
+    // playback is about to start, get the speaker ready instead of capturing
+    const bool preparing = playbackStarting && millis() - playbackStartMillis < PLAYBACK_PREPARE_TIMEOUT_MS;
+    if (preparing && device->currentMode() == MODE_MIC) {
+      switchDeviceMode(MODE_SPK);
+    }
+    if (xEventGroupGetBits(audioGroup) == STREAM && !config.mute_input && !preparing) {     
+      switchDeviceMode(MODE_MIC);
+      const int readBytes = device->readSize * device->width;
+      AudioBlock block;
+      uint8_t *data = block.get();
+      if (audioServer.connected() && channels > 1 && !localDetection) {
+        // raw microphones for processing on the server, the device does not touch them
         xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
-        if (device->readAudio(data, device->readSize * device->width)) {
-          // only send audio if hotword_detection is HW_REMOTE.
-          //TODO when LOCAL is supported: check if hotword is detected and send audio as well in that case
-          // if (config.hotword_detection == HW_REMOTE)
-          {
-            //Rhasspy needs an audiofeed of 512 bytes+header per message
-            //Some devices, like the Matrix Voice do 512 16 bit read in one mic read
-            //This is 1024 bytes, so two message are needed in that case
-            const int messageBytes = 512;
-            uint8_t payload[sizeof(header) + messageBytes];
-            const int message_count = sizeof(data) / messageBytes;
-            for (int i = 0; i < message_count; i++) {
-              memcpy(payload, &header, sizeof(header));
-              memcpy(&payload[sizeof(header)], &data[messageBytes * i], messageBytes);
-              audioServer.publish(audioFrameTopic.c_str(),(uint8_t *)payload, sizeof(payload));
+        const size_t rawBytes = device->readRawAudio(data, AUDIO_BLOCK_SIZE);
+        captureStats.busReads += device->captureBusReads();
+        captureStats.read.add(device->captureCycles());
+        xSemaphoreGive(wbSemaphore); 
+        if (rawBytes > 0) {
+          publishAudioFrames(data, rawBytes);
+        }
+      } else if (audioServer.connected()) {
+        // only the read holds the bus, the LEDs and the codec are not kept waiting for the processing
+        xSemaphoreTake(wbSemaphore, portMAX_DELAY); 
+        const bool read = device->readAudio(data, readBytes);
+        const uint32_t busReads = device->captureBusReads();
+        const uint32_t readCycles = device->captureCycles();
+        const uint32_t beamformerCycles = device->beamformerCycles();
+        xSemaphoreGive(wbSemaphore); 
+        if (read) {
+          const unsigned long now = micros();
+          const unsigned long blockMicros = (unsigned long)device->readSize * 1000000UL / device->rate;
+          const unsigned long interval = now - lastCaptureMicros;
+          if (interval < CAPTURE_GAP_BLOCKS * blockMicros) {
+            jitterStats.add(interval > blockMicros ? interval - blockMicros : blockMicros - interval);
+          }
+          lastCaptureMicros = now;
+          captureStats.busReads += busReads;
+          captureStats.read.add(readCycles);
+          if (config.beamformer) {
+            bfStats.add(beamformerCycles);
+          }
+          if (noiseSuppressor.isEnabled()) {
+            uint32_t start = ESP.getCycleCount();
+            noiseSuppressor.process((int16_t *)data, device->readSize);
+            nsStats.add(ESP.getCycleCount() - start);
+          }
+          // before the AGC, which would lift the noise floor during pauses
+          if (endpointing && endOfSpeech == Endpointer::NONE) {
+            if (utterance != endpointerSession) {
+              utterance = endpointerSession;
+              endpointer.reset();
+            }
+            const int result = endpointer.process((const int16_t *)data, device->readSize);
+            if (result != Endpointer::NONE) {
+              epStats.results[result]++;
+              if (result == Endpointer::END_OF_SPEECH) {
+                epStats.endDelayMs += endpointer.elapsedMs() - endpointer.speechEndMs();
+              }
+              endOfSpeech = result;
+              wakeLoop();
+            }
+          }
+          agc.process((int16_t *)data, device->readSize);
+          if (localDetection) {
+            // HW_LOCAL in Idle: the audio stays on the device, Idle starts the session on a detection
+            if (!detecting) {
+              detecting = true;
+              wakeWord.reset();
             }
+            if (wakeWord.isReady()) {
+              const uint32_t inferences = keywordSpotter.inferenceCount();
+              uint32_t start = ESP.getCycleCount();
+              if (wakeWord.process((const int16_t *)data, device->readSize)) {
+                wakeWordDetections++;
+                wakeWordDetected = true;
+                wakeLoop();
+              }
+              const uint32_t cycles = ESP.getCycleCount() - start;
+              wwStats.add(cycles);
+              if (keywordSpotter.inferenceCount() != inferences) {
+                kwsStats.add(cycles);
+              }
+            }
+          } else if (!endpointing || endOfSpeech == Endpointer::NONE) {
+            detecting = false;
+            publishAudioFrames(data, readBytes);
           }
         }
-        xSemaphoreGive(wbSemaphore); 
       }
     }
 
@@ -900,8 +1849,26 @@ void I2Stask(void *p) {
       xEventGroupClearBits(audioGroup, STREAM|PLAY); 
       send_event(MQTTDisconnectedEvent());
     }
-    //Added for stability when neither PLAY or STREAM is set.
-    vTaskDelay(10);
+    if (millis() - lastTelemetry > TELEMETRY_INTERVAL_MS) {
+      lastTelemetry = millis();
+      if (asyncClient.connected()) {
+        publishTelemetry();
+        publishTaskStats();
+      }
+    }
+
+    //Report the stack usage when it reaches a new high, used to size I2S_TASK_STACK_SIZE
+    UBaseType_t highWater = uxTaskGetStackHighWaterMark(NULL);
+    if (highWater < i2sStackHighWater) {
+      i2sStackHighWater = highWater;
+      char message[100];
+      snprintf(message, 100, "I2Stask stack high water mark: %d bytes free of %d%s", (int)highWater, I2S_TASK_STACK_SIZE,
+        highWater < I2S_TASK_STACK_MIN_FREE ? ", raise I2S_TASK_STACK_SIZE" : "");
+      publishDebug(message);
+    }
+
+    //Added for stability when neither PLAY or STREAM is set. A changed setting ends the wait early
+    ulTaskNotifyTake(pdTRUE, 10);
 
   }  
   vTaskDelete(NULL);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <map>
+#include "AudioBlockPool.h"
 
 int hotword_colors[4] = {0, 255, 0, 0};
 int idle_colors[4] = {0, 0, 255, 0};
@@ -55,6 +56,32 @@ class Device {
   protected:
      // for derived classes which switch between read and write mode, we store there which mode is active. Otherwise it should remain as MODE_UNUSED
     DeviceMode mode = MODE_UNUSED; 
+    // estimate of the output queue for devices that cannot read the fill of their DMA buffers,
+    // call queueOutputFormat in setWriteMode and queueOutput after every write
+    uint32_t queuedFrames = 0;
+    uint32_t queueCapacity = 0;
+    unsigned long queuedMicros = 0;
+    int queueRate = 0;
+    int queueFrameBytes = 1;
+    void queueOutputFormat(int sampleRate, int frameBytes, uint32_t capacityFrames) {
+      queueRate = sampleRate;
+      queueFrameBytes = frameBytes > 0 ? frameBytes : 1;
+      queueCapacity = capacityFrames;
+      queuedFrames = 0;
+    };
+    void queueOutput(size_t bytes) {
+      // a write returns as soon as its data fits, so the queue never holds more than the DMA buffers
+      const uint32_t frames = estimatedOutputFrames() + bytes / queueFrameBytes;
+      queuedFrames = frames > queueCapacity ? queueCapacity : frames;
+      queuedMicros = micros();
+    };
+    uint32_t estimatedOutputFrames() {
+      if (queueRate <= 0) {
+        return 0;
+      }
+      const uint64_t played = (uint64_t)(micros() - queuedMicros) * queueRate / 1000000;
+      return played >= queuedFrames ? 0 : queuedFrames - (uint32_t)played;
+    };
   public:
      //You can init your device here if needed
     virtual void init() {};
@@ -80,16 +107,52 @@ class Device {
     //Override these two methods to read and write
     virtual void writeAudio(uint8_t *data, size_t size, size_t *bytes_written) {};
     virtual bool readAudio(uint8_t *data, size_t size) {return false;};
+    //Drop the audio that is queued for output but not played yet, used when playback is stopped
+    virtual void flushOutput() {};
+    //Frames written but not played by the DAC yet. Override if the device can read its output buffer
+    virtual uint32_t pendingOutputFrames() { return estimatedOutputFrames(); };
+    //Reads of the output buffer status by devices that pace their writes by it
+    virtual uint32_t outputStatusReads() { return 0; };
     //Some devices cause a noise, even when no sound is played. override this to fix it
     virtual void muteOutput(bool mute) {};
     //Some devices have multiple outputs (jack/speeker)
     virtual void ampOutput(int output) {};
-    //Some devices support settings of volume
+    //Some devices support settings of volume, return true from volumeSupported when yours does,
+    //otherwise the volume is applied in software
     virtual void setVolume(uint16_t volume) {};
+    virtual bool volumeSupported() { return false; };
     //Possiblity to set gain
     virtual void setGain(uint16_t gain) {};
-    //You can use this method to activated the hotword state (i.e. a hardware button)
+    //Devices with a codec on I2C count the register writes sent and the ones skipped because nothing changed
+    virtual uint32_t codecWrites() { return 0; };
+    virtual uint32_t codecWritesSkipped() { return 0; };
+    //Devices with a hardware button return its GPIO (active low), it is handled by an interrupt
+    virtual int hotwordButtonPin() { return -1; };
+    //Devices without a button pin can use this method to activate the hotword state, it is polled
     virtual bool isHotwordDetected() {return false;};
+    //Devices with a microphone array can beamform on the device and estimate the direction of arrival
+    virtual bool beamformerSupported() { return false; };
+    //azimuth in degrees, -1 to follow the direction of arrival
+    virtual void setBeamformer(bool enabled, int azimuth) {};
+    //keep the beam where it is, i.e. while a command is recorded
+    virtual void holdBeam(bool hold) {};
+    //estimated azimuth in degrees, -1 if unknown
+    virtual int directionOfArrival(float *confidence) { return -1; };
+    //cycles spent beamforming in the last readAudio
+    virtual uint32_t beamformerCycles() { return 0; };
+    //Devices with separate microphone and speaker ports can capture while playing, for echo cancellation
+    virtual bool fullDuplexSupported() { return false; };
+    //Number of microphones that can be streamed without mixing them down. Override readRawAudio as well
+    virtual int rawChannels() { return 1; };
+    //Read interleaved samples of all rawChannels(), at most size bytes of whole frames. Returns the number of bytes read
+    virtual size_t readRawAudio(uint8_t *data, size_t size) { return 0; };
+    //Devices that capture at other rates than 16 kHz list them here and change rate in setCaptureRate
+    virtual bool captureRateSupported(int sampleRate) { return sampleRate == 16000; };
+    //Change the capture rate and return true, false if the rate is not supported
+    virtual bool setCaptureRate(int sampleRate) { return captureRateSupported(sampleRate); };
+    //Bus reads and cycles of the last readAudio or readRawAudio, for devices that read their microphones over a bus
+    virtual uint32_t captureBusReads() { return 0; };
+    virtual uint32_t captureCycles() { return 0; };
 
     // how many different output configurations does this devices support (1 = single output channel, 2 = 2 output channels, i.e. speaker or headphone, 3 = speaker, headphone, speaker + headphone)
     virtual int numAmpOutConfigurations() { return 2; };
@@ -98,8 +161,12 @@ class Device {
     virtual bool runningSupported() { return false; };
     virtual bool pulsingSupported() { return false; };
     virtual bool blinkingSupported() { return false; };
+    //Current I2S direction, MODE_UNUSED for devices that do not switch
+    DeviceMode currentMode() { return mode; };
     //
-    //You can override these in your device
+    //Set these in the constructor of your device, do not declare them again. Define DEVICE_READ_SIZE and
+    //DEVICE_WRITE_SIZE as well when you change them, these are used to size the audio block pool.
+    //Declare your device class final, the compiler then calls its methods directly
     int readSize = 256;
     int writeSize = 256;
     int width = 2;
@@ -1,6 +1,7 @@
 #pragma once
 #include <Arduino.h>
 #include <device.h>
+#include <tasks.h>
 
 #include <driver/i2s.h>
 #include <AC101.h>
@@ -105,7 +106,10 @@ const A1S_Pinouts a1s_pinouts[] = {
 
 #define SPEAKER_I2S_NUMBER I2S_NUM_0
 
-class AudioKit : public Device
+// AC101 uses a 1024 byte write size, see init()
+#define DEVICE_WRITE_SIZE (256 << 2)
+
+class AudioKit final : public Device
 {
 public:
   AudioKit();
@@ -116,15 +120,20 @@ public:
   void setWriteMode(int sampleRate, int bitDepth, int numChannels);
 
   void writeAudio(uint8_t *data, size_t size, size_t *bytes_written);
+  void flushOutput();
   bool readAudio(uint8_t *data, size_t size);
+  int rawChannels() { return is_es ? 2 : 1; };
+  bool fullDuplexSupported() { return is_es; };
+  size_t readRawAudio(uint8_t *data, size_t size);
 
   void muteOutput(bool mute);
 
   // ESP-Audio-Kit has speaker and headphone as outputs
   void ampOutput(int output);
   void setVolume(uint16_t volume);
+  bool volumeSupported() { return true; };
 
-  bool isHotwordDetected();
+  int hotwordButtonPin() { return key_listen; };
 
   int numAmpOutConfigurations()
   {
@@ -132,14 +141,25 @@ public:
   };
   void updateBrightness(int brightness);
 
+  uint32_t codecWrites() { return is_es ? es8388.transactions() : ac_writes; };
+  uint32_t codecWritesSkipped() { return is_es ? es8388.skippedWrites() : ac_skipped; };
+
   const i2s_pin_config_t &getPinConfig()
   {
     return a1s_pinouts[variant].i2s;
   }
 
 private:
+  void InitI2S();
   void InitI2SSpeakerOrMic(int mode);
+  void acVolumeSpeaker(uint8_t vol);
+  void acVolumeHeadphone(uint8_t vol);
   AC101 ac;
+  // the last volumes written to the AC101, -1 when unknown
+  int ac_spk_vol = -1;
+  int ac_hp_vol = -1;
+  uint32_t ac_writes = 0;
+  uint32_t ac_skipped = 0;
   ES8388Control es8388;
 
   uint8_t out_vol;
@@ -148,9 +168,11 @@ private:
   A1SVariant variant = UNIDENTIFIED;
   bool is_es = false;
   bool is_mono_stream_stereo_out = false;
+  bool i2s_installed = false;
+  uint32_t dmaFrames = 0;
   uint16_t key_listen;
 
-  IndicatorLight *indicator_light = new IndicatorLight(LED_STREAM, true);
+  IndicatorLight *indicator_light = new IndicatorLight(LED_STREAM, true, 12, INDICATOR_TASK_CORE, INDICATOR_TASK_PRIORITY);
 };
 
 AudioKit::AudioKit(){};
@@ -190,7 +212,7 @@ void AudioKit::init()
 
   if (!is_es) {
     // AC101 use 256 byte DMA buffer when writing
-    writeSize = 256 << 2;
+    writeSize = DEVICE_WRITE_SIZE;
   }
 
   // LEDs
@@ -256,28 +278,29 @@ void AudioKit::updateColors(StateColors colors)
   }
 };
 
-void AudioKit::InitI2SSpeakerOrMic(int mode)
+/**
+ * @brief installs the I2S driver for both directions, once. Switching between speaker and mic
+ * then only changes the clock and the codec settings, reinstalling the driver took tens of
+ * milliseconds and caused pops.
+ */
+void AudioKit::InitI2S()
 {
-  Serial.printf("InitI2SSpeakerOrMic -> %s\n", mode == MODE_MIC ? "Mic" : "Speaker");
   esp_err_t err = ESP_OK;
 
-  i2s_driver_uninstall(SPEAKER_I2S_NUMBER);
+  const int dmaSize = this->readSize > this->writeSize ? this->readSize : this->writeSize;
   i2s_config_t i2s_config = {
-      .mode = (i2s_mode_t)(I2S_MODE_MASTER),
+      .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_TX),
       .sample_rate = 16000,
       .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT, // is fixed at 16bit, stereo, MSB
       .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
       .communication_format = i2s_comm_format_t(I2S_COMM_FORMAT_I2S | I2S_COMM_FORMAT_I2S_MSB),
       .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
       .dma_buf_count = 8,
-      .dma_buf_len = (((mode == MODE_MIC) ? this->readSize : this->writeSize) * (is_es ? 2 : 1)) / 4,
+      .dma_buf_len = (dmaSize * (is_es ? 2 : 1)) / 4,
   };
-  if (mode == MODE_MIC) {
-    i2s_config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX);
-  } else {
-    i2s_config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX);
-    i2s_config.tx_desc_auto_clear = true;
-  }
+  // the speaker plays silence while nothing is written
+  i2s_config.tx_desc_auto_clear = true;
+  dmaFrames = i2s_config.dma_buf_count * i2s_config.dma_buf_len;
 
   err += i2s_driver_install(SPEAKER_I2S_NUMBER, &i2s_config, 0, NULL);
 
@@ -287,14 +310,42 @@ void AudioKit::InitI2SSpeakerOrMic(int mode)
     // ES8388Control requires MCLK output.
     PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO0_U, FUNC_GPIO0_CLK_OUT1);
     WRITE_PERI_REG(PIN_CTRL, 0xFFF0);
+  }
+  if (err != ESP_OK) {
+    Serial.printf("Failed installing I2S driver: %d\n", err);
+  }
+  i2s_installed = true;
+}
 
+void AudioKit::InitI2SSpeakerOrMic(int mode)
+{
+  Serial.printf("InitI2SSpeakerOrMic -> %s\n", mode == MODE_MIC ? "Mic" : "Speaker");
+  if (!i2s_installed) {
+    InitI2S();
+  }
+
+  if (mode == MODE_MIC) {
+    i2s_set_clk(SPEAKER_I2S_NUMBER, 16000, I2S_BITS_PER_SAMPLE_16BIT, is_es ? I2S_CHANNEL_STEREO : I2S_CHANNEL_MONO);
+    // drop what the mic picked up while playing, it is not what the user said
+    AudioBlock block;
+    size_t bytes_read = 0;
+    for (int i = 0; i < 32; i++) {
+      i2s_read(SPEAKER_I2S_NUMBER, block.get(), readSize * width * (is_es ? 2 : 1), &bytes_read, 0);
+      if (bytes_read == 0) {
+        break;
+      }
+    }
+  } else {
+    i2s_zero_dma_buffer(SPEAKER_I2S_NUMBER);
+  }
+
+  if (is_es) {
     if (mode == MODE_MIC) {
       es8388.setALCmode(VOICE);
     } else {
       es8388.setALCmode(DISABLE);
     }
   }
-  return;
 }
 
 void AudioKit::setWriteMode(int sampleRate, int bitDepth, int numChannels)
@@ -313,6 +364,7 @@ void AudioKit::setWriteMode(int sampleRate, int bitDepth, int numChannels)
     }
     // ES8388Control is never put into mono mode, hence we have to handle this case
     is_mono_stream_stereo_out = is_es && numChannels == 1;
+    queueOutputFormat(sampleRate, bitDepth / 8 * numChannels, dmaFrames);
   }
 }
 
@@ -320,13 +372,18 @@ void AudioKit::setReadMode()
 {
   if (mode != MODE_MIC) {
     InitI2SSpeakerOrMic(MODE_MIC);
-
-    i2s_set_clk(SPEAKER_I2S_NUMBER, 16000, I2S_BITS_PER_SAMPLE_16BIT, is_es ? I2S_CHANNEL_STEREO : I2S_CHANNEL_MONO);
-
     mode = MODE_MIC;
   }
 }
 
+void AudioKit::flushOutput()
+{
+  if (mode == MODE_SPK) {
+    i2s_zero_dma_buffer(SPEAKER_I2S_NUMBER);
+  }
+  queuedFrames = 0;
+}
+
 void AudioKit::writeAudio(uint8_t *data, size_t size, size_t *bytes_written)
 {
   if (is_mono_stream_stereo_out == false) {
@@ -337,7 +394,8 @@ void AudioKit::writeAudio(uint8_t *data, size_t size, size_t *bytes_written)
     // twice to I2S stream to create 2 channels
     // HACK: This works ATM only for 16bit samples as sample size is hardcoded
     // here
-    uint16_t data2[size];
+    AudioBlock block;
+    uint16_t *data2 = block.as<uint16_t>();
     uint16_t *data1 = (uint16_t *)data;
 
     for (int idx = 0; idx < size / 2; idx++) {
@@ -348,6 +406,7 @@ void AudioKit::writeAudio(uint8_t *data, size_t size, size_t *bytes_written)
     i2s_write(SPEAKER_I2S_NUMBER, data2, 2 * size, bytes_written, portMAX_DELAY);
     *bytes_written /= 2; // half the actual bytes written as we have double the stream size
   }
+  queueOutput(*bytes_written);
 }
 
 bool AudioKit::readAudio(uint8_t *data, size_t size)
@@ -359,7 +418,8 @@ bool AudioKit::readAudio(uint8_t *data, size_t size)
   } else {
     // ES8388Control returns stereo stream from Mic, but we need only one channel,
     // we drop channel 2 (right channel) here
-    uint16_t data2[size];
+    AudioBlock block;
+    uint16_t *data2 = block.as<uint16_t>();
     uint16_t *data1 = (uint16_t *)data;
 
     i2s_read(SPEAKER_I2S_NUMBER, data2, 2 * size, &byte_read, pdMS_TO_TICKS(100));
@@ -373,6 +433,17 @@ bool AudioKit::readAudio(uint8_t *data, size_t size)
   return byte_read == size;
 }
 
+size_t AudioKit::readRawAudio(uint8_t *data, size_t size)
+{
+  // the ES8388 delivers both microphones, interleaved left and right
+  size_t byte_read = 0;
+  const size_t frameBytes = 2 * width;
+  size_t bytes = 2 * readSize * width;
+  bytes = size < bytes ? size - size % frameBytes : bytes;
+  i2s_read(SPEAKER_I2S_NUMBER, data, bytes, &byte_read, pdMS_TO_TICKS(100));
+  return byte_read - byte_read % frameBytes;
+}
+
 void AudioKit::muteOutput(bool mute)
 {
   // switching the amp power prevents klicking noise reaching the speaker
@@ -386,11 +457,34 @@ void AudioKit::muteOutput(bool mute)
       es8388.mute(ES8388Control::ES_MAIN, mute);
     } else {
       // AC101: we just mute the headphone
-      ac.SetVolumeHeadphone(mute ? 0 : (out_vol * 63) / 100);
+      acVolumeHeadphone(mute ? 0 : (out_vol * 63) / 100);
     }
   }
 }
 
+// the AC101 is written only when a volume changes, muteOutput is called for every block
+void AudioKit::acVolumeSpeaker(uint8_t vol)
+{
+  if (ac_spk_vol == vol) {
+    ac_skipped++;
+    return;
+  }
+  ac.SetVolumeSpeaker(vol);
+  ac_spk_vol = vol;
+  ac_writes++;
+}
+
+void AudioKit::acVolumeHeadphone(uint8_t vol)
+{
+  if (ac_hp_vol == vol) {
+    ac_skipped++;
+    return;
+  }
+  ac.SetVolumeHeadphone(vol);
+  ac_hp_vol = vol;
+  ac_writes++;
+}
+
 /**
  * @brief sets output volume for all outputs
  *
@@ -408,32 +502,19 @@ void AudioKit::setVolume(uint16_t volume)
 
     switch (out_amp) {
     case AmpOut::AMP_OUT_SPEAKERS:
-      ac.SetVolumeSpeaker(vol);
+      acVolumeSpeaker(vol);
       break;
     case AmpOut::AMP_OUT_HEADPHONE:
-      ac.SetVolumeHeadphone(vol);
+      acVolumeHeadphone(vol);
       break;
     case AmpOut::AMP_OUT_BOTH:
-      ac.SetVolumeSpeaker(vol);
-      ac.SetVolumeHeadphone(vol);
+      acVolumeSpeaker(vol);
+      acVolumeHeadphone(vol);
       break;
     }
   }
 }
 
-/**
- * @brief Regularily called to check if hotword is detected. Here no real detection takes
- * places, it is simply the press of a button which activates command listening mode.
- *
- * @return true if listening key is pressed
- * @return false if listening key is not pressed
- */
-bool AudioKit::isHotwordDetected()
-{
-  // TODOD debounce maybe?
-  return digitalRead(key_listen) == LOW;
-}
-
 void AudioKit::ampOutput(int ampOut)
 {
   out_amp = (AmpOut)ampOut;
@@ -466,8 +547,8 @@ void AudioKit::ampOutput(int ampOut)
     es8388.volume(ES8388Control::ES_OUT1, mute[0] ? 0 : 100);
   } else {
     const uint8_t vol = (out_vol * 63) / 100;
-    ac.SetVolumeSpeaker(mute[0] ? 0 : vol);
-    ac.SetVolumeHeadphone(mute[1] ? 0 : vol);
+    acVolumeSpeaker(mute[0] ? 0 : vol);
+    acVolumeHeadphone(mute[1] ? 0 : vol);
   }
 }
 
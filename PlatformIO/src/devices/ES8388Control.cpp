@@ -3,6 +3,9 @@
 #include <Wire.h>
 
 #define ES8388_ADDR 0x10
+// set to 1 to write adjacent registers in one transaction, which relies on the ES8388
+// incrementing the register address after every byte. Not verified on hardware yet
+#define ES8388_BURST_WRITE 0
 
 /* ES8388 register */
 #define ES8388_CONTROL1 0x00
@@ -63,21 +66,21 @@
 #define ES8388_DACCONTROL29 0x33
 #define ES8388_DACCONTROL30 0x34
 
-bool ES8388Control::write_reg(uint8_t slave_add, uint8_t reg_add, uint8_t data)
+bool ES8388Control::write_regs(void *context, uint8_t reg_add, const uint8_t *data, size_t count)
 {
-  Wire.beginTransmission(slave_add);
+  Wire.beginTransmission(ES8388_ADDR);
   Wire.write(reg_add);
-  Wire.write(data);
+  Wire.write(data, count);
   return Wire.endTransmission() == 0;
 }
 
-bool ES8388Control::read_reg(uint8_t slave_add, uint8_t reg_add, uint8_t &data)
+bool ES8388Control::read_reg(void *context, uint8_t reg_add, uint8_t &data)
 {
   bool retval = false;
-  Wire.beginTransmission(slave_add);
+  Wire.beginTransmission(ES8388_ADDR);
   Wire.write(reg_add);
   Wire.endTransmission(false);
-  Wire.requestFrom((uint16_t)slave_add, (uint8_t)1, true);
+  Wire.requestFrom((uint16_t)ES8388_ADDR, (uint8_t)1, true);
   if (Wire.available() >= 1) {
     data = Wire.read();
     retval = true;
@@ -85,65 +88,73 @@ bool ES8388Control::read_reg(uint8_t slave_add, uint8_t reg_add, uint8_t &data)
   return retval;
 }
 
+/* write one register now, begin() keeps the power-up order of the datasheet this way */
+bool ES8388Control::write_reg(uint8_t reg_add, uint8_t data)
+{
+  registers.set(reg_add, data);
+  return registers.commit();
+}
+
 bool ES8388Control::begin(int sda, int scl, uint32_t frequency)
 {
   bool res = identify(sda, scl, frequency);
 
   if (res == true) {
+    registers.begin(write_regs, read_reg, NULL, ES8388_BURST_WRITE);
 
     /* mute DAC during setup, power up all systems, slave mode */
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL3, 0x04);
-    res &= write_reg(ES8388_ADDR, ES8388_CONTROL2, 0x50);
-    res &= write_reg(ES8388_ADDR, ES8388_CHIPPOWER, 0x00);
-    res &= write_reg(ES8388_ADDR, ES8388_MASTERMODE, 0x00);
+    res &= write_reg(ES8388_DACCONTROL3, 0x04);
+    res &= write_reg(ES8388_CONTROL2, 0x50);
+    res &= write_reg(ES8388_CHIPPOWER, 0x00);
+    res &= write_reg(ES8388_MASTERMODE, 0x00);
 
     /* power up DAC and enable LOUT1+2 / ROUT1+2, ADC sample rate = DAC sample rate */
-    res &= write_reg(ES8388_ADDR, ES8388_DACPOWER, 0x3e);
-    res &= write_reg(ES8388_ADDR, ES8388_CONTROL1, 0x12);
+    res &= write_reg(ES8388_DACPOWER, 0x3e);
+    res &= write_reg(ES8388_CONTROL1, 0x12);
 
     /* DAC I2S setup: 16 bit word length, I2S format; MCLK / Fs = 256*/
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL1, 0x18);
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL2, 0x02);
+    res &= write_reg(ES8388_DACCONTROL1, 0x18);
+    res &= write_reg(ES8388_DACCONTROL2, 0x02);
 
     /* DAC to output route mixer configuration: ADC MIX TO OUTPUT */
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL16, 0x1B);
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL17, 0x90);
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL20, 0x90);
+    res &= write_reg(ES8388_DACCONTROL16, 0x1B);
+    res &= write_reg(ES8388_DACCONTROL17, 0x90);
+    res &= write_reg(ES8388_DACCONTROL20, 0x90);
 
     /* DAC and ADC use same LRCK, enable MCLK input; output resistance setup */
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL21, 0x80);
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL23, 0x00);
+    res &= write_reg(ES8388_DACCONTROL21, 0x80);
+    res &= write_reg(ES8388_DACCONTROL23, 0x00);
 
     /* DAC volume control: 0dB (maximum, unattenuated)  */
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL5, 0x00);
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL4, 0x00);
+    res &= write_reg(ES8388_DACCONTROL5, 0x00);
+    res &= write_reg(ES8388_DACCONTROL4, 0x00);
 
     /* power down ADC while configuring; volume: +9dB for both channels */
-    res &= write_reg(ES8388_ADDR, ES8388_ADCPOWER, 0xff);
-    res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL1, 0x88); // +24db
+    res &= write_reg(ES8388_ADCPOWER, 0xff);
+    res &= write_reg(ES8388_ADCCONTROL1, 0x88); // +24db
 
     /* select LINPUT2 / RINPUT2 as ADC input; stereo; 16 bit word length, format right-justified, MCLK / Fs = 256 */
-    res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL2, 0xf0); // 50
-    res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL3, 0x80); // 00
-    res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL4, 0x0e);
-    res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL5, 0x02);
+    res &= write_reg(ES8388_ADCCONTROL2, 0xf0); // 50
+    res &= write_reg(ES8388_ADCCONTROL3, 0x80); // 00
+    res &= write_reg(ES8388_ADCCONTROL4, 0x0e);
+    res &= write_reg(ES8388_ADCCONTROL5, 0x02);
 
     /* set ADC volume */
-    res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL8, 0x20);
-    res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL9, 0x20);
+    res &= write_reg(ES8388_ADCCONTROL8, 0x20);
+    res &= write_reg(ES8388_ADCCONTROL9, 0x20);
 
     /* set LOUT1 / ROUT1 volume: 0dB (unattenuated) */
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL24, 0x1e);
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL25, 0x1e);
+    res &= write_reg(ES8388_DACCONTROL24, 0x1e);
+    res &= write_reg(ES8388_DACCONTROL25, 0x1e);
 
     /* set LOUT2 / ROUT2 volume: 0dB (unattenuated) */
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL26, 0x1e);
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL27, 0x1e);
+    res &= write_reg(ES8388_DACCONTROL26, 0x1e);
+    res &= write_reg(ES8388_DACCONTROL27, 0x1e);
 
     /* power up and enable DAC; power up ADC (no MIC bias) */
-    res &= write_reg(ES8388_ADDR, ES8388_DACPOWER, 0x3c);
-    res &= write_reg(ES8388_ADDR, ES8388_DACCONTROL3, 0x00);
-    res &= write_reg(ES8388_ADDR, ES8388_ADCPOWER, 0x00);
+    res &= write_reg(ES8388_DACPOWER, 0x3c);
+    res &= write_reg(ES8388_DACCONTROL3, 0x00);
+    res &= write_reg(ES8388_ADCPOWER, 0x00);
   }
 
   return res;
@@ -187,17 +198,18 @@ bool ES8388Control::setALCmode(alcmodesel_t alc) {
     ALCATK = 0b0010;  // 416us/step
     NGTH = 0b11000;   // -40.5db
     NGG = 0b01;       // mute ADC
-    res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL1, 0x77);
+    registers.set(ES8388_ADCCONTROL1, 0x77);
   }
-  res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL10,
-                   ALCSEL << 6 | MAXGAIN << 3 | MINGAIN);
-  res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL11,
-                   ALCLVL << 4 | ALCHLD);
-  res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL12, ALCDCY << 4 | ALCATK);
-  res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL13,
-                   ALCMODE << 7 | ALCZC << 6 | TIME_OUT << 5 | WIN_SIZE);
-  res &= write_reg(ES8388_ADDR, ES8388_ADCCONTROL14,
-                   NGTH << 3 | NGG << 2 | NGAT);
+  registers.set(ES8388_ADCCONTROL10,
+                 ALCSEL << 6 | MAXGAIN << 3 | MINGAIN);
+  registers.set(ES8388_ADCCONTROL11,
+                 ALCLVL << 4 | ALCHLD);
+  registers.set(ES8388_ADCCONTROL12, ALCDCY << 4 | ALCATK);
+  registers.set(ES8388_ADCCONTROL13,
+                 ALCMODE << 7 | ALCZC << 6 | TIME_OUT << 5 | WIN_SIZE);
+  registers.set(ES8388_ADCCONTROL14,
+                 NGTH << 3 | NGG << 2 | NGAT);
+  res &= registers.commit();
 
   return res;
 }
@@ -235,10 +247,8 @@ void ES8388Control::mute(const ES8388_OUT out, const bool muted)
     break;
   }
 
-  uint8_t reg;
-  if (read_reg(ES8388_ADDR, reg_addr, reg)) {
-    reg = (reg & ~mask_mute) | (mask_val & mask_mute);
-    write_reg(ES8388_ADDR, reg_addr, reg);
+  if (registers.update(reg_addr, mask_mute, mask_val)) {
+    registers.commit();
   }
 }
 
@@ -280,8 +290,9 @@ void ES8388Control::volume(const ES8388_OUT out, const uint8_t vol)
     vol_val = max_vol_val - vol_val;
   }
 
-  write_reg(ES8388_ADDR, lreg, vol_val);
-  write_reg(ES8388_ADDR, rreg, vol_val);
+  registers.set(lreg, vol_val);
+  registers.set(rreg, vol_val);
+  registers.commit();
 }
 
 /**
@@ -1,5 +1,6 @@
 #pragma once
 #include <stdint.h>
+#include "RegisterShadow.h"
 
 typedef enum {
   DISABLE,  // ALC Disabled
@@ -11,10 +12,14 @@ typedef enum {
 class ES8388Control
 {
 
-  bool write_reg(uint8_t slave_add, uint8_t reg_add, uint8_t data);
-  bool read_reg(uint8_t slave_add, uint8_t reg_add, uint8_t &data);
+  static bool write_regs(void *context, uint8_t reg_add, const uint8_t *data, size_t count);
+  static bool read_reg(void *context, uint8_t reg_add, uint8_t &data);
+  bool write_reg(uint8_t reg_add, uint8_t data);
   bool identify(int sda, int scl, uint32_t frequency);
 
+  // all register access goes through the shadow, unchanged values are not written again
+  RegisterShadow registers;
+
 public:
   bool begin(int sda = -1, int scl = -1, uint32_t frequency = 400000U);
 
@@ -29,4 +34,8 @@ public:
   void volume(const ES8388_OUT out, const uint8_t vol);
 
   bool setALCmode(alcmodesel_t alc);
+
+  // I2C transactions so far and writes that were skipped because the register already had the value
+  uint32_t transactions() { return registers.transactions; }
+  uint32_t skippedWrites() { return registers.skipped; }
 };
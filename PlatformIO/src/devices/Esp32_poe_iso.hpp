@@ -21,7 +21,7 @@
 #define I2S_SAMPLE_BITS   (16)
 #define I2S_READ_LEN     512
 
-class Esp32_poe_iso : public Device
+class Esp32_poe_iso final : public Device
 {
   public:
     Esp32_poe_iso();
@@ -29,8 +29,8 @@ class Esp32_poe_iso : public Device
     bool readAudio(uint8_t *data, size_t size);
     void setWriteMode(int sampleRate, int bitDepth, int numChannels);
     void writeAudio(uint8_t *data, size_t size, size_t *bytes_written);
-  private:
-    char* i2s_read_buff = (char*) calloc(I2S_READ_LEN, sizeof(char));
+    void flushOutput();
+    bool fullDuplexSupported() { return true; };
 };
 
 Esp32_poe_iso::Esp32_poe_iso() {};
@@ -113,16 +113,26 @@ void Esp32_poe_iso::setWriteMode(int sampleRate, int bitDepth, int numChannels)
     if (sampleRate > 0)
     {
         i2s_set_clk(I2S_PORT_TX, sampleRate, static_cast<i2s_bits_per_sample_t>(bitDepth), static_cast<i2s_channel_t>(numChannels));
+        // dma_buf_count * dma_buf_len of the speaker port
+        queueOutputFormat(sampleRate, bitDepth / 8 * numChannels, 2 * 512);
     }
 }
 
 void Esp32_poe_iso::writeAudio(uint8_t *data, size_t size, size_t *bytes_written) {
   i2s_write(I2S_PORT_TX, data, size, bytes_written, portMAX_DELAY);
+  queueOutput(*bytes_written);
 }
 
 
+void Esp32_poe_iso::flushOutput() {
+  i2s_zero_dma_buffer(I2S_PORT_TX);
+  queuedFrames = 0;
+}
+
 bool Esp32_poe_iso::readAudio(uint8_t *data, size_t size) {
     size_t bytes_read;
+    AudioBlock block;
+    char *i2s_read_buff = block.as<char>();
     i2s_read(I2S_PORT, (void*) i2s_read_buff, size, &bytes_read, portMAX_DELAY);
     uint32_t j = 0;
     uint32_t dac_value = 0;
@@ -26,7 +26,7 @@
 
 // class DetectWakeWordState;
 
-class Inmp441 : public Device
+class Inmp441 final : public Device
 {
   public:
     Inmp441();
@@ -34,8 +34,6 @@ class Inmp441 : public Device
     void updateColors(int colors);
     bool readAudio(uint8_t *data, size_t size);
     int numAmpOutConfigurations() { return 1; };
-  private:
-    char* i2s_read_buff = (char*) calloc(I2S_READ_LEN, sizeof(char));
 };
 
 
@@ -115,6 +113,8 @@ void Inmp441::updateColors(int colors)
 bool Inmp441::readAudio(uint8_t *data, size_t size) {
 
     size_t bytes_read;
+    AudioBlock block;
+    char *i2s_read_buff = block.as<char>();
     i2s_read(I2S_PORT, (void*) i2s_read_buff, size, &bytes_read, portMAX_DELAY);
     uint32_t j = 0;
     uint32_t dac_value = 0;
@@ -1,6 +1,7 @@
 #pragma once
 #include <Arduino.h>
 #include <device.h>
+#include <tasks.h>
 
 #include <driver/i2s.h>
 #include "IndicatorLight.h"
@@ -30,7 +31,7 @@
 // LEDs
 #define LED_FLASH 4
 
-class Inmp441Max98357a : public Device
+class Inmp441Max98357a final : public Device
 {
   public:
     Inmp441Max98357a();
@@ -40,14 +41,14 @@ class Inmp441Max98357a : public Device
     
     void setWriteMode(int sampleRate, int bitDepth, int numChannels);
     void writeAudio(uint8_t *data, size_t size, size_t *bytes_written);
+    void flushOutput();
+    bool fullDuplexSupported() { return true; };
 
-    IndicatorLight* indicator_light = new IndicatorLight(LED_FLASH);
+    IndicatorLight* indicator_light = new IndicatorLight(LED_FLASH, false, 12, INDICATOR_TASK_CORE, INDICATOR_TASK_PRIORITY);
 
     int numAmpOutConfigurations() { return 1; };
     void updateBrightness(int brightness);
     
-  private:
-    char* i2s_read_buff = (char*) calloc(I2S_READ_LEN, sizeof(char));
 };
 
 Inmp441Max98357a::Inmp441Max98357a() {};
@@ -175,17 +176,27 @@ void Inmp441Max98357a::setWriteMode(int sampleRate, int bitDepth, int numChannel
     if (sampleRate > 0)
     {
         i2s_set_clk(I2S_PORT_TX, sampleRate, static_cast<i2s_bits_per_sample_t>(bitDepth), static_cast<i2s_channel_t>(numChannels));
+        // dma_buf_count * dma_buf_len of the speaker port
+        queueOutputFormat(sampleRate, bitDepth / 8 * numChannels, 2 * 512);
     }
 }
 
 
 void Inmp441Max98357a::writeAudio(uint8_t *data, size_t size, size_t *bytes_written) {
   i2s_write(I2S_PORT_TX, data, size, bytes_written, portMAX_DELAY);
+  queueOutput(*bytes_written);
 }
 
 
+void Inmp441Max98357a::flushOutput() {
+  i2s_zero_dma_buffer(I2S_PORT_TX);
+  queuedFrames = 0;
+}
+
 bool Inmp441Max98357a::readAudio(uint8_t *data, size_t size) {
     size_t bytes_read;
+    AudioBlock block;
+    char *i2s_read_buff = block.as<char>();
     i2s_read(I2S_PORT, (void*) i2s_read_buff, size, &bytes_read, portMAX_DELAY);
     uint32_t j = 0;
     uint32_t dac_value = 0;
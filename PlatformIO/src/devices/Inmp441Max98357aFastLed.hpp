@@ -31,7 +31,7 @@ CRGB leds[NUM_LEDS];
 #define SPK_I2S_SAMPLE_BITS 16
 #define SPK_I2S_SAMPLE_BYTES (SPK_I2S_SAMPLE_BITS / 8)
 
-class Inmp441Max98357aFastLED : public Device
+class Inmp441Max98357aFastLED final : public Device
 {
 public:
   Inmp441Max98357aFastLED() = default;
@@ -41,7 +41,12 @@ public:
 
   void setWriteMode(int sampleRate, int bitDepth, int numChannels);
   void writeAudio(uint8_t *data, size_t size, size_t *bytes_written);
+  void flushOutput();
   void setGain(uint16_t gain);
+  bool fullDuplexSupported()
+  {
+    return true;
+  }
 
   int numAmpOutConfigurations()
   {
@@ -69,7 +74,6 @@ public:
   void animateBlinking(StateColors colors);
 
 private:
-  char *i2s_read_buff = (char *)calloc(I2S_READ_LEN, sizeof(char));
   uint16_t m_gain;
   long currentMillis, startMillis;
 };
@@ -216,12 +220,21 @@ void Inmp441Max98357aFastLED::setWriteMode(int sampleRate, int bitDepth, int num
   if (sampleRate > 0) {
     i2s_set_clk(SPK_I2S_PORT, sampleRate, static_cast<i2s_bits_per_sample_t>(bitDepth),
                 static_cast<i2s_channel_t>(numChannels));
+    // dma_buf_count * dma_buf_len of the speaker port
+    queueOutputFormat(sampleRate, bitDepth / 8 * numChannels, 2 * 512);
   }
 }
 
 void Inmp441Max98357aFastLED::writeAudio(uint8_t *data, size_t size, size_t *bytes_written)
 {
   i2s_write(SPK_I2S_PORT, data, size, bytes_written, portMAX_DELAY);
+  queueOutput(*bytes_written);
+}
+
+void Inmp441Max98357aFastLED::flushOutput()
+{
+  i2s_zero_dma_buffer(SPK_I2S_PORT);
+  queuedFrames = 0;
 }
 
 bool Inmp441Max98357aFastLED::readAudio(uint8_t *data, size_t size)
@@ -229,6 +242,8 @@ bool Inmp441Max98357aFastLED::readAudio(uint8_t *data, size_t size)
   size_t samples_requested = size / sizeof(int16_t);
   size_t bytes_requested = MIC_I2S_SAMPLE_BYTES * samples_requested;
   size_t bytes_read;
+  AudioBlock block;
+  char *i2s_read_buff = block.as<char>();
   // we skip every other sample, so read 2x desired # of samples
   i2s_read(MIC_I2S_PORT, (void *)i2s_read_buff, bytes_requested, &bytes_read, portMAX_DELAY);
 
@@ -12,8 +12,10 @@
 #define CONFIG_I2S_DATA_IN_PIN 23
 
 #define SPEAKER_I2S_NUMBER I2S_NUM_0
+// the button of the Atom, it has an external pull-up
+#define KEY_LISTEN 39
 
-class M5AtomEcho : public Device
+class M5AtomEcho final : public Device
 {
 public:
   M5AtomEcho();
@@ -26,8 +28,9 @@ public:
   void setReadMode();
   void setWriteMode(int sampleRate, int bitDepth, int numChannels);
   void writeAudio(uint8_t *data, size_t size, size_t *bytes_written);
+  void flushOutput();
   bool readAudio(uint8_t *data, size_t size);
-  bool isHotwordDetected();
+  int hotwordButtonPin() { return KEY_LISTEN; };
   int numAmpOutConfigurations() { return 1; };
   bool animationSupported() { return true; };
   bool runningSupported() { return false; };
@@ -49,15 +52,11 @@ M5AtomEcho::M5AtomEcho()
 void M5AtomEcho::init()
 {
   M5.begin(true,true,true);
+  pinMode(KEY_LISTEN, INPUT);
   currentMillis = millis();
   startMillis = millis();
 };
 
-bool M5AtomEcho::isHotwordDetected() {
-  M5.update();
-  return M5.Btn.isPressed();
-}
-
 void M5AtomEcho::updateColors(StateColors colors)
 {
   //Red and Green seem to be switched, we also need to map the white
@@ -110,10 +109,17 @@ void M5AtomEcho::animateBlinking(StateColors colors) {
   }
 }
 
+// The PDM microphone and the speaker share the LRCK pin and PDM is a mode of the whole port,
+// so unlike the other devices the driver has to be reinstalled for every switch. I2Stask
+// switches to the speaker while the audio is still being received, off the critical path.
 void M5AtomEcho::InitI2SSpeakerOrMic(int mode)
 {
     esp_err_t err = ESP_OK;
 
+    if (this->mode == MODE_SPK) {
+        // end on silence, stopping the clock on a sample pops
+        i2s_zero_dma_buffer(SPEAKER_I2S_NUMBER);
+    }
     i2s_driver_uninstall(SPEAKER_I2S_NUMBER);
     i2s_config_t i2s_config = {
         .mode = (i2s_mode_t)(I2S_MODE_MASTER),
@@ -146,7 +152,12 @@ void M5AtomEcho::InitI2SSpeakerOrMic(int mode)
     tx_pin_config.data_in_num = CONFIG_I2S_DATA_IN_PIN;
 
     err += i2s_set_pin(SPEAKER_I2S_NUMBER, &tx_pin_config);
-    err += i2s_set_clk(SPEAKER_I2S_NUMBER, 16000, I2S_BITS_PER_SAMPLE_16BIT, I2S_CHANNEL_MONO);
+    if (mode == MODE_MIC) {
+        err += i2s_set_clk(SPEAKER_I2S_NUMBER, 16000, I2S_BITS_PER_SAMPLE_16BIT, I2S_CHANNEL_MONO);
+    } else {
+        // setWriteMode sets the clock of the audio, start on silence
+        i2s_zero_dma_buffer(SPEAKER_I2S_NUMBER);
+    }
 
     return;
 }
@@ -158,6 +169,8 @@ void M5AtomEcho::setWriteMode(int sampleRate, int bitDepth, int numChannels) {
   }
   if (sampleRate > 0) {
     i2s_set_clk(SPEAKER_I2S_NUMBER, sampleRate, static_cast<i2s_bits_per_sample_t>(bitDepth), static_cast<i2s_channel_t>(numChannels));
+    // dma_buf_count * dma_buf_len
+    queueOutputFormat(sampleRate, bitDepth / 8 * numChannels, 6 * 60);
   }
 }
 
@@ -170,6 +183,14 @@ void M5AtomEcho::setReadMode() {
 
 void M5AtomEcho::writeAudio(uint8_t *data, size_t size, size_t *bytes_written) {
   i2s_write(SPEAKER_I2S_NUMBER, data, size, bytes_written, portMAX_DELAY);
+  queueOutput(*bytes_written);
+}
+
+void M5AtomEcho::flushOutput() {
+  if (mode == MODE_SPK) {
+    i2s_zero_dma_buffer(SPEAKER_I2S_NUMBER);
+  }
+  queuedFrames = 0;
 }
 
 bool M5AtomEcho::readAudio(uint8_t *data, size_t size) {
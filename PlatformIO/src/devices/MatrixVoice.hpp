@@ -8,8 +8,27 @@
 #include "microphone_core.h"
 #include "voice_memory_map.h"
 #include "wishbone_bus.h"
+#include <Beamformer.h>
 #include <thread>
 
+#define DEVICE_READ_SIZE 512
+#define DEVICE_WRITE_SIZE 1024
+#define MATRIX_MICS 8
+
+// readAudio beamforms whole chunks
+static_assert(DEVICE_READ_SIZE % Beamformer::CHUNK == 0, "DEVICE_READ_SIZE must be a multiple of Beamformer::CHUNK");
+
+// Microphone positions in mm, from the MATRIX HAL location table of the Voice
+const float micPositions[MATRIX_MICS][2] = {
+    {0.00f, 0.00f},
+    {-38.13f, 3.58f},
+    {-20.98f, 32.04f},
+    {11.97f, 36.38f},
+    {34.34f, 17.10f},
+    {32.68f, -19.81f},
+    {9.66f, -37.06f},
+    {-23.84f, -29.99f}};
+
 // This is used to be able to change brightness, while keeping the colors appear
 // the same Called gamma correction, check this
 // https://learn.adafruit.com/led-tricks-gamma-correction/the-issue
@@ -33,7 +52,7 @@ const uint8_t PROGMEM gamma8[] = {
     215, 218, 220, 223, 225, 228, 231, 233, 236, 239, 241, 244, 247, 249, 252,
     255};
 
-class MatrixVoice : public Device
+class MatrixVoice final : public Device
 {
 public:
   MatrixVoice();
@@ -46,36 +65,78 @@ public:
   void updateBrightness(int brightness);
   void muteOutput(bool mute);
   void setVolume(uint16_t volume);
+  bool volumeSupported() { return true; };
   void setWriteMode(int sampleRate, int bitDepth, int numChannels); 
   bool readAudio(uint8_t *data, size_t size);
   void writeAudio(uint8_t *data, size_t size, size_t *bytes_written);
+  void flushOutput();
+  // the DAC FIFO holds interleaved stereo samples
+  uint32_t pendingOutputFrames() { syncFIFO(); return fifoFill / 2; };
+  uint32_t outputStatusReads() { return fifoReads; };
   void ampOutput(int output);
+  bool beamformerSupported() { return true; };
+  void setBeamformer(bool enabled, int azimuth);
+  void holdBeam(bool hold) { beamformer.hold(hold); };
+  int directionOfArrival(float *confidence);
+  uint32_t beamformerCycles() { return cycles; };
+  int rawChannels() { return MATRIX_MICS; };
+  size_t readRawAudio(uint8_t *data, size_t size);
+  bool captureRateSupported(int sampleRate) { return sampleRate == 8000 || sampleRate == 16000 || sampleRate == 22050 || sampleRate == 48000; };
+  bool setCaptureRate(int sampleRate);
+  uint32_t captureBusReads() { return busReads; };
+  uint32_t captureCycles() { return readCycles; };
   bool animationSupported() { return true; };
   bool runningSupported() { return true; };
   bool pulsingSupported() { return true; };
   bool blinkingSupported() { return true; };
-  int readSize = 512;
-  int writeSize = 1024;
-  int width = 2;
-  int rate = 16000;
 
 private:
   matrix_hal::WishboneBus wb;
   matrix_hal::Everloop everloop;
   matrix_hal::MicrophoneArray *mics;
   matrix_hal::EverloopImage image1d;
+  Beamformer beamformer;
+  bool beamforming = false;
+  int16_t chunk[Beamformer::CHUNK * MATRIX_MICS];
+  uint32_t cycles = 0;
+  uint32_t rawPosition = 0;
+  // the HAL keeps the samples of a read interleaved, frame by frame. Then they are used where
+  // they are, without gathering them with At() first
+  bool interleavedMics = false;
+  uint32_t busReads = 0;
+  uint32_t readCycles = 0;
+  const int16_t *micFrames(uint32_t sample, uint32_t frames);
   void playBytes(int16_t* input, uint32_t length);
   void interleave(const int16_t * in_L, const int16_t * in_R, int16_t * out, const size_t num_samples);
   bool FIFOFlush();
   void updateColors(StateColors colors, bool usePulse);
   void SetPCMSamplingFrequency(uint16_t PCM_constant);
   uint16_t GetFIFOStatus();
+  void syncFIFO();
+  int estimatedFIFOFill();
   int fifoSize = 4096;
+  // DAC pacing: the fill of the FIFO is estimated from the time since the pointers were read, they
+  // are read again every FIFO_SYNC_MS. A write fills the free space and sleeps until the rest fits.
+  // The DAC clock is not exactly the sample rate, every read measures the rate it takes samples at.
+  // FIFO_MARGIN samples stay free for the error of the estimate, a full FIFO would look empty
+  static const int FIFO_MARGIN = 256;
+  static const int FIFO_MIN_BURST = 256;
+  static const int FIFO_SYNC_MS = 200;
+  static const int FIFO_RATE_UPDATES = 4;   // reads are 4 times as frequent until the rate is known
+  int fifoNominalRate = 32000;
+  int fifoRate = 32000;          // samples the DAC takes from the FIFO per second, always stereo
+  int fifoRateUpdates = 0;
+  int fifoFill = 0;              // samples in the FIFO at fifoMicros
+  unsigned long fifoMicros = 0;
+  int fifoSyncFill = 0;          // samples in the FIFO at the last read
+  int fifoWritten = 0;           // samples written since then
+  unsigned long fifoSyncMicros = 0;
+  uint32_t fifoReads = 0;
+  int outputMuted = -1;
   int sampleRate, bitDepth, numChannels;
   int brightness, pulse = 15;
-  float sample_time = 1.0 / 16000;
-  uint32_t spiLength = 1024;
-  int sleep = int(spiLength * sample_time * 1000);
+  // bytes of stereo samples per SPI write, one audio block
+  uint32_t spiLength = 2048;
   int position = 0;
   long currentMillis, startMillis;
   bool ledsOn = true;
@@ -91,6 +152,8 @@ private:
 
 MatrixVoice::MatrixVoice()
 {
+  readSize = DEVICE_READ_SIZE;
+  writeSize = DEVICE_WRITE_SIZE;
 };
 
 void MatrixVoice::init()
@@ -103,6 +166,11 @@ void MatrixVoice::init()
   mics->SetSamplingRate(rate);  
   matrix_hal::MicrophoneCore mic_core(*mics);
   mic_core.Setup(&wb);  
+  beamformer.configure(MATRIX_MICS, micPositions, rate);
+  const int16_t *first = &mics->At(0, 0);
+  const int16_t last = mics->NumberOfSamples() - 1;
+  interleavedMics = &mics->At(0, 1) == first + 1 && &mics->At(1, 0) == first + MATRIX_MICS &&
+                    &mics->At(last, MATRIX_MICS - 1) == first + (last + 1) * MATRIX_MICS - 1;
   uint16_t PCM_constant = 492;
   wb.SpiWrite(matrix_hal::kConfBaseAddress + 9, (const uint8_t *)(&PCM_constant), sizeof(uint16_t));
   currentMillis = millis();
@@ -206,6 +274,11 @@ void MatrixVoice::updateColors(StateColors colors) {
 }
 
 void MatrixVoice::muteOutput(bool mute) {
+  // called for every block, only a change goes over the bus
+  if (outputMuted == mute) {
+    return;
+  }
+  outputMuted = mute;
   int16_t muteValue = mute ? 1 : 0;
   wb.SpiWrite(matrix_hal::kConfBaseAddress+10,(const uint8_t *)(&muteValue), sizeof(uint16_t));
 }
@@ -229,59 +302,185 @@ void MatrixVoice::setWriteMode(int sampleRate, int bitDepth, int numChannels) {
   MatrixVoice::numChannels = numChannels;
   FIFOFlush();
   if (sampleRate == 8000 || sampleRate == 16000 || sampleRate == 22050 || sampleRate == 44100 ) {
-    if (sampleRate == 44100 && numChannels == 2) {
-      //Strange issue with 44100 stereo. When using 177 that output is very bad
-      //When using 220, output is ok but a tad to slow.
-      SetPCMSamplingFrequency(220);
-    } else {
-      SetPCMSamplingFrequency(FrequencyMap[sampleRate]);
-    }
+    // 44100 stereo used to run at 220 because the FIFO overflowed, with the pacing it plays at 177
+    SetPCMSamplingFrequency(FrequencyMap[sampleRate]);
   }
 
-  sample_time = 1.0 / sampleRate;
-  sleep = int(spiLength * sample_time * 1000);
+  if (fifoNominalRate != 2 * sampleRate) {
+    fifoNominalRate = 2 * sampleRate;
+    fifoRate = fifoNominalRate;
+    fifoRateUpdates = 0;
+  }
   writeSize = spiLength;
   if (numChannels == 1) {
     writeSize = writeSize / sizeof(uint16_t);
   }
 }; 
 
+void MatrixVoice::setBeamformer(bool enabled, int azimuth) {
+  beamformer.setFixedAzimuth(azimuth);
+  if (enabled && !beamforming) {
+    beamformer.reset();
+  }
+  beamforming = enabled;
+}
+
+int MatrixVoice::directionOfArrival(float *confidence) {
+  *confidence = beamformer.confidence();
+  return beamformer.azimuth();
+}
+
+bool MatrixVoice::setCaptureRate(int sampleRate) {
+  if (!captureRateSupported(sampleRate)) {
+    return false;
+  }
+  if (sampleRate != rate) {
+    mics->SetSamplingRate(sampleRate);
+    // the FIR filter of the microphones depends on the sampling rate
+    matrix_hal::MicrophoneCore mic_core(*mics);
+    mic_core.Setup(&wb);
+    rate = sampleRate;
+    beamformer.configure(MATRIX_MICS, micPositions, rate);
+    rawPosition = 0;
+  }
+  return true;
+}
+
+// interleaved frames of all microphones, in place when the HAL keeps them that way
+const int16_t *MatrixVoice::micFrames(uint32_t sample, uint32_t frames) {
+  if (interleavedMics) {
+    return &mics->At(sample, 0);
+  }
+  for (uint32_t i = 0; i < frames; i++) {
+    for (int c = 0; c < MATRIX_MICS; c++) {
+      chunk[i * MATRIX_MICS + c] = mics->At(sample + i, c);
+    }
+  }
+  return chunk;
+}
+
 bool MatrixVoice::readAudio(uint8_t *data, size_t size) {
   mics->Read();
-  uint16_t voicebuffer[readSize];
-  for (uint32_t s = 0; s < readSize; s++) {
-     voicebuffer[s] = mics->Beam(s);
+  busReads = 1;
+  // the samples go straight into the caller's block
+  const uint32_t start = ESP.getCycleCount();
+  int16_t *output = (int16_t *)data;
+  if (beamforming) {
+    // the direction search is expensive, once per read is plenty
+    beamformer.updateDirection(micFrames(0, Beamformer::CHUNK), Beamformer::CHUNK);
+    if (interleavedMics) {
+      beamformer.process(micFrames(0, readSize), readSize, output);
+    } else {
+      for (uint32_t s = 0; s < readSize; s += Beamformer::CHUNK) {
+        beamformer.process(micFrames(s, Beamformer::CHUNK), Beamformer::CHUNK, &output[s]);
+      }
+    }
+    cycles = ESP.getCycleCount() - start;
+  } else {
+    cycles = 0;
+    for (uint32_t s = 0; s < readSize; s++) {
+      output[s] = mics->Beam(s);
+    }
   }
-  memcpy(data, voicebuffer, readSize * width);
+  readCycles = ESP.getCycleCount() - start;
   return true;
 }
 
+size_t MatrixVoice::readRawAudio(uint8_t *data, size_t size) {
+  // one mic read holds more frames than a block, hand them out over several calls
+  busReads = 0;
+  if (rawPosition == 0 || rawPosition >= mics->NumberOfSamples()) {
+    mics->Read();
+    busReads = 1;
+    rawPosition = 0;
+  }
+  const uint32_t start = ESP.getCycleCount();
+  uint32_t frames = size / (MATRIX_MICS * width);
+  if (frames > mics->NumberOfSamples() - rawPosition) {
+    frames = mics->NumberOfSamples() - rawPosition;
+  }
+  int16_t *output = (int16_t *)data;
+  if (interleavedMics) {
+    memcpy(output, &mics->At(rawPosition, 0), frames * MATRIX_MICS * width);
+  } else {
+    for (uint32_t s = 0; s < frames; s++) {
+      for (int c = 0; c < MATRIX_MICS; c++) {
+        output[s * MATRIX_MICS + c] = mics->At(rawPosition + s, c);
+      }
+    }
+  }
+  rawPosition += frames;
+  readCycles = ESP.getCycleCount() - start;
+  return frames * MATRIX_MICS * width;
+}
+
 void MatrixVoice::writeAudio(uint8_t *data, size_t inputLength, size_t *bytes_written) {
   *bytes_written = inputLength;
   uint32_t outputLength = (numChannels == 1) ? inputLength * sizeof(int16_t) : inputLength;
-  int16_t output[outputLength];
+  AudioBlock block;
+  int16_t *output = block.as<int16_t>();
 
   if (numChannels == 1) {
+    // the mono samples are aligned in the audio block, so interleave straight into the output
     uint32_t monoLength = inputLength / sizeof(int16_t);
-    int16_t mono[monoLength]; 
-    int16_t stereo[inputLength];
-    for (int i = 0; i < inputLength; i += 2) {
-      mono[i/2] = ((data[i] & 0xff) | (data[i + 1] << 8));
-    }
-    interleave(mono, mono, stereo, monoLength);
-    for (int i = 0; i < inputLength; i++) {
-      output[i] = stereo[i];
-    }
+    interleave((const int16_t *)data, (const int16_t *)data, output, monoLength);
   } else {
     for (int i = 0; i < inputLength; i += 2) {
       output[i/2] = ((data[i] & 0xff) | (data[i + 1] << 8));
     }
   }
 
-  if (GetFIFOStatus() > fifoSize * 3 / 4) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(sleep));
+  const int syncMs = fifoRateUpdates < FIFO_RATE_UPDATES ? FIFO_SYNC_MS / 4 : FIFO_SYNC_MS;
+  if (micros() - fifoSyncMicros >= syncMs * 1000UL) {
+    syncFIFO();
   }
-  wb.SpiWrite(matrix_hal::kDACBaseAddress, (const uint8_t *)output, outputLength);
+  const int total = outputLength / sizeof(int16_t);
+  int written = 0;
+  while (written < total) {
+    const int remaining = total - written;
+    const int space = fifoSize - FIFO_MARGIN - estimatedFIFOFill();
+    if (space < remaining && space < FIFO_MIN_BURST) {
+      // sleep until the rest, or at least a burst, fits
+      const int wanted = remaining < FIFO_MIN_BURST ? remaining : FIFO_MIN_BURST;
+      std::this_thread::sleep_for(std::chrono::microseconds((uint64_t)(wanted - space) * 1000000 / fifoRate + 1));
+      continue;
+    }
+    const int count = space < remaining ? space : remaining;
+    wb.SpiWrite(matrix_hal::kDACBaseAddress, (const uint8_t *)&output[written], count * sizeof(int16_t));
+    fifoWritten += count;
+    fifoFill = estimatedFIFOFill() + count;
+    fifoMicros = micros();
+    written += count;
+  }
+}
+
+void MatrixVoice::flushOutput() {
+  // resetting the FIFO pointers silences the DAC at once
+  FIFOFlush();
+}
+
+void MatrixVoice::syncFIFO() {
+  const int fill = GetFIFOStatus();
+  const unsigned long now = micros();
+  fifoReads++;
+  // the rate is only known when the FIFO did not run empty in between
+  if (fifoSyncFill > 0 && fill > 0 && now != fifoSyncMicros) {
+    const int64_t rate = (int64_t)(fifoSyncFill + fifoWritten - fill) * 1000000 / (int64_t)(now - fifoSyncMicros);
+    if (rate > fifoNominalRate * 19 / 20 && rate < fifoNominalRate * 21 / 20) {
+      fifoRate += ((int)rate - fifoRate) / 4;
+      fifoRateUpdates++;
+    }
+  }
+  fifoFill = fill;
+  fifoSyncFill = fill;
+  fifoWritten = 0;
+  fifoMicros = now;
+  fifoSyncMicros = now;
+}
+
+int MatrixVoice::estimatedFIFOFill() {
+  const int played = (uint64_t)(micros() - fifoMicros) * fifoRate / 1000000;
+  return played >= fifoFill ? 0 : fifoFill - played;
 }
 
 void MatrixVoice::interleave(const int16_t * in_L, const int16_t * in_R, int16_t * out, const size_t num_samples)
@@ -298,6 +497,11 @@ bool MatrixVoice::FIFOFlush() {
   wb.SpiWrite(matrix_hal::kConfBaseAddress + 12,(const uint8_t *)(&value), sizeof(uint16_t));	
   value = 0;
   wb.SpiWrite(matrix_hal::kConfBaseAddress + 12,(const uint8_t *)(&value), sizeof(uint16_t));	
+  fifoFill = 0;
+  fifoSyncFill = 0;
+  fifoWritten = 0;
+  fifoMicros = micros();
+  fifoSyncMicros = fifoMicros;
   return true;
 }
 
@@ -307,7 +511,8 @@ uint16_t MatrixVoice::GetFIFOStatus() {
   wb.SpiRead(matrix_hal::kDACBaseAddress + 2050, (uint8_t *)(&read_pointer), sizeof(uint16_t));
   wb.SpiRead(matrix_hal::kDACBaseAddress + 2051, (uint8_t *)(&write_pointer), sizeof(uint16_t));
 
-  if (write_pointer > read_pointer)
+  // equal pointers are an empty FIFO
+  if (write_pointer >= read_pointer)
     return write_pointer - read_pointer;
   else
     return fifoSize - read_pointer + write_pointer;
@@ -33,11 +33,14 @@
 
 #define I2S_NUM I2S_NUM_0
 
+#define DEVICE_READ_SIZE 512
+#define DEVICE_WRITE_SIZE 512
+
 
 NeoPixelBus<NeoRgbFeature, NeoEsp32I2s1800KbpsMethod> strip(WS2812B_NUM_LEDS, WS2812B_DATA_PIN);
 
 
-class TAudio : public Device {
+class TAudio final : public Device {
   public:
     TAudio();
     void init();
@@ -46,21 +49,29 @@ class TAudio : public Device {
     void setReadMode();
     void setWriteMode(int sampleRate, int bitDepth, int numChannels);
     void writeAudio(uint8_t *data, size_t size, size_t *bytes_written);
+    void flushOutput();
     bool readAudio(uint8_t *data, size_t size);
     void muteOutput(bool mute);
     void ampOutput(int output);
     void setVolume(uint16_t volume);
+    bool volumeSupported() { return true; };
     void setGain(uint16_t gain);
-    bool isHotwordDetected();
+    int hotwordButtonPin() { return KEY_LISTEN; };
     int numAmpOutConfigurations() { return 3; };
-    int readSize = 512;
-    int writeSize = 512;
-    int width = 2;
-    int rate = 16000;
+    uint32_t codecWrites() { return codec_writes; };
+    uint32_t codecWritesSkipped() { return codec_skipped; };
 
   private:
     void InitI2S();
+    void spkVolume(uint8_t vol);
+    void hpVolume(uint8_t vol);
     WM8978 dac;
+    // the last values written to the WM8978, -1 when unknown
+    int spk_vol = -1;
+    int hp_vol = -1;
+    int mic_gain = -1;
+    uint32_t codec_writes = 0;
+    uint32_t codec_skipped = 0;
 
     AmpOut out_amp = AMP_OUT_SPEAKERS;
     uint8_t out_vol;
@@ -69,6 +80,8 @@ class TAudio : public Device {
 };
 
 TAudio::TAudio() {
+  readSize = DEVICE_READ_SIZE;
+  writeSize = DEVICE_WRITE_SIZE;
 }
 
 void TAudio::init() {
@@ -88,10 +101,11 @@ void TAudio::init() {
   }
   dac.cfgInput(1, 0, 0);
   dac.setMICgain(40); // 25
+  mic_gain = 40;
   dac.setHPF(1);
 
-  dac.setSPKvol(58);  // 63
-  dac.setHPvol(48, 48);
+  spkVolume(58);  // 63
+  hpVolume(48);
   out_vol = 58; muted = false;
 
   pinMode(KEY_LISTEN, INPUT);
@@ -149,6 +163,8 @@ void TAudio::setWriteMode(int sampleRate, int bitDepth, int numChannels) {
   if (sampleRate > 0) {
     //i2s_zero_dma_buffer(I2S_NUM);
     i2s_set_clk(I2S_NUM, sampleRate, static_cast<i2s_bits_per_sample_t>(bitDepth), static_cast<i2s_channel_t>(numChannels));
+    // dma_buf_count * dma_buf_len
+    queueOutputFormat(sampleRate, bitDepth / 8 * numChannels, 4 * 512);
   }
 }
 
@@ -162,6 +178,7 @@ void TAudio::setReadMode() {
 
 void TAudio::writeAudio(uint8_t *data, size_t size, size_t *bytes_written) {
   i2s_write(I2S_NUM, data, size, bytes_written, portMAX_DELAY);
+  queueOutput(*bytes_written);
 }
 
 bool TAudio::readAudio(uint8_t *data, size_t size) {
@@ -170,11 +187,20 @@ bool TAudio::readAudio(uint8_t *data, size_t size) {
   return true;
 }
 
+void TAudio::flushOutput() {
+  i2s_zero_dma_buffer(I2S_NUM);
+  queuedFrames = 0;
+}
+
 void TAudio::muteOutput(bool mute) {
-  if (muted == mute) return;  // already set
+  if (muted == mute) {
+    codec_skipped++;
+    return;  // already set
+  }
 
   if (mute) i2s_zero_dma_buffer(I2S_NUM);
   dac.cfgOutput(mute ? 0 : 1, 0);
+  codec_writes++;
   //setVolume(mute ? 0 : out_vol);
   muted = mute;
 }
@@ -186,16 +212,16 @@ void TAudio::ampOutput(int output) {
   switch (out_amp)
   {
     case AmpOut::AMP_OUT_SPEAKERS:
-      dac.setSPKvol(vol);
-      dac.setHPvol(0, 0);
+      spkVolume(vol);
+      hpVolume(0);
       break;
     case AmpOut::AMP_OUT_HEADPHONE:
-      dac.setSPKvol(0);
-      dac.setHPvol(vol, vol);
+      spkVolume(0);
+      hpVolume(vol);
       break;
     case AmpOut::AMP_OUT_BOTH:
-      dac.setSPKvol(vol);
-      dac.setHPvol(vol, vol);
+      spkVolume(vol);
+      hpVolume(vol);
       break;
   }
 }
@@ -208,23 +234,46 @@ void TAudio::setVolume(uint16_t volume) {
   switch (out_amp)
   {
     case AmpOut::AMP_OUT_SPEAKERS:
-      dac.setSPKvol(vol);
+      spkVolume(vol);
       break;
     case AmpOut::AMP_OUT_HEADPHONE:
-      dac.setHPvol(vol, vol);
+      hpVolume(vol);
       break;
     case AmpOut::AMP_OUT_BOTH:
-      dac.setSPKvol(vol);
-      dac.setHPvol(vol, vol);
+      spkVolume(vol);
+      hpVolume(vol);
       break;
   }
 }
 
+// the WM8978 is written only when a value changes
+void TAudio::spkVolume(uint8_t vol) {
+  if (spk_vol == vol) {
+    codec_skipped++;
+    return;
+  }
+  dac.setSPKvol(vol);
+  spk_vol = vol;
+  codec_writes++;
+}
+
+void TAudio::hpVolume(uint8_t vol) {
+  if (hp_vol == vol) {
+    codec_skipped++;
+    return;
+  }
+  dac.setHPvol(vol, vol);
+  hp_vol = vol;
+  codec_writes++;
+}
+
 void TAudio::setGain(uint16_t gain) {
   const uint8_t g = (gain * 63) / 8;
+  if (mic_gain == g) {
+    codec_skipped++;
+    return;
+  }
   dac.setMICgain(g);
-}
-
-bool TAudio::isHotwordDetected() {
-  return (digitalRead(KEY_LISTEN) == LOW);
+  mic_gain = g;
+  codec_writes++;
 }
@@ -93,10 +93,19 @@ input::-moz-focus-inner,input::-moz-focus-outer {border: 0;}
     <div class="input-container">
       <label for="hotword_detection">Activation:&nbsp;</label>
       <select name="hotword_detection">
-        <option value="0" %HW_LOCAL%>Key Press Only</option>
+        <option value="0" %HW_LOCAL%>Local Wake Word / Key Press</option>
         <option value="1" %HW_REMOTE%>Remote Hotword Detection</option>
       </select>
     </div>
+    <div class="input-container">
+      <label for="capture_rate">Capture rate:&nbsp;</label>
+      <select name="capture_rate">
+        <option value="8000" %RATE_8000%>8 kHz</option>
+        <option value="16000" %RATE_16000%>16 kHz</option>
+        <option value="22050" %RATE_22050%>22.05 kHz</option>
+        <option value="48000" %RATE_48000%>48 kHz</option>
+      </select>
+    </div>
     <div class="input-container">
       <label for="brightness">Brightness:&nbsp;</label>
       <div class="range-slider">
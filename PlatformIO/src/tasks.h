@@ -0,0 +1,31 @@
+#pragma once
+#include <Arduino.h>
+
+// Where the firmware tasks run and at which priority. Core 0 has the Wi-Fi driver and lwIP
+// (priorities 23 and 18), the codec writes and the LED animation go next to them. Core 1 has the
+// audio pipeline and the Arduino loop, which sleeps until it is notified. Per task CPU use is
+// published to SITEID/tasks with the telemetry.
+//
+// The MQTT callbacks, I2Stask and loopTask all dispatch state machine events with send_event,
+// which takes no lock. async_tcp stays on core 1 with the other two until the events are handed
+// to one task; on core 0 a callback would run a transition in parallel with fsm::run.
+//
+//   task                core  priority
+//   I2Stask                1         3  capture, DSP, wake word, playback, audio publishing
+//   loopTask               1         1  state machine and OTA, core and priority set by the framework
+//   async_tcp              1         3  MQTT and web server callbacks, CONFIG_ASYNC_TCP_RUNNING_CORE
+//                                       in platformio.ini, the priority is fixed by AsyncTCP
+//   codecTask              0         1  codec register writes over I2C
+//   Indicator LED Task     0         1  LED animation of the AudioKit and INMP441 boards
+//
+// The LED strips (NeoPixelBus, FastLED) have no task, they are written by the task that changes
+// the colors, mostly loopTask.
+#define I2S_TASK_CORE 1
+#define I2S_TASK_PRIORITY 3
+#define CODEC_TASK_CORE 0
+#define CODEC_TASK_PRIORITY 1
+#define INDICATOR_TASK_CORE 0
+#define INDICATOR_TASK_PRIORITY 1
+
+// room for the tasks reported on SITEID/tasks, with more tasks there is no report
+#define TASK_STATS_MAX 24
@@ -0,0 +1,88 @@
+#pragma once
+#include "HostTest.h"
+#include <AutomaticGainControl.h>
+#include <NoiseSuppressor.h>
+
+/**
+ * @brief The mono capture processing of I2Stask on the host: noise suppression, then gain control
+ *
+ * Uses the firmware defaults of Config in General.hpp, blocks of DEVICE_READ_SIZE samples.
+ */
+struct CaptureChain
+{
+    static const int BLOCK_SIZE = 256;
+
+    NoiseSuppressor noiseSuppressor;
+    AutomaticGainControl agc;
+
+    // gain of the AGC after each block, in dB
+    std::vector<float> gainDb;
+    double totalMicros = 0;
+    double maxMicros = 0;
+    size_t blocks = 0;
+
+    CaptureChain(int rate, bool ns, bool agcEnabled, int nsLevel = 12, int agcTarget = -9, int agcMaxGain = 30)
+    {
+        noiseSuppressor.configure(nsLevel);
+        noiseSuppressor.setEnabled(ns);
+        agc.configure(rate, BLOCK_SIZE, agcTarget, agcMaxGain);
+        agc.setEnabled(agcEnabled);
+    }
+
+    /* number of samples the output lags the input */
+    int delay() { return noiseSuppressor.isEnabled() ? NoiseSuppressor::FFT_SIZE : 0; }
+
+    /* processes the samples in place, a last partial block is left as it is */
+    void process(std::vector<int16_t> &samples)
+    {
+        for (size_t start = 0; start + BLOCK_SIZE <= samples.size(); start += BLOCK_SIZE) {
+            int16_t *block = samples.data() + start;
+            const double begin = nowMicros();
+            if (noiseSuppressor.isEnabled()) {
+                noiseSuppressor.process(block, BLOCK_SIZE);
+            }
+            agc.process(block, BLOCK_SIZE);
+            const double micros = nowMicros() - begin;
+            totalMicros += micros;
+            maxMicros = micros > maxMicros ? micros : maxMicros;
+            blocks++;
+            gainDb.push_back(agc.getGainDb());
+        }
+    }
+};
+
+/**
+ * @brief SNR of a processed signal, the speech and noise blocks are labeled from the clean reference
+ *
+ * Blocks where the reference is within 30 dB of its loudest block count as speech, blocks where it
+ * is silent as noise, everything in between is ignored. delay aligns the processed signal.
+ */
+static inline double measureSnrDb(const std::vector<int16_t> &reference, const std::vector<int16_t> &processed, int delay,
+                                  int blockSize = CaptureChain::BLOCK_SIZE)
+{
+    double loudest = 0;
+    for (size_t start = 0; start + blockSize <= reference.size(); start += blockSize) {
+        const double power = powerOf(reference.data() + start, blockSize);
+        loudest = power > loudest ? power : loudest;
+    }
+    double speech = 0, noise = 0;
+    size_t speechBlocks = 0, noiseBlocks = 0;
+    for (size_t start = 0; start + blockSize + delay <= processed.size() && start + blockSize <= reference.size(); start += blockSize) {
+        const double power = powerOf(reference.data() + start, blockSize);
+        const double out = powerOf(processed.data() + start + delay, blockSize);
+        if (power > loudest * 0.001) {
+            speech += out;
+            speechBlocks++;
+        } else if (power == 0) {
+            noise += out;
+            noiseBlocks++;
+        }
+    }
+    if (speechBlocks == 0 || noiseBlocks == 0) {
+        return 0;
+    }
+    speech /= speechBlocks;
+    noise /= noiseBlocks;
+    // the speech blocks carry the noise as well
+    return toDb((speech - noise) / noise);
+}
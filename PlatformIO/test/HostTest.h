@@ -0,0 +1,139 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Helpers for the host tests of the libraries in lib/
+ *
+ * The tests are plain programs, CHECK counts the failures and testResult() is the exit code.
+ * Audio fixtures are 16 bit PCM WAV files in test/audio.
+ */
+
+static int testFailures = 0;
+static int testChecks = 0;
+
+#define CHECK(cond) checkResult((cond), #cond, __FILE__, __LINE__)
+#define CHECK_NEAR(a, b, tolerance) checkNear((double)(a), (double)(b), (double)(tolerance), #a, __FILE__, __LINE__)
+
+static inline bool checkResult(bool ok, const char *what, const char *file, int line)
+{
+    testChecks++;
+    if (!ok) {
+        testFailures++;
+        printf("%s:%d: CHECK failed: %s\n", file, line, what);
+    }
+    return ok;
+}
+
+static inline bool checkNear(double a, double b, double tolerance, const char *what, const char *file, int line)
+{
+    testChecks++;
+    if (!(fabs(a - b) <= tolerance)) {
+        testFailures++;
+        printf("%s:%d: CHECK_NEAR failed: %s = %g, expected %g +- %g\n", file, line, what, a, b, tolerance);
+        return false;
+    }
+    return true;
+}
+
+/* prints the summary, the return value is the exit code of the test */
+static inline int testResult(const char *name)
+{
+    printf("%s: %d checks, %d failed\n", name, testChecks, testFailures);
+    return testFailures == 0 ? 0 : 1;
+}
+
+static inline double nowMicros()
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* the path of a fixture, the tests run from test/ */
+static inline std::string fixturePath(const char *name)
+{
+    return std::string("audio/") + name;
+}
+
+/* reads a 16 bit PCM WAV file, channels are interleaved */
+static inline bool readWav(const std::string &path, std::vector<int16_t> &samples, int &rate, int &channels)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == NULL) {
+        printf("cannot open %s\n", path.c_str());
+        return false;
+    }
+    uint8_t riff[12];
+    bool ok = fread(riff, 1, 12, f) == 12 && memcmp(riff, "RIFF", 4) == 0 && memcmp(riff + 8, "WAVE", 4) == 0;
+    int bits = 0;
+    while (ok) {
+        uint8_t chunk[8];
+        if (fread(chunk, 1, 8, f) != 8) {
+            ok = false;
+            break;
+        }
+        const uint32_t size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            uint8_t fmt[16];
+            ok = size >= 16 && fread(fmt, 1, 16, f) == 16;
+            channels = fmt[2] | fmt[3] << 8;
+            rate = fmt[4] | fmt[5] << 8 | fmt[6] << 16 | fmt[7] << 24;
+            bits = fmt[14] | fmt[15] << 8;
+            fseek(f, size - 16, SEEK_CUR);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            ok = bits == 16;
+            samples.resize(size / 2);
+            const size_t read = fread(samples.data(), 2, samples.size(), f);
+            samples.resize(read);
+            break;
+        } else {
+            fseek(f, size, SEEK_CUR);
+        }
+    }
+    fclose(f);
+    if (!ok) {
+        printf("%s is not a 16 bit PCM WAV file\n", path.c_str());
+    }
+    return ok;
+}
+
+static inline bool writeWav(const std::string &path, const std::vector<int16_t> &samples, int rate, int channels)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == NULL) {
+        return false;
+    }
+    const uint32_t data = samples.size() * 2;
+    const uint32_t byteRate = rate * channels * 2;
+    const uint8_t header[44] = {
+        'R', 'I', 'F', 'F',
+        (uint8_t)(data + 36), (uint8_t)((data + 36) >> 8), (uint8_t)((data + 36) >> 16), (uint8_t)((data + 36) >> 24),
+        'W', 'A', 'V', 'E', 'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, (uint8_t)channels, 0,
+        (uint8_t)rate, (uint8_t)(rate >> 8), (uint8_t)(rate >> 16), (uint8_t)(rate >> 24),
+        (uint8_t)byteRate, (uint8_t)(byteRate >> 8), (uint8_t)(byteRate >> 16), (uint8_t)(byteRate >> 24),
+        (uint8_t)(channels * 2), 0, 16, 0, 'd', 'a', 't', 'a',
+        (uint8_t)data, (uint8_t)(data >> 8), (uint8_t)(data >> 16), (uint8_t)(data >> 24)};
+    bool ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+    ok = ok && fwrite(samples.data(), 2, samples.size(), f) == samples.size();
+    fclose(f);
+    return ok;
+}
+
+static inline double powerOf(const int16_t *samples, size_t count)
+{
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += (double)samples[i] * samples[i];
+    }
+    return count > 0 ? sum / count : 0;
+}
+
+static inline double toDb(double ratio)
+{
+    return 10.0 * log10(ratio > 1e-20 ? ratio : 1e-20);
+}
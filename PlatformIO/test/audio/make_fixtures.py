@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""Writes the audio fixtures of the host tests, 16 kHz mono 16 bit WAV.
+
+speech.wav  a speech-like signal: voiced syllables with a moving pitch and formants,
+            fricative bursts and pauses, peaks around -12 dBFS
+noisy.wav   speech.wav with stationary noise (pink noise, mains hum and a fan tone)
+            at about 10 dB SNR
+
+The signal is synthetic so that the clean reference is known exactly. Recordings of a real
+satellite can be used with the harness as well, see test/README.md.
+"""
+import math
+import random
+import struct
+import wave
+import os
+
+RATE = 16000
+SECONDS = 2.5
+
+# vowel formants (F1, F2, F3) in Hz
+VOWELS = [(730, 1090, 2440), (270, 2290, 3010), (530, 1840, 2480), (570, 840, 2410), (300, 870, 2240)]
+
+
+def formant_gain(f, formants):
+    g = 0.0
+    for i, fc in enumerate(formants):
+        bw = 80.0 + 40.0 * i
+        g += 1.0 / (1.0 + ((f - fc) / bw) ** 2) / (i + 1)
+    return g
+
+
+def speech(rng, n):
+    out = [0.0] * n
+    t = int(0.2 * RATE)
+    while t < n - int(0.3 * RATE):
+        length = int(rng.uniform(0.15, 0.3) * RATE)
+        f0 = rng.uniform(100, 180)
+        glide = rng.uniform(-30, 30)
+        formants = rng.choice(VOWELS)
+        phase = 0.0
+        for i in range(length):
+            if t + i >= n:
+                break
+            env = min(1.0, i / (0.02 * RATE)) * min(1.0, (length - i) / (0.04 * RATE))
+            f = f0 + glide * i / length
+            phase += 2 * math.pi * f / RATE
+            s = 0.0
+            for h in range(1, int(3800 / f)):
+                s += formant_gain(h * f, formants) * math.sin(h * phase) / math.sqrt(h)
+            out[t + i] += 0.08 * env * s
+        t += length
+        if rng.random() < 0.4:
+            # fricative
+            flen = int(rng.uniform(0.05, 0.1) * RATE)
+            prev = 0.0
+            for i in range(flen):
+                if t + i >= n:
+                    break
+                w = rng.gauss(0, 1)
+                hp = w - prev
+                prev = w
+                out[t + i] += 0.05 * hp * math.sin(math.pi * i / flen)
+            t += flen
+        t += int(rng.uniform(0.1, 0.35) * RATE)
+    return out
+
+
+def noise(rng, n):
+    # pink noise by the Voss-McCartney method, plus hum and a fan tone
+    rows = [rng.gauss(0, 1) for _ in range(8)]
+    out = []
+    for i in range(n):
+        for r in range(8):
+            if i % (1 << r) == 0:
+                rows[r] = rng.gauss(0, 1)
+        pink = sum(rows) / 8.0
+        hum = 0.3 * math.sin(2 * math.pi * 50 * i / RATE) + 0.15 * math.sin(2 * math.pi * 150 * i / RATE)
+        fan = 0.1 * math.sin(2 * math.pi * 1210 * i / RATE)
+        out.append(pink + hum + fan)
+    return out
+
+
+def scale_to_peak(x, dbfs):
+    peak = max(abs(v) for v in x)
+    g = 10 ** (dbfs / 20.0) / peak
+    return [v * g for v in x]
+
+
+def power(x):
+    return sum(v * v for v in x) / len(x)
+
+
+def write(name, x):
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)), name)
+    with wave.open(path, 'wb') as w:
+        w.setnchannels(1)
+        w.setsampwidth(2)
+        w.setframerate(RATE)
+        w.writeframes(b''.join(struct.pack('<h', max(-32768, min(32767, int(round(v * 32767))))) for v in x))
+
+
+def main():
+    rng = random.Random(20261018)
+    n = int(SECONDS * RATE)
+    s = scale_to_peak(speech(rng, n), -12)
+    v = noise(rng, n)
+    # 10 dB SNR, measured over the voiced parts
+    active = [a for a in s if abs(a) > 0.001]
+    g = math.sqrt(power(active) / power(v) / 10.0)
+    noisy = [a + g * b for a, b in zip(s, v)]
+    write('speech.wav', s)
+    write('noisy.wav', noisy)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,76 @@
+// Runs the capture processing of the firmware on a WAV file and reports what it did.
+//
+//   capture_harness [--ns] [--agc] [--ref clean.wav] [--out processed.wav] [--trace] input.wav
+//
+// Prints the runtime per block, the AGC gain trajectory (--trace) and, with a clean reference,
+// the SNR before and after processing. The input must be 16 bit mono, as the firmware captures.
+#include "CaptureChain.h"
+#include <stdlib.h>
+
+int main(int argc, char **argv)
+{
+    bool ns = false, agc = false, trace = false;
+    const char *input = NULL, *reference = NULL, *output = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ns") == 0) {
+            ns = true;
+        } else if (strcmp(argv[i], "--agc") == 0) {
+            agc = true;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace = true;
+        } else if (strcmp(argv[i], "--ref") == 0 && i + 1 < argc) {
+            reference = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            input = argv[i];
+        }
+    }
+    if (input == NULL) {
+        printf("usage: %s [--ns] [--agc] [--ref clean.wav] [--out processed.wav] [--trace] input.wav\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<int16_t> samples;
+    int rate = 0, channels = 0;
+    if (!readWav(input, samples, rate, channels)) {
+        return 2;
+    }
+    if (channels != 1) {
+        printf("%s has %d channels, the capture processing is mono\n", input, channels);
+        return 2;
+    }
+    const std::vector<int16_t> original = samples;
+
+    CaptureChain chain(rate, ns, agc);
+    chain.process(samples);
+
+    const double blockMs = 1000.0 * CaptureChain::BLOCK_SIZE / rate;
+    printf("%s: %d Hz, %zu blocks of %d samples (%.1f ms)\n", input, rate, chain.blocks, CaptureChain::BLOCK_SIZE, blockMs);
+    printf("runtime per block: avg %.1f us, max %.1f us (%.2f%% of real time)\n", chain.totalMicros / chain.blocks,
+           chain.maxMicros, chain.totalMicros / chain.blocks / (blockMs * 10.0));
+    if (agc) {
+        printf("agc gain: final %.1f dB\n", chain.gainDb.back());
+        if (trace) {
+            for (size_t i = 0; i < chain.gainDb.size(); i++) {
+                printf("%8.1f ms %6.1f dB\n", (i + 1) * blockMs, chain.gainDb[i]);
+            }
+        }
+    }
+    if (reference != NULL) {
+        std::vector<int16_t> clean;
+        int cleanRate = 0, cleanChannels = 0;
+        if (!readWav(reference, clean, cleanRate, cleanChannels) || cleanRate != rate || cleanChannels != 1) {
+            printf("%s does not match the input\n", reference);
+            return 2;
+        }
+        const double before = measureSnrDb(clean, original, 0);
+        const double after = measureSnrDb(clean, samples, chain.delay());
+        printf("snr: %.1f dB in, %.1f dB out, %+.1f dB\n", before, after, after - before);
+    }
+    if (output != NULL && !writeWav(output, samples, rate, 1)) {
+        printf("cannot write %s\n", output);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,4 @@
+#pragma once
+// the parts of Arduino.h the codec drivers use on the host
+#include <stdint.h>
+#include <stddef.h>
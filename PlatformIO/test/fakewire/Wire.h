@@ -0,0 +1,107 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/**
+ * @brief An I2C bus with one codec on it, for the host tests of the codec drivers
+ *
+ * The chip answers at address, keeps 64 registers and logs every transaction. With
+ * autoIncrement the bytes of a write go to consecutive registers, without it they all go to the
+ * first one. After failAfter transactions the chip stops acknowledging.
+ */
+struct FakeTransaction {
+    bool read;
+    uint8_t reg;
+    std::vector<uint8_t> data;
+};
+
+class TwoWire
+{
+public:
+    uint8_t address = 0x10;
+    bool autoIncrement = true;
+    int failAfter = -1;
+    uint8_t registers[64] = {};
+    std::vector<FakeTransaction> log;
+
+    bool begin(int sda, int scl, uint32_t frequency) { return true; }
+    void end() {}
+    void beginTransmission(uint8_t target)
+    {
+        this->target = target;
+        buffer.clear();
+    }
+    size_t write(uint8_t value)
+    {
+        buffer.push_back(value);
+        return 1;
+    }
+    size_t write(const uint8_t *values, size_t count)
+    {
+        buffer.insert(buffer.end(), values, values + count);
+        return count;
+    }
+    uint8_t endTransmission(bool stop = true)
+    {
+        if (!acknowledge()) {
+            return 2;
+        }
+        if (buffer.size() == 1 && !stop) {
+            pointer = buffer[0];
+        } else if (buffer.size() > 1) {
+            log.push_back(FakeTransaction{false, buffer[0], std::vector<uint8_t>(buffer.begin() + 1, buffer.end())});
+            for (size_t i = 1; i < buffer.size(); i++) {
+                registers[(buffer[0] + (autoIncrement ? i - 1 : 0)) & 63] = buffer[i];
+            }
+        }
+        return 0;
+    }
+    uint8_t requestFrom(uint16_t target, uint8_t count, bool stop)
+    {
+        this->target = (uint8_t)target;
+        if (!acknowledge()) {
+            return 0;
+        }
+        log.push_back(FakeTransaction{true, pointer, std::vector<uint8_t>(1, registers[pointer & 63])});
+        pending = registers[pointer & 63];
+        available_ = 1;
+        return 1;
+    }
+    int available() { return available_; }
+    int read()
+    {
+        available_ = 0;
+        return pending;
+    }
+
+    /* the register writes in the order they reached the chip */
+    std::vector<std::pair<uint8_t, uint8_t>> writes() const
+    {
+        std::vector<std::pair<uint8_t, uint8_t>> result;
+        for (size_t t = 0; t < log.size(); t++) {
+            for (size_t i = 0; !log[t].read && i < log[t].data.size(); i++) {
+                result.push_back(std::make_pair((uint8_t)(log[t].reg + (autoIncrement ? i : 0)), log[t].data[i]));
+            }
+        }
+        return result;
+    }
+
+private:
+    bool acknowledge()
+    {
+        if (target != address || failAfter == 0) {
+            return false;
+        }
+        failAfter = failAfter > 0 ? failAfter - 1 : failAfter;
+        return true;
+    }
+
+    uint8_t target = 0;
+    uint8_t pointer = 0;
+    uint8_t pending = 0;
+    int available_ = 0;
+    std::vector<uint8_t> buffer;
+};
+
+extern TwoWire Wire;
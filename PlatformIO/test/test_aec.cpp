@@ -0,0 +1,209 @@
+// Echo cancellation on a simulated echo path: the far end is speech.wav, the microphone hears it
+// through a bulk delay and a synthetic room response. Measures the echo return loss enhancement
+// (ERLE), how fast it converges, what double talk does to it, and the time per block.
+#include "HostTest.h"
+#include <EchoCanceller.h>
+
+static const int RATE = 16000;
+static const int BLOCK = 256;             // device->readSize of the full duplex devices
+static const int TAPS = 256;              // aec_taps of the firmware
+static const int BULK_DELAY = 512;        // aec_delay of 32 ms at 16 kHz
+static const int PATH_DELAY = 20;         // from the loudspeaker to the microphone, within the filter
+static const int PATH_LENGTH = 160;
+
+static uint32_t seed = 7;
+
+static float randomUniform()
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / 16777216.0f;
+}
+
+/* direct sound and exponentially decaying reflections, about -6 dB in total */
+static std::vector<float> roomResponse()
+{
+    std::vector<float> h(PATH_DELAY + PATH_LENGTH, 0.0f);
+    h[PATH_DELAY] = 0.4f;
+    for (int k = PATH_DELAY + 3; k < (int)h.size(); k++) {
+        h[k] = 0.25f * (randomUniform() - 0.5f) * expf(-(k - PATH_DELAY) / 40.0f);
+    }
+    return h;
+}
+
+/* the microphone: the far end through the echo path after the bulk delay, plus near end and noise */
+static std::vector<int16_t> microphone(const std::vector<int16_t> &farEnd, const std::vector<int16_t> &nearEnd,
+                                       const std::vector<float> &h)
+{
+    std::vector<int16_t> mic(farEnd.size());
+    for (size_t n = 0; n < mic.size(); n++) {
+        float echo = 0.0f;
+        for (size_t k = 0; k < h.size(); k++) {
+            if (n >= BULK_DELAY + k) {
+                echo += h[k] * farEnd[n - BULK_DELAY - k];
+            }
+        }
+        const float noise = 10.0f * sqrtf(12.0f) * (randomUniform() - 0.5f);
+        const float s = echo + noise + (n < nearEnd.size() ? nearEnd[n] : 0);
+        mic[n] = (int16_t)lrintf(s > 32767.0f ? 32767.0f : (s < -32768.0f ? -32768.0f : s));
+    }
+    return mic;
+}
+
+/* plays farEnd and cancels its echo from mic block by block, the way I2Stask does while playing */
+static std::vector<int16_t> cancel(EchoCanceller &aec, const std::vector<int16_t> &farEnd, const std::vector<int16_t> &mic,
+                                   double *micros = NULL)
+{
+    std::vector<int16_t> out = mic;
+    double total = 0;
+    size_t blocks = 0;
+    for (size_t s = 0; s + BLOCK <= out.size(); s += BLOCK) {
+        aec.pushReference(&farEnd[s], BLOCK, 1);
+        const double start = nowMicros();
+        aec.process(&out[s], BLOCK);
+        total += nowMicros() - start;
+        blocks++;
+    }
+    if (micros != NULL) {
+        *micros = total / blocks;
+    }
+    return out;
+}
+
+/* ERLE in dB over [from, to) */
+static double erleDb(const std::vector<int16_t> &mic, const std::vector<int16_t> &out, size_t from, size_t to)
+{
+    return toDb(powerOf(&mic[from], to - from) / powerOf(&out[from], to - from));
+}
+
+static std::vector<int16_t> loop(const std::vector<int16_t> &samples, size_t length)
+{
+    std::vector<int16_t> out(length);
+    for (size_t i = 0; i < length; i++) {
+        out[i] = samples[i % samples.size()];
+    }
+    return out;
+}
+
+static void testConvergence(const std::vector<int16_t> &speech, const std::vector<float> &h)
+{
+    const std::vector<int16_t> farEnd = loop(speech, RATE * 5);
+    const std::vector<int16_t> mic = microphone(farEnd, std::vector<int16_t>(), h);
+    EchoCanceller aec;
+    aec.configure(TAPS, BULK_DELAY);
+    aec.setEnabled(true);
+    const std::vector<int16_t> out = cancel(aec, farEnd, mic);
+
+    // ERLE per 250 ms, speech.wav has pauses, a window is skipped when the echo is at the noise
+    const size_t window = RATE / 4;
+    size_t converged = 0;
+    printf("aec: erle per 250 ms:");
+    for (size_t s = 0; s + window <= out.size(); s += window) {
+        const double erle = erleDb(mic, out, s, s + window);
+        printf(" %.1f", erle);
+        if (converged == 0 && erle > 15.0) {
+            converged = s + window;
+        }
+    }
+    const double final = erleDb(mic, out, RATE * 4, RATE * 5);
+    const float reported = aec.takeErle();
+    printf("\naec: converged to 15 dB after %d ms, last second %.1f dB, reported %.1f dB\n", (int)(converged * 1000 / RATE), final, reported);
+    CHECK(converged > 0 && converged <= (size_t)RATE * 2);
+    CHECK_NEAR(final, 28.5, 2.0);
+    // the telemetry counts the blocks that adapt from the start, it is lower than the converged ERLE
+    CHECK(reported > 10.0f && reported < final + 1.0);
+}
+
+static void testDoubleTalk(const std::vector<int16_t> &speech, const std::vector<float> &h)
+{
+    // the near end talks from 2 s to 3.5 s, 6 dB above the far end, reversed speech so it is not
+    // correlated with the far end
+    const std::vector<int16_t> farEnd = loop(speech, RATE * 8);
+    std::vector<int16_t> nearEnd(farEnd.size(), 0);
+    for (size_t i = 0; i < (size_t)RATE * 3 / 2; i++) {
+        nearEnd[RATE * 2 + i] = 2 * speech[speech.size() - 1 - i % speech.size()];
+    }
+    const std::vector<int16_t> mic = microphone(farEnd, nearEnd, h);
+    const std::vector<int16_t> echoOnly = microphone(farEnd, std::vector<int16_t>(), h);
+    EchoCanceller aec;
+    aec.configure(TAPS, BULK_DELAY);
+    aec.setEnabled(true);
+    const std::vector<int16_t> out = cancel(aec, farEnd, mic);
+
+    // while both talk, what is left of the echo is measured against the near end
+    const size_t from = RATE * 2, to = RATE * 7 / 2;
+    double error = 0, near = 0, echo = 0;
+    for (size_t i = from; i < to; i++) {
+        const double d = out[i] - nearEnd[i];
+        error += d * d;
+        near += (double)nearEnd[i] * nearEnd[i];
+        echo += (double)(echoOnly[i]) * echoOnly[i];
+    }
+    const double before = toDb(near / echo);
+    const double after = toDb(near / error);
+    printf("aec: double talk, near end to echo %.1f dB -> %.1f dB, erle per second after it:", before, after);
+    for (int second = 4; second < 8; second++) {
+        printf(" %.1f", erleDb(mic, out, RATE * second, RATE * (second + 1)));
+    }
+    printf("\n");
+    // The Geigel detector only holds the adaptation on the loudest syllables of the near end, it
+    // allows the echo path to be 6 dB louder than the reference. In between the filter adapts to
+    // the near end and is detuned, the echo is not reduced while both talk.
+    CHECK(after > 0.0);
+    // the filter comes back once the near end stops
+    CHECK(erleDb(mic, out, RATE * 7, RATE * 8) > 20.0);
+}
+
+static void testNoReference(const std::vector<int16_t> &speech, const std::vector<float> &h)
+{
+    // a learned filter and nothing played: the microphone passes unchanged
+    const std::vector<int16_t> farEnd = loop(speech, RATE * 2);
+    EchoCanceller aec;
+    aec.configure(TAPS, BULK_DELAY);
+    aec.setEnabled(true);
+    cancel(aec, farEnd, microphone(farEnd, std::vector<int16_t>(), h));
+    aec.reset();
+    std::vector<int16_t> talk(speech.begin(), speech.end());
+    const std::vector<int16_t> out = cancel(aec, std::vector<int16_t>(talk.size(), 0), talk);
+    const size_t blocks = talk.size() / BLOCK * BLOCK;
+    CHECK(std::equal(out.begin(), out.begin() + blocks, talk.begin()));
+    CHECK(aec.overruns() == 0);
+}
+
+static void testBenchmark(const std::vector<int16_t> &speech, const std::vector<float> &h)
+{
+    const std::vector<int16_t> farEnd = loop(speech, RATE * 5);
+    const std::vector<int16_t> mic = microphone(farEnd, std::vector<int16_t>(), h);
+    const int taps[] = {128, 256, 512};
+    for (size_t t = 0; t < sizeof(taps) / sizeof(taps[0]); t++) {
+        double best = 1e9;
+        double erle = 0;
+        for (int run = 0; run < 3; run++) {
+            EchoCanceller aec;
+            aec.configure(taps[t], BULK_DELAY);
+            aec.setEnabled(true);
+            double micros = 0;
+            const std::vector<int16_t> out = cancel(aec, farEnd, mic, &micros);
+            best = micros < best ? micros : best;
+            erle = erleDb(mic, out, RATE * 4, RATE * 5);
+        }
+        printf("aec: %d taps, %.0f us per %d sample block on the host, erle %.1f dB\n", taps[t], best, BLOCK, erle);
+        // 128 taps are shorter than the echo path, the rest of it is left
+        CHECK(taps[t] < PATH_DELAY + PATH_LENGTH ? erle > 10.0 : erle > 20.0);
+    }
+}
+
+int main()
+{
+    std::vector<int16_t> speech;
+    int rate = 0, channels = 0;
+    if (!readWav(fixturePath("speech.wav"), speech, rate, channels)) {
+        return 1;
+    }
+    CHECK(rate == RATE && channels == 1);
+    const std::vector<float> h = roomResponse();
+    testConvergence(speech, h);
+    testDoubleTalk(speech, h);
+    testNoReference(speech, h);
+    testBenchmark(speech, h);
+    return testResult("test_aec");
+}
@@ -0,0 +1,266 @@
+// Simulation of the Matrix Voice array with far field plane waves from known directions. The
+// microphone signals are computed analytically, so the fractional delays between the microphones
+// are exact. The test checks the direction of arrival and the gain of the beam.
+#include "HostTest.h"
+#include <Beamformer.h>
+
+static const int RATE = 16000;
+static const int MICS = 8;
+static const int BLOCK = 512;             // DEVICE_READ_SIZE of the Matrix Voice
+static const float SPEED_OF_SOUND = 343000.0f;
+static const size_t FRAMES = BLOCK * 16;  // about 0.5 s
+static const size_t ONSET = RATE / 4;     // the talker starts after 250 ms of room noise
+
+// the positions of src/devices/MatrixVoice.hpp
+static const float micPositions[MICS][2] = {
+    {0.00f, 0.00f},
+    {-38.13f, 3.58f},
+    {-20.98f, 32.04f},
+    {11.97f, 36.38f},
+    {34.34f, 17.10f},
+    {32.68f, -19.81f},
+    {9.66f, -37.06f},
+    {-23.84f, -29.99f}};
+
+struct Tone {
+    float frequency;
+    float amplitude;
+    float phase;
+};
+
+static uint32_t seed = 1;
+
+static float randomUniform()
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / 16777216.0f;
+}
+
+// broadband source, tones from 300 Hz to 6 kHz with random phases, about -12 dBFS
+static std::vector<Tone> broadband()
+{
+    std::vector<Tone> tones;
+    for (float f = 300.0f; f < 6000.0f; f += 137.0f) {
+        tones.push_back(Tone{f, 0.0f, 2.0f * (float)M_PI * randomUniform()});
+    }
+    for (size_t i = 0; i < tones.size(); i++) {
+        tones[i].amplitude = 8200.0f / sqrtf(tones.size() / 2.0f);
+    }
+    return tones;
+}
+
+/**
+ * @brief adds a plane wave from azimuth degrees to interleaved microphone samples
+ *
+ * A microphone further along the direction of the source hears it earlier. The source starts at
+ * frame start: the direction search only runs above the noise floor, which a source that is
+ * there from the first frame on sets itself.
+ */
+static void addPlaneWave(std::vector<float> &mics, const std::vector<Tone> &tones, float azimuth, size_t start = 0)
+{
+    const float theta = azimuth * (float)M_PI / 180.0f;
+    const size_t frames = mics.size() / MICS;
+    for (int c = 0; c < MICS; c++) {
+        const double lead = (micPositions[c][0] * cos(theta) + micPositions[c][1] * sin(theta)) / SPEED_OF_SOUND;
+        for (size_t t = 0; t < tones.size(); t++) {
+            const double w = 2.0 * M_PI * tones[t].frequency;
+            for (size_t s = start; s < frames; s++) {
+                mics[s * MICS + c] += tones[t].amplitude * (float)sin(w * ((double)s / RATE + lead) + tones[t].phase);
+            }
+        }
+    }
+}
+
+/* uncorrelated noise at every microphone, uniform with the given rms */
+static void addNoise(std::vector<float> &mics, float rms)
+{
+    for (size_t i = 0; i < mics.size(); i++) {
+        mics[i] += rms * sqrtf(12.0f) * (randomUniform() - 0.5f);
+    }
+}
+
+static std::vector<int16_t> toPcm(const std::vector<float> &mics)
+{
+    std::vector<int16_t> pcm(mics.size());
+    for (size_t i = 0; i < mics.size(); i++) {
+        const float s = mics[i] > 32767.0f ? 32767.0f : (mics[i] < -32768.0f ? -32768.0f : mics[i]);
+        pcm[i] = (int16_t)lrintf(s);
+    }
+    return pcm;
+}
+
+/* runs the blocks the way MatrixVoice::readAudio does, returns the mono output */
+static std::vector<int16_t> run(Beamformer &beamformer, const std::vector<int16_t> &mics, double *micros = NULL)
+{
+    const size_t frames = mics.size() / MICS;
+    std::vector<int16_t> output(frames);
+    const double start = nowMicros();
+    for (size_t s = 0; s + BLOCK <= frames; s += BLOCK) {
+        beamformer.updateDirection(&mics[s * MICS], Beamformer::CHUNK);
+        beamformer.process(&mics[s * MICS], BLOCK, &output[s]);
+    }
+    if (micros != NULL) {
+        *micros = (nowMicros() - start) / (frames / BLOCK);
+    }
+    return output;
+}
+
+static int angleError(int a, int b)
+{
+    const int d = ((a - b) % 360 + 360) % 360;
+    return d > 180 ? 360 - d : d;
+}
+
+/* power of mic 0 over the second half, the beamformer has settled by then */
+static double micPower(const std::vector<int16_t> &mics)
+{
+    const size_t frames = mics.size() / MICS;
+    double sum = 0;
+    for (size_t s = frames / 2; s < frames; s++) {
+        sum += (double)mics[s * MICS] * mics[s * MICS];
+    }
+    return sum / (frames - frames / 2);
+}
+
+static double outputPower(const std::vector<int16_t> &output)
+{
+    return powerOf(&output[output.size() / 2], output.size() - output.size() / 2);
+}
+
+static void testDirectionOfArrival()
+{
+    // multiples of the 15 degree grid and directions in between, the estimate is the nearest grid direction
+    const int azimuths[] = {0, 45, 90, 135, 180, 225, 270, 315, 20, 100, 200, 290};
+    const std::vector<Tone> tones = broadband();
+    int worst = 0;
+    double totalMicros = 0;
+    for (size_t i = 0; i < sizeof(azimuths) / sizeof(azimuths[0]); i++) {
+        std::vector<float> mics(FRAMES * MICS, 0.0f);
+        addPlaneWave(mics, tones, azimuths[i], ONSET);
+        addNoise(mics, 200.0f);    // about 20 dB SNR at every microphone
+        Beamformer beamformer;
+        beamformer.configure(MICS, micPositions, RATE);
+        double micros = 0;
+        run(beamformer, toPcm(mics), &micros);
+        totalMicros += micros;
+        const int error = angleError(beamformer.azimuth(), azimuths[i]);
+        worst = error > worst ? error : worst;
+        if (!CHECK(error <= 8)) {
+            printf("source at %d degrees, estimate %d, confidence %.2f\n", azimuths[i], beamformer.azimuth(), beamformer.confidence());
+        }
+        CHECK(beamformer.confidence() > 0.2f);
+        // the beam follows the estimate
+        CHECK(beamformer.steering() == beamformer.azimuth());
+    }
+    printf("doa: worst error %d degrees, %.0f us per %d sample block\n", worst, totalMicros / (sizeof(azimuths) / sizeof(azimuths[0])), BLOCK);
+}
+
+static void testSilence()
+{
+    // nothing above the noise floor, no estimate
+    std::vector<float> mics(FRAMES * MICS, 0.0f);
+    addNoise(mics, 30.0f);
+    Beamformer beamformer;
+    beamformer.configure(MICS, micPositions, RATE);
+    run(beamformer, toPcm(mics));
+    CHECK(beamformer.azimuth() == -1);
+}
+
+/* gain in dB of the beam steered to steering for a plane wave from 60 degrees */
+static double beamGain(const std::vector<Tone> &tones, int steering)
+{
+    std::vector<float> source(FRAMES * MICS, 0.0f);
+    addPlaneWave(source, tones, 60.0f);
+    const std::vector<int16_t> mics = toPcm(source);
+    Beamformer beamformer;
+    beamformer.configure(MICS, micPositions, RATE);
+    beamformer.setFixedAzimuth(steering);
+    const double gain = toDb(outputPower(run(beamformer, mics)) / micPower(mics));
+    CHECK(beamformer.steering() == steering);
+    return gain;
+}
+
+static void testGain()
+{
+    // steered to the source the channels add up in phase, the level is that of one microphone.
+    // The 4 tap interpolation of the fractional delays rolls off the top octave, by about 3 dB
+    // at 6 kHz. Steered away the array cancels, from about 1.5 kHz up where it is large enough.
+    const float frequencies[] = {500, 1000, 2000, 3000, 4000, 5000, 6000};
+    printf("gain:");
+    for (size_t i = 0; i < sizeof(frequencies) / sizeof(frequencies[0]); i++) {
+        const std::vector<Tone> tone(1, Tone{frequencies[i], 8000.0f, 0.0f});
+        const double onAxis = beamGain(tone, 60);
+        const double offAxis = beamGain(tone, 240);
+        printf(" %.0f Hz %.1f/%.1f dB", frequencies[i], onAxis, offAxis);
+        if (frequencies[i] <= 2000) {
+            CHECK_NEAR(onAxis, 0.0, 0.1);
+        } else {
+            CHECK(onAxis < 0.0 && onAxis > -3.5);
+        }
+        if (frequencies[i] >= 2000) {
+            CHECK(offAxis < onAxis - 8.0);
+        }
+    }
+    printf(" (on axis/opposite)\n");
+
+    const std::vector<Tone> tones = broadband();
+    const double onAxis = beamGain(tones, 60);
+    const double offAxis = beamGain(tones, 240);
+
+    // uncorrelated noise is averaged, 8 microphones give -9 dB, the interpolation another 1 dB
+    std::vector<float> noise(FRAMES * MICS, 0.0f);
+    addNoise(noise, 1000.0f);
+    const std::vector<int16_t> noiseMics = toPcm(noise);
+    Beamformer beamformer;
+    beamformer.configure(MICS, micPositions, RATE);
+    beamformer.setFixedAzimuth(60);
+    const double noiseGain = toDb(outputPower(run(beamformer, noiseMics)) / micPower(noiseMics));
+
+    printf("gain: broadband on axis %.2f dB, opposite %.2f dB, uncorrelated noise %.2f dB\n", onAxis, offAxis, noiseGain);
+    CHECK_NEAR(onAxis, -0.6, 0.3);
+    CHECK(offAxis < onAxis - 6.0);
+    CHECK_NEAR(noiseGain, -10.0, 0.5);
+    CHECK(noiseGain < toDb(1.0 / MICS));
+}
+
+static void testHold()
+{
+    const std::vector<Tone> tones = broadband();
+    std::vector<float> first(FRAMES * MICS, 0.0f);
+    addPlaneWave(first, tones, 90.0f, ONSET);
+    std::vector<float> second(FRAMES * MICS, 0.0f);
+    addPlaneWave(second, tones, 270.0f, ONSET);
+
+    Beamformer beamformer;
+    beamformer.configure(MICS, micPositions, RATE);
+    run(beamformer, toPcm(first));
+    CHECK(angleError(beamformer.steering(), 90) <= 8);
+
+    // during a session the beam stays, the estimate moves on
+    beamformer.hold(true);
+    run(beamformer, toPcm(second));
+    CHECK(angleError(beamformer.steering(), 90) <= 8);
+    CHECK(angleError(beamformer.azimuth(), 270) <= 8);
+
+    // released it follows again
+    beamformer.hold(false);
+    run(beamformer, toPcm(second));
+    CHECK(angleError(beamformer.steering(), 270) <= 8);
+
+    // a fixed azimuth wins over the estimate, -1 follows the talker again
+    beamformer.setFixedAzimuth(0);
+    run(beamformer, toPcm(first));
+    CHECK(beamformer.steering() == 0);
+    beamformer.setFixedAzimuth(-1);
+    run(beamformer, toPcm(first));
+    CHECK(angleError(beamformer.steering(), 90) <= 8);
+}
+
+int main()
+{
+    testDirectionOfArrival();
+    testSilence();
+    testGain();
+    testHold();
+    return testResult("test_beamformer");
+}
@@ -0,0 +1,96 @@
+// Regression test of the capture processing (NoiseSuppressor, AutomaticGainControl) on the
+// audio fixtures. The expected values were recorded with the current implementation, the
+// tolerances leave room for differences of libm between hosts.
+#include "CaptureChain.h"
+
+static const int LIMIT = 29204;   // -1 dBFS, the limit of the AGC
+
+static int16_t peakOf(const std::vector<int16_t> &samples, size_t from = 0)
+{
+    int peak = 0;
+    for (size_t i = from; i < samples.size(); i++) {
+        const int s = samples[i] < 0 ? -samples[i] : samples[i];
+        peak = s > peak ? s : peak;
+    }
+    return peak;
+}
+
+static std::vector<int16_t> sine(int rate, float seconds, float dbfs)
+{
+    std::vector<int16_t> samples(rate * seconds);
+    const float amplitude = 32767.0f * powf(10.0f, dbfs / 20.0f);
+    for (size_t i = 0; i < samples.size(); i++) {
+        samples[i] = (int16_t)lrintf(amplitude * sinf(2.0f * (float)M_PI * 440.0f * i / rate));
+    }
+    return samples;
+}
+
+static void testNoiseSuppression(const std::vector<int16_t> &clean, const std::vector<int16_t> &noisy, int rate)
+{
+    std::vector<int16_t> samples = noisy;
+    CaptureChain chain(rate, true, false);
+    chain.process(samples);
+    const double before = measureSnrDb(clean, noisy, 0);
+    const double after = measureSnrDb(clean, samples, chain.delay());
+    printf("ns: snr %.1f dB -> %.1f dB, avg %.1f us per block\n", before, after, chain.totalMicros / chain.blocks);
+    CHECK_NEAR(before, 9.8, 0.2);
+    CHECK_NEAR(after, 18.0, 1.0);
+    CHECK(after - before > 6.0);
+
+    // the same input gives the same output
+    std::vector<int16_t> again = noisy;
+    CaptureChain second(rate, true, false);
+    second.process(again);
+    CHECK(again == samples);
+}
+
+static void testCaptureChain(const std::vector<int16_t> &clean, const std::vector<int16_t> &noisy, int rate)
+{
+    std::vector<int16_t> samples = noisy;
+    CaptureChain chain(rate, true, true);
+    chain.process(samples);
+    const double after = measureSnrDb(clean, samples, chain.delay());
+    printf("ns+agc: snr %.1f dB, final gain %.1f dB, peak %d\n", after, chain.gainDb.back(), peakOf(samples));
+    CHECK_NEAR(after, 10.3, 1.0);
+    CHECK_NEAR(chain.gainDb.back(), 21.6, 1.0);
+    CHECK(peakOf(samples) <= LIMIT);
+    // the gain never exceeds the configured maximum
+    for (size_t i = 0; i < chain.gainDb.size(); i++) {
+        CHECK(chain.gainDb[i] <= 30.1f);
+    }
+}
+
+static void testGainTrajectory(int rate)
+{
+    // a quiet tone is brought up to the target of -9 dBFS within the release time
+    std::vector<int16_t> quiet = sine(rate, 3.0f, -30.0f);
+    CaptureChain up(rate, false, true);
+    up.process(quiet);
+    const size_t blocksPerSecond = rate / CaptureChain::BLOCK_SIZE;
+    CHECK(up.gainDb[blocksPerSecond / 10] < 15.0f);
+    CHECK_NEAR(up.gainDb.back(), 21.0, 0.5);
+    CHECK_NEAR(20.0 * log10(peakOf(quiet, quiet.size() - CaptureChain::BLOCK_SIZE) / 32767.0), -9.0, 0.5);
+
+    // a loud tone after the quiet one is limited right away, not a single sample overshoots
+    std::vector<int16_t> step = sine(rate, 3.0f, -30.0f);
+    const std::vector<int16_t> loud = sine(rate, 1.0f, -3.0f);
+    step.insert(step.end(), loud.begin(), loud.end());
+    CaptureChain down(rate, false, true);
+    down.process(step);
+    CHECK(peakOf(step) <= LIMIT);
+    CHECK_NEAR(down.gainDb.back(), -6.0, 0.5);
+}
+
+int main()
+{
+    std::vector<int16_t> clean, noisy;
+    int rate = 0, channels = 0, noisyRate = 0;
+    if (!readWav(fixturePath("speech.wav"), clean, rate, channels) || !readWav(fixturePath("noisy.wav"), noisy, noisyRate, channels)) {
+        return 1;
+    }
+    CHECK(rate == 16000 && noisyRate == rate && channels == 1);
+    testNoiseSuppression(clean, noisy, rate);
+    testCaptureChain(clean, noisy, rate);
+    testGainTrajectory(rate);
+    return testResult("test_capture");
+}
@@ -0,0 +1,258 @@
+// Concealment of playback underflows. The playback is simulated the way playRequest fills the
+// output blocks: whatever audio has arrived is played, the rest of the block is concealed, and
+// the audio that comes late is crossfaded in.
+#include "HostTest.h"
+#include <Concealer.h>
+
+static const int RATE = 16000;
+static const int BLOCK_FRAMES = 256;
+
+static uint32_t seed = 3;
+
+static uint32_t randomNumber()
+{
+    seed = seed * 1664525u + 1013904223u;
+    return seed >> 8;
+}
+
+/* interleaved tones, frequency and amplitude per channel */
+static std::vector<int16_t> tones(int channels, size_t frames, const float *frequencies, float amplitude = 12000.0f)
+{
+    std::vector<int16_t> samples(frames * channels);
+    for (size_t i = 0; i < frames; i++) {
+        for (int c = 0; c < channels; c++) {
+            samples[i * channels + c] = (int16_t)lrintf(amplitude * sinf(2.0f * (float)M_PI * frequencies[c] * i / RATE));
+        }
+    }
+    return samples;
+}
+
+/* largest difference between two frames that follow each other, per channel */
+static int maxStep(const std::vector<int16_t> &samples, int channels, size_t from = 0, size_t to = 0)
+{
+    to = to == 0 ? samples.size() : to;
+    int largest = 0;
+    for (size_t i = from + channels; i < to; i++) {
+        const int step = abs(samples[i] - samples[i - channels]);
+        largest = step > largest ? step : largest;
+    }
+    return largest;
+}
+
+static int peak(const int16_t *samples, size_t count)
+{
+    int largest = 0;
+    for (size_t i = 0; i < count; i++) {
+        largest = abs(samples[i]) > largest ? abs(samples[i]) : largest;
+    }
+    return largest;
+}
+
+static void testPeriodicSignal()
+{
+    // 200 Hz, 80 samples per period, played for 40 ms then the audio runs out
+    const float frequency[] = {200.0f};
+    const std::vector<int16_t> clean = tones(1, RATE / 10, frequency);
+    const size_t played = RATE * 40 / 1000;
+    Concealer concealer;
+    concealer.configure(1, RATE);
+    concealer.push(clean.data(), played);
+
+    // concealed in odd pieces, 60 ms in total
+    std::vector<int16_t> out(clean.begin(), clean.begin() + played);
+    const size_t gap = RATE * 60 / 1000;
+    const size_t pieces[] = {7, 100, 333, 520};
+    size_t concealed = 0;
+    for (size_t p = 0; concealed < gap; p = (p + 1) % 4) {
+        const size_t count = pieces[p] < gap - concealed ? pieces[p] : gap - concealed;
+        std::vector<int16_t> piece(count);
+        concealer.conceal(piece.data(), count);
+        concealer.push(piece.data(), count);
+        out.insert(out.end(), piece.begin(), piece.end());
+        concealed += count;
+    }
+    CHECK(concealer.concealing());
+    CHECK(concealer.underflows == 1);
+    CHECK(concealer.concealedMicros == 60000);
+
+    // the repeated period continues the tone, the first period follows it within the fade
+    double error = 0, signal = 0;
+    const size_t periodSamples = RATE / 200;
+    for (size_t i = played; i < played + periodSamples; i++) {
+        const double gain = 1.0 - (double)(i - played) / (RATE * Concealer::FADE_MS / 1000);
+        const double expected = clean[i] * gain;
+        error += (out[i] - expected) * (out[i] - expected);
+        signal += expected * expected;
+    }
+    const double snr = toDb(signal / error);
+
+    // no click at the start, the level falls every period, silence after the fade
+    const size_t fadeEnd = played + RATE * Concealer::FADE_MS / 1000;
+    bool falling = true;
+    for (size_t p = played + periodSamples; p + periodSamples <= fadeEnd; p += periodSamples) {
+        falling &= peak(&out[p], periodSamples) <= peak(&out[p - periodSamples], periodSamples);
+    }
+    printf("concealer: period continued at %.1f dB SNR, largest step %d, clean %d\n", snr, maxStep(out, 1), maxStep(clean, 1));
+    CHECK(snr > 20.0);
+    CHECK(maxStep(out, 1) <= maxStep(clean, 1));
+    CHECK(falling);
+    CHECK(peak(&out[fadeEnd], out.size() - fadeEnd) == 0);
+}
+
+static void testStereo()
+{
+    // the channels keep their own waveform and do not swap, the period is the one of the first channel
+    const float frequencies[] = {200.0f, 400.0f};
+    const std::vector<int16_t> clean = tones(2, RATE / 10, frequencies);
+    const size_t played = RATE * 40 / 1000 * 2;
+    Concealer concealer;
+    concealer.configure(2, RATE);
+    concealer.push(clean.data(), played);
+    std::vector<int16_t> out(RATE * 10 / 1000 * 2);
+    concealer.conceal(out.data(), out.size());
+    double error[2] = {0, 0}, swapped[2] = {0, 0};
+    for (size_t i = 0; i < out.size(); i++) {
+        const int c = i % 2;
+        const double gain = 1.0 - (double)(i / 2) / (RATE * Concealer::FADE_MS / 1000);
+        error[c] += fabs(out[i] - clean[played + i] * gain);
+        swapped[c] += fabs(out[i] - clean[played + (i ^ 1)] * gain);
+    }
+    CHECK(error[0] * 4 < swapped[0]);
+    CHECK(error[1] * 4 < swapped[1]);
+    CHECK(concealer.concealedMicros == 10000);
+}
+
+/**
+ * @brief plays chunks the way playRequest does, gaps are concealed
+ *
+ * @param arrivals frames that arrive before each output block, the playback ends with the
+ * block that plays the last frame
+ */
+static std::vector<int16_t> play(Concealer &concealer, const std::vector<int16_t> &audio, int channels,
+                                 const std::vector<size_t> &arrivals)
+{
+    std::vector<int16_t> out;
+    size_t available = 0, position = 0;
+    for (size_t b = 0; b < arrivals.size(); b++) {
+        available += arrivals[b] * channels;
+        available = available > audio.size() ? audio.size() : available;
+        std::vector<int16_t> block(BLOCK_FRAMES * channels);
+        const size_t real = available - position < block.size() ? available - position : block.size();
+        memcpy(block.data(), &audio[position], real * sizeof(int16_t));
+        position += real;
+        if (real > 0) {
+            concealer.resume(block.data(), real);
+            concealer.push(block.data(), real);
+        }
+        if (real < block.size()) {
+            concealer.conceal(&block[real], block.size() - real);
+            concealer.push(&block[real], block.size() - real);
+        }
+        out.insert(out.end(), block.begin(), block.end());
+        if (position == audio.size()) {
+            break;
+        }
+    }
+    return out;
+}
+
+static void testDroppedChunks()
+{
+    // chunks of random size arrive in time for the block they start in, now and then one comes a
+    // block late. The blocks after a gap play behind the arrivals, a late chunk then may not hurt.
+    const float frequencies[] = {220.0f, 330.0f};
+    const std::vector<int16_t> clean = tones(2, RATE * 2, frequencies);
+    const size_t frames = clean.size() / 2;
+    std::vector<size_t> arrivals(frames / BLOCK_FRAMES + 2, 0);
+    size_t late = 0;
+    for (size_t start = 0; start < frames;) {
+        const size_t size = 100 + randomNumber() % 300;
+        const bool delayed = randomNumber() % 8 == 0;
+        late += delayed ? 1 : 0;
+        arrivals[start / BLOCK_FRAMES + (delayed ? 1 : 0)] += size;
+        start += size;
+    }
+    // the blocks go on until everything is played
+    arrivals.resize(arrivals.size() + late, 0);
+    Concealer concealer;
+    concealer.configure(2, RATE);
+    const std::vector<int16_t> out = play(concealer, clean, 2, arrivals);
+
+    // the concealed time is what the output got in addition to the audio
+    const uint32_t extraMicros = (uint32_t)((uint64_t)(out.size() - clean.size()) / 2 * 1000000 / RATE);
+    printf("concealer: %d late chunks, %d underflows, %d ms concealed, largest step %d, clean %d\n", (int)late,
+           (int)concealer.underflows, (int)(concealer.concealedMicros / 1000), maxStep(out, 2), maxStep(clean, 2));
+    CHECK(late > 0 && concealer.underflows > 0 && concealer.underflows <= late + 1);
+    CHECK(concealer.concealedMicros == extraMicros);
+    // the gaps and the returns are smooth, within twice the largest step of the tones
+    CHECK(maxStep(out, 2) <= 2 * maxStep(clean, 2));
+}
+
+static void testReorderedChunk()
+{
+    // a chunk comes late and the next one is played in its place: after the gap the audio
+    // continues somewhere else, the crossfade hides the jump
+    const float frequency[] = {300.0f};
+    const std::vector<int16_t> clean = tones(1, RATE / 4, frequency);
+    const size_t played = 1000, skipped = 123;
+    Concealer concealer;
+    concealer.configure(1, RATE);
+    std::vector<int16_t> out(clean.begin(), clean.begin() + played);
+    concealer.push(out.data(), out.size());
+    std::vector<int16_t> gap(64);
+    concealer.conceal(gap.data(), gap.size());
+    concealer.push(gap.data(), gap.size());
+    out.insert(out.end(), gap.begin(), gap.end());
+    std::vector<int16_t> next(clean.begin() + played + skipped, clean.begin() + played + skipped + 256);
+    const std::vector<int16_t> original = next;
+    concealer.resume(next.data(), next.size());
+    out.insert(out.end(), next.begin(), next.end());
+
+    const int jump = abs(original[0] - gap.back());
+    printf("concealer: jump after a reordered chunk %d, largest step with crossfade %d\n", jump, maxStep(out, 1));
+    CHECK(!concealer.concealing());
+    CHECK(maxStep(out, 1) <= 2 * maxStep(clean, 1));
+    // after the crossfade the audio is untouched
+    CHECK(std::equal(next.begin() + Concealer::MERGE_FRAMES, next.end(), original.begin() + Concealer::MERGE_FRAMES));
+}
+
+static void testAfterFade()
+{
+    // audio that comes back after the fade starts from silence without a click
+    const float frequency[] = {200.0f};
+    const std::vector<int16_t> clean = tones(1, RATE / 4, frequency);
+    Concealer concealer;
+    concealer.configure(1, RATE);
+    concealer.push(clean.data(), 800);
+    std::vector<int16_t> gap(RATE / 10);
+    concealer.conceal(gap.data(), gap.size());
+    std::vector<int16_t> next(clean.begin() + 800, clean.begin() + 1056);
+    concealer.resume(next.data(), next.size());
+    CHECK(gap.back() == 0);
+    CHECK(abs(next[0]) <= maxStep(clean, 1));
+
+    // without history there is nothing to repeat, the gap is silent
+    Concealer empty;
+    empty.configure(1, RATE);
+    std::vector<int16_t> silent(256, 1);
+    empty.conceal(silent.data(), silent.size());
+    CHECK(peak(silent.data(), silent.size()) == 0);
+    CHECK(empty.underflows == 1);
+
+    // resume without a gap leaves the samples alone
+    Concealer fresh;
+    fresh.configure(1, RATE);
+    std::vector<int16_t> untouched(clean.begin(), clean.begin() + 256);
+    fresh.resume(untouched.data(), untouched.size());
+    CHECK(std::equal(untouched.begin(), untouched.end(), clean.begin()));
+}
+
+int main()
+{
+    testPeriodicSignal();
+    testStereo();
+    testDroppedChunks();
+    testReorderedChunk();
+    testAfterFade();
+    return testResult("test_concealer");
+}
@@ -0,0 +1,225 @@
+// Drift correction of a streaming sender whose clock is off by a few hundred ppm. The sender
+// pushes chunks with network jitter, the DAC takes blocks at the nominal rate, the blocks are
+// filled the way playRequest fills them with drift correction on. The sender starts LEAD_MS
+// ahead, like a TTS stream that sends its first chunks at once.
+#include "HostTest.h"
+#include <DriftCorrector.h>
+#include <deque>
+
+static const int RATE = 16000;
+static const int BLOCK_FRAMES = 256;
+static const uint32_t BUFFER_FRAMES = 16384;    // audioData, 32 KB of 16 bit mono
+static const int LEAD_MS = 200;
+
+static uint32_t seed = 11;
+
+static uint32_t randomNumber()
+{
+    seed = seed * 1664525u + 1013904223u;
+    return seed >> 8;
+}
+
+struct DriftRun {
+    uint32_t underruns = 0;
+    uint32_t maxFill = 0;
+    int32_t maxFillError = 0;   // after the controller has settled
+    int32_t finalPpm = 0;
+    float meanPpm = 0.0f;       // over the second half, the P part follows the chunks
+    uint32_t finalFill = 0;
+    uint64_t played = 0;
+};
+
+/**
+ * @brief streams seconds of audio from a sender with a clock off by skewPpm
+ *
+ * @param chunkMs length of the chunks the sender pushes
+ * @param jitterMs network delay of a chunk, uniform from 0
+ * @param correct false plays the samples as they come, without the corrector
+ */
+static DriftRun stream(int skewPpm, int seconds, int chunkMs, int jitterMs, bool correct = true)
+{
+    DriftCorrector corrector;
+    corrector.configure(1, RATE);
+    DriftRun run;
+    std::deque<int16_t> buffer;
+
+    const int chunkFrames = RATE * chunkMs / 1000;
+    const double senderRate = RATE * (1.0 + skewPpm * 1e-6);
+    // arrival of the next chunk, a chunk never overtakes the one before it
+    double arrival = (randomNumber() % (jitterMs * 1000 + 1)) / 1e6;
+    uint64_t sent = 0;
+    bool playing = false;
+    double ppmSum = 0;
+    const size_t blocks = (size_t)seconds * RATE / BLOCK_FRAMES;
+    for (size_t b = 0; b < blocks; b++) {
+        const double now = (double)b * BLOCK_FRAMES / RATE;
+        // the chunks that arrived before this block
+        while (arrival <= now) {
+            buffer.insert(buffer.end(), chunkFrames, (int16_t)(sent & 0x7fff));
+            sent += chunkFrames;
+            const double due = (double)sent / senderRate - LEAD_MS / 1000.0 + (randomNumber() % (jitterMs * 1000 + 1)) / 1e6;
+            arrival = due > arrival ? due : arrival;
+        }
+        run.maxFill = buffer.size() > run.maxFill ? buffer.size() : run.maxFill;
+
+        if (correct) {
+            corrector.update(buffer.size(), (unsigned long)(now * 1e6));
+        }
+        int16_t block[BLOCK_FRAMES];
+        int frames = 0;
+        while (frames < BLOCK_FRAMES) {
+            if (!correct && !buffer.empty()) {
+                block[frames++] = buffer.front();
+                buffer.pop_front();
+                continue;
+            }
+            if (correct && !corrector.needsInput()) {
+                corrector.output(&block[frames++]);
+                continue;
+            }
+            if (buffer.empty()) {
+                break;
+            }
+            corrector.input(&buffer.front());
+            buffer.pop_front();
+        }
+        run.played += frames;
+        // the blocks before the first chunk wait for it, after that a short block is an underrun
+        if (frames < BLOCK_FRAMES && playing) {
+            run.underruns++;
+        }
+        playing |= frames > 0;
+        if (correct && now > 60.0) {
+            const int32_t error = abs(corrector.fillError());
+            run.maxFillError = error > run.maxFillError ? error : run.maxFillError;
+        }
+        if (b >= blocks / 2) {
+            ppmSum += corrector.ppm();
+        }
+    }
+    run.finalPpm = corrector.ppm();
+    run.meanPpm = (float)(ppmSum / (blocks - blocks / 2));
+    run.finalFill = buffer.size();
+    return run;
+}
+
+static void testSkew()
+{
+    // 10 minutes each, chunks of 100 ms and 500 ms with 40 ms of jitter
+    const int skews[] = {-800, -300, 0, 300, 800};
+    const int chunks[] = {100, 500};
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        for (size_t s = 0; s < sizeof(skews) / sizeof(skews[0]); s++) {
+            const DriftRun run = stream(skews[s], 600, chunks[c], 40);
+            printf("drift: %4d ppm, %d ms chunks: correction %.1f ppm, fill error up to %d frames, max fill %d, %d underruns\n",
+                   skews[s], chunks[c], run.meanPpm, (int)run.maxFillError, (int)run.maxFill, (int)run.underruns);
+            // the correction matches the sender clock, the fill stays at its target. The 500 ms
+            // chunks leave a ripple in the smoothed fill, the mean is off by up to 15 ppm.
+            CHECK(fabsf(run.meanPpm - skews[s]) <= 15.0f);
+            CHECK(abs(run.finalPpm) <= DriftCorrector::MAX_PPM);
+            CHECK(run.maxFillError < RATE / 10);
+            CHECK(run.underruns == 0);
+            CHECK(run.maxFill < BUFFER_FRAMES);
+        }
+    }
+}
+
+static void testWithoutCorrection()
+{
+    // the same senders played as they come: 800 ppm are 7680 frames in 10 minutes, the lead of
+    // 3200 frames runs out for the slow one and the fast one fills the buffer
+    const DriftRun fast = stream(800, 600, 100, 40, false);
+    const DriftRun slow = stream(-800, 600, 100, 40, false);
+    printf("drift: +-800 ppm without correction: max fill %d, %d underruns\n", (int)fast.maxFill, (int)slow.underruns);
+    CHECK(fast.maxFill > 7680);
+    CHECK(slow.underruns > 0);
+}
+
+static void testOutOfRange()
+{
+    // a sender further off than MAX_PPM is corrected as far as possible, the buffer drifts
+    const DriftRun fast = stream(1500, 600, 100, 40);
+    const DriftRun slow = stream(-1500, 600, 100, 40);
+    const DriftRun uncorrected = stream(1500, 600, 100, 40, false);
+    printf("drift: +-1500 ppm: correction %d/%d ppm, max fill %d (%d without correction)\n", (int)fast.finalPpm,
+           (int)slow.finalPpm, (int)fast.maxFill, (int)uncorrected.maxFill);
+    CHECK(fast.finalPpm == DriftCorrector::MAX_PPM);
+    CHECK(slow.finalPpm == -DriftCorrector::MAX_PPM);
+    // without correction 1500 ppm are 14400 frames in 10 minutes, with it a third of that
+    CHECK(fast.maxFill < BUFFER_FRAMES);
+    CHECK(uncorrected.maxFill - fast.maxFill > 14400 * 2 / 3 - RATE / 10);
+}
+
+static void testPassThrough()
+{
+    // until the controller has settled the ratio is exactly 1, the samples pass unchanged
+    DriftCorrector corrector;
+    corrector.configure(2, RATE);
+    std::vector<int16_t> in(2000), out;
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = (int16_t)(randomNumber() & 0xffff);
+    }
+    size_t read = 0;
+    while (read + 2 <= in.size() || !corrector.needsInput()) {
+        if (corrector.needsInput()) {
+            corrector.input(&in[read]);
+            read += 2;
+        } else {
+            int16_t frame[2];
+            corrector.output(frame);
+            out.push_back(frame[0]);
+            out.push_back(frame[1]);
+        }
+    }
+    // the output is two frames behind the input, the last two are still in the taps
+    CHECK(out.size() == in.size() - 2 * 2);
+    CHECK(std::equal(out.begin(), out.end(), in.begin()));
+    CHECK(corrector.ppm() == 0 && !corrector.settled());
+}
+
+static void testInterpolation()
+{
+    // at the largest correction a 1 kHz tone is resampled with little error
+    DriftCorrector corrector;
+    corrector.configure(1, RATE);
+    // settle on a fill of 1000 frames, then report a fill 100 ms higher until the correction is at MAX_PPM
+    for (int i = 0; i <= 100; i++) {
+        corrector.update(1000, (unsigned long)i * 40000);
+    }
+    for (int i = 101; i <= 1000; i++) {
+        corrector.update(1000 + RATE / 10, (unsigned long)i * 40000);
+    }
+    CHECK(corrector.ppm() == DriftCorrector::MAX_PPM);
+
+    const double ratio = 1.0 + DriftCorrector::MAX_PPM * 1e-6;
+    const double w = 2.0 * M_PI * 1000.0 / RATE;
+    size_t read = 0, written = 0;
+    double error = 0, signal = 0;
+    while (written < (size_t)RATE) {
+        if (corrector.needsInput()) {
+            const int16_t s = (int16_t)lrint(16000.0 * sin(w * read++));
+            corrector.input(&s);
+            continue;
+        }
+        int16_t out;
+        corrector.output(&out);
+        // output n is input n * ratio, the first output is input 0
+        const double expected = 16000.0 * sin(w * written * ratio);
+        error += (out - expected) * (out - expected);
+        signal += expected * expected;
+        written++;
+    }
+    const double snr = toDb(signal / error);
+    printf("drift: 1 kHz at %d ppm, %.1f dB SNR\n", DriftCorrector::MAX_PPM, snr);
+    CHECK(snr > 40.0);
+}
+
+int main()
+{
+    testSkew();
+    testWithoutCorrection();
+    testOutOfRange();
+    testPassThrough();
+    testInterpolation();
+    return testResult("test_drift");
+}
@@ -0,0 +1,208 @@
+// The ES8388 driver and its register shadow on a fake I2C bus (fakewire/Wire.h). Checks the
+// power-up order of begin(), that unchanged settings cost no transaction, what a failed write
+// leaves behind, and the burst writes of RegisterShadow on chips with and without auto increment.
+#include "HostTest.h"
+#include <Wire.h>
+#include <ES8388Control.h>
+#include <RegisterShadow.h>
+
+TwoWire Wire;
+
+typedef std::vector<std::pair<uint8_t, uint8_t>> Writes;
+
+// the bring-up sequence of the datasheet: the DAC is muted first, the ADC powered down while it
+// is configured, DAC, unmute and ADC are powered up last
+static const uint8_t powerUp[][2] = {
+    {0x19, 0x04}, {0x01, 0x50}, {0x02, 0x00}, {0x08, 0x00},
+    {0x04, 0x3e}, {0x00, 0x12},
+    {0x17, 0x18}, {0x18, 0x02},
+    {0x26, 0x1b}, {0x27, 0x90}, {0x2a, 0x90},
+    {0x2b, 0x80}, {0x2d, 0x00},
+    {0x1b, 0x00}, {0x1a, 0x00},
+    {0x03, 0xff}, {0x09, 0x88},
+    {0x0a, 0xf0}, {0x0b, 0x80}, {0x0c, 0x0e}, {0x0d, 0x02},
+    {0x10, 0x20}, {0x11, 0x20},
+    {0x2e, 0x1e}, {0x2f, 0x1e},
+    {0x30, 0x1e}, {0x31, 0x1e},
+    {0x04, 0x3c}, {0x19, 0x00}, {0x03, 0x00}};
+
+static void resetBus()
+{
+    Wire = TwoWire();
+}
+
+static void testPowerUpOrder()
+{
+    resetBus();
+    ES8388Control codec;
+    CHECK(codec.begin());
+    const Writes writes = Wire.writes();
+    const size_t expected = sizeof(powerUp) / sizeof(powerUp[0]);
+    bool inOrder = writes.size() == expected;
+    for (size_t i = 0; inOrder && i < expected; i++) {
+        inOrder = writes[i].first == powerUp[i][0] && writes[i].second == powerUp[i][1];
+    }
+    CHECK(inOrder);
+    // one register per transaction, nothing read back
+    CHECK(Wire.log.size() == expected);
+    CHECK(codec.transactions() == expected);
+    CHECK(Wire.registers[0x19] == 0x00 && Wire.registers[0x04] == 0x3c && Wire.registers[0x03] == 0x00);
+}
+
+static void testCachedSettings()
+{
+    resetBus();
+    ES8388Control codec;
+    codec.begin();
+    Wire.log.clear();
+    const uint32_t before = codec.transactions();
+
+    // the main volume is written once, both channels, the same volume again is skipped
+    codec.volume(ES8388Control::ES_MAIN, 50);
+    CHECK(Wire.writes().size() == 2);
+    CHECK(Wire.registers[0x1a] == 48 && Wire.registers[0x1b] == 48);
+    codec.volume(ES8388Control::ES_MAIN, 50);
+    CHECK(Wire.log.size() == 2);
+    CHECK(codec.skippedWrites() == 2);
+
+    // mute works on the shadow, no read, only DACCONTROL3 changes and only once
+    codec.mute(ES8388Control::ES_MAIN, true);
+    codec.mute(ES8388Control::ES_MAIN, true);
+    codec.mute(ES8388Control::ES_MAIN, false);
+    codec.mute(ES8388Control::ES_MAIN, false);
+    bool reads = false;
+    for (size_t t = 0; t < Wire.log.size(); t++) {
+        reads |= Wire.log[t].read;
+    }
+    CHECK(!reads);
+    CHECK(Wire.log.size() == 4);
+    CHECK(Wire.log[2].reg == 0x19 && Wire.log[2].data[0] == 0x04);
+    CHECK(Wire.log[3].reg == 0x19 && Wire.log[3].data[0] == 0x00);
+
+    // the outputs share DACPOWER with the power bits, those stay as begin() left them
+    codec.mute(ES8388Control::ES_OUT2, true);
+    CHECK(Wire.registers[0x04] == 0x30);
+    codec.mute(ES8388Control::ES_OUT2, false);
+    CHECK(Wire.registers[0x04] == 0x3c);
+    printf("es8388: %d transactions for 2 volume and 6 mute calls after begin()\n", (int)(codec.transactions() - before));
+}
+
+static void testFailedWrite()
+{
+    // the chip stops answering in the middle of begin(): begin() fails, and the registers that
+    // were not acknowledged are written again once the bus is back
+    resetBus();
+    Wire.failAfter = 10;
+    ES8388Control codec;
+    CHECK(!codec.begin());
+    Wire.failAfter = -1;
+    Wire.log.clear();
+    codec.volume(ES8388Control::ES_OUT1, 100);
+    CHECK(Wire.writes().size() == 2);
+    CHECK(Wire.registers[0x2e] == 0x21 && Wire.registers[0x2f] == 0x21);
+
+    // a codec that is not there is not configured at all
+    resetBus();
+    Wire.address = 0x11;
+    ES8388Control missing;
+    CHECK(!missing.begin());
+    CHECK(Wire.log.empty());
+}
+
+struct ShadowBus {
+    TwoWire chip;
+};
+
+static bool shadowWrite(void *context, uint8_t reg, const uint8_t *values, size_t count)
+{
+    TwoWire &chip = ((ShadowBus *)context)->chip;
+    chip.beginTransmission(chip.address);
+    chip.write(reg);
+    chip.write(values, count);
+    return chip.endTransmission() == 0;
+}
+
+static bool shadowRead(void *context, uint8_t reg, uint8_t &value)
+{
+    TwoWire &chip = ((ShadowBus *)context)->chip;
+    chip.beginTransmission(chip.address);
+    chip.write(reg);
+    chip.endTransmission(false);
+    if (chip.requestFrom(chip.address, 1, true) == 0) {
+        return false;
+    }
+    value = (uint8_t)chip.read();
+    return true;
+}
+
+static void testBurst()
+{
+    // adjacent changed registers go out in one transaction, an unchanged one splits the run
+    ShadowBus bus;
+    RegisterShadow shadow;
+    shadow.begin(shadowWrite, shadowRead, &bus, true);
+    for (uint8_t reg = 0x10; reg < 0x18; reg++) {
+        shadow.set(reg, reg);
+    }
+    CHECK(shadow.commit());
+    CHECK(bus.chip.log.size() == 1 && bus.chip.log[0].data.size() == 8);
+    for (uint8_t reg = 0x10; reg < 0x18; reg++) {
+        shadow.set(reg, reg == 0x13 ? reg : reg + 1);
+    }
+    CHECK(shadow.commit());
+    CHECK(bus.chip.log.size() == 3 && shadow.skipped == 1);
+    bool written = true;
+    for (uint8_t reg = 0x10; reg < 0x18; reg++) {
+        written &= bus.chip.registers[reg] == (reg == 0x13 ? reg : reg + 1);
+    }
+    CHECK(written);
+
+    // read-modify-write reads a register once, then works on the shadow
+    bus.chip.registers[0x20] = 0xa5;
+    CHECK(shadow.update(0x20, 0x0f, 0x00));
+    CHECK(shadow.update(0x20, 0xf0, 0x30));
+    CHECK(shadow.commit());
+    CHECK(bus.chip.registers[0x20] == 0x30);
+    CHECK(bus.chip.log.size() == 5 && bus.chip.log[3].read);
+
+    // a chip without auto increment writes a burst into its first register, which is why the
+    // ES8388 driver only bursts when ES8388_BURST_WRITE says the chip increments
+    ShadowBus plain;
+    plain.chip.autoIncrement = false;
+    RegisterShadow burst;
+    burst.begin(shadowWrite, shadowRead, &plain, true);
+    burst.set(0x1a, 0x11);
+    burst.set(0x1b, 0x22);
+    burst.commit();
+    CHECK(plain.chip.registers[0x1a] == 0x22 && plain.chip.registers[0x1b] == 0x00);
+    RegisterShadow single;
+    plain.chip = TwoWire();
+    plain.chip.autoIncrement = false;
+    single.begin(shadowWrite, shadowRead, &plain, false);
+    single.set(0x1a, 0x11);
+    single.set(0x1b, 0x22);
+    single.commit();
+    CHECK(plain.chip.registers[0x1a] == 0x11 && plain.chip.registers[0x1b] == 0x22);
+    CHECK(plain.chip.log.size() == 2);
+
+    // a failed write is forgotten, the next commit of the same value goes out again
+    ShadowBus failing;
+    failing.chip.failAfter = 0;
+    RegisterShadow lost;
+    lost.begin(shadowWrite, shadowRead, &failing, true);
+    lost.set(0x05, 0x42);
+    CHECK(!lost.commit());
+    failing.chip.failAfter = -1;
+    lost.set(0x05, 0x42);
+    CHECK(lost.commit());
+    CHECK(failing.chip.registers[0x05] == 0x42 && lost.skipped == 0);
+}
+
+int main()
+{
+    testPowerUpOrder();
+    testCachedSettings();
+    testFailedWrite();
+    testBurst();
+    return testResult("test_es8388");
+}
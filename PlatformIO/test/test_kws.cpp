@@ -0,0 +1,594 @@
+// Checks the int8 kernels of the keyword spotter against straightforward reference
+// implementations of the TFLite int8 semantics, loads a small KWS1 model end to end and
+// measures the runtime of a DS-CNN sized network.
+#include "HostTest.h"
+#include <Int8Kernels.h>
+#include <KeywordSpotter.h>
+#include <stdlib.h>
+
+static uint32_t randomState = 20261018;
+
+static int32_t randomInt(int32_t low, int32_t high)
+{
+    randomState = randomState * 1664525u + 1013904223u;
+    return low + (int32_t)((randomState >> 8) % (uint32_t)(high - low + 1));
+}
+
+static void randomFill(int8_t *values, size_t count, int low = -128, int high = 127)
+{
+    for (size_t i = 0; i < count; i++) {
+        values[i] = (int8_t)randomInt(low, high);
+    }
+}
+
+// TFLite: SaturatingRoundingDoublingHighMul rounds half up, RoundingDivideByPowerOfTwo rounds
+// half away from zero. Written with floor division on int64 to be independent of the kernel.
+static int64_t floorDivide(int64_t a, int64_t b)
+{
+    const int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+static int32_t referenceRequantize(int32_t acc, int32_t multiplier, int shift)
+{
+    const int64_t x = (int64_t)acc * ((int64_t)1 << (shift > 0 ? shift : 0));
+    int64_t high;
+    if (x == INT32_MIN && multiplier == INT32_MIN) {
+        high = INT32_MAX;
+    } else {
+        high = floorDivide(x * multiplier + ((int64_t)1 << 30), (int64_t)1 << 31);
+    }
+    const int right = shift > 0 ? 0 : -shift;
+    if (right == 0) {
+        return (int32_t)high;
+    }
+    const int64_t half = (int64_t)1 << (right - 1);
+    return (int32_t)(high >= 0 ? (high + half) >> right : -((-high + half) >> right));
+}
+
+static int8_t referenceOutput(int32_t acc, int channel, const Int8Quantization &quant)
+{
+    int32_t y = referenceRequantize(acc, quant.multiplier[channel], quant.shift[channel]) + quant.outputZeroPoint;
+    y = y < quant.activationMin ? quant.activationMin : (y > quant.activationMax ? quant.activationMax : y);
+    return (int8_t)y;
+}
+
+static void testRequantize()
+{
+    // hand computed: 0.5 * 2^-1, ties of both roundings
+    CHECK(int8Requantize(100, 1 << 30, 0) == 50);
+    CHECK(int8Requantize(1, 1 << 30, 0) == 1);     // 0.5 rounds up
+    CHECK(int8Requantize(-1, 1 << 30, 0) == 0);    // -0.5 rounds up as well
+    CHECK(int8Requantize(6, 1 << 30, -1) == 2);    // 3 / 2 = 1.5 rounds away from zero
+    CHECK(int8Requantize(-6, 1 << 30, -1) == -2);
+    CHECK(int8Requantize(1000, 1 << 30, 2) == 2000);
+    CHECK(int8Requantize(INT32_MIN, INT32_MIN, 0) == INT32_MAX);
+
+    int mismatches = 0;
+    for (int i = 0; i < 200000; i++) {
+        const int shift = randomInt(-31, 6);
+        const int32_t limit = shift > 0 ? (INT32_MAX >> shift) : INT32_MAX;
+        const int32_t acc = randomInt(-limit, limit) >> randomInt(0, 24);
+        const int32_t multiplier = randomInt(1 << 30, INT32_MAX);
+        if (int8Requantize(acc, multiplier, shift) != referenceRequantize(acc, multiplier, shift)) {
+            mismatches++;
+        }
+    }
+    CHECK(mismatches == 0);
+}
+
+/* random quantization of a layer, the multiplier puts a typical accumulator into the int8 range */
+struct RandomQuantization {
+    std::vector<int32_t> multiplier;
+    std::vector<int8_t> shift;
+    Int8Quantization quant;
+
+    RandomQuantization(int channels, int shiftLow, int shiftHigh, bool relu)
+    {
+        for (int c = 0; c < channels; c++) {
+            multiplier.push_back(randomInt(1 << 30, INT32_MAX));
+            shift.push_back((int8_t)randomInt(shiftLow, shiftHigh));
+        }
+        quant.multiplier = multiplier.data();
+        quant.shift = shift.data();
+        quant.outputZeroPoint = randomInt(-20, 20);
+        quant.activationMin = relu ? quant.outputZeroPoint : -128;
+        quant.activationMax = 127;
+    }
+};
+
+static void referenceConv2d(const int8_t *input, int inH, int inW, int inC, int32_t inputOffset, const int8_t *weights,
+                            const int32_t *bias, int outC, int kH, int kW, int sH, int sW, int pH, int pW, int outH,
+                            int outW, const Int8Quantization &quant, int8_t *output)
+{
+    for (int oy = 0; oy < outH; oy++) {
+        for (int ox = 0; ox < outW; ox++) {
+            for (int c = 0; c < outC; c++) {
+                int32_t acc = bias[c];
+                for (int ky = 0; ky < kH; ky++) {
+                    for (int kx = 0; kx < kW; kx++) {
+                        const int iy = oy * sH - pH + ky;
+                        const int ix = ox * sW - pW + kx;
+                        if (iy < 0 || iy >= inH || ix < 0 || ix >= inW) {
+                            continue;
+                        }
+                        for (int i = 0; i < inC; i++) {
+                            acc += (input[(iy * inW + ix) * inC + i] + inputOffset) * weights[((c * kH + ky) * kW + kx) * inC + i];
+                        }
+                    }
+                }
+                output[(oy * outW + ox) * outC + c] = referenceOutput(acc, c, quant);
+            }
+        }
+    }
+}
+
+static void referenceDepthwise(const int8_t *input, int inH, int inW, int channels, int32_t inputOffset, const int8_t *weights,
+                               const int32_t *bias, int kH, int kW, int sH, int sW, int pH, int pW, int outH, int outW,
+                               const Int8Quantization &quant, int8_t *output)
+{
+    for (int oy = 0; oy < outH; oy++) {
+        for (int ox = 0; ox < outW; ox++) {
+            for (int c = 0; c < channels; c++) {
+                int32_t acc = bias[c];
+                for (int ky = 0; ky < kH; ky++) {
+                    for (int kx = 0; kx < kW; kx++) {
+                        const int iy = oy * sH - pH + ky;
+                        const int ix = ox * sW - pW + kx;
+                        if (iy >= 0 && iy < inH && ix >= 0 && ix < inW) {
+                            acc += (input[(iy * inW + ix) * channels + c] + inputOffset) * weights[(ky * kW + kx) * channels + c];
+                        }
+                    }
+                }
+                output[(oy * outW + ox) * channels + c] = referenceOutput(acc, c, quant);
+            }
+        }
+    }
+}
+
+static void referenceFullyConnected(const int8_t *input, int pixels, int inSize, int32_t inputOffset, const int8_t *weights,
+                                    const int32_t *bias, int outSize, const Int8Quantization &quant, int8_t *output)
+{
+    for (int p = 0; p < pixels; p++) {
+        for (int c = 0; c < outSize; c++) {
+            int32_t acc = bias[c];
+            for (int i = 0; i < inSize; i++) {
+                acc += (input[p * inSize + i] + inputOffset) * weights[c * inSize + i];
+            }
+            output[p * outSize + c] = referenceOutput(acc, c, quant);
+        }
+    }
+}
+
+static int outputSize(int in, int kernel, int stride, int pad)
+{
+    return (in + 2 * pad - kernel) / stride + 1;
+}
+
+static void testConv2d()
+{
+    // shapes: first layer of a DS-CNN, a padded 3x3 with channels, a stride without padding, a kernel wider than the input
+    const int shapes[][9] = {
+        // inH inW inC outC kH kW stride pH pW
+        {49, 10, 1, 8, 10, 4, 2, 4, 1},
+        {7, 6, 5, 6, 3, 3, 1, 1, 1},
+        {9, 9, 3, 4, 3, 3, 2, 0, 0},
+        {4, 3, 2, 3, 5, 5, 1, 2, 2},
+    };
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        const int *d = shapes[s];
+        const int inH = d[0], inW = d[1], inC = d[2], outC = d[3], kH = d[4], kW = d[5], stride = d[6], pH = d[7], pW = d[8];
+        const int outH = outputSize(inH, kH, stride, pH), outW = outputSize(inW, kW, stride, pW);
+        std::vector<int8_t> input(inH * inW * inC), weights(outC * kH * kW * inC);
+        std::vector<int8_t> expected(outH * outW * outC), output(outH * outW * outC);
+        std::vector<int32_t> bias(outC);
+        randomFill(input.data(), input.size());
+        randomFill(weights.data(), weights.size(), -127, 127);
+        for (int c = 0; c < outC; c++) {
+            bias[c] = randomInt(-5000, 5000);
+        }
+        const int32_t inputOffset = randomInt(-127, 128);
+        // scale a random accumulator of kH * kW * inC taps to about +-50
+        const int shift = -(int)lrint(log2(400.0 * sqrt((double)kH * kW * inC)));
+        RandomQuantization q(outC, shift - 1, shift + 1, s % 2 == 0);
+        referenceConv2d(input.data(), inH, inW, inC, inputOffset, weights.data(), bias.data(), outC, kH, kW, stride, stride,
+                        pH, pW, outH, outW, q.quant, expected.data());
+        std::vector<int32_t> folded = bias;
+        int8FoldInputOffset(folded.data(), weights.data(), outC, kH * kW * inC, inputOffset);
+        int8Conv2d(input.data(), inH, inW, inC, inputOffset, weights.data(), folded.data(), outC, kH, kW, stride, stride, pH, pW,
+                   outH, outW, q.quant, output.data());
+        CHECK(output == expected);
+        // the output must not be saturated everywhere, or the comparison says little
+        int saturated = 0;
+        for (size_t i = 0; i < output.size(); i++) {
+            saturated += output[i] == 127 || output[i] == -128;
+        }
+        CHECK(saturated < (int)output.size() / 2);
+    }
+}
+
+static void testDepthwise()
+{
+    const int shapes[][7] = {
+        // inH inW C kH kW stride pad
+        {25, 5, 16, 3, 3, 1, 1},
+        {8, 8, 5, 3, 3, 2, 1},
+        {6, 4, 3, 3, 3, 1, 0},
+    };
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        const int *d = shapes[s];
+        const int inH = d[0], inW = d[1], channels = d[2], kH = d[3], kW = d[4], stride = d[5], pad = d[6];
+        const int outH = outputSize(inH, kH, stride, pad), outW = outputSize(inW, kW, stride, pad);
+        std::vector<int8_t> input(inH * inW * channels), weights(kH * kW * channels);
+        std::vector<int8_t> expected(outH * outW * channels), output(outH * outW * channels);
+        std::vector<int32_t> bias(channels);
+        randomFill(input.data(), input.size());
+        randomFill(weights.data(), weights.size(), -127, 127);
+        for (int c = 0; c < channels; c++) {
+            bias[c] = randomInt(-2000, 2000);
+        }
+        const int32_t inputOffset = randomInt(-127, 128);
+        RandomQuantization q(channels, -10, -6, true);
+        referenceDepthwise(input.data(), inH, inW, channels, inputOffset, weights.data(), bias.data(), kH, kW, stride, stride, pad,
+                           pad, outH, outW, q.quant, expected.data());
+        int8DepthwiseConv2d(input.data(), inH, inW, channels, inputOffset, weights.data(), bias.data(), kH, kW, stride, stride,
+                            pad, pad, outH, outW, q.quant, output.data());
+        CHECK(output == expected);
+    }
+}
+
+static void testPointwiseAndFullyConnected()
+{
+    const int pixels = 25 * 5, inC = 24, outC = 16, fcIn = 257, fcOut = 12;
+    std::vector<int8_t> input(pixels * inC), weights(outC * inC), expected(pixels * outC), output(pixels * outC);
+    std::vector<int32_t> bias(outC);
+    randomFill(input.data(), input.size());
+    randomFill(weights.data(), weights.size(), -127, 127);
+    for (int c = 0; c < outC; c++) {
+        bias[c] = randomInt(-3000, 3000);
+    }
+    int32_t inputOffset = randomInt(-127, 128);
+    RandomQuantization q(outC, -12, -7, true);
+    referenceFullyConnected(input.data(), pixels, inC, inputOffset, weights.data(), bias.data(), outC, q.quant, expected.data());
+    std::vector<int32_t> folded = bias;
+    int8FoldInputOffset(folded.data(), weights.data(), outC, inC, inputOffset);
+    int8Pointwise(input.data(), pixels, inC, weights.data(), folded.data(), outC, q.quant, output.data());
+    CHECK(output == expected);
+
+    // odd size, so the tail of the unrolled dot product is used
+    std::vector<int8_t> fcInput(fcIn), fcWeights(fcOut * fcIn), fcExpected(fcOut), fcOutput(fcOut);
+    std::vector<int32_t> fcBias(fcOut);
+    randomFill(fcInput.data(), fcInput.size());
+    randomFill(fcWeights.data(), fcWeights.size(), -127, 127);
+    for (int c = 0; c < fcOut; c++) {
+        fcBias[c] = randomInt(-3000, 3000);
+    }
+    inputOffset = randomInt(-127, 128);
+    RandomQuantization fq(fcOut, -14, -9, false);
+    referenceFullyConnected(fcInput.data(), 1, fcIn, inputOffset, fcWeights.data(), fcBias.data(), fcOut, fq.quant, fcExpected.data());
+    int8FoldInputOffset(fcBias.data(), fcWeights.data(), fcOut, fcIn, inputOffset);
+    int8FullyConnected(fcInput.data(), fcIn, fcWeights.data(), fcBias.data(), fcOut, fq.quant, fcOutput.data());
+    CHECK(fcOutput == fcExpected);
+}
+
+static void testPoolAndSoftmax()
+{
+    const int8_t pool[] = {10, -10, 11, -11, 12, -13};   // 3 pixels, 2 channels
+    int8_t pooled[2];
+    int8AveragePool(pool, 3, 1, 2, pooled);
+    CHECK(pooled[0] == 11);
+    CHECK(pooled[1] == -11);   // -34 / 3 = -11.33
+
+    const int8_t logits[] = {0, 10, 20};
+    uint8_t probabilities[3];
+    int8Softmax(logits, 3, 0.1f, probabilities);
+    const double e0 = exp(-2.0), e1 = exp(-1.0), sum = e0 + e1 + 1.0;
+    CHECK_NEAR(probabilities[0], 255 * e0 / sum, 0.51);
+    CHECK_NEAR(probabilities[1], 255 * e1 / sum, 0.51);
+    CHECK_NEAR(probabilities[2], 255 * 1.0 / sum, 0.51);
+}
+
+/**
+ * @brief writes a KWS1 model and computes its output with the reference layers
+ */
+struct TestModel {
+    std::vector<uint8_t> file;
+    KeywordSpotter::ModelHeader header;
+    std::vector<KeywordSpotter::LayerHeader> layers;
+    std::vector<std::vector<int8_t> > weights;
+    std::vector<std::vector<int32_t> > biases;
+    std::vector<RandomQuantization *> quantizations;
+
+    ~TestModel()
+    {
+        for (size_t i = 0; i < quantizations.size(); i++) {
+            delete quantizations[i];
+        }
+    }
+
+    void append(const void *data, size_t size)
+    {
+        file.insert(file.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+        while (file.size() % 4 != 0) {
+            file.push_back(0);
+        }
+    }
+
+    void addLayer(uint8_t type, int outC, int kernel, int stride, int pad, int weightCount, bool relu)
+    {
+        KeywordSpotter::LayerHeader lh;
+        memset(&lh, 0, sizeof(lh));
+        lh.type = type;
+        lh.kernelH = lh.kernelW = kernel;
+        lh.strideH = lh.strideW = stride;
+        lh.padH = lh.padW = pad;
+        lh.outChannels = outC;
+        lh.outputScale = 0.05f;
+        std::vector<int8_t> w(weightCount);
+        std::vector<int32_t> b(outC);
+        randomFill(w.data(), w.size(), -127, 127);
+        for (int c = 0; c < outC; c++) {
+            b[c] = randomInt(-3000, 3000);
+        }
+        RandomQuantization *q = new RandomQuantization(outC, -12, -7, relu);
+        lh.outputZeroPoint = q->quant.outputZeroPoint;
+        lh.activationMin = q->quant.activationMin;
+        lh.activationMax = q->quant.activationMax;
+        append(&lh, sizeof(lh));
+        if (weightCount > 0) {
+            append(w.data(), w.size());
+            append(b.data(), b.size() * 4);
+            append(q->multiplier.data(), outC * 4);
+            append(q->shift.data(), outC);
+        }
+        layers.push_back(lh);
+        weights.push_back(w);
+        biases.push_back(b);
+        quantizations.push_back(q);
+    }
+
+    /* input 49 x 10, conv, depthwise, pointwise, average pool, fully connected, softmax */
+    TestModel(int channels, int blocks, int labels)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "KWS1", 4);
+        header.layerCount = 2 * blocks + 4;
+        header.inputFrames = 49;
+        header.inputFeatures = 10;
+        header.inputScale = 0.1f;
+        header.inputZeroPoint = -3;
+        header.labelCount = labels;
+        header.wakeLabel = 2;
+        header.strideFrames = 2;
+        append(&header, sizeof(header));
+        addLayer(KeywordSpotter::CONV, channels, 3, 2, 1, channels * 3 * 3, true);
+        for (int i = 0; i < blocks; i++) {
+            addLayer(KeywordSpotter::DEPTHWISE, channels, 3, 1, 1, 3 * 3 * channels, true);
+            addLayer(KeywordSpotter::POINTWISE, channels, 1, 1, 0, channels * channels, true);
+        }
+        addLayer(KeywordSpotter::AVERAGE_POOL, channels, 0, 0, 0, 0, false);
+        addLayer(KeywordSpotter::FULLY_CONNECTED, labels, 0, 0, 0, labels * channels, false);
+        addLayer(KeywordSpotter::SOFTMAX, labels, 0, 0, 0, 0, false);
+    }
+
+    /* output of the reference layers, before the softmax */
+    std::vector<int8_t> reference(const std::vector<int8_t> &input)
+    {
+        std::vector<int8_t> x = input;
+        int h = header.inputFrames, w = header.inputFeatures, c = 1;
+        int32_t zeroPoint = header.inputZeroPoint;
+        for (size_t i = 0; i + 1 < layers.size(); i++) {
+            const KeywordSpotter::LayerHeader &lh = layers[i];
+            const Int8Quantization &q = quantizations[i]->quant;
+            std::vector<int8_t> y;
+            if (lh.type == KeywordSpotter::CONV || lh.type == KeywordSpotter::DEPTHWISE) {
+                const int oh = outputSize(h, lh.kernelH, lh.strideH, lh.padH), ow = outputSize(w, lh.kernelW, lh.strideW, lh.padW);
+                y.resize(oh * ow * lh.outChannels);
+                if (lh.type == KeywordSpotter::CONV) {
+                    referenceConv2d(x.data(), h, w, c, -zeroPoint, weights[i].data(), biases[i].data(), lh.outChannels, lh.kernelH,
+                                    lh.kernelW, lh.strideH, lh.strideW, lh.padH, lh.padW, oh, ow, q, y.data());
+                } else {
+                    referenceDepthwise(x.data(), h, w, c, -zeroPoint, weights[i].data(), biases[i].data(), lh.kernelH, lh.kernelW,
+                                       lh.strideH, lh.strideW, lh.padH, lh.padW, oh, ow, q, y.data());
+                }
+                h = oh;
+                w = ow;
+            } else if (lh.type == KeywordSpotter::POINTWISE) {
+                y.resize(h * w * lh.outChannels);
+                referenceFullyConnected(x.data(), h * w, c, -zeroPoint, weights[i].data(), biases[i].data(), lh.outChannels, q, y.data());
+            } else if (lh.type == KeywordSpotter::FULLY_CONNECTED) {
+                y.resize(lh.outChannels);
+                referenceFullyConnected(x.data(), 1, h * w * c, -zeroPoint, weights[i].data(), biases[i].data(), lh.outChannels, q, y.data());
+                h = w = 1;
+            } else {
+                y.resize(c);
+                int8AveragePool(x.data(), h, w, c, y.data());
+                h = w = 1;
+                x = y;
+                continue;   // keeps the quantization of its input
+            }
+            c = lh.outChannels;
+            zeroPoint = lh.outputZeroPoint;
+            x = y;
+        }
+        return x;
+    }
+};
+
+struct FileReader {
+    const std::vector<uint8_t> *file;
+    size_t position;
+};
+
+static size_t readModel(void *context, uint8_t *buffer, size_t size)
+{
+    FileReader *reader = (FileReader *)context;
+    const size_t left = reader->file->size() - reader->position;
+    size = size > left ? left : size;
+    size = size > 100 ? 100 : size;   // short reads, like a file
+    memcpy(buffer, reader->file->data() + reader->position, size);
+    reader->position += size;
+    return size;
+}
+
+static void testModel()
+{
+    TestModel model(12, 2, 4);
+    static KeywordSpotter spotter;
+    std::vector<uint8_t> arena(64 * 1024);
+    FileReader reader = {&model.file, 0};
+    CHECK(spotter.load(readModel, &reader, arena.data(), arena.size()));
+    CHECK(reader.position == model.file.size());
+
+    std::vector<int8_t> input(49 * 10);
+    randomFill(input.data(), input.size());
+    const uint8_t *probabilities = spotter.invoke(input.data());
+    CHECK(probabilities != NULL);
+    const std::vector<int8_t> logits = model.reference(input);
+    uint8_t expected[4];
+    int8Softmax(logits.data(), 4, model.layers[model.layers.size() - 2].outputScale, expected);
+    CHECK(probabilities != NULL && memcmp(probabilities, expected, 4) == 0);
+
+    // a truncated file and a too small arena are refused
+    std::vector<uint8_t> truncated(model.file.begin(), model.file.end() - 8);
+    FileReader shortReader = {&truncated, 0};
+    CHECK(!spotter.load(readModel, &shortReader, arena.data(), arena.size()));
+    reader.position = 0;
+    CHECK(!spotter.load(readModel, &reader, arena.data(), 1024));
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &data)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("cannot open %s, run test_kws_convert.py first\n", path);
+        return false;
+    }
+    uint8_t buffer[256];
+    size_t bytes;
+    while ((bytes = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        data.insert(data.end(), buffer, buffer + bytes);
+    }
+    fclose(f);
+    return true;
+}
+
+/* a model converted from .tflite by kws_convert.py, the expected output is from its TFLite reference */
+static void testConvertedModel()
+{
+    std::vector<uint8_t> file, input, expected;
+    if (!CHECK(readFile("build/kws_convert/model.kws", file) && readFile("build/kws_convert/input.bin", input) &&
+               readFile("build/kws_convert/expected.bin", expected))) {
+        return;
+    }
+    static KeywordSpotter spotter;
+    std::vector<uint8_t> arena(16 * 1024);
+    FileReader reader = {&file, 0};
+    if (!CHECK(spotter.load(readModel, &reader, arena.data(), arena.size()))) {
+        printf("%s\n", spotter.error());
+        return;
+    }
+    const uint8_t *probabilities = spotter.invoke((const int8_t *)input.data());
+    CHECK(probabilities != NULL);
+    for (size_t i = 0; probabilities != NULL && i < expected.size(); i++) {
+        // the softmax is float, on the host and in Python
+        CHECK_NEAR(probabilities[i], expected[i], 1);
+    }
+}
+
+/* the loop of int8Conv2d before the input offset was folded into the bias at load */
+static void conv2dSummingFilters(const int8_t *input, int inH, int inW, int inC, int32_t inputOffset, const int8_t *weights,
+                                 const int32_t *bias, int outC, int kernelH, int kernelW, int strideH, int strideW, int padH,
+                                 int padW, int outH, int outW, const Int8Quantization &quant, int8_t *output)
+{
+    for (int oy = 0; oy < outH; oy++) {
+        for (int ox = 0; ox < outW; ox++) {
+            const int iy0 = oy * strideH - padH;
+            const int ix0 = ox * strideW - padW;
+            for (int c = 0; c < outC; c++) {
+                const int8_t *filter = &weights[c * kernelH * kernelW * inC];
+                int32_t acc = bias[c];
+                for (int ky = 0; ky < kernelH; ky++) {
+                    const int iy = iy0 + ky;
+                    if (iy < 0 || iy >= inH) {
+                        continue;
+                    }
+                    for (int kx = 0; kx < kernelW; kx++) {
+                        const int ix = ix0 + kx;
+                        if (ix < 0 || ix >= inW) {
+                            continue;
+                        }
+                        const int8_t *x = &input[(iy * inW + ix) * inC];
+                        const int8_t *w = &filter[(ky * kernelW + kx) * inC];
+                        int32_t sumW = 0;
+                        for (int i = 0; i < inC; i++) {
+                            sumW += w[i];
+                        }
+                        acc += int8Dot(x, w, inC) + inputOffset * sumW;
+                    }
+                }
+                *output++ = referenceOutput(acc, c, quant);
+            }
+        }
+    }
+}
+
+static void benchmark()
+{
+    // DS-CNN small: 64 channels, 4 blocks, 12 labels
+    TestModel model(64, 4, 12);
+    static KeywordSpotter spotter;
+    std::vector<uint8_t> arena(64 * 1024);
+    FileReader reader = {&model.file, 0};
+    CHECK(spotter.load(readModel, &reader, arena.data(), arena.size()));
+    std::vector<int8_t> input(49 * 10);
+    randomFill(input.data(), input.size());
+    const int runs = 200;
+    double begin = nowMicros();
+    for (int i = 0; i < runs; i++) {
+        spotter.invoke(input.data());
+    }
+    const double inference = (nowMicros() - begin) / runs;
+    printf("kws: DS-CNN 64x4 inference %.0f us on the host, arena %zu bytes\n", inference, spotter.arenaUsed());
+
+    // a 3x3 convolution with 64 input channels, where summing the filters per output costs the most
+    const int h = 25, w = 5, c = 64;
+    std::vector<int8_t> in(h * w * c), weights(c * 9 * c), out(h * w * c), old(h * w * c);
+    std::vector<int32_t> bias(c, 0);
+    randomFill(in.data(), in.size());
+    randomFill(weights.data(), weights.size(), -127, 127);
+    RandomQuantization q(c, -14, -10, true);
+    std::vector<int32_t> folded = bias;
+    int8FoldInputOffset(folded.data(), weights.data(), c, 9 * c, 5);
+    // best of a few rounds, the host is not idle
+    double summing = 1e9, foldedTime = 1e9;
+    for (int round = 0; round < 5; round++) {
+        begin = nowMicros();
+        for (int i = 0; i < 10; i++) {
+            conv2dSummingFilters(in.data(), h, w, c, 5, weights.data(), bias.data(), c, 3, 3, 1, 1, 1, 1, h, w, q.quant, old.data());
+        }
+        const double t0 = (nowMicros() - begin) / 10;
+        summing = t0 < summing ? t0 : summing;
+        begin = nowMicros();
+        for (int i = 0; i < 10; i++) {
+            int8Conv2d(in.data(), h, w, c, 5, weights.data(), folded.data(), c, 3, 3, 1, 1, 1, 1, h, w, q.quant, out.data());
+        }
+        const double t1 = (nowMicros() - begin) / 10;
+        foldedTime = t1 < foldedTime ? t1 : foldedTime;
+    }
+    printf("kws: conv 3x3x64 on 25x5: %.0f us summing filters per output, %.0f us with the folded bias\n", summing, foldedTime);
+    CHECK(out == old);
+}
+
+int main()
+{
+    testRequantize();
+    testConv2d();
+    testDepthwise();
+    testPointwiseAndFullyConnected();
+    testPoolAndSoftmax();
+    testModel();
+    testConvertedModel();
+    benchmark();
+    return testResult("test_kws");
+}
@@ -0,0 +1,344 @@
+#!/usr/bin/env python3
+# Builds a small int8 .tflite keyword model, converts it with kws_convert.py and computes its
+# output with a reference of the TFLite int8 operators. test_kws loads the converted model and
+# compares the output of the firmware runtime with the reference.
+#
+# The model has a flat input with a reshape, a SAME convolution with an odd padding (the case the
+# converter rewrites), depthwise, pointwise, a 2x2 SAME convolution, mean, fully connected, softmax.
+import math
+import os
+import random
+import struct
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+import kws_convert as kc
+
+OUT = os.path.join("build", "kws_convert")
+
+
+# --- a minimal flatbuffer writer, children are placed after their parents ---
+
+class Vector:
+    def __init__(self, fmt, values):
+        self.fmt = fmt
+        self.values = values
+
+
+class Tables:
+    def __init__(self, tables):
+        self.tables = tables
+
+
+class Table:
+    def __init__(self, **fields):
+        # field index -> ("fmt", value) or a Table, Tables, Vector or bytes
+        self.fields = {int(k[1:]): v for k, v in fields.items()}
+
+
+def serialize(root, identifier=b"TFL3"):
+    buf = bytearray(8)
+    buf[4:8] = identifier
+    pending = []   # (slot position, object)
+
+    def align(n):
+        while len(buf) % n:
+            buf.append(0)
+
+    def write(obj):
+        if isinstance(obj, bytes):
+            align(4)
+            pos = len(buf)
+            buf.extend(struct.pack("<I", len(obj)) + obj + b"\0")
+            return pos
+        if isinstance(obj, Vector):
+            size = struct.calcsize(obj.fmt)
+            align(4)
+            while (len(buf) + 4) % max(size, 4):
+                buf.append(0)
+            pos = len(buf)
+            buf.extend(struct.pack("<I%d%s" % (len(obj.values), obj.fmt), len(obj.values), *obj.values))
+            return pos
+        if isinstance(obj, Tables):
+            align(4)
+            pos = len(buf)
+            buf.extend(struct.pack("<I", len(obj.tables)))
+            for table in obj.tables:
+                pending.append((len(buf), table))
+                buf.extend(bytes(4))
+            return pos
+        # table: vtable, then the table with every field in a 4 byte slot
+        count = max(obj.fields) + 1 if obj.fields else 0
+        align(4)
+        vtable = len(buf)
+        vsize = 4 + 2 * count
+        buf.extend(bytes(vsize + (-vsize % 4)))
+        pos = len(buf)
+        buf.extend(struct.pack("<i", pos - vtable))
+        offsets = [0] * count
+        for index in sorted(obj.fields):
+            value = obj.fields[index]
+            offsets[index] = len(buf) - pos
+            if isinstance(value, tuple):
+                packed = struct.pack("<" + value[0], value[1])
+                buf.extend(packed + bytes(-len(packed) % 4))
+            else:
+                pending.append((len(buf), value))
+                buf.extend(bytes(4))
+        struct.pack_into("<HH%dH" % count, buf, vtable, vsize, len(buf) - pos, *offsets)
+        return pos
+
+    struct.pack_into("<I", buf, 0, write(root))
+    while pending:
+        slot, obj = pending.pop(0)
+        struct.pack_into("<I", buf, slot, write(obj) - slot)
+    return bytes(buf)
+
+
+# --- the model ---
+
+rng = random.Random(20261018)
+
+
+class Builder:
+    def __init__(self):
+        self.tensors = []
+        self.buffers = [Table()]   # buffer 0 is the empty one
+        self.operators = []
+        self.codes = []
+
+    def tensor(self, name, shape, scale, zero_point, data=None, fmt="b", scales=None):
+        buffer = 0
+        if data is not None:
+            self.buffers.append(Table(f0=Vector("B", list(struct.pack("<%d%s" % (len(data), fmt), *data)))))
+            buffer = len(self.buffers) - 1
+        scales = scales if scales is not None else [scale]
+        self.tensors.append(dict(name=name, shape=shape, scales=scales, zero_points=[zero_point] * len(scales),
+                                 type=kc.INT32 if fmt == "i" else kc.INT8, buffer=buffer, data=data))
+        return len(self.tensors) - 1
+
+    def operator(self, code, inputs, outputs, options=None):
+        if code not in self.codes:
+            self.codes.append(code)
+        fields = dict(f0=("I", self.codes.index(code)), f1=Vector("i", inputs), f2=Vector("i", outputs))
+        if options is not None:
+            fields["f4"] = options
+        self.operators.append(Table(**fields))
+
+    def build(self, inputs, outputs):
+        tensors = [Table(f0=Vector("i", t["shape"]), f1=("b", t["type"]), f2=("I", t["buffer"]), f3=t["name"].encode(),
+                         f4=Table(f2=Vector("f", t["scales"]), f3=Vector("q", t["zero_points"]), f6=("i", 0)))
+                   for t in self.tensors]
+        graph = Table(f0=Tables(tensors), f1=Vector("i", inputs), f2=Vector("i", outputs), f3=Tables(self.operators))
+        # old style operator codes: only the deprecated byte, as written by TensorFlow before 2.4
+        codes = [Table(f0=("b", c), f2=("i", 1)) for c in self.codes]
+        return serialize(Table(f0=("I", 3), f1=Tables(codes), f2=Tables([graph]), f4=Tables(self.buffers)))
+
+
+def random_layer(b, name, x, weight_shape, out_shape, w_range=(0.004, 0.01)):
+    """Random weights and bias of a layer."""
+    channels = weight_shape[0] if name != "depthwise" else weight_shape[3]
+    count = 1
+    for d in weight_shape:
+        count *= d
+    weights = [rng.randint(-127, 127) for _ in range(count)]
+    w_scales = [rng.uniform(*w_range) for _ in range(channels)]
+    bias = [rng.randint(-2000, 2000) for _ in range(channels)]
+    w = b.tensor(name + "/weights", weight_shape, None, 0, weights, scales=w_scales)
+    # the scales of the bias and the output are set by calibrate()
+    bb = b.tensor(name + "/bias", [channels], None, 0, bias, fmt="i", scales=[None] * channels)
+    y = b.tensor(name + "/out", out_shape, None, rng.randint(-10, 10))
+    return w, bb, y
+
+
+def build_model():
+    b = Builder()
+    flat = b.tensor("input", [1, 490], 0.25, -5)
+    image = b.tensor("input/reshaped", [1, 49, 10, 1], 0.25, -5)
+    shape = b.tensor("shape", [4], None, 0, [1, 49, 10, 1], fmt="i", scales=[])
+    b.operator(kc.RESHAPE, [flat, shape], [image])
+    # 10x4, stride 2, SAME: 25 x 5, the rows need a padding of 9, 4 on top and 5 below
+    w, bias, conv = random_layer(b, "conv", image, [6, 10, 4, 1], [1, 25, 5, 6])
+    b.operator(kc.CONV_2D, [image, w, bias], [conv], Table(f0=("b", kc.SAME), f1=("i", 2), f2=("i", 2), f3=("b", kc.RELU)))
+    w, bias, dw = random_layer(b, "depthwise", conv, [1, 3, 3, 6], [1, 25, 5, 6])
+    b.operator(kc.DEPTHWISE_CONV_2D, [conv, w, bias], [dw],
+               Table(f0=("b", kc.SAME), f1=("i", 1), f2=("i", 1), f3=("i", 1), f4=("b", kc.RELU)))
+    w, bias, pw = random_layer(b, "pointwise", dw, [8, 1, 1, 6], [1, 25, 5, 8])
+    b.operator(kc.CONV_2D, [dw, w, bias], [pw], Table(f0=("b", kc.SAME), f1=("i", 1), f2=("i", 1), f3=("b", kc.RELU6)))
+    # 2x2 SAME: one padding row and column, below and right
+    w, bias, conv2 = random_layer(b, "conv2x2", pw, [8, 2, 2, 8], [1, 25, 5, 8])
+    b.operator(kc.CONV_2D, [pw, w, bias], [conv2], Table(f0=("b", kc.SAME), f1=("i", 1), f2=("i", 1), f3=("b", kc.RELU)))
+    mean = b.tensor("mean", [1, 8], None, b.tensors[conv2]["zero_points"][0])
+    axes = b.tensor("axes", [2], None, 0, [1, 2], fmt="i", scales=[])
+    b.operator(kc.MEAN, [conv2, axes], [mean])
+    # small weights, so the logits are a few units apart and the softmax is not saturated
+    w, bias, fc = random_layer(b, "fc", mean, [3, 8], [1, 3], w_range=(0.0008, 0.0015))
+    b.operator(kc.FULLY_CONNECTED, [mean, w, bias], [fc], Table(f0=("b", 0)))
+    probabilities = b.tensor("softmax", [1, 3], 1.0 / 256, -128)
+    b.operator(kc.SOFTMAX, [fc], [probabilities], Table(f0=("f", 1.0)))
+    return b
+
+
+# --- reference of the TFLite int8 operators, on the tensors of the builder ---
+
+def multiplier(m):
+    q, shift = math.frexp(m)
+    q = int(math.floor(q * (1 << 31) + 0.5))
+    if q == 1 << 31:
+        q //= 2
+        shift += 1
+    return q, shift
+
+
+def requantize(acc, m):
+    q, shift = multiplier(m)
+    x = acc * (1 << max(shift, 0))
+    high = (x * q + (1 << 30)) >> 31          # rounding doubling high multiply, half up
+    right = max(-shift, 0)
+    if right == 0:
+        return high
+    half = 1 << (right - 1)
+    return (high + half) >> right if high >= 0 else -((-high + half) >> right)
+
+
+def activation(value, low, high):
+    return min(max(value, low), high)
+
+
+def output_scale(t, accumulators, real_per_unit, target=60):
+    """Calibration: the output scale that puts most accumulators within +-target."""
+    if t["scales"][0] is None:
+        magnitudes = sorted(abs(a) for a in accumulators)
+        t["scales"] = [max(real_per_unit * magnitudes[len(magnitudes) * 95 // 100], 1e-6) / target]
+    return t["scales"][0]
+
+
+def set_bias_scale(b, x, wi, bi):
+    x_scale = b.tensors[x]["scales"][0]
+    b.tensors[bi]["scales"] = [x_scale * s for s in b.tensors[wi]["scales"]]
+
+
+def reference_conv(b, x, hwc, wi, bi, yi, stride, relu6=False, depthwise=False):
+    xs, w, t, bias = b.tensors[x], b.tensors[wi], b.tensors[yi], b.tensors[bi]["data"]
+    set_bias_scale(b, x, wi, bi)
+    h, wd, c = hwc
+    _, kh, kw, _ = w["shape"]
+    _, oh, ow, oc = t["shape"]
+    # TFLite SAME padding: half on top, an odd row at the bottom
+    pad_h = max((oh - 1) * stride + kh - h, 0) // 2
+    pad_w = max((ow - 1) * stride + kw - wd, 0) // 2
+    zx = xs["zero_points"][0]
+    accumulators = []
+    for oy in range(oh):
+        for ox in range(ow):
+            for o in range(oc):
+                acc = bias[o]
+                for ky in range(kh):
+                    for kx in range(kw):
+                        iy, ix = oy * stride - pad_h + ky, ox * stride - pad_w + kx
+                        if not (0 <= iy < h and 0 <= ix < wd):
+                            continue
+                        if depthwise:
+                            acc += (xs["value"][(iy * wd + ix) * c + o] - zx) * w["data"][(ky * kw + kx) * c + o]
+                        else:
+                            for i in range(c):
+                                acc += (xs["value"][(iy * wd + ix) * c + i] - zx) * w["data"][((o * kh + ky) * kw + kx) * c + i]
+                accumulators.append(acc)
+    scale = output_scale(t, accumulators, xs["scales"][0] * sum(w["scales"]) / oc)
+    zp_out = t["zero_points"][0]
+    high = min(127, zp_out + int(math.floor(6.0 / scale + 0.5))) if relu6 else 127
+    out = []
+    for i, acc in enumerate(accumulators):
+        m = xs["scales"][0] * w["scales"][i % oc] / scale
+        out.append(activation(requantize(acc, m) + zp_out, zp_out, high))
+    t["value"] = out
+    return [oh, ow, oc]
+
+
+def reference(b, values):
+    """Runs the model on an input, the first run calibrates the output scales."""
+    b.tensors[0]["value"] = values
+    b.tensors[1]["value"] = values
+    hwc = reference_conv(b, 1, [49, 10, 1], 3, 4, 5, 2)
+    hwc = reference_conv(b, 5, hwc, 6, 7, 8, 1, depthwise=True)
+    hwc = reference_conv(b, 8, hwc, 9, 10, 11, 1, relu6=True)
+    hwc = reference_conv(b, 11, hwc, 12, 13, 14, 1)
+    h, w, c = hwc
+    x = b.tensors[14]["value"]
+    mean = b.tensors[15]
+    mean["scales"] = b.tensors[14]["scales"]
+    n = h * w
+    pooled = []
+    for ch in range(c):
+        total = sum(x[i * c + ch] for i in range(n))
+        pooled.append((total + n // 2) // n if total > 0 else -((-total + n // 2) // n))
+    mean["value"] = pooled
+    fc_w, fc_b, fc_y = b.tensors[17], b.tensors[18], b.tensors[19]
+    set_bias_scale(b, 15, 17, 18)
+    accumulators = []
+    for o in range(3):
+        accumulators.append(fc_b["data"][o] + sum((pooled[i] - mean["zero_points"][0]) * fc_w["data"][o * 8 + i] for i in range(8)))
+    scale = output_scale(fc_y, accumulators, mean["scales"][0] * sum(fc_w["scales"]) / 3)
+    logits = []
+    for o in range(3):
+        m = mean["scales"][0] * fc_w["scales"][o] / scale
+        logits.append(activation(requantize(accumulators[o], m) + fc_y["zero_points"][0], -128, 127))
+    exps = [math.exp((v - max(logits)) * scale) for v in logits]
+    return logits, [min(255, int(math.floor(255 * e / sum(exps) + 0.5))) for e in exps]
+
+
+failures = 0
+
+
+def check(ok, what):
+    global failures
+    if not ok:
+        failures += 1
+        print("CHECK failed: " + what)
+
+
+def main():
+    os.makedirs(OUT, exist_ok=True)
+    b = build_model()
+    inputs = [rng.randint(-128, 127) for _ in range(490)]
+    reference(b, inputs)   # calibration
+    model = b.build([0], [20])
+    data, layers = kc.convert(model, 1, 2)
+    kinds = [layer.kind for layer in layers]
+    check(kinds == [kc.KWS_CONV, kc.KWS_DEPTHWISE, kc.KWS_POINTWISE, kc.KWS_CONV, kc.KWS_AVERAGE_POOL,
+                    kc.KWS_FULLY_CONNECTED, kc.KWS_SOFTMAX], "layer types %s" % kinds)
+    # the odd padding rows became a leading zero row of the kernel and one more padding row
+    check(layers[0].kernel == [11, 4] and layers[0].pad == [5, 1], "first conv %s %s" % (layers[0].kernel, layers[0].pad))
+    check(layers[3].kernel == [3, 3] and layers[3].pad == [1, 1], "2x2 conv %s %s" % (layers[3].kernel, layers[3].pad))
+    check(data[:4] == b"KWS1" and len(data) % 4 == 0, "file header")
+
+    logits, probabilities = reference(b, inputs)
+    saturated = sum(1 for v in b.tensors[5]["value"] if v == 127)
+    check(saturated < len(b.tensors[5]["value"]) // 4, "first layer saturated %d times" % saturated)
+    check(len(set(logits)) > 1, "logits %s" % logits)
+
+    with open(os.path.join(OUT, "model.kws"), "wb") as f:
+        f.write(data)
+    with open(os.path.join(OUT, "input.bin"), "wb") as f:
+        f.write(struct.pack("<490b", *inputs))
+    with open(os.path.join(OUT, "expected.bin"), "wb") as f:
+        f.write(bytes(probabilities))
+
+    # what cannot be converted is refused with a reason
+    try:
+        kc.convert(model, 3, 2)
+        check(False, "a wake label outside the labels is refused")
+    except kc.ConvertError:
+        pass
+    try:
+        kc.convert(b"not a model", 0, 1)
+        check(False, "a file that is no model is refused")
+    except kc.ConvertError:
+        pass
+
+    print("test_kws_convert: probabilities %s, %d failed" % (probabilities, failures))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,186 @@
+// Software volume and soft limiter on blocks the size playRequest writes. Checks that unity gain
+// is bit exact, that a steady gain is exactly the Q14 product, and that full scale input at the
+// most boost neither wraps nor stays above LIMIT.
+#include "HostTest.h"
+#include <SoftVolume.h>
+
+static const int RATE = 16000;
+static const int BLOCK_FRAMES = 256;
+
+static uint32_t seed = 5;
+
+static int16_t randomSample()
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (int16_t)(seed >> 16);
+}
+
+/* full range noise with both extremes in it */
+static std::vector<int16_t> noise(size_t count)
+{
+    std::vector<int16_t> samples(count);
+    for (size_t i = 0; i < count; i++) {
+        samples[i] = randomSample();
+    }
+    samples[1] = 32767;
+    samples[2] = -32768;
+    return samples;
+}
+
+static void processBlocks(SoftVolume &volume, std::vector<int16_t> &samples, int channels)
+{
+    const size_t frames = samples.size() / channels;
+    for (size_t f = 0; f < frames; f += BLOCK_FRAMES) {
+        const size_t n = frames - f < (size_t)BLOCK_FRAMES ? frames - f : BLOCK_FRAMES;
+        volume.process(&samples[f * channels], n);
+    }
+}
+
+static int peak(const int16_t *samples, size_t count)
+{
+    int largest = 0;
+    for (size_t i = 0; i < count; i++) {
+        largest = abs(samples[i]) > largest ? abs(samples[i]) : largest;
+    }
+    return largest;
+}
+
+static void testUnity()
+{
+    // volume 100 without boost does not touch a sample
+    SoftVolume volume;
+    volume.configure(2, RATE);
+    volume.setVolume(100, 0);
+    const std::vector<int16_t> clean = noise(RATE * 2);
+    std::vector<int16_t> samples = clean;
+    processBlocks(volume, samples, 2);
+    CHECK(volume.isUnity());
+    CHECK(samples == clean);
+
+    // back at unity after a lower volume, the ramp ends and the samples pass unchanged again
+    volume.setVolume(50, 0);
+    std::vector<int16_t> ramp = noise(RATE / 10 * 2);
+    processBlocks(volume, ramp, 2);
+    volume.setVolume(100, 0);
+    ramp = noise(RATE / 10 * 2);
+    processBlocks(volume, ramp, 2);
+    CHECK(volume.isUnity());
+    samples = clean;
+    processBlocks(volume, samples, 2);
+    CHECK(samples == clean);
+}
+
+static void testSteadyGain()
+{
+    // once the ramp is done a quiet signal is scaled by the Q14 gain, nothing else
+    const int volumes[] = {1, 30, 75, 99};
+    for (size_t v = 0; v < sizeof(volumes) / sizeof(volumes[0]); v++) {
+        SoftVolume volume;
+        volume.configure(1, RATE);
+        volume.setVolume(volumes[v], 0);
+        std::vector<int16_t> ramp(RATE / 10, 1000);
+        processBlocks(volume, ramp, 1);
+        const int32_t gain = (int32_t)lroundf(SoftVolume::UNITY * powf(10.0f, (volumes[v] - 100) * 40 / 100.0f / 20.0f));
+        std::vector<int16_t> samples = noise(RATE);
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples[i] /= 2;
+        }
+        const std::vector<int16_t> clean = samples;
+        processBlocks(volume, samples, 1);
+        bool exact = true;
+        for (size_t i = 0; i < samples.size(); i++) {
+            exact &= samples[i] == (int16_t)((clean[i] * gain) >> 14);
+        }
+        CHECK(exact);
+        CHECK(volume.limitedChunks == 0);
+    }
+
+    // volume 0 mutes after the ramp
+    SoftVolume muted;
+    muted.configure(1, RATE);
+    muted.setVolume(0, 0);
+    std::vector<int16_t> samples = noise(RATE);
+    processBlocks(muted, samples, 1);
+    CHECK(peak(&samples[RATE / 10], samples.size() - RATE / 10) == 0);
+}
+
+/**
+ * @brief full scale at volume 100 with the most boost
+ *
+ * Without the limiter the gain of 12 dB would take every sample above 32767. The first chunk
+ * starts at the gain before it and is saturated, after that the limiter holds the output at
+ * LIMIT. The look-ahead ends with the block: the first chunk of a block may be louder than the
+ * end of the block before and go over LIMIT. A wrap around would flip the sign of a sample.
+ */
+static void testFullScale(const std::vector<int16_t> &input, int channels, const char *name)
+{
+    SoftVolume volume;
+    volume.configure(channels, RATE);
+    volume.setVolume(100, 12);
+    std::vector<int16_t> samples = input;
+    processBlocks(volume, samples, channels);
+
+    bool wrapped = false;
+    for (size_t i = 0; i < samples.size(); i++) {
+        wrapped |= (samples[i] < 0) != (input[i] < 0) && samples[i] != 0;
+    }
+    // the loudest chunk inside the blocks and at their starts, the very first chunk aside
+    const size_t chunk = SoftVolume::CHUNK * channels;
+    int inside = 0, starts = 0;
+    for (size_t i = chunk; i < samples.size(); i += chunk) {
+        const int p = peak(&samples[i], chunk);
+        if (i % (BLOCK_FRAMES * channels) == 0) {
+            starts = p > starts ? p : starts;
+        } else {
+            inside = p > inside ? p : inside;
+        }
+    }
+    printf("softvolume: full scale %s with 12 dB boost, peak %d in the blocks, %d at their start, %d limited chunks\n", name,
+           inside, starts, (int)volume.limitedChunks);
+    CHECK(!wrapped);
+    CHECK(inside <= SoftVolume::LIMIT);
+    // the limiter gives back no more than it has to, the peak stays within 0.1 dB of LIMIT
+    CHECK(inside > SoftVolume::LIMIT * 0.988);
+    CHECK(volume.limitedChunks > 0);
+}
+
+static void testBurst()
+{
+    // a full scale burst in the middle of a quiet block: the gain is down before it arrives
+    SoftVolume volume;
+    volume.configure(1, RATE);
+    volume.setVolume(100, 12);
+    std::vector<int16_t> samples(RATE, 0);
+    for (size_t i = 0; i < samples.size(); i++) {
+        samples[i] = (int16_t)(2000.0f * sinf(2.0f * (float)M_PI * 440.0f * i / RATE));
+    }
+    const size_t burst = 10 * BLOCK_FRAMES + 100;
+    for (size_t i = burst; i < burst + 64; i++) {
+        samples[i] = i % 2 ? 32767 : -32768;
+    }
+    processBlocks(volume, samples, 1);
+    CHECK(peak(samples.data(), samples.size()) <= SoftVolume::LIMIT);
+    // released after the hold, the quiet tone is boosted again
+    CHECK(peak(&samples[samples.size() - BLOCK_FRAMES], BLOCK_FRAMES) > 2000 * 3);
+}
+
+int main()
+{
+    testUnity();
+    testSteadyGain();
+
+    std::vector<int16_t> square(RATE * 2);
+    std::vector<int16_t> sine(RATE * 2 * 2);
+    for (size_t i = 0; i < square.size(); i++) {
+        square[i] = (i / 20) % 2 ? 32767 : -32768;
+    }
+    for (size_t i = 0; i < sine.size(); i++) {
+        const float s = 32768.0f * sinf(2.0f * (float)M_PI * 1000.0f * (i / 2) / RATE + (i % 2) * 1.0f);
+        sine[i] = (int16_t)(s > 32767.0f ? 32767.0f : s);
+    }
+    testFullScale(square, 1, "square");
+    testFullScale(sine, 2, "stereo sine");
+    testFullScale(noise(RATE * 2), 2, "noise");
+    testBurst();
+    return testResult("test_softvolume");
+}